@@ -6,6 +6,9 @@
 #include <functional>
 #include <memory>
 
+// Bytes of one 256-bit rBRIEF descriptor:
+#define ORB_DESC_BYTES 32
+
 using namespace cv;
 using namespace std;
 
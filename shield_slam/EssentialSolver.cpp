@@ -0,0 +1,598 @@
+#include "EssentialSolver.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#define NUM_MONOMIALS 20
+#define STURM_MAX_DEGREE 10
+#define STURM_MAX_INTERVALS 128
+#define STURM_BISECTION_ITERATIONS 100
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // Monomials of degree <= 3 in x, y, z, in Nister's order; elimination removes the first ten:
+    static const int MONOMIAL_EXPONENTS[NUM_MONOMIALS][3] = {
+        {3, 0, 0}, {0, 3, 0}, {2, 1, 0}, {1, 2, 0}, {2, 0, 1},
+        {2, 0, 0}, {0, 2, 1}, {0, 2, 0}, {1, 1, 1}, {1, 1, 0},
+        {1, 0, 2}, {1, 0, 1}, {1, 0, 0}, {0, 1, 2}, {0, 1, 1},
+        {0, 1, 0}, {0, 0, 3}, {0, 0, 2}, {0, 0, 1}, {0, 0, 0}
+    };
+
+    enum {
+        MONO_XZZ = 10, MONO_XZ = 11, MONO_X = 12,
+        MONO_YZZ = 13, MONO_YZ = 14, MONO_Y = 15,
+        MONO_ZZZ = 16, MONO_ZZ = 17, MONO_Z = 18, MONO_ONE = 19
+    };
+
+    // Index of the product of two monomials, -1 above degree three:
+    struct MonomialProducts
+    {
+        int index[NUM_MONOMIALS][NUM_MONOMIALS];
+
+        MonomialProducts()
+        {
+            for (int i=0; i<NUM_MONOMIALS; i++)
+            {
+                for (int j=0; j<NUM_MONOMIALS; j++)
+                {
+                    int e[3];
+                    for (int k=0; k<3; k++)
+                        e[k] = MONOMIAL_EXPONENTS[i][k] + MONOMIAL_EXPONENTS[j][k];
+
+                    index[i][j] = -1;
+                    for (int m=0; m<NUM_MONOMIALS; m++)
+                    {
+                        if (MONOMIAL_EXPONENTS[m][0] == e[0] && MONOMIAL_EXPONENTS[m][1] == e[1] &&
+                            MONOMIAL_EXPONENTS[m][2] == e[2])
+                            index[i][j] = m;
+                    }
+                }
+            }
+        }
+    };
+
+    static const MonomialProducts& GetMonomialProducts(void)
+    {
+        static MonomialProducts products;
+        return products;
+    }
+
+    // out = a * b for polynomials in x, y, z whose product stays within degree three:
+    static void PolyMul(const double* a, const double* b, double* out)
+    {
+        const MonomialProducts& products = GetMonomialProducts();
+        memset(out, 0, NUM_MONOMIALS * sizeof(double));
+
+        for (int i=0; i<NUM_MONOMIALS; i++)
+        {
+            if (a[i] == 0.0)
+                continue;
+
+            for (int j=0; j<NUM_MONOMIALS; j++)
+            {
+                if (b[j] == 0.0)
+                    continue;
+
+                int m = products.index[i][j];
+                assert(m >= 0);
+                out[m] += a[i] * b[j];
+            }
+        }
+    }
+
+    static inline void PolyAxpy(double* y, double a, const double* x)
+    {
+        for (int i=0; i<NUM_MONOMIALS; i++)
+            y[i] += a * x[i];
+    }
+
+    // 2x2 minor a * d - b * c of degree-one polynomials:
+    static void PolyMinor(const double* a, const double* d, const double* b, const double* c, double* out)
+    {
+        double bc[NUM_MONOMIALS];
+        PolyMul(a, d, out);
+        PolyMul(b, c, bc);
+        PolyAxpy(out, -1.0, bc);
+    }
+
+    // Univariate polynomials, coefficients in ascending order:
+    static int UniMul(const double* a, int da, const double* b, int db, double* out)
+    {
+        memset(out, 0, (da + db + 1) * sizeof(double));
+        for (int i=0; i<=da; i++)
+        {
+            for (int j=0; j<=db; j++)
+                out[i + j] += a[i] * b[j];
+        }
+        return da + db;
+    }
+
+    static inline double UniEval(const double* p, int degree, double x)
+    {
+        double v = p[degree];
+        for (int i=degree-1; i>=0; i--)
+            v = v * x + p[i];
+        return v;
+    }
+
+    // Sturm sequence of p; members are scaled to a unit leading coefficient magnitude:
+    static int BuildSturmSequence(const double* p, int degree,
+                                  double seq[STURM_MAX_DEGREE + 1][STURM_MAX_DEGREE + 1],
+                                  int seq_degree[STURM_MAX_DEGREE + 1])
+    {
+        double lead = fabs(p[degree]);
+        for (int i=0; i<=degree; i++)
+            seq[0][i] = p[i] / lead;
+        seq_degree[0] = degree;
+
+        for (int i=1; i<=degree; i++)
+            seq[1][i-1] = i * seq[0][i] / degree;
+        seq_degree[1] = degree - 1;
+
+        int count = 2;
+        while (seq_degree[count-1] > 0)
+        {
+            const double* num = seq[count-2];
+            const double* den = seq[count-1];
+            const int dd = seq_degree[count-1];
+
+            double r[STURM_MAX_DEGREE + 1];
+            int dr = seq_degree[count-2];
+            double scale = 0.0;
+            for (int i=0; i<=dr; i++)
+            {
+                r[i] = num[i];
+                scale = max(scale, fabs(num[i]));
+            }
+
+            // Remainder of num / den:
+            while (dr >= dd)
+            {
+                double q = r[dr] / den[dd];
+                for (int i=0; i<=dd; i++)
+                    r[i + dr - dd] -= q * den[i];
+                dr--;
+            }
+
+            while (dr >= 0 && fabs(r[dr]) <= 1e-13 * scale)
+                dr--;
+
+            // p has a repeated root; the sequence ends with their gcd:
+            if (dr < 0)
+                break;
+
+            double r_lead = fabs(r[dr]);
+            for (int i=0; i<=dr; i++)
+                seq[count][i] = -r[i] / r_lead;
+            seq_degree[count] = dr;
+            count++;
+        }
+
+        return count;
+    }
+
+    static int SturmSignChanges(const double seq[STURM_MAX_DEGREE + 1][STURM_MAX_DEGREE + 1],
+                                const int seq_degree[STURM_MAX_DEGREE + 1], int count, double x)
+    {
+        int changes = 0;
+        double prev = 0.0;
+        for (int k=0; k<count; k++)
+        {
+            double v = UniEval(seq[k], seq_degree[k], x);
+            if (v == 0.0)
+                continue;
+
+            if (prev != 0.0 && (v > 0.0) != (prev > 0.0))
+                changes++;
+            prev = v;
+        }
+        return changes;
+    }
+
+    // Bisection on a sign change of p inside [lo, hi]:
+    static double RefineRoot(const double* p, int degree, double lo, double hi)
+    {
+        double f_lo = UniEval(p, degree, lo);
+        double f_hi = UniEval(p, degree, hi);
+
+        // Even multiplicity, no sign change to follow:
+        if ((f_lo > 0.0) == (f_hi > 0.0))
+            return 0.5 * (lo + hi);
+
+        for (int it=0; it<STURM_BISECTION_ITERATIONS; it++)
+        {
+            double mid = 0.5 * (lo + hi);
+            if (mid <= lo || mid >= hi)
+                break;
+
+            double f_mid = UniEval(p, degree, mid);
+            if (f_mid == 0.0)
+                return mid;
+
+            if ((f_mid > 0.0) == (f_lo > 0.0))
+            {
+                lo = mid;
+                f_lo = f_mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        return 0.5 * (lo + hi);
+    }
+
+    // Real roots of p (ascending coefficients), each distinct root once:
+    static int RealRoots(const double* p, int degree, double* roots)
+    {
+        double scale = 0.0;
+        for (int i=0; i<=degree; i++)
+            scale = max(scale, fabs(p[i]));
+
+        while (degree > 0 && fabs(p[degree]) <= 1e-14 * scale)
+            degree--;
+
+        if (degree <= 0)
+            return 0;
+
+        double seq[STURM_MAX_DEGREE + 1][STURM_MAX_DEGREE + 1];
+        int seq_degree[STURM_MAX_DEGREE + 1];
+        int count = BuildSturmSequence(p, degree, seq, seq_degree);
+
+        // Cauchy bound on the root magnitudes:
+        double bound = 0.0;
+        for (int i=0; i<degree; i++)
+            bound = max(bound, fabs(p[i] / p[degree]));
+        bound += 1.0;
+
+        struct Interval { double lo, hi; int v_lo, v_hi; };
+        Interval stack[STURM_MAX_INTERVALS];
+        int stack_size = 0;
+
+        stack[stack_size].lo = -bound;
+        stack[stack_size].hi = bound;
+        stack[stack_size].v_lo = SturmSignChanges(seq, seq_degree, count, -bound);
+        stack[stack_size].v_hi = SturmSignChanges(seq, seq_degree, count, bound);
+        stack_size++;
+
+        int num_roots = 0;
+        while (stack_size > 0)
+        {
+            Interval iv = stack[--stack_size];
+            int num_inside = iv.v_lo - iv.v_hi;
+            if (num_inside <= 0)
+                continue;
+
+            if (num_inside == 1 || iv.hi - iv.lo <= 1e-12 * (1.0 + fabs(iv.lo)))
+            {
+                if (num_roots < degree)
+                    roots[num_roots++] = RefineRoot(p, degree, iv.lo, iv.hi);
+                continue;
+            }
+
+            if (stack_size + 2 > STURM_MAX_INTERVALS)
+                continue;
+
+            double mid = 0.5 * (iv.lo + iv.hi);
+            int v_mid = SturmSignChanges(seq, seq_degree, count, mid);
+
+            Interval left = { iv.lo, mid, iv.v_lo, v_mid };
+            Interval right = { mid, iv.hi, v_mid, iv.v_hi };
+            stack[stack_size++] = left;
+            stack[stack_size++] = right;
+        }
+
+        return num_roots;
+    }
+
+    // Linear coefficients in x, y and the constant of row r1 - z * row r2 of the reduced
+    // system, as polynomials in z:
+    static void ReducedRowPolys(const double* r1, const double* r2, double px[4], double py[4], double p1[5])
+    {
+        px[0] = r1[MONO_X];
+        px[1] = r1[MONO_XZ] - r2[MONO_X];
+        px[2] = r1[MONO_XZZ] - r2[MONO_XZ];
+        px[3] = -r2[MONO_XZZ];
+
+        py[0] = r1[MONO_Y];
+        py[1] = r1[MONO_YZ] - r2[MONO_Y];
+        py[2] = r1[MONO_YZZ] - r2[MONO_YZ];
+        py[3] = -r2[MONO_YZZ];
+
+        p1[0] = r1[MONO_ONE];
+        p1[1] = r1[MONO_Z] - r2[MONO_ONE];
+        p1[2] = r1[MONO_ZZ] - r2[MONO_Z];
+        p1[3] = r1[MONO_ZZZ] - r2[MONO_ZZ];
+        p1[4] = -r2[MONO_ZZZ];
+    }
+
+    // Gauss-Jordan elimination of the first num_pivots columns with partial pivoting:
+    static bool GaussJordan(double* A, int rows, int cols, int num_pivots)
+    {
+        for (int c=0; c<num_pivots; c++)
+        {
+            int pivot = c;
+            for (int r=c+1; r<rows; r++)
+            {
+                if (fabs(A[r * cols + c]) > fabs(A[pivot * cols + c]))
+                    pivot = r;
+            }
+
+            if (fabs(A[pivot * cols + c]) < 1e-14)
+                return false;
+
+            if (pivot != c)
+            {
+                for (int k=0; k<cols; k++)
+                    swap(A[c * cols + k], A[pivot * cols + k]);
+            }
+
+            double inv = 1.0 / A[c * cols + c];
+            for (int k=0; k<cols; k++)
+                A[c * cols + k] *= inv;
+
+            for (int r=0; r<rows; r++)
+            {
+                double f = A[r * cols + c];
+                if (r == c || f == 0.0)
+                    continue;
+
+                for (int k=0; k<cols; k++)
+                    A[r * cols + k] -= f * A[c * cols + k];
+            }
+        }
+
+        return true;
+    }
+
+    // The last four columns of the Householder QR of Q^T (9x5), an orthonormal basis of
+    // the null space of Q:
+    static bool NullSpaceBasis(double Qt[9][5], double basis[4][9])
+    {
+        double v[5][9];
+        for (int k=0; k<5; k++)
+        {
+            double col_norm = 0.0;
+            for (int i=k; i<9; i++)
+                col_norm += Qt[i][k] * Qt[i][k];
+            col_norm = sqrt(col_norm);
+
+            if (col_norm < 1e-12)
+                return false;
+
+            // Reflector v = a + sign(a_k) |a| e_k, normalized:
+            double alpha = (Qt[k][k] > 0.0) ? -col_norm : col_norm;
+            double v_norm = 0.0;
+            for (int i=0; i<9; i++)
+            {
+                v[k][i] = (i < k) ? 0.0 : Qt[i][k];
+            }
+            v[k][k] -= alpha;
+            for (int i=k; i<9; i++)
+                v_norm += v[k][i] * v[k][i];
+            v_norm = sqrt(v_norm);
+            for (int i=k; i<9; i++)
+                v[k][i] /= v_norm;
+
+            for (int c=k; c<5; c++)
+            {
+                double d = 0.0;
+                for (int i=k; i<9; i++)
+                    d += v[k][i] * Qt[i][c];
+                for (int i=k; i<9; i++)
+                    Qt[i][c] -= 2.0 * d * v[k][i];
+            }
+        }
+
+        // H_0 * ... * H_4 * e_j for j = 5..8:
+        for (int j=0; j<4; j++)
+        {
+            double* b = basis[j];
+            for (int i=0; i<9; i++)
+                b[i] = (i == 5 + j) ? 1.0 : 0.0;
+
+            for (int k=4; k>=0; k--)
+            {
+                double d = 0.0;
+                for (int i=k; i<9; i++)
+                    d += v[k][i] * b[i];
+                for (int i=k; i<9; i++)
+                    b[i] -= 2.0 * d * v[k][i];
+            }
+        }
+
+        return true;
+    }
+
+    int SolveEssentialFivePoint(const PointArray &x1, const PointArray &x2, const int *sample,
+                                Matx33d E[FIVE_POINT_MAX_SOLUTIONS])
+    {
+        // Epipolar constraints on the entries of E (row-major), one column per correspondence:
+        double Qt[9][5];
+        for (int i=0; i<5; i++)
+        {
+            const double u1 = x1[sample[i]].x, v1 = x1[sample[i]].y;
+            const double u2 = x2[sample[i]].x, v2 = x2[sample[i]].y;
+
+            Qt[0][i] = u2 * u1; Qt[1][i] = u2 * v1; Qt[2][i] = u2;
+            Qt[3][i] = v2 * u1; Qt[4][i] = v2 * v1; Qt[5][i] = v2;
+            Qt[6][i] = u1;      Qt[7][i] = v1;      Qt[8][i] = 1.0;
+        }
+
+        // Orthonormal null space basis X, Y, Z, W; E = x * X + y * Y + z * Z + W:
+        double basis[4][9];
+        if (!NullSpaceBasis(Qt, basis))
+            return 0;
+
+        double e[9][NUM_MONOMIALS];
+        memset(e, 0, sizeof(e));
+        for (int i=0; i<9; i++)
+        {
+            e[i][MONO_X] = basis[0][i];
+            e[i][MONO_Y] = basis[1][i];
+            e[i][MONO_Z] = basis[2][i];
+            e[i][MONO_ONE] = basis[3][i];
+        }
+
+        double A[10][NUM_MONOMIALS];
+        double tmp[NUM_MONOMIALS];
+
+        // det(E) = 0, expanded along the first row:
+        double minor[NUM_MONOMIALS];
+        PolyMinor(e[4], e[8], e[5], e[7], minor);
+        PolyMul(e[0], minor, A[0]);
+        PolyMinor(e[3], e[8], e[5], e[6], minor);
+        PolyMul(e[1], minor, tmp);
+        PolyAxpy(A[0], -1.0, tmp);
+        PolyMinor(e[3], e[7], e[4], e[6], minor);
+        PolyMul(e[2], minor, tmp);
+        PolyAxpy(A[0], 1.0, tmp);
+
+        // 2 * E * E^T * E - trace(E * E^T) * E = 0:
+        double eet[3][3][NUM_MONOMIALS];
+        for (int i=0; i<3; i++)
+        {
+            for (int j=i; j<3; j++)
+            {
+                memset(eet[i][j], 0, sizeof(eet[i][j]));
+                for (int k=0; k<3; k++)
+                {
+                    PolyMul(e[3 * i + k], e[3 * j + k], tmp);
+                    PolyAxpy(eet[i][j], 1.0, tmp);
+                }
+                if (i != j)
+                    memcpy(eet[j][i], eet[i][j], sizeof(eet[i][j]));
+            }
+        }
+
+        double trace[NUM_MONOMIALS];
+        memset(trace, 0, sizeof(trace));
+        for (int i=0; i<3; i++)
+            PolyAxpy(trace, 1.0, eet[i][i]);
+
+        for (int i=0; i<3; i++)
+        {
+            for (int j=0; j<3; j++)
+            {
+                double* row = A[1 + 3 * i + j];
+                PolyMul(trace, e[3 * i + j], row);
+                for (int k=0; k<NUM_MONOMIALS; k++)
+                    row[k] = -row[k];
+
+                for (int k=0; k<3; k++)
+                {
+                    PolyMul(eet[i][k], e[3 * k + j], tmp);
+                    PolyAxpy(row, 2.0, tmp);
+                }
+            }
+        }
+
+        if (!GaussJordan(&A[0][0], 10, NUM_MONOMIALS, 10))
+            return 0;
+
+        // Rows (x^2 z, x^2), (y^2 z, y^2) and (xyz, xy) give three equations linear in x, y:
+        double px[3][4], py[3][4], p1[3][5];
+        ReducedRowPolys(A[4], A[5], px[0], py[0], p1[0]);
+        ReducedRowPolys(A[6], A[7], px[1], py[1], p1[1]);
+        ReducedRowPolys(A[8], A[9], px[2], py[2], p1[2]);
+
+        // Their 3x3 determinant vanishes at every solution, a tenth-degree polynomial in z:
+        double n[STURM_MAX_DEGREE + 1];
+        double t7a[8], t7b[8], t6a[7], t6b[7], t10[11];
+        memset(n, 0, sizeof(n));
+
+        UniMul(py[1], 3, p1[2], 4, t7a);
+        UniMul(p1[1], 4, py[2], 3, t7b);
+        for (int i=0; i<8; i++)
+            t7a[i] -= t7b[i];
+        UniMul(px[0], 3, t7a, 7, t10);
+        for (int i=0; i<=10; i++)
+            n[i] += t10[i];
+
+        UniMul(px[1], 3, p1[2], 4, t7a);
+        UniMul(p1[1], 4, px[2], 3, t7b);
+        for (int i=0; i<8; i++)
+            t7a[i] -= t7b[i];
+        UniMul(py[0], 3, t7a, 7, t10);
+        for (int i=0; i<=10; i++)
+            n[i] -= t10[i];
+
+        UniMul(px[1], 3, py[2], 3, t6a);
+        UniMul(py[1], 3, px[2], 3, t6b);
+        for (int i=0; i<7; i++)
+            t6a[i] -= t6b[i];
+        UniMul(p1[0], 4, t6a, 6, t10);
+        for (int i=0; i<=10; i++)
+            n[i] += t10[i];
+
+        double z_roots[STURM_MAX_DEGREE];
+        int num_roots = RealRoots(n, STURM_MAX_DEGREE, z_roots);
+
+        int num_solutions = 0;
+        for (int r=0; r<num_roots; r++)
+        {
+            const double z = z_roots[r];
+
+            Vec3d rows[3];
+            for (int k=0; k<3; k++)
+                rows[k] = Vec3d(UniEval(px[k], 3, z), UniEval(py[k], 3, z), UniEval(p1[k], 4, z));
+
+            // (x, y, 1) spans the null space; take the best conditioned cross product:
+            Vec3d v = rows[0].cross(rows[1]);
+            Vec3d v_alt = rows[0].cross(rows[2]);
+            if (norm(v_alt) > norm(v))
+                v = v_alt;
+            v_alt = rows[1].cross(rows[2]);
+            if (norm(v_alt) > norm(v))
+                v = v_alt;
+
+            if (fabs(v[2]) <= 1e-12 * norm(v))
+                continue;
+
+            const double x = v[0] / v[2];
+            const double y = v[1] / v[2];
+
+            Matx33d sol;
+            for (int i=0; i<9; i++)
+                sol.val[i] = x * basis[0][i] + y * basis[1][i] + z * basis[2][i] + basis[3][i];
+
+            E[num_solutions++] = sol * (1.0 / norm(sol));
+        }
+
+        return num_solutions;
+    }
+
+    bool FitEssential(const PointArray &x1, const PointArray &x2, const int *indices, int num_indices,
+                      Matx33d &E)
+    {
+        if (num_indices < 8)
+            return false;
+
+        Mat A(num_indices, 9, CV_64F);
+        for (int i=0; i<num_indices; i++)
+        {
+            const double u1 = x1[indices[i]].x, v1 = x1[indices[i]].y;
+            const double u2 = x2[indices[i]].x, v2 = x2[indices[i]].y;
+
+            double* r = A.ptr<double>(i);
+            r[0] = u2 * u1; r[1] = u2 * v1; r[2] = u2;
+            r[3] = v2 * u1; r[4] = v2 * v1; r[5] = v2;
+            r[6] = u1;      r[7] = v1;      r[8] = 1.0;
+        }
+
+        Mat w, u, vt;
+        SVD::compute(A, w, u, vt, num_indices < 9 ? SVD::MODIFY_A | SVD::FULL_UV : SVD::MODIFY_A);
+        Mat E_lin = vt.row(8).reshape(0, 3);
+
+        // Closest essential matrix: equal non-zero singular values:
+        SVD::compute(E_lin, w, u, vt, SVD::FULL_UV);
+        Mat E_proj = u * Mat::diag((Mat_<double>(3, 1) << 1.0, 1.0, 0.0)) * vt;
+
+        E = Matx33d((double*)E_proj.clone().data);
+        return true;
+    }
+}
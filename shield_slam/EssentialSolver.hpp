@@ -0,0 +1,38 @@
+#ifndef __shield_slam__EssentialSolver__
+#define __shield_slam__EssentialSolver__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+
+#define FIVE_POINT_SAMPLE_SIZE 5
+// Most real solutions of the five-point problem:
+#define FIVE_POINT_MAX_SOLUTIONS 10
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    /*
+     Calibrated relative pose solvers on normalized image coordinates (K^-1 * x, so the
+     coordinates of a bearing vector scaled to z = 1). E satisfies x2^T * E * x1 = 0.
+
+     SolveEssentialFivePoint is Nister's five-point algorithm with fixed-size storage: the
+     four-dimensional null space of the epipolar constraints, the ten cubic constraints
+     det(E) = 0 and 2 E E^T E - trace(E E^T) E = 0 reduced by Gauss-Jordan elimination,
+     and the real roots of the resulting tenth-degree polynomial isolated with a Sturm
+     sequence.
+     */
+
+    // Reference: Nister, "An Efficient Solution to the Five-Point Relative Pose Problem", PAMI 2004
+    // sample picks five correspondences; returns the number of solutions written to E:
+    int SolveEssentialFivePoint(const PointArray& x1, const PointArray& x2, const int* sample,
+                                Matx33d E[FIVE_POINT_MAX_SOLUTIONS]);
+
+    // Linear fit on eight or more correspondences, projected onto the essential manifold:
+    bool FitEssential(const PointArray& x1, const PointArray& x2, const int* indices, int num_indices,
+                      Matx33d& E);
+}
+
+#endif /* defined(__shield_slam__EssentialSolver__) */
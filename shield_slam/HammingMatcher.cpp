@@ -0,0 +1,264 @@
+#include "HammingMatcher.hpp"
+
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HAMMING_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define HAMMING_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // Keeps the two smallest distances seen so far. Ties keep the lower train index first,
+    // which is the order BFMatcher::knnMatch reports them in.
+    static inline void UpdateBestTwo(int dist, int train_idx, int& best_dist, int& best_idx,
+                                     int& second_dist)
+    {
+        if (dist < best_dist)
+        {
+            second_dist = best_dist;
+            best_dist = dist;
+            best_idx = train_idx;
+        }
+        else if (dist < second_dist)
+        {
+            second_dist = dist;
+        }
+    }
+
+    static inline int DistanceScalar(const uchar* a, const uchar* b, bool pairwise)
+    {
+        const uint64_t pair_mask = 0x5555555555555555ULL;
+
+        int dist = 0;
+        for (int i=0; i<ORB_DESC_BYTES; i+=8)
+        {
+            uint64_t wa, wb;
+            memcpy(&wa, a + i, 8);
+            memcpy(&wb, b + i, 8);
+
+            uint64_t x = wa ^ wb;
+            if (pairwise)
+                x = (x | (x >> 1)) & pair_mask;
+
+            dist += __builtin_popcountll(x);
+        }
+
+        return dist;
+    }
+
+    static void BlockKernelScalar(const uchar* query, int num_query, size_t query_step,
+                                  const uchar* train, int num_train, size_t train_step,
+                                  int train_offset, bool pairwise,
+                                  int* best_dist, int* best_idx, int* second_dist)
+    {
+        for (int q=0; q<num_query; q++)
+        {
+            const uchar* q_desc = query + q * query_step;
+
+            for (int t=0; t<num_train; t++)
+            {
+                int dist = DistanceScalar(q_desc, train + t * train_step, pairwise);
+                UpdateBestTwo(dist, train_offset + t, best_dist[q], best_idx[q], second_dist[q]);
+            }
+        }
+    }
+
+#ifdef HAMMING_HAVE_AVX2_KERNEL
+    __attribute__((target("avx2")))
+    static void BlockKernelAVX2(const uchar* query, int num_query, size_t query_step,
+                                const uchar* train, int num_train, size_t train_step,
+                                int train_offset, bool pairwise,
+                                int* best_dist, int* best_idx, int* second_dist)
+    {
+        // Nibble popcount lookup, one copy per 128-bit lane:
+        const __m256i popcount_lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        const __m256i pair_mask = _mm256_set1_epi8(0x55);
+        const __m256i zero = _mm256_setzero_si256();
+
+        for (int q=0; q<num_query; q++)
+        {
+            const __m256i q_desc = _mm256_loadu_si256((const __m256i*)(query + q * query_step));
+
+            int q_best_dist = best_dist[q];
+            int q_best_idx = best_idx[q];
+            int q_second_dist = second_dist[q];
+
+            for (int t=0; t<num_train; t++)
+            {
+                __m256i x = _mm256_xor_si256(q_desc, _mm256_loadu_si256((const __m256i*)(train + t * train_step)));
+
+                // Bit 7 picks up the neighbouring byte's bit 0 here, but the pair mask drops it:
+                if (pairwise)
+                    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_srli_epi16(x, 1)), pair_mask);
+
+                __m256i lo = _mm256_shuffle_epi8(popcount_lut, _mm256_and_si256(x, low_mask));
+                __m256i hi = _mm256_shuffle_epi8(popcount_lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+                __m256i sums = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero);
+
+                __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+                sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+
+                UpdateBestTwo(_mm_cvtsi128_si32(sum), train_offset + t, q_best_dist, q_best_idx, q_second_dist);
+            }
+
+            best_dist[q] = q_best_dist;
+            best_idx[q] = q_best_idx;
+            second_dist[q] = q_second_dist;
+        }
+    }
+#endif
+
+#ifdef HAMMING_HAVE_NEON_KERNEL
+    static void BlockKernelNEON(const uchar* query, int num_query, size_t query_step,
+                                const uchar* train, int num_train, size_t train_step,
+                                int train_offset, bool pairwise,
+                                int* best_dist, int* best_idx, int* second_dist)
+    {
+        const uint8x16_t pair_mask = vdupq_n_u8(0x55);
+
+        for (int q=0; q<num_query; q++)
+        {
+            const uchar* q_ptr = query + q * query_step;
+            const uint8x16_t q_lo = vld1q_u8(q_ptr);
+            const uint8x16_t q_hi = vld1q_u8(q_ptr + 16);
+
+            int q_best_dist = best_dist[q];
+            int q_best_idx = best_idx[q];
+            int q_second_dist = second_dist[q];
+
+            for (int t=0; t<num_train; t++)
+            {
+                const uchar* t_ptr = train + t * train_step;
+                uint8x16_t x_lo = veorq_u8(q_lo, vld1q_u8(t_ptr));
+                uint8x16_t x_hi = veorq_u8(q_hi, vld1q_u8(t_ptr + 16));
+
+                if (pairwise)
+                {
+                    x_lo = vandq_u8(vorrq_u8(x_lo, vshrq_n_u8(x_lo, 1)), pair_mask);
+                    x_hi = vandq_u8(vorrq_u8(x_hi, vshrq_n_u8(x_hi, 1)), pair_mask);
+                }
+
+                uint8x16_t counts = vaddq_u8(vcntq_u8(x_lo), vcntq_u8(x_hi));
+                uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(counts)));
+                int dist = (int)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+
+                UpdateBestTwo(dist, train_offset + t, q_best_dist, q_best_idx, q_second_dist);
+            }
+
+            best_dist[q] = q_best_dist;
+            best_idx[q] = q_best_idx;
+            second_dist[q] = q_second_dist;
+        }
+    }
+#endif
+
+    HammingMatcher::HammingMatcher(int norm_type)
+    {
+        if (norm_type != NORM_HAMMING && norm_type != NORM_HAMMING2)
+        {
+            CV_Error(0, "HammingMatcher: norm must be NORM_HAMMING or NORM_HAMMING2");
+        }
+
+        pairwise = (norm_type == NORM_HAMMING2);
+
+        kernel = BlockKernelScalar;
+        kernel_name = "scalar";
+
+#if defined(HAMMING_HAVE_AVX2_KERNEL)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = BlockKernelAVX2;
+            kernel_name = "avx2";
+        }
+#elif defined(HAMMING_HAVE_NEON_KERNEL)
+        kernel = BlockKernelNEON;
+        kernel_name = "neon";
+#endif
+    }
+
+    int HammingMatcher::Distance(const uchar *a, const uchar *b) const
+    {
+        return DistanceScalar(a, b, pairwise);
+    }
+
+    void HammingMatcher::MatchQueryBlock(const Mat &query_desc, const Mat &train_desc, int block_idx,
+                                         int *best_dist, int *best_idx, int *second_dist) const
+    {
+        const int query_start = block_idx * HAMMING_QUERY_BLOCK;
+        const int num_query = min(HAMMING_QUERY_BLOCK, query_desc.rows - query_start);
+
+        for (int train_start=0; train_start<train_desc.rows; train_start+=HAMMING_TRAIN_BLOCK)
+        {
+            const int num_train = min(HAMMING_TRAIN_BLOCK, train_desc.rows - train_start);
+
+            kernel(query_desc.ptr<uchar>(query_start), num_query, query_desc.step,
+                   train_desc.ptr<uchar>(train_start), num_train, train_desc.step,
+                   train_start, pairwise,
+                   best_dist + query_start, best_idx + query_start, second_dist + query_start);
+        }
+    }
+
+    void HammingMatcher::KnnRatioMatch(const Mat &query_desc, const Mat &train_desc, vector<DMatch> &matches,
+                                       bool use_ratio_test, float ratio, int max_distance) const
+    {
+        matches.clear();
+
+        if (query_desc.empty() || train_desc.empty())
+            return;
+
+        if (query_desc.type() != CV_8U || train_desc.type() != CV_8U ||
+            query_desc.cols != ORB_DESC_BYTES || train_desc.cols != ORB_DESC_BYTES)
+        {
+            CV_Error(0, "HammingMatcher: expected 32-byte CV_8U descriptors");
+        }
+
+        const int num_query = query_desc.rows;
+        const int num_blocks = (num_query + HAMMING_QUERY_BLOCK - 1) / HAMMING_QUERY_BLOCK;
+
+        vector<int> best_dist(num_query, INT_MAX);
+        vector<int> best_idx(num_query, -1);
+        vector<int> second_dist(num_query, INT_MAX);
+
+        // Every block writes its own slice, so the result does not depend on the thread count:
+        function<void(int)> match_block = [&](int block_idx)
+        {
+            MatchQueryBlock(query_desc, train_desc, block_idx, &best_dist[0], &best_idx[0], &second_dist[0]);
+        };
+
+        if (num_query >= HAMMING_MIN_PARALLEL_QUERIES)
+        {
+            ThreadPool::Shared().ParallelFor(0, num_blocks, match_block);
+        }
+        else
+        {
+            for (int i=0; i<num_blocks; i++)
+                match_block(i);
+        }
+
+        matches.reserve(num_query);
+        for (int i=0; i<num_query; i++)
+        {
+            if (best_idx[i] < 0 || best_dist[i] > max_distance)
+                continue;
+
+            if (use_ratio_test && !((float)best_dist[i] / (float)second_dist[i] < ratio))
+                continue;
+
+            matches.push_back(DMatch(i, best_idx[i], 0, (float)best_dist[i]));
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef __shield_slam__HammingMatcher__
+#define __shield_slam__HammingMatcher__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "Common.hpp"
+#include "ThreadPool.hpp"
+
+// Query block (2KB) and train tile (16KB) are sized to stay resident in a 32KB L1:
+#define HAMMING_QUERY_BLOCK 64
+#define HAMMING_TRAIN_BLOCK 512
+
+// Below this many queries the matcher stays on the calling thread:
+#define HAMMING_MIN_PARALLEL_QUERIES 256
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    /*
+     Brute-force 2-NN matcher for 256-bit binary descriptors. Finds the best two train
+     descriptors for every query and applies the ratio test and a max-distance cutoff in the
+     same pass, returning the same DMatch list as BFMatcher::knnMatch(k=2) + ratio test.
+
+     Kernels: AVX2 (selected at runtime on x86), NEON (ARM builds with NEON enabled) and a
+     portable 64-bit popcount fallback.
+     */
+    class HammingMatcher
+    {
+    public:
+
+        HammingMatcher(int norm_type = NORM_HAMMING2);
+        virtual ~HammingMatcher() = default;
+
+        void KnnRatioMatch(const Mat& query_desc, const Mat& train_desc, vector<DMatch>& matches,
+                           bool use_ratio_test, float ratio, int max_distance) const;
+
+        int Distance(const uchar* a, const uchar* b) const;
+
+        const char* GetKernelName(void) const { return kernel_name; }
+
+        typedef void (*BlockKernel)(const uchar* query, int num_query, size_t query_step,
+                                    const uchar* train, int num_train, size_t train_step,
+                                    int train_offset, bool pairwise,
+                                    int* best_dist, int* best_idx, int* second_dist);
+
+    private:
+
+        void MatchQueryBlock(const Mat& query_desc, const Mat& train_desc, int block_idx,
+                             int* best_dist, int* best_idx, int* second_dist) const;
+
+    protected:
+        bool pairwise;
+
+        BlockKernel kernel;
+        const char* kernel_name;
+    };
+}
+
+#endif /* defined(__shield_slam__HammingMatcher__) */
@@ -5,53 +5,243 @@ using namespace std;
 
 namespace vslam
 {
-    Initializer::Initializer() {}
+    Initializer::Initializer()
+    {
+        has_ref_features = false;
+        use_klt = INIT_USE_KLT;
+        ransac_backend = INIT_RANSAC_BACKEND;
+        use_five_point = INIT_USE_FIVE_POINT;
+        
+        memset(&h_ransac_stats, 0, sizeof(h_ransac_stats));
+        memset(&f_ransac_stats, 0, sizeof(f_ransac_stats));
+    }
     
-    bool Initializer::InitializeMap(Ptr<ORB> orb_handler, Mat &img_ref, Mat &img_tar, vector<KeyFrame> &keyframes)
+    void Initializer::SetReferenceFrame(Ptr<ORB> orb_handler, Mat &img_ref)
     {
-        // Match ORB Features:
-        Mat matched_tar_desc;
-        vector<DMatch> matches;
-        PointArray ref_matches, tar_matches;
-        KeypointArray ref_kp, tar_kp;
-        Mat ref_desc, tar_desc;
+        KeypointArray img_kp;
+        Mat img_desc;
+        orb_handler->ExtractFeatures(img_ref, img_kp, img_desc);
         
-        orb_handler->DetectAndMatch(img_ref, img_tar, matches, ref_matches, tar_matches, matched_tar_desc, ref_kp, tar_kp, ref_desc, tar_desc);
+        SetReferenceFrame(img_ref, img_kp, img_desc);
+    }
+    
+    void Initializer::SetReferenceFrame(Mat &img_ref, const KeypointArray &img_kp, const Mat &img_desc)
+    {
+        ref_kp = img_kp;
+        ref_desc = img_desc;
+        has_ref_features = true;
         
-        // Undistort key points using camera intrinsics:
-        PointArray undist_ref_matches, undist_tar_matches;
+        klt_points.clear();
+        klt_ref_idx.clear();
+        klt_prev_pyramid.clear();
         
-        /*
-        undistortPoints(ref_matches, undist_ref_matches, camera_matrix, dist_coeff);
-        undistortPoints(tar_matches, undist_tar_matches, camera_matrix, dist_coeff);
-        */
+        if (use_klt)
+        {
+            klt_points.reserve(ref_kp.size());
+            klt_ref_idx.reserve(ref_kp.size());
+            for (int i=0; i<ref_kp.size(); i++)
+            {
+                klt_points.push_back(ref_kp[i].pt);
+                klt_ref_idx.push_back(i);
+            }
+            
+            buildOpticalFlowPyramid(img_ref, klt_prev_pyramid, Size(KLT_WINDOW_SIZE, KLT_WINDOW_SIZE), KLT_PYRAMID_LEVELS);
+        }
+    }
+    
+    void Initializer::ResetReferenceFrame(void)
+    {
+        ref_kp.clear();
+        ref_desc.release();
+        has_ref_features = false;
         
+        klt_points.clear();
+        klt_ref_idx.clear();
+        klt_prev_pyramid.clear();
+    }
+    
+    bool Initializer::TrackReference(Mat &img_tar, float &median_parallax)
+    {
+        median_parallax = 0.0f;
         
-        undist_ref_matches = ref_matches;
-        undist_tar_matches = tar_matches;
+        if (klt_points.empty() || klt_prev_pyramid.empty())
+            return false;
         
-         
-        // Compute homography and fundamental matrices:
-        Mat H = findHomography(undist_ref_matches, undist_tar_matches, CV_RANSAC, 3);
-        Mat F = findFundamentalMat(undist_ref_matches, undist_tar_matches, CV_FM_RANSAC, 3, 0.99);
+        // Each frame's pyramid is built once and kept as the source of the next step:
+        vector<Mat> tar_pyramid;
+        buildOpticalFlowPyramid(img_tar, tar_pyramid, Size(KLT_WINDOW_SIZE, KLT_WINDOW_SIZE), KLT_PYRAMID_LEVELS);
+        
+        PointArray tracked;
+        vector<uchar> status;
+        vector<float> error;
+        calcOpticalFlowPyrLK(klt_prev_pyramid, tar_pyramid, klt_points, tracked, status, error,
+                             Size(KLT_WINDOW_SIZE, KLT_WINDOW_SIZE), KLT_PYRAMID_LEVELS);
+        
+        // Keep tracks that converged inside the image, with their displacement from the reference:
+        int num_kept = 0;
+        vector<float> parallax;
+        parallax.reserve(klt_points.size());
+        for (int i=0; i<klt_points.size(); i++)
+        {
+            const Point2f& pt = tracked[i];
+            if (!status[i] || pt.x < 0 || pt.y < 0 || pt.x >= img_tar.cols || pt.y >= img_tar.rows)
+                continue;
+            
+            const Point2f& ref_pt = ref_kp[klt_ref_idx[i]].pt;
+            parallax.push_back((float)norm(pt - ref_pt));
+            
+            klt_points[num_kept] = pt;
+            klt_ref_idx[num_kept] = klt_ref_idx[i];
+            num_kept++;
+        }
+        klt_points.resize(num_kept);
+        klt_ref_idx.resize(num_kept);
+        klt_prev_pyramid.swap(tar_pyramid);
         
-        // Decide between homography and fundamental matrix:
-        vector<bool> h_inliers, f_inliers;
-        int h_num_inliers = 0, f_num_inliers;
+        if (num_kept < KLT_MIN_TRACKS)
+            return false;
         
-        float SH = CheckHomography(undist_ref_matches, undist_tar_matches, H, h_inliers, h_num_inliers);
-        float SF = CheckFundamental(undist_ref_matches, undist_tar_matches, F, f_inliers, f_num_inliers);
+        nth_element(parallax.begin(), parallax.begin() + num_kept / 2, parallax.end());
+        median_parallax = parallax[num_kept / 2];
         
+        return median_parallax >= KLT_MIN_MEDIAN_PARALLAX;
+    }
+    
+    void Initializer::AssociateTracks(const KeypointArray &tar_kp, const Mat &tar_desc, Size img_size,
+                                      vector<DMatch> &matches, PointArray &ref_matches, PointArray &tar_matches,
+                                      Mat &matched_tar_desc)
+    {
+        matches.clear();
+        ref_matches.clear();
+        tar_matches.clear();
         
-        /*
+        KeypointGrid tar_grid(tar_kp, img_size);
+        
+        // Nearest target keypoint per track; a keypoint claimed twice goes to the closer track:
+        vector<int> best_track(tar_kp.size(), -1);
+        vector<float> best_dist(tar_kp.size(), numeric_limits<float>::max());
+        vector<int> candidates;
+        for (int i=0; i<klt_points.size(); i++)
+        {
+            const Point2f& pt = klt_points[i];
+            tar_grid.GetFeaturesInArea(pt.x, pt.y, KLT_ASSOCIATION_RADIUS, 0, numeric_limits<int>::max(), candidates);
+            
+            int nearest = -1;
+            float nearest_dist = numeric_limits<float>::max();
+            for (int j=0; j<candidates.size(); j++)
+            {
+                Point2f d = tar_kp[candidates[j]].pt - pt;
+                float dist = d.x * d.x + d.y * d.y;
+                if (dist < nearest_dist)
+                {
+                    nearest_dist = dist;
+                    nearest = candidates[j];
+                }
+            }
+            
+            if (nearest >= 0 && nearest_dist < best_dist[nearest])
+            {
+                best_dist[nearest] = nearest_dist;
+                best_track[nearest] = i;
+            }
+        }
+        
+        // Ordered by reference keypoint, as the descriptor matcher reports them:
+        for (int tar_idx=0; tar_idx<tar_kp.size(); tar_idx++)
+        {
+            if (best_track[tar_idx] >= 0)
+                matches.push_back(DMatch(klt_ref_idx[best_track[tar_idx]], tar_idx, sqrt(best_dist[tar_idx])));
+        }
+        sort(matches.begin(), matches.end(), [](const DMatch& a, const DMatch& b) {
+            return a.queryIdx < b.queryIdx;
+        });
+        
+        matched_tar_desc.create((int)matches.size(), tar_desc.cols, tar_desc.type());
+        for (int i=0; i<matches.size(); i++)
+        {
+            ref_matches.push_back(ref_kp[matches[i].queryIdx].pt);
+            tar_matches.push_back(tar_kp[matches[i].trainIdx].pt);
+            tar_desc.row(matches[i].trainIdx).copyTo(matched_tar_desc.row(i));
+        }
+    }
+    
+    bool Initializer::InitializeMap(Ptr<ORB> orb_handler, Ptr<Map> global_map, Mat &img_ref, Mat &img_tar,
+                                    vector<KeyFramePtr> &keyframes)
+    {
+        // Reference features are extracted once per reference frame, only img_tar is new:
+        if (!has_ref_features)
+            SetReferenceFrame(orb_handler, img_ref);
+        
+        InitTargetFrame target(img_tar);
+        if (!AttemptInitialization(orb_handler, target))
+            return false;
+        
+        CommitMap(global_map, keyframes);
+        
+        return true;
+    }
+    
+    bool Initializer::AttemptInitialization(Ptr<ORB> orb_handler, InitTargetFrame &target, const atomic<bool> *cancel)
+    {
+        // Match ORB Features:
+        PointArray ref_matches;
+        matches.clear();
+        tar_matches.clear();
+        
+        if (use_klt)
+        {
+            // Target features are only extracted once the tracks promise a usable baseline:
+            float median_parallax;
+            if (!TrackReference(target.img, median_parallax))
+                return false;
+            
+            target.ExtractFeatures(orb_handler);
+            AssociateTracks(target.keypoints, target.desc, target.img.size(), matches, ref_matches, tar_matches, matched_tar_desc);
+        }
+        else
+        {
+            target.ExtractFeatures(orb_handler);
+            orb_handler->MatchFeatures(ref_desc, target.desc, matches, ref_kp, target.keypoints, ref_matches, tar_matches, matched_tar_desc);
+        }
+        
+        tar_kp = target.keypoints;
+        tar_desc = target.desc;
+        
+        if (cancel != NULL && *cancel)
+            return false;
+        
+        // Undistort key points using camera intrinsics, in pixels of the same camera matrix:
+        PointArray undist_ref_matches, undist_tar_matches;
+        Undistorter::Shared().UndistortPixels(ref_matches, undist_ref_matches);
+        Undistorter::Shared().UndistortPixels(tar_matches, undist_tar_matches);
+        
+        if (undist_ref_matches.size() < RANSAC_SAMPLE_SIZE)
+            return false;
+        
+        // Both models are estimated concurrently from the same minimal samples:
+        RansacSamples samples;
+        PrepareSamples(undist_ref_matches, undist_tar_matches, samples);
+        if (ransac_backend == RANSAC_BACKEND_ENGINE)
+        {
+            RansacOrderByDistance(matches, samples.order);
+        }
+        
+        Mat H, F;
         float SH = 0.0f, SF = 0.0f;
         vector<bool> h_inliers, f_inliers;
-        int h_num_inliers = 0, f_num_inliers;
+        int h_num_inliers = 0, f_num_inliers = 0;
+        
+        ThreadPool::Shared().ParallelFor(0, 2, [&](int model)
+        {
+            if (model == 0)
+                H = FindHomography(undist_ref_matches, undist_tar_matches, samples, SH, h_inliers, h_num_inliers);
+            else
+                F = FindFundamental(undist_ref_matches, undist_tar_matches, samples, SF, f_inliers, f_num_inliers);
+        });
+        
+        if (cancel != NULL && *cancel)
+            return false;
         
-        Mat H = FindHomography(undist_ref_matches, undist_tar_matches, SH, h_inliers, h_num_inliers);
-        Mat F = FindFundamental(undist_ref_matches, undist_tar_matches, SF, f_inliers, f_num_inliers);
-        */
-         
         float RH = SH / (SH + SF);
         
         PointArray ref_inliers, tar_inliers;
@@ -79,65 +269,66 @@ namespace vslam
                                              F, R, t, point_cloud_3D, triangulated_state);
         }
         
-        if (success)
+        return success;
+    }
+    
+    void Initializer::CommitMap(Ptr<Map> global_map, vector<KeyFramePtr> &keyframes)
+    {
+        // (REFACTOR) Load details into the current keyframe:
+        vector<Point2f> points_2D;
+        vector<Point3f> points_3D;
+        
+        int pc_idx = 0;
+        int kf_id = global_map->NextKeyFrameId();
+        vector<int> point_ids, point_kp_idx;
+        for (int i=0; i<tar_matches.size(); i++)
         {
-            // (REFACTOR) Load details into the current keyframe:
-            vector<Point2f> points_2D;
-            vector<Point3f> points_3D;
-            
-            int pc_idx = 0;
-            vector<MapPoint> local_map;
-            for (int i=0; i<tar_matches.size(); i++)
-            {
-                if (triangulated_state.at(i))
-                {
-                    Mat desc = matched_tar_desc.row(i);
-                    
-                    MapPoint mp;
-                    mp.SetPoint3D(point_cloud_3D.at(pc_idx));
-                    mp.SetPoint2D(tar_matches.at(i));
-                    mp.SetDesc(desc);
-                    
-                    points_3D.push_back(point_cloud_3D.at(pc_idx));
-                    points_2D.push_back(tar_matches.at(i));
-                    
-                    local_map.push_back(mp);
-                    pc_idx++;
-                }
-            }
-            
-            // Compute scale factor
-//            double scale_factor = Tracking::FindLinearScale(R, t, points_2D, points_3D);
-//            Tracking::SetInitScale(scale_factor);
-            
-            KeyFrame kf = KeyFrame(R, t, local_map, tar_kp, tar_desc);
-            keyframes.push_back(kf);
-            
-            // Scale Translation mat
-            /*
-            float inv_median_depth = 1.0 / kf.ComputeMedianDepth();
-            
-            Mat scaled_t = inv_median_depth * t;
-            kf.SetTranslation(scaled_t);
-            
-            // Scaled map points
-            vector<MapPoint> scaled_local_map;
-            for (int i=0; i<local_map.size(); i++)
+            if (triangulated_state.at(i))
             {
-                MapPoint mp = local_map.at(i);
+                Mat desc = matched_tar_desc.row(i);
+                int kp_idx = matches[i].trainIdx;
                 
-                Point3f point_3D = mp.GetPoint3D() * inv_median_depth;
-                point_3D.z *= 1000;
+                int point_id = global_map->AddMapPoint(point_cloud_3D.at(pc_idx), desc);
+                global_map->AddObservation(point_id, kf_id, kp_idx);
                 
-                mp.SetPoint3D(point_3D);
-                scaled_local_map.push_back(mp);
+                points_3D.push_back(point_cloud_3D.at(pc_idx));
+                points_2D.push_back(tar_matches.at(i));
+                
+                point_ids.push_back(point_id);
+                point_kp_idx.push_back(kp_idx);
+                pc_idx++;
             }
-            kf.SetLocalMap(scaled_local_map);
-             
-             */
         }
         
-        return success;
+        // Compute scale factor
+//        double scale_factor = Tracking::FindLinearScale(R, t, points_2D, points_3D);
+//        Tracking::SetInitScale(scale_factor);
+        
+        KeyFramePtr kf = make_shared<KeyFrame>(kf_id, SE3(R, t), global_map, point_ids, point_kp_idx, tar_kp, tar_desc);
+        keyframes.push_back(kf);
+        
+        // Scale Translation mat
+        /*
+        float inv_median_depth = 1.0 / kf.ComputeMedianDepth();
+        
+        Mat scaled_t = inv_median_depth * t;
+        kf.SetTranslation(scaled_t);
+        
+        // Scaled map points
+        vector<MapPoint> scaled_local_map;
+        for (int i=0; i<local_map.size(); i++)
+        {
+            MapPoint mp = local_map.at(i);
+            
+            Point3f point_3D = mp.GetPoint3D() * inv_median_depth;
+            point_3D.z *= 1000;
+            
+            mp.SetPoint3D(point_3D);
+            scaled_local_map.push_back(mp);
+        }
+        kf.SetLocalMap(scaled_local_map);
+         
+         */
     }
     
     
@@ -196,45 +387,421 @@ namespace vslam
                 R1.at<double>(2, 0), R1.at<double>(2, 1), R1.at<double>(2, 2), T1.at<double>(2, 0));
     }
     
-    Mat Initializer::FindHomography(PointArray &ref_keypoints, PointArray &tar_keypoints, float &score, vector<bool> &match_inliers, int &num_inliers)
+    void Initializer::PrepareSamples(const PointArray &ref_keypoints, const PointArray &tar_keypoints, RansacSamples &samples)
+    {
+        Normalize(ref_keypoints, samples.ref_norm, samples.T1);
+        Normalize(tar_keypoints, samples.tar_norm, samples.T2);
+        samples.scorer.SetPoints(ref_keypoints, tar_keypoints);
+        
+        // The keypoints are already undistorted, K^-1 is all that is left:
+        if (use_five_point && ransac_backend == RANSAC_BACKEND_ENGINE)
+        {
+            Mat K_inv;
+            Mat(camera_matrix.inv()).convertTo(K_inv, CV_64F);
+            samples.K_inv = Matx33d((double*)K_inv.data);
+            
+            samples.ref_calib.resize(ref_keypoints.size());
+            samples.tar_calib.resize(tar_keypoints.size());
+            for (int i=0; i<ref_keypoints.size(); i++)
+            {
+                Vec3d x1 = samples.K_inv * Vec3d(ref_keypoints[i].x, ref_keypoints[i].y, 1.0);
+                Vec3d x2 = samples.K_inv * Vec3d(tar_keypoints[i].x, tar_keypoints[i].y, 1.0);
+                samples.ref_calib[i] = Point2f(x1[0] / x1[2], x1[1] / x1[2]);
+                samples.tar_calib[i] = Point2f(x2[0] / x2[2], x2[1] / x2[2]);
+            }
+        }
+        
+        // Only the legacy loops consume pre-drawn samples:
+        const int num_points = (int)ref_keypoints.size();
+        samples.num_iterations = ransac_backend == RANSAC_BACKEND_LEGACY ? RANSAC_MAX_ITERATIONS : 0;
+        samples.indices.resize(samples.num_iterations * RANSAC_SAMPLE_SIZE);
+        
+        // Seeded per attempt, so the chosen model only depends on the matches:
+        RNG rng(RANSAC_SEED);
+        
+        vector<int> available(num_points);
+        for (int it=0; it<samples.num_iterations; it++)
+        {
+            for (int i=0; i<num_points; i++)
+                available[i] = i;
+            
+            // Partial Fisher-Yates shuffle without repeated indices:
+            int* sample = &samples.indices[it * RANSAC_SAMPLE_SIZE];
+            for (int j=0; j<RANSAC_SAMPLE_SIZE; j++)
+            {
+                int remaining = num_points - j;
+                int k = rng.uniform(0, remaining);
+                
+                sample[j] = available[k];
+                available[k] = available[remaining-1];
+            }
+        }
+    }
+    
+    // Fewer equations than unknowns need the full V to get the null vector:
+    static int NullSpaceSvdFlags(const Mat &A)
+    {
+        return A.rows < A.cols ? SVD::MODIFY_A | SVD::FULL_UV : SVD::MODIFY_A;
+    }
+    
+    // DLT on normalized points, two rows per correspondence of the sample:
+    static Mat ComputeHomography(const PointArray &ref_norm, const PointArray &tar_norm, const int* sample,
+                                 int sample_size = RANSAC_SAMPLE_SIZE)
+    {
+        Mat A(2 * sample_size, 9, CV_64F);
+        
+        for (int i=0; i<sample_size; i++)
+        {
+            const double x1 = ref_norm[sample[i]].x, y1 = ref_norm[sample[i]].y;
+            const double x2 = tar_norm[sample[i]].x, y2 = tar_norm[sample[i]].y;
+            
+            double* r0 = A.ptr<double>(2*i);
+            double* r1 = A.ptr<double>(2*i+1);
+            
+            r0[0] = 0.0;    r0[1] = 0.0;    r0[2] = 0.0;
+            r0[3] = -x1;    r0[4] = -y1;    r0[5] = -1.0;
+            r0[6] = y2*x1;  r0[7] = y2*y1;  r0[8] = y2;
+            
+            r1[0] = x1;     r1[1] = y1;     r1[2] = 1.0;
+            r1[3] = 0.0;    r1[4] = 0.0;    r1[5] = 0.0;
+            r1[6] = -x2*x1; r1[7] = -x2*y1; r1[8] = -x2;
+        }
+        
+        Mat w, u, vt;
+        SVD::compute(A, w, u, vt, NullSpaceSvdFlags(A));
+        
+        return vt.row(8).reshape(0, 3).clone();
+    }
+    
+    // Eight-point algorithm on normalized points, with the rank-2 constraint enforced:
+    static Mat ComputeFundamental(const PointArray &ref_norm, const PointArray &tar_norm, const int* sample,
+                                  int sample_size = RANSAC_SAMPLE_SIZE)
+    {
+        Mat A(sample_size, 9, CV_64F);
+        
+        for (int i=0; i<sample_size; i++)
+        {
+            const double x1 = ref_norm[sample[i]].x, y1 = ref_norm[sample[i]].y;
+            const double x2 = tar_norm[sample[i]].x, y2 = tar_norm[sample[i]].y;
+            
+            double* r = A.ptr<double>(i);
+            r[0] = x2*x1; r[1] = x2*y1; r[2] = x2;
+            r[3] = y2*x1; r[4] = y2*y1; r[5] = y2;
+            r[6] = x1;    r[7] = y1;    r[8] = 1.0;
+        }
+        
+        Mat w, u, vt;
+        SVD::compute(A, w, u, vt, NullSpaceSvdFlags(A));
+        
+        Mat F_pre = vt.row(8).reshape(0, 3).clone();
+        SVD::compute(F_pre, w, u, vt, SVD::MODIFY_A | SVD::FULL_UV);
+        w.at<double>(2) = 0.0;
+        
+        return u * Mat::diag(w) * vt;
+    }
+    
+    static RansacOptions InitRansacOptions(void)
+    {
+        RansacOptions options;
+        options.max_iterations = RANSAC_MAX_ITERATIONS;
+        options.seed = RANSAC_SEED;
+        return options;
+    }
+    
+    /*
+     RansacEngine problems over the shared RansacSamples: minimal solvers on normalized
+     matches, denormalized before scoring with the pixel-space TwoViewScorer.
+     */
+    class HomographyProblem
+    {
+    public:
+        
+        struct Model {
+            Matx33d H;
+            TwoViewScoreParams params;
+        };
+        
+        HomographyProblem(const RansacSamples& samples) : samples(samples), scratch(samples.scorer.Size())
+        {
+            T2_inv = samples.T2.inv();
+        }
+        
+        int SampleSize(void) const { return 4; }
+        int NumPoints(void) const { return samples.scorer.Size(); }
+        
+        void Solve(const int* sample, vector<Model>& models) const
+        {
+            models.resize(1);
+            MakeModel(ComputeHomography(samples.ref_norm, samples.tar_norm, sample, SampleSize()), models[0]);
+        }
+        
+        float Score(const Model& model, int begin, int end, float score, uchar* inliers, int& num_inliers) const
+        {
+            return samples.scorer.ScoreHomography(model.params, begin, end, score,
+                                                  inliers != NULL ? inliers : &scratch[0], num_inliers);
+        }
+        
+        bool Refit(const vector<int>& inliers, Model& model) const
+        {
+            MakeModel(ComputeHomography(samples.ref_norm, samples.tar_norm, &inliers[0], (int)inliers.size()), model);
+            return true;
+        }
+        
+    private:
+        
+        void MakeModel(const Mat& H_norm, Model& model) const
+        {
+            Mat H = T2_inv * H_norm * samples.T1;
+            model.H = Matx33d(H);
+            samples.scorer.MakeHomographyParams(model.H, SYMMETRIC_ERROR_SIGMA, SYMMETRIC_ERROR_TH, model.params);
+        }
+        
+    protected:
+        const RansacSamples& samples;
+        Mat T2_inv;
+        mutable vector<uchar> scratch;
+    };
+    
+    class FundamentalProblem
+    {
+    public:
+        
+        struct Model {
+            Matx33d F;
+            TwoViewScoreParams params;
+        };
+        
+        FundamentalProblem(const RansacSamples& samples) : samples(samples), scratch(samples.scorer.Size())
+        {
+            T2_tp = samples.T2.t();
+        }
+        
+        int SampleSize(void) const { return RANSAC_SAMPLE_SIZE; }
+        int NumPoints(void) const { return samples.scorer.Size(); }
+        
+        void Solve(const int* sample, vector<Model>& models) const
+        {
+            models.resize(1);
+            MakeModel(ComputeFundamental(samples.ref_norm, samples.tar_norm, sample, SampleSize()), models[0]);
+        }
+        
+        float Score(const Model& model, int begin, int end, float score, uchar* inliers, int& num_inliers) const
+        {
+            return samples.scorer.ScoreFundamental(model.params, begin, end, score,
+                                                   inliers != NULL ? inliers : &scratch[0], num_inliers);
+        }
+        
+        bool Refit(const vector<int>& inliers, Model& model) const
+        {
+            MakeModel(ComputeFundamental(samples.ref_norm, samples.tar_norm, &inliers[0], (int)inliers.size()), model);
+            return true;
+        }
+        
+    private:
+        
+        void MakeModel(const Mat& F_norm, Model& model) const
+        {
+            Mat F = T2_tp * F_norm * samples.T1;
+            model.F = Matx33d(F);
+            samples.scorer.MakeFundamentalParams(model.F, SYMMETRIC_ERROR_SIGMA, FUNDAMENTAL_ERROR_TH,
+                                                 FUNDAMENTAL_ERROR_TH_SCORE, model.params);
+        }
+        
+    protected:
+        const RansacSamples& samples;
+        Mat T2_tp;
+        mutable vector<uchar> scratch;
+    };
+    
+    // Five-point hypotheses on calibrated matches, as F = K^-T * E * K^-1 for pixel scoring:
+    class EssentialProblem
+    {
+    public:
+        
+        typedef FundamentalProblem::Model Model;
+        
+        EssentialProblem(const RansacSamples& samples) : samples(samples), scratch(samples.scorer.Size()) {}
+        
+        int SampleSize(void) const { return FIVE_POINT_SAMPLE_SIZE; }
+        int NumPoints(void) const { return samples.scorer.Size(); }
+        
+        void Solve(const int* sample, vector<Model>& models) const
+        {
+            Matx33d E[FIVE_POINT_MAX_SOLUTIONS];
+            int num_solutions = SolveEssentialFivePoint(samples.ref_calib, samples.tar_calib, sample, E);
+            
+            models.resize(num_solutions);
+            for (int s=0; s<num_solutions; s++)
+                MakeModel(E[s], models[s]);
+        }
+        
+        float Score(const Model& model, int begin, int end, float score, uchar* inliers, int& num_inliers) const
+        {
+            return samples.scorer.ScoreFundamental(model.params, begin, end, score,
+                                                   inliers != NULL ? inliers : &scratch[0], num_inliers);
+        }
+        
+        bool Refit(const vector<int>& inliers, Model& model) const
+        {
+            Matx33d E;
+            if (!FitEssential(samples.ref_calib, samples.tar_calib, &inliers[0], (int)inliers.size(), E))
+                return false;
+            
+            MakeModel(E, model);
+            return true;
+        }
+        
+    private:
+        
+        void MakeModel(const Matx33d& E, Model& model) const
+        {
+            model.F = samples.K_inv.t() * E * samples.K_inv;
+            samples.scorer.MakeFundamentalParams(model.F, SYMMETRIC_ERROR_SIGMA, FUNDAMENTAL_ERROR_TH,
+                                                 FUNDAMENTAL_ERROR_TH_SCORE, model.params);
+        }
+        
+    protected:
+        const RansacSamples& samples;
+        mutable vector<uchar> scratch;
+    };
+    
+    // F stays untouched when the engine finds no model:
+    template <class Problem>
+    static void RunFundamentalEngine(const RansacSamples& samples, Mat& F, float& score,
+                                     vector<bool>& match_inliers, int& num_inliers, RansacStats& stats)
+    {
+        Problem problem(samples);
+        typename Problem::Model model;
+        RansacEngine<Problem> engine(InitRansacOptions());
+        vector<uchar> inliers;
+        
+        if (engine.Run(problem, model, inliers, &samples.order))
+        {
+            F = Mat(model.F);
+            score = engine.GetStats().score;
+            match_inliers.assign(inliers.begin(), inliers.end());
+            num_inliers = engine.GetStats().num_inliers;
+        }
+        stats = engine.GetStats();
+    }
+    
+    Mat Initializer::FindHomography(PointArray &ref_keypoints, PointArray &tar_keypoints, const RansacSamples &samples, float &score, vector<bool> &match_inliers, int &num_inliers)
     {
         Mat H = Mat::eye(3, 3, CV_64F);
         match_inliers = vector<bool>(ref_keypoints.size(), false);
         num_inliers = 0;
+        score = 0.0f;
         
-        Mat T1, T2;
-        PointArray ref_norm_kp, tar_norm_kp;
+        vector<uchar> curr_inliers;
         
-        Normalize(ref_keypoints, ref_norm_kp, T1);
-        Normalize(tar_keypoints, tar_norm_kp, T2);
+        if (ransac_backend == RANSAC_BACKEND_ENGINE)
+        {
+            HomographyProblem problem(samples);
+            HomographyProblem::Model model;
+            RansacEngine<HomographyProblem> engine(InitRansacOptions());
+            
+            if (engine.Run(problem, model, curr_inliers, &samples.order))
+            {
+                H = Mat(model.H);
+                score = engine.GetStats().score;
+                match_inliers.assign(curr_inliers.begin(), curr_inliers.end());
+                num_inliers = engine.GetStats().num_inliers;
+            }
+            h_ransac_stats = engine.GetStats();
+            
+            return H;
+        }
         
-        Mat H_norm = findHomography(ref_norm_kp, tar_norm_kp, CV_RANSAC, 3);
-        H_norm.convertTo(H_norm, CV_64F);
+        if (ransac_backend == RANSAC_BACKEND_OPENCV)
+        {
+            // Same pixel threshold as the chi-square test, scored like the other backends:
+            Mat H_cv = findHomography(ref_keypoints, tar_keypoints, CV_RANSAC, sqrt(SYMMETRIC_ERROR_TH) * SYMMETRIC_ERROR_SIGMA);
+            if (!H_cv.empty())
+            {
+                H_cv.convertTo(H, CV_64F);
+                score = samples.scorer.ScoreHomography(Matx33d(H), SYMMETRIC_ERROR_SIGMA, SYMMETRIC_ERROR_TH, curr_inliers, num_inliers);
+                match_inliers.assign(curr_inliers.begin(), curr_inliers.end());
+            }
+            
+            return H;
+        }
         
-        H = T2.inv() * H_norm * T1;
+        Mat T2_inv = samples.T2.inv();
         
-        score = CheckHomography(ref_keypoints, tar_keypoints, H, match_inliers, num_inliers);
+        for (int it=0; it<samples.num_iterations; it++)
+        {
+            Mat H_norm = ComputeHomography(samples.ref_norm, samples.tar_norm, &samples.indices[it * RANSAC_SAMPLE_SIZE]);
+            Mat H_curr = T2_inv * H_norm * samples.T1;
+            
+            int curr_num_inliers;
+            float curr_score = samples.scorer.ScoreHomography(Matx33d(H_curr), SYMMETRIC_ERROR_SIGMA, SYMMETRIC_ERROR_TH, curr_inliers, curr_num_inliers);
+            
+            // Strictly greater, so ties keep the earliest sample:
+            if (curr_score > score)
+            {
+                H = H_curr;
+                score = curr_score;
+                match_inliers.assign(curr_inliers.begin(), curr_inliers.end());
+                num_inliers = curr_num_inliers;
+            }
+        }
         
         return H;
     }
     
-    
-    Mat Initializer::FindFundamental(PointArray &ref_keypoints, PointArray &tar_keypoints, float &score, vector<bool> &match_inliers, int &num_inliers)
+    Mat Initializer::FindFundamental(PointArray &ref_keypoints, PointArray &tar_keypoints, const RansacSamples &samples, float &score, vector<bool> &match_inliers, int &num_inliers)
     {
         Mat F = Mat::eye(3, 3, CV_64F);
         match_inliers = vector<bool>(ref_keypoints.size(), false);
         num_inliers = 0;
+        score = 0.0f;
+        
+        vector<uchar> curr_inliers;
         
-        Mat T1, T2;
-        PointArray ref_norm_kp, tar_norm_kp;
+        if (ransac_backend == RANSAC_BACKEND_ENGINE)
+        {
+            if (use_five_point)
+                RunFundamentalEngine<EssentialProblem>(samples, F, score, match_inliers, num_inliers, f_ransac_stats);
+            else
+                RunFundamentalEngine<FundamentalProblem>(samples, F, score, match_inliers, num_inliers, f_ransac_stats);
+            
+            return F;
+        }
         
-        Normalize(ref_keypoints, ref_norm_kp, T1);
-        Normalize(tar_keypoints, tar_norm_kp, T2);
+        if (ransac_backend == RANSAC_BACKEND_OPENCV)
+        {
+            Mat F_cv = findFundamentalMat(ref_keypoints, tar_keypoints, FM_RANSAC, sqrt(FUNDAMENTAL_ERROR_TH) * SYMMETRIC_ERROR_SIGMA, 0.99);
+            if (F_cv.rows == 3 && F_cv.cols == 3)
+            {
+                F_cv.convertTo(F, CV_64F);
+                score = samples.scorer.ScoreFundamental(Matx33d(F), SYMMETRIC_ERROR_SIGMA, FUNDAMENTAL_ERROR_TH, FUNDAMENTAL_ERROR_TH_SCORE, curr_inliers, num_inliers);
+                match_inliers.assign(curr_inliers.begin(), curr_inliers.end());
+            }
+            
+            return F;
+        }
         
-        Mat F_norm = findFundamentalMat(ref_norm_kp, tar_norm_kp, CV_FM_RANSAC, 3, 0.99);
-        F = T2.inv() * F_norm * T1;
+        // Eight-point on every shared sample, so F gets as many hypotheses as H and the score
+        // ratio RH stays unbiased; the five-point solver only runs with the engine backend.
+        // F = T2^T * F_norm * T1
+        Mat T2_tp = samples.T2.t();
         
-        score = CheckFundamental(ref_keypoints, tar_keypoints, F, match_inliers, num_inliers);
+        for (int it=0; it<samples.num_iterations; it++)
+        {
+            Mat F_norm = ComputeFundamental(samples.ref_norm, samples.tar_norm, &samples.indices[it * RANSAC_SAMPLE_SIZE]);
+            Mat F_curr = T2_tp * F_norm * samples.T1;
+            
+            int curr_num_inliers;
+            float curr_score = samples.scorer.ScoreFundamental(Matx33d(F_curr), SYMMETRIC_ERROR_SIGMA, FUNDAMENTAL_ERROR_TH, FUNDAMENTAL_ERROR_TH_SCORE, curr_inliers, curr_num_inliers);
+            
+            if (curr_score > score)
+            {
+                F = F_curr;
+                score = curr_score;
+                match_inliers.assign(curr_inliers.begin(), curr_inliers.end());
+                num_inliers = curr_num_inliers;
+            }
+        }
         
         return F;
     }
@@ -385,9 +952,9 @@ namespace vslam
         vector<Point3f> best_points;
         vector<bool> best_triangulated_state;
         
-        float norm_triangulation_score = ScoreRt(p_R, p_t, ref_keypoints, tar_keypoints, inliers, matches, best_points, max_parallax, best_triangulated_state, best_trans_idx);
+        bool is_unambiguous = ScoreRt(p_R, p_t, ref_keypoints, tar_keypoints, inliers, matches, TRIANGULATION_NORM_SCORE_H_TH, best_points, max_parallax, best_triangulated_state, best_trans_idx);
                 
-        if (norm_triangulation_score > TRIANGULATION_NORM_SCORE_H_TH && max_parallax > PARALLAX_MIN_DEGREES)
+        if (is_unambiguous && max_parallax > PARALLAX_MIN_DEGREES)
         {
             p_R.at(best_trans_idx).copyTo(R);
             p_t.at(best_trans_idx).copyTo(t);
@@ -449,9 +1016,9 @@ namespace vslam
         vector<Point3f> best_points;
         vector<bool> best_triangulated_state;
         
-        float norm_triangulation_score = ScoreRt(p_R, p_t, ref_keypoints, tar_keypoints, inliers, matches, best_points, max_parallax, best_triangulated_state, best_trans_idx);
+        bool is_unambiguous = ScoreRt(p_R, p_t, ref_keypoints, tar_keypoints, inliers, matches, TRIANGULATION_NORM_SCORE_F_TH, best_points, max_parallax, best_triangulated_state, best_trans_idx);
         
-        if (norm_triangulation_score > TRIANGULATION_NORM_SCORE_F_TH && max_parallax > PARALLAX_MIN_DEGREES)
+        if (is_unambiguous && max_parallax > PARALLAX_MIN_DEGREES)
         {
             p_R.at(best_trans_idx).copyTo(R);
             p_t.at(best_trans_idx).copyTo(t);
@@ -465,146 +1032,206 @@ namespace vslam
         return false;
     }
     
-    float Initializer::ScoreRt(vector<Mat> &p_R, vector<Mat> &p_t, const PointArray &ref_keypoints, const PointArray &tar_keypoints, const vector<bool> &inliers, const vector<DMatch> &matches, vector<Point3f> &best_point_cloud, float& best_parallax, vector<bool> &best_triangulated_state, int &best_trans_idx)
+    // The acceptance test of CheckRt, shared with the counting pass of ScoreRt:
+    static inline bool IsGoodTriangulation(const TriangulationResult& tri, int i)
     {
-        // Assuming p_R elements directly correspond to p_t elemetns
-        assert(p_R.size() == p_t.size());
-        
-        best_trans_idx = -1;
-        
-        int highest_good_points = 0, sum_good_points = 0;
-        best_parallax = -1.0;
-        best_point_cloud.clear();
-        
-        for (int i=0; i<p_R.size(); i++)
-        {
-            float parallax;
-            vector<Point3f> point_cloud;
-            vector<bool> triangulated_state;
-            
-            int num_good_points = CheckRt(p_R[i], p_t[i], ref_keypoints, tar_keypoints, inliers, matches, point_cloud, parallax, triangulated_state);
-            sum_good_points += num_good_points;
-            
-            if (num_good_points > highest_good_points)
-            {
-                highest_good_points = num_good_points;
-                
-                best_parallax = parallax;
-                best_trans_idx = i;
-                best_point_cloud = point_cloud;
-                best_triangulated_state = triangulated_state;
-            }
-        }
+        // Check that the point is finite:
+        if (!isfinite(tri.X[i]) || !isfinite(tri.Y[i]) || !isfinite(tri.Z[i]))
+            return false;
         
-        if (highest_good_points < TRIANGULATION_MIN_POINTS)
-            return 0.0f;
+        // Check that the point is in front of both cameras:
+        if ((tri.depth1[i] <= 0.0 || tri.depth2[i] <= 0.0) && tri.cos_parallax[i] < 0.9998)
+            return false;
         
-        return (1.0f * highest_good_points) / sum_good_points;
+        // Check reprojection error for both images:
+        return tri.error1[i] <= REPROJECTION_ERROR_TH && tri.error2[i] <= REPROJECTION_ERROR_TH;
     }
     
-    int Initializer::CheckRt(Mat &R, Mat &t, const PointArray &ref_keypoints, const PointArray &tar_keypoints, const vector<bool> &inliers, const vector<DMatch> &matches, vector<Point3f> &point_cloud, float& max_parallax, vector<bool> &triangulated_state)
+    // Bounds on the good point counts of the hypotheses in ScoreRt while they are counted. Once
+    // no remaining point can change the winner or its score the outcome is decided, so the
+    // result does not depend on how far each hypothesis got:
+    struct RtScoreBounds {
+        RtScoreBounds(int num_hypotheses, int num_points, float min_score)
+            : lo(num_hypotheses, 0), hi(num_hypotheses, num_points), min_score(min_score),
+              decided(false), accepted(false), winner(-1) {}
+        
+        mutex bounds_mutex;
+        vector<int> lo, hi;
+        float min_score;
+        
+        atomic<bool> decided;
+        bool accepted;
+        int winner;
+    };
+    
+    static inline float RtScore(int best, int others)
     {
-        // Intrinsic parameters (3D->2D) for projection error checking:
-        float cam_fx = camera_matrix.at<double>(0, 0);
-        float cam_fy = camera_matrix.at<double>(1, 1);
-        float cam_cx = camera_matrix.at<double>(0, 2);
-        float cam_cy = camera_matrix.at<double>(1, 2);
-        
-        vector<float> cos_parallaxes;
-        triangulated_state = vector<bool>(ref_keypoints.size(), false);
+        return (1.0f * best) / (best + others);
+    }
+    
+    // Called with bounds_mutex held after any bound moved:
+    static void DecideScoreRt(RtScoreBounds& bounds)
+    {
+        const vector<int>& lo = bounds.lo;
+        const vector<int>& hi = bounds.hi;
+        const int n = (int)lo.size();
         
-        point_cloud.clear();
-        cos_parallaxes.reserve(ref_keypoints.size());
+        int sum_lo = 0, sum_hi = 0;
+        for (int i=0; i<n; i++)
+        {
+            sum_lo += lo[i];
+            sum_hi += hi[i];
+        }
         
-        // P1 = K[I|0]
-        Mat ref_origin = Mat::zeros(3, 1, CV_64F);
-        Mat P1 = (Mat_<double>(3, 4) << cam_fx, 0.0,    cam_cx, 0.0,
-                                        0.0,    cam_fy, cam_cy, 0.0,
-                                        0.0,    0.0,    1.0,    0.0);
+        // Rejected if no hypothesis can reach the minimum or the score, even at its upper bound:
+        bool rejected = true;
+        for (int w=0; w<n && rejected; w++)
+        {
+            if (hi[w] >= TRIANGULATION_MIN_POINTS && RtScore(hi[w], sum_lo - lo[w]) > bounds.min_score)
+                rejected = false;
+        }
         
-        // P2 = K[R|t]
-        Mat tar_origin = -R.t()*t;
-        Mat P2 = (Mat_<double>(3, 4) << R.at<double>(0, 0), R.at<double>(0, 1), R.at<double>(0, 2), t.at<double>(0),
-                                        R.at<double>(1, 0), R.at<double>(1, 1), R.at<double>(1, 2), t.at<double>(1),
-                                        R.at<double>(2, 0), R.at<double>(2, 1), R.at<double>(2, 2), t.at<double>(2));
-        P2 = camera_matrix * P2;
+        if (rejected)
+        {
+            bounds.accepted = false;
+            bounds.decided = true;
+            return;
+        }
         
-        int num_good_points = 0;
-        for (int i=0; i<ref_keypoints.size(); i++)
+        // Accepted once the winner is fixed (ties go to the first hypothesis) and its lower bound
+        // beats the score against every other count at its upper bound:
+        for (int w=0; w<n; w++)
         {
-            if (!inliers[i])
-                continue;
-            
-            KeyPoint ref_kp, tar_kp;
-            ref_kp.pt = ref_keypoints[i];
-            tar_kp.pt = tar_keypoints[i];
-            
-            Mat ref_point_3D = Mat(3, 1, CV_64F, Scalar(0));
-            Tracking::Triangulate(ref_kp, tar_kp, P1, P2, ref_point_3D);
-            
-            // Check that the point is finite:
-            if (!isfinite(ref_point_3D.at<double>(0)) ||
-                !isfinite(ref_point_3D.at<double>(1)) ||
-                !isfinite(ref_point_3D.at<double>(2)))
+            bool is_winner = true;
+            for (int j=0; j<n && is_winner; j++)
             {
-                continue;
+                if (j != w && (j < w ? hi[j] >= lo[w] : hi[j] > lo[w]))
+                    is_winner = false;
             }
             
-            // Check parallax:
-            Mat ref_normal = ref_point_3D - ref_origin;
-            float ref_dist = norm(ref_normal);
-            
-            Mat tar_normal = ref_point_3D - tar_origin;
-            float tar_dist = norm(tar_normal);
-            
-            float cos_parallax = ref_normal.dot(tar_normal) / (ref_dist * tar_dist);
-            
-            // Check that the point is in front of the reference camera:
-            if (ref_point_3D.at<double>(2) <= 0.0 && cos_parallax < 0.9998)
+            if (is_winner && lo[w] >= TRIANGULATION_MIN_POINTS &&
+                RtScore(lo[w], sum_hi - hi[w]) > bounds.min_score)
             {
-                continue;
+                bounds.accepted = true;
+                bounds.winner = w;
+                bounds.decided = true;
+                return;
             }
+        }
+    }
+    
+    // Counts the good points of hypothesis h chunk by chunk until ScoreRt is decided:
+    static void CountRt(const SE3& pose, const Triangulator& triangulator, int h, RtScoreBounds& bounds)
+    {
+        const SE3 ref_pose;
+        int num_points = triangulator.Size();
+        
+        TriangulationResult tri;
+        int num_good_points = 0;
+        
+        for (int begin=0; begin<num_points; begin+=SCORE_RT_CHUNK_SIZE)
+        {
+            if (bounds.decided)
+                return;
             
-            Mat tar_point_3D = R * ref_point_3D + t;
+            int end = min(begin + SCORE_RT_CHUNK_SIZE, num_points);
+            triangulator.Run(ref_pose, pose, begin, end, tri);
             
-            // Check that the point is in front of the target camera:
-            if (tar_point_3D.at<double>(2) <= 0.0 && cos_parallax < 0.9998)
+            for (int i=0; i<end-begin; i++)
             {
-                continue;
+                if (IsGoodTriangulation(tri, i))
+                    num_good_points++;
             }
             
-            // Check reprojection error for reference image:
-            float ref_reproj_x, ref_reproj_y;
-            ref_reproj_x = cam_fx * (ref_point_3D.at<double>(0) / ref_point_3D.at<double>(2)) + cam_cx;
-            ref_reproj_y = cam_fy * (ref_point_3D.at<double>(1) / ref_point_3D.at<double>(2)) + cam_cy;
+            lock_guard<mutex> lock(bounds.bounds_mutex);
+            bounds.lo[h] = num_good_points;
+            bounds.hi[h] = num_good_points + num_points - end;
             
-            float ref_square_error = (ref_reproj_x - ref_kp.pt.x) * (ref_reproj_x - ref_kp.pt.x) +
-            (ref_reproj_y - ref_kp.pt.y) * (ref_reproj_y - ref_kp.pt.y);
-            
-            if (ref_square_error > REPROJECTION_ERROR_TH)
-            {
+            if (!bounds.decided)
+                DecideScoreRt(bounds);
+        }
+    }
+    
+    bool Initializer::ScoreRt(vector<Mat> &p_R, vector<Mat> &p_t, const PointArray &ref_keypoints, const PointArray &tar_keypoints, const vector<bool> &inliers, const vector<DMatch> &matches, float min_score, vector<Point3f> &best_point_cloud, float& best_parallax, vector<bool> &best_triangulated_state, int &best_trans_idx)
+    {
+        // Assuming p_R elements directly correspond to p_t elemetns
+        assert(p_R.size() == p_t.size());
+        
+        best_trans_idx = -1;
+        best_parallax = -1.0;
+        best_point_cloud.clear();
+        
+        // The inlier correspondences are the same for every hypothesis, so they are
+        // normalized once and each hypothesis only reruns the batched kernel:
+        Triangulator triangulator(camera_matrix);
+        triangulator.Reserve((int)ref_keypoints.size());
+        
+        vector<int> point_idx;
+        for (int i=0; i<ref_keypoints.size(); i++)
+        {
+            if (!inliers[i])
                 continue;
-            }
-            
-            // Check reprojection error for target image:b
-            float tar_reproj_x, tar_reproj_y;
-            tar_reproj_x = cam_fx * (tar_point_3D.at<double>(0) / tar_point_3D.at<double>(2)) + cam_cx;
-            tar_reproj_y = cam_fy * (tar_point_3D.at<double>(1) / tar_point_3D.at<double>(2)) + cam_cy;
             
-            float tar_square_error = (tar_reproj_x - tar_kp.pt.x) * (tar_reproj_x - tar_kp.pt.x) +
-            (tar_reproj_y - tar_kp.pt.y) * (tar_reproj_y - tar_kp.pt.y);
-            
-            if (tar_square_error > REPROJECTION_ERROR_TH)
-            {
+            triangulator.Add(ref_keypoints[i], tar_keypoints[i]);
+            point_idx.push_back(i);
+        }
+        
+        // Count good points for every hypothesis in parallel. The score is the winner's share of
+        // all good points; counting stops as soon as the bounds decide it either way:
+        int num_hypotheses = (int)p_R.size();
+        vector<SE3> poses(num_hypotheses);
+        for (int i=0; i<num_hypotheses; i++)
+        {
+            poses[i] = SE3(p_R[i], p_t[i]);
+        }
+        
+        RtScoreBounds bounds(num_hypotheses, triangulator.Size(), min_score);
+        {
+            lock_guard<mutex> lock(bounds.bounds_mutex);
+            DecideScoreRt(bounds);
+        }
+        
+        ThreadPool::Shared().ParallelFor(0, num_hypotheses, [&](int i)
+        {
+            CountRt(poses[i], triangulator, i, bounds);
+        });
+        
+        if (!bounds.accepted)
+            return false;
+        
+        // Only the winner's point cloud is built:
+        best_trans_idx = bounds.winner;
+        CheckRt(p_R[best_trans_idx], p_t[best_trans_idx], triangulator, point_idx, (int)ref_keypoints.size(), best_point_cloud, best_parallax, best_triangulated_state);
+        
+        return true;
+    }
+    
+    int Initializer::CheckRt(Mat &R, Mat &t, const Triangulator &triangulator, const vector<int> &point_idx, int num_points, vector<Point3f> &point_cloud, float& max_parallax, vector<bool> &triangulated_state)
+    {
+        vector<float> cos_parallaxes;
+        triangulated_state = vector<bool>(num_points, false);
+        
+        point_cloud.clear();
+        cos_parallaxes.reserve(point_idx.size());
+        
+        // P1 = K[I|0], P2 = K[R|t]
+        TriangulationResult tri;
+        triangulator.Run(SE3(), SE3(R, t), tri);
+        
+        int num_good_points = 0;
+        for (int i=0; i<point_idx.size(); i++)
+        {
+            if (!IsGoodTriangulation(tri, i))
                 continue;
-            }
+            
+            float cos_parallax = tri.cos_parallax[i];
             
             cos_parallaxes.push_back(cos_parallax);
-            point_cloud.push_back(Point3f(ref_point_3D.at<double>(0), ref_point_3D.at<double>(1), ref_point_3D.at<double>(2)));
+            point_cloud.push_back(Point3f(tri.X[i], tri.Y[i], tri.Z[i]));
             
             num_good_points++;
             if (cos_parallax < 0.9998)
-                triangulated_state[i] = true;
+                triangulated_state[point_idx[i]] = true;
         }
         
         // Find the max parallax (in degrees) of the first N=TRIANGULATION_MIN_POINTS points
@@ -640,152 +1267,25 @@ namespace vslam
     
     float Initializer::CheckHomography(PointArray& ref_keypoints, PointArray& tar_keypoints, Mat &H_ref2tar, vector<bool> &match_inliers, int &num_inliers)
     {
-        float score = 0;
-        Mat H_tar2ref = H_ref2tar.inv();
-        
-        const float inv_sigma_square = 1.0 / (SYMMETRIC_ERROR_SIGMA * SYMMETRIC_ERROR_SIGMA);
-        match_inliers.resize(ref_keypoints.size());
+        TwoViewScorer scorer;
+        scorer.SetPoints(ref_keypoints, tar_keypoints);
         
-        num_inliers = 0;
-        
-        assert(ref_keypoints.size() == tar_keypoints.size());
-        for(int i=0; i<ref_keypoints.size(); i++)
-        {
-            bool is_inlier = true;
-            
-            const float x1 = ref_keypoints[i].x;
-            const float y1 = ref_keypoints[i].y;
-            const float x2 = tar_keypoints[i].x;
-            const float y2 = tar_keypoints[i].y;
-            
-            // Reproject tar keypoints to ref keypoints:
-            Mat x2_y2 = (Mat_<double>(3, 1) << x2, y2, 1.0f);
-            Mat reproj_x1_y1 = H_tar2ref * x2_y2;
-            
-            const float reproj_w1 = 1.0 / reproj_x1_y1.at<double>(2, 0);
-            const float reproj_x1 = reproj_x1_y1.at<double>(0, 0) * reproj_w1;
-            const float reproj_y1 = reproj_x1_y1.at<double>(1, 0) * reproj_w1;
-            
-            // Euclidean distance between 2D points:
-            const float ref_square_dist = (x1-reproj_x1)*(x1-reproj_x1) + (y1-reproj_y1)*(y1-reproj_y1);
-            const float ref_chi_square = ref_square_dist * inv_sigma_square;
-            
-            if (ref_chi_square > SYMMETRIC_ERROR_TH)
-            {
-                is_inlier = false;
-            }
-            else
-            {
-                score += SYMMETRIC_ERROR_TH - ref_chi_square;
-            }
-            
-            // Reproject ref keypoints to tar keypoints;
-            Mat x1_y1 = (Mat_<double>(3, 1) << x1, y1, 1.0f);
-            Mat reproj_x2_y2 = H_ref2tar * x1_y1;
-            
-            const float reproj_w2 = 1.0 / reproj_x2_y2.at<double>(2, 0);
-            const float reproj_x2 = reproj_x2_y2.at<double>(0, 0) * reproj_w2;
-            const float reproj_y2 = reproj_x2_y2.at<double>(1, 0) * reproj_w2;
-            
-            // Euclidean distance between 2D points:
-            const float tar_square_dist = (x2-reproj_x2)*(x2-reproj_x2) + (y2-reproj_y2)*(y2-reproj_y2);
-            const float tar_chi_square = tar_square_dist * inv_sigma_square;
-            
-            if (tar_square_dist > SYMMETRIC_ERROR_TH)
-            {
-                is_inlier = false;
-            }
-            else
-            {
-                score += SYMMETRIC_ERROR_TH - tar_chi_square;
-            }
-            
-            // Update inlier status:
-            if (is_inlier)
-            {
-                match_inliers[i] = true;
-                num_inliers++;
-            }
-            else
-            {
-                match_inliers[i] = false;
-            }
-        }
+        vector<uchar> inliers;
+        float score = scorer.ScoreHomography(Matx33d(H_ref2tar), SYMMETRIC_ERROR_SIGMA, SYMMETRIC_ERROR_TH, inliers, num_inliers);
         
+        match_inliers.assign(inliers.begin(), inliers.end());
         return score;
     }
     
     float Initializer::CheckFundamental(PointArray &ref_keypoints, PointArray &tar_keypoints, Mat &F, vector<bool> &match_inliers, int &num_inliers)
     {
-        float score = 0;
-        
-        const float inv_sigma_square = 1.0 / (SYMMETRIC_ERROR_SIGMA * SYMMETRIC_ERROR_SIGMA);
-        match_inliers.resize(ref_keypoints.size());
+        TwoViewScorer scorer;
+        scorer.SetPoints(ref_keypoints, tar_keypoints);
         
-        num_inliers = 0;
-        
-        assert(ref_keypoints.size() == tar_keypoints.size());
-        for (int i=0; i<ref_keypoints.size(); i++)
-        {
-            bool is_inliner = true;
-            
-            const float x1 = ref_keypoints[i].x;
-            const float y1 = ref_keypoints[i].y;
-            const float x2 = tar_keypoints[i].x;
-            const float y2 = tar_keypoints[i].y;
-            
-            Mat x1_y1 = (Mat_<double>(3, 1) << x1, y1, 1.0f);
-            Mat x2_y2 = (Mat_<double>(3, 1) << x2, y2, 1.0f);
-            Mat x1_y1_tp = x1_y1.t();
-            Mat x2_y2_tp = x2_y2.t();
-            
-            // Project ref keypoints to target keypoints (aT * F * a'):
-            Mat F_alpha_prime = F * x1_y1;
-            Mat alpha_tp_F_alpha_prime = x2_y2_tp * F_alpha_prime;
-            
-            const float ref_square_dist = (alpha_tp_F_alpha_prime.at<double>(0, 0) * alpha_tp_F_alpha_prime.at<double>(0, 0)) /             ( F_alpha_prime.at<double>(0, 0) * F_alpha_prime.at<double>(0, 0) + F_alpha_prime.at<double>(1, 0) * F_alpha_prime.at<double>(1, 0) );
-            
-            const float ref_chi_square = ref_square_dist * inv_sigma_square;
-            
-            if (ref_chi_square > FUNDAMENTAL_ERROR_TH)
-            {
-                is_inliner = false;
-            }
-            else
-            {
-                score += FUNDAMENTAL_ERROR_TH_SCORE - ref_chi_square;
-            }
-            
-            // Project tar keypoints to ref keypoints (a'T * F * a):
-            Mat F_alpha = F * x2_y2;
-            Mat alpha_prime_tp_F_alpha = x1_y1_tp * F_alpha;
-            
-            const float tar_square_dist = (alpha_prime_tp_F_alpha.at<double>(0, 0) * alpha_prime_tp_F_alpha.at<double>(0, 0)) /
-            (F_alpha.at<double>(0, 0) * F_alpha.at<double>(0, 0) + F_alpha.at<double>(1, 0) * F_alpha.at<double>(1, 0                                                                                                              ));
-            
-            const float tar_chi_square = tar_square_dist * inv_sigma_square;
-            
-            if (tar_chi_square > FUNDAMENTAL_ERROR_TH)
-            {
-                is_inliner = false;
-            }
-            else
-            {
-                score += FUNDAMENTAL_ERROR_TH_SCORE - tar_chi_square;
-            }
-            
-            if (is_inliner)
-            {
-                match_inliers[i] = true;
-                num_inliers++;
-            }
-            else
-            {
-                match_inliers[i] = false;
-            }
-            
-        }
+        vector<uchar> inliers;
+        float score = scorer.ScoreFundamental(Matx33d(F), SYMMETRIC_ERROR_SIGMA, FUNDAMENTAL_ERROR_TH, FUNDAMENTAL_ERROR_TH_SCORE, inliers, num_inliers);
         
+        match_inliers.assign(inliers.begin(), inliers.end());
         return score;
     }
     
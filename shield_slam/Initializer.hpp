@@ -7,7 +7,14 @@
 #include "Common.hpp"
 #include "MapPoint.hpp"
 #include "KeyFrame.hpp"
+#include "Map.hpp"
 #include "Tracking.hpp"
+#include "Triangulator.hpp"
+#include "ThreadPool.hpp"
+#include "TwoViewScorer.hpp"
+#include "Ransac.hpp"
+#include "EssentialSolver.hpp"
+#include "Undistorter.hpp"
 
 using namespace cv;
 using namespace std;
@@ -29,9 +36,71 @@ using namespace std;
 #define TRIANGULATION_NORM_SCORE_H_TH 0.45
 #define TRIANGULATION_NORM_SCORE_F_TH 0.7
 
+// H and F are scored on the same RANSAC_MAX_ITERATIONS samples of RANSAC_SAMPLE_SIZE matches:
+#define RANSAC_MAX_ITERATIONS 200
+#define RANSAC_SAMPLE_SIZE 8
+#define RANSAC_SEED 0x2545f491
+
+// Estimator behind FindHomography/FindFundamental, see RansacBackend:
+#define INIT_RANSAC_BACKEND RANSAC_BACKEND_LEGACY
+
+// With the engine backend, F hypotheses come from the calibrated five-point solver
+// (F = K^-T * E * K^-1) instead of the eight-point algorithm, and the smaller sample cuts
+// the adaptive iteration count. The legacy loop keeps eight-point so H and F are scored on
+// the same number of hypotheses:
+#define INIT_USE_FIVE_POINT true
+
+// Points triangulated per step when counting a hypothesis; it can stop between steps:
+#define SCORE_RT_CHUNK_SIZE 64
+
+// Optical-flow initialization: reference keypoints are tracked frame to frame with pyramidal
+// Lucas-Kanade, and the two-view reconstruction only runs once enough tracks moved far enough
+// from the reference. Below KLT_MIN_TRACKS surviving tracks the reference frame is replaced.
+#define INIT_USE_KLT true
+#define KLT_WINDOW_SIZE 21
+#define KLT_PYRAMID_LEVELS 3
+#define KLT_MIN_TRACKS 100
+#define KLT_MIN_MEDIAN_PARALLAX 15.0f
+// Radius (px) in which a track is tied to a target ORB keypoint once the gate passes:
+#define KLT_ASSOCIATION_RADIUS 3.0f
+
 namespace vslam
 {
     
+    // Target frame of one or more concurrent initialization attempts. Its ORB features are
+    // extracted once, by whichever attempt needs them first:
+    struct InitTargetFrame {
+        InitTargetFrame(Mat& img) : img(img) {}
+        
+        void ExtractFeatures(Ptr<ORB> orb_handler)
+        {
+            call_once(extracted, [&] { orb_handler->ExtractFeatures(img, keypoints, desc); });
+        }
+        
+        Mat img;
+        KeypointArray keypoints;
+        Mat desc;
+        once_flag extracted;
+    };
+    
+    // Matches normalized for both estimators, and the indices of every minimal sample:
+    struct RansacSamples {
+        PointArray ref_norm, tar_norm;
+        Mat T1, T2;
+        vector<int> indices;
+        int num_iterations;
+        
+        // Matches in normalized camera coordinates (K^-1 * x), for the five-point solver:
+        PointArray ref_calib, tar_calib;
+        Matx33d K_inv;
+        
+        // Matches by ascending descriptor distance, for PROSAC:
+        vector<int> order;
+        
+        // Pixel matches in SoA layout for hypothesis scoring:
+        TwoViewScorer scorer;
+    };
+    
     class Initializer
     {
     public:
@@ -39,10 +108,43 @@ namespace vslam
         Initializer();
         virtual ~Initializer() = default;
         
-        bool InitializeMap(Ptr<ORB> orb_handler, Mat& img_ref, Mat& img_tar, vector<KeyFrame>& keyframes);
+        bool InitializeMap(Ptr<ORB> orb_handler, Ptr<Map> global_map, Mat& img_ref, Mat& img_tar,
+                           vector<KeyFramePtr>& keyframes);
+        
+        // InitializeMap in two steps: the attempt only touches this initializer, so attempts
+        // against several reference frames can run concurrently, and it gives up once cancel
+        // is set. CommitMap adds the last successful attempt to the map:
+        bool AttemptInitialization(Ptr<ORB> orb_handler, InitTargetFrame& target, const atomic<bool>* cancel = NULL);
+        void CommitMap(Ptr<Map> global_map, vector<KeyFramePtr>& keyframes);
+        
+        // Caches the keypoints and descriptors of img_ref for every InitializeMap against it;
+        // reset whenever the reference frame is replaced:
+        void SetReferenceFrame(Ptr<ORB> orb_handler, Mat& img_ref);
+        void SetReferenceFrame(Mat& img_ref, const KeypointArray& img_kp, const Mat& img_desc);
+        void ResetReferenceFrame(void);
+        
+        // Optical-flow mode, see INIT_USE_KLT; takes effect with the next reference frame:
+        void SetUseKlt(bool enable) { use_klt = enable; }
+        // Too few reference keypoints are still tracked, the caller should pick a new reference:
+        bool IsReferenceLost(void) const { return use_klt && has_ref_features && klt_points.size() < KLT_MIN_TRACKS; }
+        
+        // Advances the tracks to img_tar; true when the parallax and track-count gate passes:
+        bool TrackReference(Mat& img_tar, float& median_parallax);
+        // Ties the tracks to ORB keypoints of img_tar, in the layout of ORB::MatchFeatures:
+        void AssociateTracks(const KeypointArray& tar_kp, const Mat& tar_desc, Size img_size,
+                             vector<DMatch>& matches, PointArray& ref_matches, PointArray& tar_matches,
+                             Mat& matched_tar_desc);
         
-        Mat FindHomography(PointArray& ref_keypoints, PointArray& tar_keypoints, float& score, vector<bool>& match_inliers, int& num_inliers);
-        Mat FindFundamental(PointArray& ref_keypoints, PointArray& tar_keypoints, float& score, vector<bool>& match_inliers, int& num_inliers);
+        void SetRansacBackend(RansacBackend backend) { ransac_backend = backend; }
+        void SetUseFivePoint(bool enable) { use_five_point = enable; }
+        const RansacStats& GetHomographyRansacStats(void) const { return h_ransac_stats; }
+        const RansacStats& GetFundamentalRansacStats(void) const { return f_ransac_stats; }
+        
+        // Draws the minimal samples shared by the homography and fundamental estimators:
+        void PrepareSamples(const PointArray& ref_keypoints, const PointArray& tar_keypoints, RansacSamples& samples);
+        
+        Mat FindHomography(PointArray& ref_keypoints, PointArray& tar_keypoints, const RansacSamples& samples, float& score, vector<bool>& match_inliers, int& num_inliers);
+        Mat FindFundamental(PointArray& ref_keypoints, PointArray& tar_keypoints, const RansacSamples& samples, float& score, vector<bool>& match_inliers, int& num_inliers);
         
         float CheckHomography(PointArray& ref_keypoints, PointArray& tar_keypoints, Mat& H_ref2tar, vector<bool>& match_inliers, int& num_inliers);
         float CheckFundamental(PointArray& ref_keypoints, PointArray& tar_keypoints, Mat& F, vector<bool>& match_inliers, int& num_inliers);
@@ -53,8 +155,11 @@ namespace vslam
         bool ReconstructHomography(PointArray& ref_keypoints, PointArray& tar_keypoints, vector<DMatch>& matches, vector<bool>& inliers, int& num_inliers, Mat& H, Mat& R, Mat& t, vector<Point3f>& points, vector<bool>& triangulated_state);
         bool ReconstructFundamental(PointArray& ref_keypoints, PointArray& tar_keypoints, vector<DMatch>& matches, vector<bool>& inliers, int& num_inliers, Mat& F, Mat& R, Mat& t, vector<Point3f>& points, vector<bool>& triangulated_state);
         
-        int CheckRt(Mat& R, Mat& t, const PointArray& ref_keypoints, const PointArray& tar_keypoints, const vector<bool>& inliers, const vector<DMatch>& matches, vector<Point3f>& point_cloud, float& max_parallax, vector<bool>& triangulated_state);
-        float ScoreRt(vector<Mat>& p_R, vector<Mat>& p_t, const PointArray& ref_keypoints, const PointArray& tar_keypoints, const vector<bool>& inliers, const vector<DMatch>& matches, vector<Point3f>& best_point_cloud, float& best_parallax, vector<bool>& best_triangulated_state, int& best_trans_idx);
+        // point_idx maps batch entries back to the num_points correspondences:
+        int CheckRt(Mat& R, Mat& t, const Triangulator& triangulator, const vector<int>& point_idx, int num_points, vector<Point3f>& point_cloud, float& max_parallax, vector<bool>& triangulated_state);
+        // True when the hypothesis with the most good points holds more than min_score of all
+        // good points (and at least TRIANGULATION_MIN_POINTS); only then is its point cloud built:
+        bool ScoreRt(vector<Mat>& p_R, vector<Mat>& p_t, const PointArray& ref_keypoints, const PointArray& tar_keypoints, const vector<bool>& inliers, const vector<DMatch>& matches, float min_score, vector<Point3f>& best_point_cloud, float& best_parallax, vector<bool>& best_triangulated_state, int& best_trans_idx);
         
         void Normalize(const PointArray& in_points, PointArray& norm_points, Mat& T);
         void FilterInliers(PointArray& ref_keypoints, PointArray& tar_keypoints, vector<bool>& inliers, PointArray& ref_inliers, PointArray& tar_inliers);
@@ -62,6 +167,28 @@ namespace vslam
     private:
         
     protected:
+        KeypointArray ref_kp;
+        Mat ref_desc;
+        bool has_ref_features;
+        
+        // Target side of the last attempt, as CommitMap needs it:
+        KeypointArray tar_kp;
+        Mat tar_desc;
+        vector<DMatch> matches;
+        PointArray tar_matches;
+        Mat matched_tar_desc;
+        
+        // Optical-flow tracks: current position and reference keypoint index of each track,
+        // and the pyramid of the last tracked frame:
+        bool use_klt;
+        PointArray klt_points;
+        vector<int> klt_ref_idx;
+        vector<Mat> klt_prev_pyramid;
+        
+        RansacBackend ransac_backend;
+        bool use_five_point;
+        RansacStats h_ransac_stats, f_ransac_stats;
+        
         Mat R, t;
         vector<bool> triangulated_state;
         vector<Point3f> point_cloud_3D;
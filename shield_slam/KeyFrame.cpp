@@ -1,5 +1,7 @@
 #include "KeyFrame.hpp"
 
+#include <cstring>
+
 using namespace cv;
 using namespace std;
 
@@ -7,82 +9,130 @@ namespace vslam {
     
     KeyFrame::KeyFrame(void)
     {
-        R = Mat::eye(3, 3, CV_64F);
-        t = Mat::zeros(3, 1, CV_64F);
+        id = -1;
+        
+        pose = SE3();
         
-        local_map.clear();
+        map_point_ids.clear();
+        map_point_kp_idx.clear();
         orb_kp.clear();
         orb_desc = Mat();
         
-        insertion_frame_count = 0;
+        point_obs.clear();
+        point_octaves.clear();
+        point_desc = Mat();
     }
     
-    KeyFrame::KeyFrame(Mat &rot_mat, Mat &trans_mat, vector<MapPoint> &map,
+    KeyFrame::KeyFrame(int kf_id, const SE3 &kf_pose, Ptr<Map> map,
+                       vector<int> &point_ids, vector<int> &point_kp_idx,
                        KeypointArray &total_kp, Mat &total_desc)
     {
-        R = rot_mat.clone();
-        t = trans_mat.clone();
+        if (point_ids.size() != point_kp_idx.size())
+        {
+            CV_Error(0, "KeyFrame: every map point needs a keypoint index");
+        }
         
-        local_map = map;
+        id = kf_id;
+        
+        pose = kf_pose;
+        
+        global_map = map;
+        map_point_ids = point_ids;
+        map_point_kp_idx = point_kp_idx;
         
         orb_kp = total_kp;
         orb_desc = total_desc.clone();
         
-        insertion_frame_count = 0;
+        // Pack this keyframe's observations once:
+        const int num_points = (int)map_point_ids.size();
+        point_obs.resize(num_points);
+        point_octaves.resize(num_points);
+        point_desc.create(num_points, orb_desc.cols, CV_8U);
+        
+        for (int i=0; i<num_points; i++)
+        {
+            const KeyPoint& kp = orb_kp[map_point_kp_idx[i]];
+            point_obs[i] = kp.pt;
+            point_octaves[i] = kp.octave;
+            memcpy(point_desc.ptr<uchar>(i), orb_desc.ptr<uchar>(map_point_kp_idx[i]), orb_desc.cols);
+        }
+        
+        point_cache = make_shared<KeyFramePointCache>();
+        point_cache->revision = -1;
     }
     
-    vector<Point3f> KeyFrame::Get3DPoints(void)
+    KeyFramePtr KeyFrame::WithPose(const SE3 &new_pose) const
     {
-        vector<Point3f> point_3D;
-        for (int i=0; i<local_map.size(); i++)
-        {
-            point_3D.push_back(local_map.at(i).GetPoint3D());
-        }
+        shared_ptr<KeyFrame> kf = make_shared<KeyFrame>(*this);
+        kf->pose = new_pose;
         
-        return point_3D;
+        return kf;
     }
     
-    Mat KeyFrame::GetDescriptors(void)
+    shared_ptr<const vector<Point3f> > KeyFrame::GetPointCoords(void) const
     {
-        Mat desc = Mat::zeros((int)local_map.size(), local_map.at(0).GetDesc().cols, CV_8U);
+        if (global_map.empty() || !point_cache)
+            return make_shared<const vector<Point3f> >();
+        
+        lock_guard<mutex> lock(point_cache->cache_mutex);
         
-        for (int i=0; i<local_map.size(); i++)
+        int revision = global_map->GetRevision();
+        if (revision != point_cache->revision)
         {
-            local_map.at(i).GetDesc().copyTo(desc.row(i));
+            point_cache->coords = make_shared<const vector<Point3f> >(global_map->GetPoints3D(map_point_ids));
+            point_cache->revision = revision;
         }
         
-        return desc;
+        return point_cache->coords;
     }
     
-    void KeyFrame::GetKpDesc(PointArray &kp, Mat &desc)
+    vector<Point3f> KeyFrame::Get3DPoints(void) const
     {
-        desc = Mat::zeros((int)local_map.size(), local_map.at(0).GetDesc().cols, CV_8U);
-        kp.clear();
+        return *GetPointCoords();
+    }
+    
+    Mat KeyFrame::GetDescriptors(void) const
+    {
+        Mat desc;
+        if (!global_map.empty())
+            global_map->GetDescriptors(map_point_ids, desc);
         
-        for (int i=0; i<local_map.size(); i++)
-        {            
-            kp.push_back(local_map.at(i).GetPoint2D());
-            local_map.at(i).GetDesc().copyTo(desc.row(i));
-        }
+        return desc;
     }
     
-    float KeyFrame::ComputeMedianDepth(void)
+    vector<MapPoint> KeyFrame::GetMap(void) const
     {
-        Mat R_t = R.row(2);
-        R_t = R_t.t();
+        vector<MapPoint> local_map;
+        if (global_map.empty())
+            return local_map;
         
-        float z_world = t.at<double>(2);
+        for (int i=0; i<map_point_ids.size(); i++)
+        {
+            MapPoint mp = global_map->GetMapPoint(map_point_ids[i]);
+            mp.SetPoint2D(point_obs[i]);
+            mp.SetOctave(point_octaves[i]);
+            local_map.push_back(mp);
+        }
         
-        vector<float> depths;
+        return local_map;
+    }
+    
+    void KeyFrame::GetKpDesc(PointArray &kp, Mat &desc) const
+    {
+        // Descriptors of this keyframe's own observations, which is what tracking matches:
+        kp = point_obs;
+        desc = point_desc;
+    }
+    
+    float KeyFrame::ComputeMedianDepth(void) const
+    {
+        shared_ptr<const vector<Point3f> > points_3D = GetPointCoords();
         
-        for (int i=0; i<local_map.size(); i++)
+        vector<float> depths(points_3D->size());
+        for (int i=0; i<points_3D->size(); i++)
         {
-            Mat point_3D = Mat(local_map.at(i).GetPoint3D());
-            point_3D.convertTo(point_3D, CV_64F);
-            
-            float z = R_t.dot(point_3D) + z_world;
-            
-            depths.push_back(z);
+            const Point3f& p = points_3D->at(i);
+            depths[i] = (float)pose.Depth(Vec3d(p.x, p.y, p.z));
         }
         
         sort(depths.begin(), depths.end());
@@ -90,14 +140,13 @@ namespace vslam {
         return depths[(depths.size()-1)/2];
     }
     
-    KeypointArray KeyFrame::GetTrackedKeypoints(void)
+    KeypointArray KeyFrame::GetTrackedKeypoints(void) const
     {
         KeypointArray kp_array;
         
-        for (int i=0; i<local_map.size(); i++)
+        for (int i=0; i<point_obs.size(); i++)
         {
-            MapPoint mp = local_map.at(i);
-            KeyPoint kp = KeyPoint(mp.GetPoint2D().x, mp.GetPoint2D().y, 1);
+            KeyPoint kp = KeyPoint(point_obs[i].x, point_obs[i].y, 1);
             kp_array.push_back(kp);
         }
         
@@ -4,49 +4,91 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
+#include <memory>
+#include <mutex>
+
 #include "Common.hpp"
 #include "MapPoint.hpp"
+#include "Map.hpp"
+#include "Pose.hpp"
 
 using namespace cv;
 using namespace std;
 
 namespace vslam {
     
+    // Positions of a keyframe's points gathered from the map, shared by all copies of the
+    // keyframe and refreshed when the map revision moves on:
+    struct KeyFramePointCache {
+        mutex cache_mutex;
+        int revision;
+        shared_ptr<const vector<Point3f> > coords;
+    };
+    
+    class KeyFrame;
+    
+    // Published keyframes are immutable and shared between tracking, mapping and BA:
+    typedef shared_ptr<const KeyFrame> KeyFramePtr;
+    
+    /*
+     Keyframes refer to map points by ID; coordinates and descriptors live in the global map.
+     point_kp_idx[i] is the keypoint in orb_kp at which point_ids[i] is observed.
+     
+     The per-point observation arrays (2D position, octave, packed descriptor rows) are built
+     once at construction and never change, so the getters hand out views rather than copies.
+     */
     class KeyFrame
     {
     public:
         KeyFrame();
-        KeyFrame(Mat& rot_mat, Mat& trans_mat, vector<MapPoint>& map, KeypointArray& total_kp, Mat& total_desc);
+        KeyFrame(int kf_id, const SE3& kf_pose, Ptr<Map> map, vector<int>& point_ids,
+                 vector<int>& point_kp_idx, KeypointArray& total_kp, Mat& total_desc);
         virtual ~KeyFrame() = default;
         
-        void SetRotation(Mat& rot) { R = rot.clone(); }
-        void SetTranslation(Mat& trans) { t = t.clone(); }
-        void SetLocalMap(vector<MapPoint>& map) { local_map = map; }
+        // Copy of this keyframe with a new pose; everything else is shared or copied as-is:
+        shared_ptr<const KeyFrame> WithPose(const SE3& new_pose) const;
+        
+        int GetId(void) const { return id; }
+        const SE3& GetPose(void) const { return pose; }
+        Mat GetRotation(void) const { return pose.GetRotationMat(); }
+        Mat GetTranslation(void) const { return pose.GetTranslationMat(); }
+        Mat GetDescriptors(void) const;
+        vector<Point3f> Get3DPoints(void) const;
+        vector<MapPoint> GetMap(void) const;
+        Ptr<Map> GetGlobalMap(void) const { return global_map; }
+        const vector<int>& GetPointIds(void) const { return map_point_ids; }
+        const vector<int>& GetPointKeypointIdx(void) const { return map_point_kp_idx; }
+        void GetKpDesc(PointArray& kp, Mat& desc) const;
+        vector<int> GetOctaves(void) const { return point_octaves; }
+        KeypointArray GetTrackedKeypoints(void) const;
+        const KeypointArray& GetTotalKeypoints(void) const { return orb_kp; }
+        const Mat& GetTotalDescriptors(void) const { return orb_desc; }
         
-        Mat GetRotation(void) { return R; }
-        Mat GetTranslation(void) { return t; }
-        Mat GetDescriptors(void);
-        vector<Point3f> Get3DPoints(void);
-        vector<MapPoint> GetMap(void) { return local_map; }
-        void GetKpDesc(PointArray& kp, Mat& desc);
-        KeypointArray GetTrackedKeypoints(void);
-        KeypointArray GetTotalKeypoints(void) { return orb_kp; }
-        Mat GetTotalDescriptors(void) { return orb_desc; }
-        int GetFrameCountSinceInsertion(void) { return insertion_frame_count; }
+        // Views for the tracking hot path; the position array is replaced, never modified, so
+        // a caller holding it is unaffected by a concurrent refresh:
+        shared_ptr<const vector<Point3f> > GetPointCoords(void) const;
+        const PointArray& GetPointObservations(void) const { return point_obs; }
+        const vector<int>& GetPointOctaves(void) const { return point_octaves; }
+        const Mat& GetPointDescriptors(void) const { return point_desc; }
         
-        void IncrementFrameCount(void) { insertion_frame_count++; }
-        float ComputeMedianDepth(void);
+        float ComputeMedianDepth(void) const;
         
     private:
         
     protected:
-        Mat R, t;
-        vector<MapPoint> local_map;
+        int id;
+        SE3 pose;
+        Ptr<Map> global_map;
+        vector<int> map_point_ids;
+        vector<int> map_point_kp_idx;
         KeypointArray orb_kp;
         Mat orb_desc;
         
-        int insertion_frame_count;
+        PointArray point_obs;
+        vector<int> point_octaves;
+        Mat point_desc;
+        shared_ptr<KeyFramePointCache> point_cache;
     };
 }
 
-#endif /* defined(__shield_slam__KeyFrame__) */
\ No newline at end of file
+#endif /* defined(__shield_slam__KeyFrame__) */
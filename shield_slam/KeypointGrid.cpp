@@ -0,0 +1,82 @@
+#include "KeypointGrid.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    KeypointGrid::KeypointGrid()
+    {
+        keypoints = NULL;
+        grid_cols = 0;
+        grid_rows = 0;
+    }
+    
+    KeypointGrid::KeypointGrid(const KeypointArray &keypoints, Size img_size)
+    {
+        Build(keypoints, img_size);
+    }
+    
+    void KeypointGrid::Build(const KeypointArray &kp, Size img_size)
+    {
+        keypoints = &kp;
+        
+        grid_cols = max(1, (img_size.width + KEYPOINT_GRID_CELL_SIZE - 1) / KEYPOINT_GRID_CELL_SIZE);
+        grid_rows = max(1, (img_size.height + KEYPOINT_GRID_CELL_SIZE - 1) / KEYPOINT_GRID_CELL_SIZE);
+        
+        cells.assign(grid_cols * grid_rows, vector<int>());
+        
+        for (int i=0; i<kp.size(); i++)
+        {
+            int cell_x = (int)floor(kp[i].pt.x / KEYPOINT_GRID_CELL_SIZE);
+            int cell_y = (int)floor(kp[i].pt.y / KEYPOINT_GRID_CELL_SIZE);
+            
+            if (cell_x < 0 || cell_x >= grid_cols || cell_y < 0 || cell_y >= grid_rows)
+                continue;
+            
+            cells[CellIndex(cell_x, cell_y)].push_back(i);
+        }
+    }
+    
+    void KeypointGrid::GetFeaturesInArea(float x, float y, float radius, int min_octave, int max_octave,
+                                         vector<int> &indices) const
+    {
+        indices.clear();
+        
+        if (IsEmpty())
+            return;
+        
+        const int min_cell_x = max(0, (int)floor((x - radius) / KEYPOINT_GRID_CELL_SIZE));
+        const int max_cell_x = min(grid_cols - 1, (int)floor((x + radius) / KEYPOINT_GRID_CELL_SIZE));
+        const int min_cell_y = max(0, (int)floor((y - radius) / KEYPOINT_GRID_CELL_SIZE));
+        const int max_cell_y = min(grid_rows - 1, (int)floor((y + radius) / KEYPOINT_GRID_CELL_SIZE));
+        
+        const float radius_sq = radius * radius;
+        
+        for (int cy=min_cell_y; cy<=max_cell_y; cy++)
+        {
+            for (int cx=min_cell_x; cx<=max_cell_x; cx++)
+            {
+                const vector<int>& cell = cells[CellIndex(cx, cy)];
+                
+                for (int i=0; i<cell.size(); i++)
+                {
+                    const KeyPoint& kp = (*keypoints)[cell[i]];
+                    
+                    if (kp.octave < min_octave || kp.octave > max_octave)
+                        continue;
+                    
+                    float dx = kp.pt.x - x;
+                    float dy = kp.pt.y - y;
+                    if (dx * dx + dy * dy > radius_sq)
+                        continue;
+                    
+                    indices.push_back(cell[i]);
+                }
+            }
+        }
+        
+        // Ascending order so ties resolve to the lower index, as in brute-force matching:
+        sort(indices.begin(), indices.end());
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef __shield_slam__KeypointGrid__
+#define __shield_slam__KeypointGrid__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "Common.hpp"
+
+// Side length (px) of the square bins keypoints are hashed into:
+#define KEYPOINT_GRID_CELL_SIZE 32
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    /*
+     Buckets a frame's keypoints into fixed-size image cells so that a radius query only
+     visits the cells overlapping the search window. Indices refer to the keypoint array
+     the grid was built from.
+     */
+    class KeypointGrid
+    {
+    public:
+        
+        KeypointGrid();
+        KeypointGrid(const KeypointArray& keypoints, Size img_size);
+        virtual ~KeypointGrid() = default;
+        
+        void Build(const KeypointArray& keypoints, Size img_size);
+        
+        // Keypoints within radius of (x, y) whose octave lies in [min_octave, max_octave]:
+        void GetFeaturesInArea(float x, float y, float radius, int min_octave, int max_octave,
+                               vector<int>& indices) const;
+        
+        bool IsEmpty(void) const { return keypoints == NULL || keypoints->empty(); }
+        
+    private:
+        
+        int CellIndex(int cell_x, int cell_y) const { return cell_y * grid_cols + cell_x; }
+        
+    protected:
+        const KeypointArray* keypoints;
+        
+        int grid_cols, grid_rows;
+        vector<vector<int> > cells;
+    };
+}
+
+#endif /* defined(__shield_slam__KeypointGrid__) */
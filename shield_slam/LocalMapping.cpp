@@ -0,0 +1,118 @@
+#include "LocalMapping.hpp"
+#include "Tracking.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    LocalMapping::LocalMapping()
+    {
+        stopping = false;
+        busy = false;
+        num_failed = 0;
+        
+        worker = thread(&LocalMapping::Run, this);
+    }
+    
+    LocalMapping::~LocalMapping()
+    {
+        Stop();
+    }
+    
+    void LocalMapping::Stop(void)
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_cond.notify_all();
+        
+        if (worker.joinable())
+            worker.join();
+    }
+    
+    bool LocalMapping::InsertRequest(const KeyFrameRequest &request)
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            
+            if (stopping || requests.size() >= LOCAL_MAPPING_QUEUE_SIZE)
+                return false;
+            
+            requests.push_back(request);
+        }
+        queue_cond.notify_one();
+        
+        return true;
+    }
+    
+    bool LocalMapping::AcceptsKeyFrames(void)
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            if (busy || !requests.empty())
+                return false;
+        }
+        
+        // A published keyframe that tracking has not fetched yet would make a new request stale:
+        lock_guard<mutex> lock(outbox_mutex);
+        return outbox.empty();
+    }
+    
+    int LocalMapping::FetchNewKeyFrames(vector<KeyFramePtr> &keyframes)
+    {
+        lock_guard<mutex> lock(outbox_mutex);
+        
+        int num_new = (int)outbox.size();
+        for (int i=0; i<outbox.size(); i++)
+        {
+            keyframes.push_back(outbox[i]);
+        }
+        outbox.clear();
+        
+        return num_new;
+    }
+    
+    int LocalMapping::GetNumFailed(void)
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        return num_failed;
+    }
+    
+    void LocalMapping::Run(void)
+    {
+        while (true)
+        {
+            KeyFrameRequest request;
+            
+            {
+                unique_lock<mutex> lock(queue_mutex);
+                queue_cond.wait(lock, [this] { return stopping || !requests.empty(); });
+                
+                if (stopping)
+                    return;
+                
+                request = requests.front();
+                requests.pop_front();
+                busy = true;
+            }
+            
+            KeyFramePtr kf = request.ref_kf;
+            bool created = Tracking::NewKeyFrame(kf, request.pose, request.ref_kp, request.tar_kp,
+                                                 request.ref_desc, request.tar_desc, request.matches,
+                                                 request.pnp_inliers, request.max_val);
+            
+            if (created)
+            {
+                lock_guard<mutex> lock(outbox_mutex);
+                outbox.push_back(kf);
+            }
+            
+            lock_guard<mutex> lock(queue_mutex);
+            busy = false;
+            if (!created)
+                num_failed++;
+        }
+    }
+}
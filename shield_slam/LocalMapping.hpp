@@ -0,0 +1,78 @@
+#ifndef __shield_slam__LocalMapping__
+#define __shield_slam__LocalMapping__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Common.hpp"
+#include "KeyFrame.hpp"
+
+// Pending keyframe requests; tracking drops new ones while the queue is full:
+#define LOCAL_MAPPING_QUEUE_SIZE 2
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    // Everything Tracking::NewKeyFrame needs, captured on the tracking thread:
+    struct KeyFrameRequest {
+        KeyFramePtr ref_kf;
+        SE3 pose;
+        KeypointArray ref_kp, tar_kp;
+        Mat ref_desc, tar_desc;
+        vector<DMatch> matches;
+        Mat pnp_inliers;
+        double max_val;
+    };
+    
+    /*
+     Keyframe creation on a dedicated thread. Tracking queues a request and keeps localizing
+     against the last published keyframe; the mapping thread matches, triangulates and builds
+     the new keyframe, then publishes it to an outbox that tracking drains between frames.
+     */
+    class LocalMapping
+    {
+    public:
+        
+        LocalMapping();
+        virtual ~LocalMapping();
+        
+        // False when the queue is full or the mapper is stopping:
+        bool InsertRequest(const KeyFrameRequest& request);
+        
+        // True when nothing is queued or in progress, i.e. a request would not be stale:
+        bool AcceptsKeyFrames(void);
+        
+        // Appends the keyframes published since the last call, returns how many:
+        int FetchNewKeyFrames(vector<KeyFramePtr>& keyframes);
+        
+        void Stop(void);
+        
+        int GetNumFailed(void);
+        
+    private:
+        
+        void Run(void);
+        
+    protected:
+        thread worker;
+        
+        mutex queue_mutex;
+        condition_variable queue_cond;
+        deque<KeyFrameRequest> requests;
+        bool stopping;
+        bool busy;
+        int num_failed;
+        
+        mutex outbox_mutex;
+        vector<KeyFramePtr> outbox;
+    };
+}
+
+#endif /* defined(__shield_slam__LocalMapping__) */
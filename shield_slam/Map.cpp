@@ -0,0 +1,155 @@
+#include "Map.hpp"
+
+#include <cstring>
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    Map::Map()
+    {
+        num_points = 0;
+        positions.reserve(MAP_INITIAL_CAPACITY);
+        descriptors = Mat::zeros(MAP_INITIAL_CAPACITY, ORB_DESC_BYTES, CV_8U);
+        observations.reserve(MAP_INITIAL_CAPACITY);
+        
+        next_kf_id = 0;
+        revision = 0;
+    }
+    
+    int Map::AddMapPoint(const Point3f &coord, const Mat &desc)
+    {
+        if (desc.rows != 1 || desc.cols != ORB_DESC_BYTES || desc.type() != CV_8U)
+        {
+            CV_Error(0, "Map: expected a single 32-byte CV_8U descriptor");
+        }
+        
+        lock_guard<mutex> lock(map_mutex);
+        
+        // Grow into a fresh block; views of the old one keep it alive:
+        if (num_points == descriptors.rows)
+        {
+            Mat grown = Mat::zeros(2 * descriptors.rows, ORB_DESC_BYTES, CV_8U);
+            descriptors.copyTo(grown.rowRange(0, descriptors.rows));
+            descriptors = grown;
+        }
+        
+        desc.copyTo(descriptors.row(num_points));
+        positions.push_back(coord);
+        observations.push_back(vector<MapPointObservation>());
+        
+        return num_points++;
+    }
+    
+    void Map::AddObservation(int point_id, int kf_id, int kp_idx)
+    {
+        lock_guard<mutex> lock(map_mutex);
+        
+        MapPointObservation obs = { kf_id, kp_idx };
+        observations.at(point_id).push_back(obs);
+    }
+    
+    int Map::NextKeyFrameId(void)
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return next_kf_id++;
+    }
+    
+    MapPoint Map::GetMapPoint(int point_id) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        
+        MapPoint mp;
+        mp.SetId(point_id);
+        mp.SetPoint3D(positions.at(point_id));
+        
+        Mat desc = descriptors.row(point_id);
+        mp.SetDesc(desc);
+        
+        for (int i=0; i<observations[point_id].size(); i++)
+        {
+            mp.AddObservation(observations[point_id][i].kf_id, observations[point_id][i].kp_idx);
+        }
+        
+        return mp;
+    }
+    
+    Point3f Map::GetPoint3D(int point_id) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return positions.at(point_id);
+    }
+    
+    void Map::SetPoint3D(int point_id, const Point3f &coord)
+    {
+        lock_guard<mutex> lock(map_mutex);
+        positions.at(point_id) = coord;
+        revision++;
+    }
+    
+    void Map::SetPoints3D(const vector<int> &point_ids, const vector<Point3f> &coords)
+    {
+        lock_guard<mutex> lock(map_mutex);
+        
+        for (int i=0; i<point_ids.size(); i++)
+        {
+            positions.at(point_ids[i]) = coords[i];
+        }
+        revision++;
+    }
+    
+    vector<MapPointObservation> Map::GetObservations(int point_id) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return observations.at(point_id);
+    }
+    
+    vector<Point3f> Map::GetPoints3D(const vector<int> &point_ids) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        
+        vector<Point3f> coords(point_ids.size());
+        for (int i=0; i<point_ids.size(); i++)
+        {
+            coords[i] = positions.at(point_ids[i]);
+        }
+        
+        return coords;
+    }
+    
+    void Map::GetDescriptors(const vector<int> &point_ids, Mat &desc) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        
+        desc.create((int)point_ids.size(), ORB_DESC_BYTES, CV_8U);
+        for (int i=0; i<point_ids.size(); i++)
+        {
+            memcpy(desc.ptr<uchar>(i), descriptors.ptr<uchar>(point_ids[i]), ORB_DESC_BYTES);
+        }
+    }
+    
+    vector<Point3f> Map::GetAllPoints3D(void) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return positions;
+    }
+    
+    Mat Map::GetAllDescriptors(void) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return descriptors.rowRange(0, num_points);
+    }
+    
+    int Map::GetNumPoints(void) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return num_points;
+    }
+    
+    int Map::GetRevision(void) const
+    {
+        lock_guard<mutex> lock(map_mutex);
+        return revision;
+    }
+}
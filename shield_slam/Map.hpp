@@ -0,0 +1,74 @@
+#ifndef __shield_slam__Map__
+#define __shield_slam__Map__
+
+#include <opencv2/opencv.hpp>
+
+#include <mutex>
+
+#include "Common.hpp"
+#include "MapPoint.hpp"
+
+#define MAP_INITIAL_CAPACITY 1024
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    /*
+     Global store of map points. Every physical point is stored once, with one descriptor and
+     the list of (keyframe, keypoint) observations; keyframes refer to points by ID. IDs are
+     indices into the store and stay valid for the lifetime of the map.
+     
+     Storage is structure-of-arrays: positions are packed xyz floats and descriptors are rows
+     of one contiguous 32-byte-per-row block that grows by doubling. Descriptors never change
+     once added, so views into the block stay valid across growth. Positions do change; every
+     SetPoint3D bumps the revision so cached copies know to refresh.
+     
+     Tracking, local mapping and bundle adjustment run on different threads, so every access
+     goes through the map mutex.
+     */
+    class Map
+    {
+    public:
+        
+        Map();
+        virtual ~Map() = default;
+        
+        int AddMapPoint(const Point3f& coord, const Mat& desc);
+        void AddObservation(int point_id, int kf_id, int kp_idx);
+        int NextKeyFrameId(void);
+        
+        MapPoint GetMapPoint(int point_id) const;
+        Point3f GetPoint3D(int point_id) const;
+        void SetPoint3D(int point_id, const Point3f& coord);
+        void SetPoints3D(const vector<int>& point_ids, const vector<Point3f>& coords);
+        vector<MapPointObservation> GetObservations(int point_id) const;
+        
+        // Batched lookups under a single lock:
+        vector<Point3f> GetPoints3D(const vector<int>& point_ids) const;
+        void GetDescriptors(const vector<int>& point_ids, Mat& desc) const;
+        vector<Point3f> GetAllPoints3D(void) const;
+        
+        // View of the descriptor block, one row per point ID:
+        Mat GetAllDescriptors(void) const;
+        
+        int GetNumPoints(void) const;
+        int GetRevision(void) const;
+        
+    private:
+        
+    protected:
+        mutable mutex map_mutex;
+        
+        int num_points;
+        vector<Point3f> positions;
+        Mat descriptors;
+        vector<vector<MapPointObservation> > observations;
+        
+        int next_kf_id;
+        int revision;
+    };
+}
+
+#endif /* defined(__shield_slam__Map__) */
@@ -10,10 +10,21 @@ using namespace std;
 
 namespace vslam {
     
+    // A keyframe that sees the point, and the index of the keypoint it is seen at:
+    struct MapPointObservation {
+        int kf_id;
+        int kp_idx;
+    };
+    
     class MapPoint
     {
         
     public:
+        MapPoint() : id(-1), octave(0) {}
+        
+        void SetId(int point_id) { id = point_id; }
+        int GetId(void) { return id; }
+        
         void SetPoint3D(Point3f coord) { point_3D = coord; }
         Point3f GetPoint3D(void) { return point_3D; }
         
@@ -23,12 +34,26 @@ namespace vslam {
         void SetDesc(Mat& desc) { descriptor = desc.clone(); }
         Mat GetDesc(void) { return descriptor; }
         
+        // Pyramid level the point was observed at in its keyframe:
+        void SetOctave(int level) { octave = level; }
+        int GetOctave(void) { return octave; }
+        
+        void AddObservation(int kf_id, int kp_idx)
+        {
+            MapPointObservation obs = { kf_id, kp_idx };
+            observations.push_back(obs);
+        }
+        const vector<MapPointObservation>& GetObservations(void) { return observations; }
+        
     private:
         
     protected:
+        int id;
         Point2f point_2D;
         Point3f point_3D;
         Mat descriptor;
+        int octave;
+        vector<MapPointObservation> observations;
         
     };
 }
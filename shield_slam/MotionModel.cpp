@@ -0,0 +1,61 @@
+#include "MotionModel.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    MotionModel::MotionModel()
+    {
+        Reset();
+    }
+    
+    void MotionModel::Reset(void)
+    {
+        last_pose = SE3();
+        last_timestamp = 0.0;
+        has_pose = false;
+        
+        angular_rate = Vec3d(0.0, 0.0, 0.0);
+        linear_rate = Vec3d(0.0, 0.0, 0.0);
+        has_velocity = false;
+    }
+    
+    void MotionModel::Update(const SE3 &pose, double timestamp)
+    {
+        double dt = timestamp - last_timestamp;
+        
+        if (has_pose && dt > 0.0 && dt <= MOTION_MODEL_MAX_GAP)
+        {
+            // T_delta = T_curr * T_last^-1:
+            SE3 delta = pose * last_pose.Inverse();
+            
+            angular_rate = SE3::LogSO3(delta.GetRotation()) * (1.0 / dt);
+            linear_rate = delta.GetTranslation() * (1.0 / dt);
+            has_velocity = true;
+        }
+        else
+        {
+            has_velocity = false;
+        }
+        
+        last_pose = pose;
+        last_timestamp = timestamp;
+        has_pose = true;
+    }
+    
+    bool MotionModel::Predict(double timestamp, SE3 &pose_pred) const
+    {
+        if (!has_pose || !has_velocity)
+            return false;
+        
+        double dt = timestamp - last_timestamp;
+        if (dt <= 0.0 || dt > MOTION_MODEL_MAX_GAP)
+            return false;
+        
+        SE3 delta(SE3::ExpSO3(angular_rate * dt), linear_rate * dt);
+        pose_pred = delta * last_pose;
+        
+        return true;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __shield_slam__MotionModel__
+#define __shield_slam__MotionModel__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+#include "Pose.hpp"
+
+// No prediction across gaps longer than this (seconds), e.g. after dropped frames:
+#define MOTION_MODEL_MAX_GAP 0.5
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    /*
+     Constant-velocity pose predictor. Poses are world-to-camera, as returned by
+     Tracking::TrackMap. The relative motion between the last two tracked frames is stored
+     as an angular and a linear rate, and extrapolated to the timestamp of the next frame.
+     */
+    class MotionModel
+    {
+    public:
+        
+        MotionModel();
+        virtual ~MotionModel() = default;
+        
+        void Update(const SE3& pose, double timestamp);
+        void Reset(void);
+        
+        // Returns false when there is no velocity estimate or the frame gap is too long:
+        bool Predict(double timestamp, SE3& pose_pred) const;
+        
+        bool HasVelocity(void) const { return has_velocity; }
+        double GetLastTimestamp(void) const { return last_timestamp; }
+        
+    private:
+        
+    protected:
+        SE3 last_pose;
+        double last_timestamp;
+        bool has_pose;
+        
+        // Rotation (axis-angle, rad/s) and translation (units/s) of the camera-frame delta:
+        Vec3d angular_rate, linear_rate;
+        bool has_velocity;
+    };
+}
+
+#endif /* defined(__shield_slam__MotionModel__) */
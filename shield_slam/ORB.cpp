@@ -1,5 +1,7 @@
 #include <opencv2/features2d/features2d.hpp>
 
+#include <climits>
+
 #include "ORB.hpp"
 
 using namespace cv;
@@ -9,20 +11,18 @@ namespace vslam {
     
     ORB::ORB(int n_features, bool use_gpu)
     {
-        detector = Ptr<FeatureDetector>(
-                                        new GridAdaptedFeatureDetector(
-                                                                       new cv::ORB(n_features, 1.2f, 8, 31, 0, 4, cv::ORB::HARRIS_SCORE, 31), n_features, GRID_CELL_ROWS, GRID_CELL_COLS));
-        
-        extractor = DescriptorExtractor::create("ORB");
-        matcher = Ptr<BFMatcher>(new BFMatcher(NORM_HAMMING2, false));
+        extractor = Ptr<OrbExtractor>(new OrbExtractor(n_features, ORB_SCALE_FACTOR, ORB_NUM_LEVELS));
+        extractor->SetExtractionMode(OrbExtractor::EXTRACT_TILED, GRID_CELL_ROWS, GRID_CELL_COLS);
+        extractor->SetDistributionStrategy(OrbExtractor::DISTRIBUTE_QUADTREE);
+        matcher = Ptr<HammingMatcher>(new HammingMatcher(NORM_HAMMING2));
         
         // TODO: GPU Implementation
     }
     
     void ORB::ExtractFeatures(cv::Mat &img, KeypointArray &img_keypoints, cv::Mat &img_desc)
     {
-        detector->detect(img, img_keypoints);
-        extractor->compute(img, img_keypoints, img_desc);
+        // Single pyramid for detection and description:
+        extractor->Extract(img, img_keypoints, img_desc);
     }
     
     
@@ -36,39 +36,20 @@ namespace vslam {
             CV_Error(0, "ORB::ExtractFeatures descriptors are empty");
         }
         
-        // Brute-Force Matching:
-        vector<vector<DMatch> > bf_matches_, good_matches_;
-        matcher->knnMatch(desc_ref, desc_tar, bf_matches_, 2);
+        // Brute-Force Matching (ratio test applied inside the matcher):
+        matcher->KnnRatioMatch(desc_ref, desc_tar, matches, use_ratio_test,
+                               KNN_RATIO_INIT_THRESHOLD, MATCH_MAX_DISTANCE_INIT);
         
-        matches.clear();
         ref_matches.clear();
         tar_matches.clear();
         
-        vector<Mat> kp_desc;
-        for (int i=0; i<bf_matches_.size(); i++)
-        {
-            if (use_ratio_test)
-            {
-                if (bf_matches_[i][0].distance / bf_matches_[i][1].distance < KNN_RATIO_INIT_THRESHOLD)
-                {
-                    matches.push_back(bf_matches_[i][0]);
-                    
-                    ref_matches.push_back(ref_keypoints[bf_matches_[i][0].queryIdx].pt);
-                    tar_matches.push_back(tar_keypoints[bf_matches_[i][0].trainIdx].pt);
-                    
-                    kp_desc.push_back(desc_tar.row(bf_matches_[i][0].trainIdx));
-                }
-            }
-            else
-            {
-                matches.push_back(bf_matches_[i][0]);
-            }
-        }
-        
-        matched_tar_desc = Mat::zeros((int)kp_desc.size(), kp_desc.at(0).cols, CV_8U);
-        for (int i=0; i<kp_desc.size(); i++)
+        matched_tar_desc.create((int)matches.size(), desc_tar.cols, desc_tar.type());
+        for (int i=0; i<matches.size(); i++)
         {
-            kp_desc.at(i).copyTo(matched_tar_desc.row(i));
+            ref_matches.push_back(ref_keypoints[matches[i].queryIdx].pt);
+            tar_matches.push_back(tar_keypoints[matches[i].trainIdx].pt);
+            
+            desc_tar.row(matches[i].trainIdx).copyTo(matched_tar_desc.row(i));
         }
     }
     
@@ -79,27 +60,103 @@ namespace vslam {
             CV_Error(0, "ORB::ExtractFeatures descriptors are empty");
         }
         
-        // Brute-Force Matching:
-        vector<vector<DMatch> > bf_matches_;
-        matcher->knnMatch(desc_ref, desc_tar, bf_matches_, 2);
-        
+        // Brute-Force Matching (ratio test applied inside the matcher):
+        matcher->KnnRatioMatch(desc_ref, desc_tar, matches, use_ratio_test,
+                               KNN_RATIO_TRACKING_THRESHOLD, MATCH_MAX_DISTANCE_TRACKING);
+    }
+    
+    void ORB::MatchByProjection(const vector<Point3f> &points_3D, const Mat &points_desc,
+                                const vector<int> &points_octave, const SE3 &pose,
+                                const KeypointArray &tar_keypoints, const KeypointGrid &tar_grid,
+                                const Mat &tar_desc, vector<DMatch> &matches, float radius)
+    {
         matches.clear();
         
-        for (int i=0; i<bf_matches_.size(); i++)
+        if (points_3D.empty() || tar_keypoints.empty())
+            return;
+        
+        // Keep the points in front of the predicted camera:
+        vector<int> visible_idx;
+        vector<Point3f> visible_points;
+        for (int i=0; i<points_3D.size(); i++)
+        {
+            const Point3f& p = points_3D[i];
+            if (pose.Depth(Vec3d(p.x, p.y, p.z)) <= 0.0)
+                continue;
+            
+            visible_idx.push_back(i);
+            visible_points.push_back(p);
+        }
+        
+        if (visible_points.empty())
+            return;
+        
+        Mat rvec = Mat(SE3::LogSO3(pose.GetRotation()));
+        Mat tvec = Mat(pose.GetTranslation());
+        
+        PointArray projected;
+        projectPoints(visible_points, rvec, tvec, camera_matrix, dist_coeff, projected);
+        
+        // Every target keypoint goes to the closest map point that claims it:
+        vector<int> train_owner(tar_keypoints.size(), -1);
+        vector<int> train_dist(tar_keypoints.size(), INT_MAX);
+        
+        const int max_level = extractor->GetNumLevels() - 1;
+        const float scale_factor = extractor->GetScaleFactor();
+        
+        vector<int> candidates;
+        for (int i=0; i<visible_idx.size(); i++)
         {
-            if (use_ratio_test)
-            {                
-                if (bf_matches_[i][0].distance / bf_matches_[i][1].distance < KNN_RATIO_TRACKING_THRESHOLD)
+            const int point_idx = visible_idx[i];
+            const int octave = points_octave[point_idx];
+            const float level_radius = radius * pow(scale_factor, octave);
+            
+            tar_grid.GetFeaturesInArea(projected[i].x, projected[i].y, level_radius,
+                                       max(0, octave - 1), min(max_level, octave + 1), candidates);
+            
+            int best_dist = INT_MAX, second_dist = INT_MAX, best_idx = -1;
+            const uchar* query = points_desc.ptr<uchar>(point_idx);
+            
+            for (int k=0; k<candidates.size(); k++)
+            {
+                int dist = matcher->Distance(query, tar_desc.ptr<uchar>(candidates[k]));
+                
+                if (dist < best_dist)
+                {
+                    second_dist = best_dist;
+                    best_dist = dist;
+                    best_idx = candidates[k];
+                }
+                else if (dist < second_dist)
                 {
-                    matches.push_back(bf_matches_[i][0]);
+                    second_dist = dist;
                 }
             }
-            else
+            
+            if (best_idx < 0 || best_dist > GUIDED_MATCH_MAX_DISTANCE)
+                continue;
+            
+            if (second_dist != INT_MAX && !((float)best_dist < GUIDED_MATCH_RATIO * (float)second_dist))
+                continue;
+            
+            if (best_dist < train_dist[best_idx])
             {
-                matches.push_back(bf_matches_[i][0]);
+                train_owner[best_idx] = point_idx;
+                train_dist[best_idx] = best_dist;
             }
         }
-
+        
+        // Report in map point order, like the brute-force matcher:
+        for (int i=0; i<train_owner.size(); i++)
+        {
+            if (train_owner[i] >= 0)
+                matches.push_back(DMatch(train_owner[i], i, 0, (float)train_dist[i]));
+        }
+        
+        sort(matches.begin(), matches.end(), [](const DMatch& a, const DMatch& b)
+        {
+            return a.queryIdx < b.queryIdx;
+        });
     }
     
     void ORB::DetectAndMatch(Mat &img_ref, Mat &img_tar, vector<cv::DMatch> &matches,
@@ -111,15 +168,6 @@ namespace vslam {
         ExtractFeatures(img_tar, tar_keypoints, tar_desc);
         
         MatchFeatures(ref_desc, tar_desc, matches, ref_keypoints, tar_keypoints, ref_matches, tar_matches, matched_tar_desc);
-        
-        // Debug:
-        cout << "Number of matches " << matches.size() << endl;
-        Mat debug_draw_img;
-        drawMatches(img_ref, ref_keypoints, img_tar, tar_keypoints, matches, debug_draw_img);
-        
-        imshow("init orb matches", debug_draw_img);
-        waitKey(0);
-        //------
     }
     
     
@@ -5,13 +5,31 @@
 #include <opencv2/features2d/features2d.hpp>
 
 #include "Common.hpp"
+#include "HammingMatcher.hpp"
+#include "OrbExtractor.hpp"
+#include "KeypointGrid.hpp"
+#include "Pose.hpp"
 
-#define GRID_CELL_ROWS 1
-#define GRID_CELL_COLS 1
+// Cells per pyramid level for tiled extraction:
+#define GRID_CELL_ROWS 4
+#define GRID_CELL_COLS 4
+
+#define ORB_SCALE_FACTOR 1.2
+#define ORB_NUM_LEVELS 8
 
 #define KNN_RATIO_INIT_THRESHOLD 0.7
 #define KNN_RATIO_TRACKING_THRESHOLD 0.75
 
+// Hamming distance cutoffs for accepted matches (256 disables the cutoff):
+#define MATCH_MAX_DISTANCE_INIT 256
+#define MATCH_MAX_DISTANCE_TRACKING 256
+
+// Guided matching: search radius (px) at octave 0, grown by the scale factor per octave,
+// plus the distance cutoff (NORM_HAMMING2, max 128) and ratio test inside the window:
+#define GUIDED_MATCH_RADIUS 15.0f
+#define GUIDED_MATCH_MAX_DISTANCE 50
+#define GUIDED_MATCH_RATIO 0.8f
+
 using namespace cv;
 using namespace std;
 
@@ -26,6 +44,13 @@ namespace vslam {
         virtual ~ORB() = default;
         
         void ExtractFeatures (Mat& img, KeypointArray& img_keypoints, Mat& img_desc);
+        const vector<double>& GetOctaveTimings(void) const { return extractor->GetOctaveTimings(); }
+        double GetDescriptorThroughput(void) const { return extractor->GetDescriptorThroughput(); }
+        
+        void SetDistributionStrategy(OrbExtractor::DistributionStrategy strategy)
+        {
+            extractor->SetDistributionStrategy(strategy);
+        }
         
         void MatchFeatures (Mat& desc_ref, Mat& desc_tar, vector<DMatch>& matches,
                             KeypointArray& ref_keypoints, KeypointArray& tar_keypoints,
@@ -34,6 +59,15 @@ namespace vslam {
         void MatchFeatures (Mat& desc_ref, Mat& desc_tar, vector<DMatch>& matches,
                             bool use_ratio_test = true);
         
+        // Projects map points with the predicted pose and compares each descriptor only
+        // against target keypoints near the projection and within one octave of the point.
+        // queryIdx indexes the map points, trainIdx the target keypoints.
+        void MatchByProjection (const vector<Point3f>& points_3D, const Mat& points_desc,
+                                const vector<int>& points_octave, const SE3& pose,
+                                const KeypointArray& tar_keypoints, const KeypointGrid& tar_grid,
+                                const Mat& tar_desc, vector<DMatch>& matches,
+                                float radius = GUIDED_MATCH_RADIUS);
+        
         void DetectAndMatch (Mat& img_ref, Mat& img_tar, vector<DMatch>& matches,
                              PointArray& ref_matches, PointArray& tar_matches, Mat& matched_tar_desc,
                              KeypointArray &ref_keypoints, KeypointArray &tar_keypoints,
@@ -41,9 +75,8 @@ namespace vslam {
         
     private:
         
-        Ptr<FeatureDetector> detector;
-        Ptr<DescriptorExtractor> extractor;
-        Ptr<DescriptorMatcher> matcher;
+        Ptr<OrbExtractor> extractor;
+        Ptr<HammingMatcher> matcher;
     
     };
 }
@@ -1,15 +1,611 @@
 #include "Optimizer.hpp"
+#include "ORB.hpp"
+#include "Undistorter.hpp"
 
 using namespace cv;
+using namespace std;
 
 namespace vslam
 {
-    void Optimizer::BundleAdjust(vector<vslam::KeyFrame> &keyframes)
+    int Optimizer::OptimizePose(const vector<Point3f> &object_points, const vector<Point2f> &image_points,
+                                const vector<float> &sigma2, SE3 &pose, vector<bool> &inliers)
     {
-        LevMarqSparse lms;
+        const int n = (int)object_points.size();
+        inliers.assign(n, true);
         
+        if (n < POSE_OPT_MIN_POINTS)
+            return n;
         
+        const double fx = camera_matrix.at<double>(0, 0);
+        const double fy = camera_matrix.at<double>(1, 1);
+        const double cx = camera_matrix.at<double>(0, 2);
+        const double cy = camera_matrix.at<double>(1, 2);
         
+        Matx33d R_opt = pose.GetRotation();
+        Vec3d t_opt = pose.GetTranslation();
+        
+        int num_inliers = n;
+        
+        for (int round=0; round<POSE_OPT_ROUNDS; round++)
+        {
+            // The last round is plain least squares on the surviving inliers:
+            const bool use_huber = (round < POSE_OPT_ROUNDS - 1);
+            
+            for (int iter=0; iter<POSE_OPT_ITERATIONS; iter++)
+            {
+                // Upper triangle of J^T W J and J^T W e, update order (w, tau):
+                double H[21] = {0.0};
+                double g[6] = {0.0};
+                int num_used = 0;
+                
+                for (int i=0; i<n; i++)
+                {
+                    if (!inliers[i])
+                        continue;
+                    
+                    const Point3f& P = object_points[i];
+                    const double x = R_opt(0, 0) * P.x + R_opt(0, 1) * P.y + R_opt(0, 2) * P.z + t_opt[0];
+                    const double y = R_opt(1, 0) * P.x + R_opt(1, 1) * P.y + R_opt(1, 2) * P.z + t_opt[1];
+                    const double z = R_opt(2, 0) * P.x + R_opt(2, 1) * P.y + R_opt(2, 2) * P.z + t_opt[2];
+                    
+                    if (z <= 0.0)
+                        continue;
+                    
+                    const double inv_z = 1.0 / z;
+                    const double xz = x * inv_z, yz = y * inv_z;
+                    const double eu = fx * xz + cx - image_points[i].x;
+                    const double ev = fy * yz + cy - image_points[i].y;
+                    
+                    const double inv_sigma2 = 1.0 / sigma2[i];
+                    double w = inv_sigma2;
+                    
+                    if (use_huber)
+                    {
+                        double e = sqrt((eu * eu + ev * ev) * inv_sigma2);
+                        if (e > POSE_OPT_HUBER_DELTA)
+                            w *= POSE_OPT_HUBER_DELTA / e;
+                    }
+                    
+                    // d(u, v) / d(w, tau) for the update exp(w) * X_c + tau:
+                    const double ju[6] = { -fx * xz * yz, fx * (1.0 + xz * xz), -fx * yz,
+                                           fx * inv_z, 0.0, -fx * xz * inv_z };
+                    const double jv[6] = { -fy * (1.0 + yz * yz), fy * xz * yz, fy * xz,
+                                           0.0, fy * inv_z, -fy * yz * inv_z };
+                    
+                    int k = 0;
+                    for (int r=0; r<6; r++)
+                    {
+                        const double wju = w * ju[r], wjv = w * jv[r];
+                        for (int c=r; c<6; c++)
+                            H[k++] += wju * ju[c] + wjv * jv[c];
+                        
+                        g[r] += wju * eu + wjv * ev;
+                    }
+                    
+                    num_used++;
+                }
+                
+                if (num_used < POSE_OPT_MIN_POINTS)
+                    break;
+                
+                Matx66d H_full;
+                Matx61d rhs;
+                int k = 0;
+                for (int r=0; r<6; r++)
+                {
+                    for (int c=r; c<6; c++)
+                    {
+                        H_full(r, c) = H[k];
+                        H_full(c, r) = H[k];
+                        k++;
+                    }
+                    
+                    rhs(r) = -g[r];
+                }
+                
+                Matx61d delta = H_full.solve(rhs, DECOMP_CHOLESKY);
+                
+                Matx33d dR = SE3::ExpSO3(Vec3d(delta(0), delta(1), delta(2)));
+                R_opt = dR * R_opt;
+                t_opt = dR * t_opt + Vec3d(delta(3), delta(4), delta(5));
+                
+                if (delta.dot(delta) < POSE_OPT_EPSILON)
+                    break;
+            }
+            
+            // Reclassify every observation, so earlier outliers can come back:
+            num_inliers = 0;
+            bool changed = false;
+            for (int i=0; i<n; i++)
+            {
+                const Point3f& P = object_points[i];
+                Vec3d X_c = R_opt * Vec3d(P.x, P.y, P.z) + t_opt;
+                
+                bool is_inlier = false;
+                if (X_c[2] > 0.0)
+                {
+                    double eu = fx * X_c[0] / X_c[2] + cx - image_points[i].x;
+                    double ev = fy * X_c[1] / X_c[2] + cy - image_points[i].y;
+                    is_inlier = (eu * eu + ev * ev) / sigma2[i] < POSE_OPT_CHI2_TH;
+                }
+                
+                changed |= (inliers[i] != is_inlier);
+                inliers[i] = is_inlier;
+                num_inliers += is_inlier;
+            }
+            
+            // Converged once a round leaves the inlier set as it was:
+            if (num_inliers < POSE_OPT_MIN_POINTS || (round > 0 && !changed))
+                break;
+        }
+        
+        pose = SE3(R_opt, t_opt);
+        
+        return num_inliers;
+    }
+    
+    typedef Matx<double, 6, 3> Matx63d;
+    
+    struct BAObservation {
+        int cam;
+        int point;
+        double u, v;
+        double inv_sigma2;
+    };
+    
+    // Keyframe window and its map points; points are indexed by global map ID, so every
+    // keyframe observing one point shares its index:
+    struct LocalBAProblem {
+        vector<int> kf_indices;
+        int num_fixed;
+        vector<SE3> poses;
+        
+        Ptr<Map> global_map;
+        vector<int> point_ids;
+        vector<Vec3d> points;
+        vector<bool> point_fixed;
+        
+        vector<BAObservation> obs;
+        vector<vector<int> > point_obs;
+        
+        BundleAdjustStats stats;
+    };
+    
+    static inline double HuberCost(double chi2)
+    {
+        const double delta2 = POSE_OPT_HUBER_DELTA * POSE_OPT_HUBER_DELTA;
+        return chi2 <= delta2 ? chi2 : 2.0 * POSE_OPT_HUBER_DELTA * sqrt(chi2) - delta2;
+    }
+    
+    static bool BuildLocalProblem(const vector<KeyFramePtr>& keyframes, LocalBAProblem& problem)
+    {
+        const int window_start = max(0, (int)keyframes.size() - BA_WINDOW_SIZE);
+        const int num_cams = (int)keyframes.size() - window_start;
+        
+        problem.num_fixed = min(BA_FIXED_KEYFRAMES, num_cams);
+        if (num_cams - problem.num_fixed < 1)
+            return false;
+        
+        map<int, int> point_index;
+        
+        for (int c=0; c<num_cams; c++)
+        {
+            const KeyFramePtr& kf = keyframes[window_start + c];
+            problem.kf_indices.push_back(window_start + c);
+            
+            problem.poses.push_back(kf->GetPose());
+            
+            const vector<int>& point_ids = kf->GetPointIds();
+            if (point_ids.empty() || kf->GetGlobalMap().empty())
+                continue;
+            
+            problem.global_map = kf->GetGlobalMap();
+            
+            const vector<int>& octaves = kf->GetPointOctaves();
+            
+            PointArray undistorted;
+            Undistorter::Shared().UndistortPixels(kf->GetPointObservations(), undistorted);
+            
+            shared_ptr<const vector<Point3f> > kf_coords = kf->GetPointCoords();
+            const vector<Point3f>& coords = *kf_coords;
+            
+            for (int i=0; i<point_ids.size(); i++)
+            {
+                int p;
+                map<int, int>::iterator it = point_index.find(point_ids[i]);
+                if (it == point_index.end())
+                {
+                    p = (int)problem.points.size();
+                    point_index[point_ids[i]] = p;
+                    problem.point_ids.push_back(point_ids[i]);
+                    problem.points.push_back(Vec3d(coords[i].x, coords[i].y, coords[i].z));
+                }
+                else
+                {
+                    p = it->second;
+                }
+                
+                double level_scale = pow(ORB_SCALE_FACTOR, octaves[i]);
+                
+                BAObservation ob;
+                ob.cam = c;
+                ob.point = p;
+                ob.u = undistorted[i].x;
+                ob.v = undistorted[i].y;
+                ob.inv_sigma2 = 1.0 / (level_scale * level_scale);
+                problem.obs.push_back(ob);
+            }
+        }
+        
+        // A single view does not constrain a point's depth; such points only anchor cameras:
+        problem.point_obs.assign(problem.points.size(), vector<int>());
+        for (int o=0; o<problem.obs.size(); o++)
+            problem.point_obs[problem.obs[o].point].push_back(o);
+        
+        problem.point_fixed.assign(problem.points.size(), true);
+        for (int p=0; p<problem.points.size(); p++)
+            problem.point_fixed[p] = (problem.point_obs[p].size() < 2);
+        
+        problem.stats.num_keyframes = num_cams;
+        problem.stats.num_points = (int)problem.points.size();
+        problem.stats.num_observations = (int)problem.obs.size();
+        
+        return !problem.obs.empty();
+    }
+    
+    static double LocalProblemCost(const LocalBAProblem& problem, const vector<SE3>& poses,
+                                   const vector<Vec3d>& points)
+    {
+        const double fx = camera_matrix.at<double>(0, 0);
+        const double fy = camera_matrix.at<double>(1, 1);
+        const double cx = camera_matrix.at<double>(0, 2);
+        const double cy = camera_matrix.at<double>(1, 2);
+        
+        double cost = 0.0;
+        for (int o=0; o<problem.obs.size(); o++)
+        {
+            const BAObservation& ob = problem.obs[o];
+            Vec3d X_c = poses[ob.cam] * points[ob.point];
+            if (X_c[2] <= 0.0)
+                continue;
+            
+            double eu = fx * X_c[0] / X_c[2] + cx - ob.u;
+            double ev = fy * X_c[1] / X_c[2] + cy - ob.v;
+            cost += HuberCost((eu * eu + ev * ev) * ob.inv_sigma2);
+        }
+        
+        return cost;
+    }
+    
+    static void SolveLocalProblem(LocalBAProblem& problem)
+    {
+        int64 start = getTickCount();
+        
+        const double fx = camera_matrix.at<double>(0, 0);
+        const double fy = camera_matrix.at<double>(1, 1);
+        const double cx = camera_matrix.at<double>(0, 2);
+        const double cy = camera_matrix.at<double>(1, 2);
+        
+        const int num_cams = (int)problem.poses.size();
+        const int num_free = num_cams - problem.num_fixed;
+        const int num_points = (int)problem.points.size();
+        
+        double lambda = BA_INITIAL_LAMBDA;
+        double cost = LocalProblemCost(problem, problem.poses, problem.points);
+        
+        problem.stats.iteration_cost.clear();
+        problem.stats.iteration_ms.clear();
+        
+        for (int iter=0; iter<BA_MAX_ITERATIONS; iter++)
+        {
+            int64 iter_start = getTickCount();
+            
+            vector<Matx66d> U(num_free, Matx66d::zeros());
+            vector<Matx61d> g_cam(num_free, Matx61d::zeros());
+            vector<Matx33d> V(num_points, Matx33d::zeros());
+            vector<Matx31d> g_point(num_points, Matx31d::zeros());
+            vector<Matx63d> W(problem.obs.size(), Matx63d::zeros());
+            
+            for (int o=0; o<problem.obs.size(); o++)
+            {
+                const BAObservation& ob = problem.obs[o];
+                const int free_cam = ob.cam - problem.num_fixed;
+                const bool point_free = !problem.point_fixed[ob.point];
+                
+                if (free_cam < 0 && !point_free)
+                    continue;
+                
+                const Matx33d& R = problem.poses[ob.cam].GetRotation();
+                Vec3d X_c = problem.poses[ob.cam] * problem.points[ob.point];
+                if (X_c[2] <= 0.0)
+                    continue;
+                
+                const double inv_z = 1.0 / X_c[2];
+                const double xz = X_c[0] * inv_z, yz = X_c[1] * inv_z;
+                const double eu = fx * xz + cx - ob.u;
+                const double ev = fy * yz + cy - ob.v;
+                
+                double w = ob.inv_sigma2;
+                double e = sqrt((eu * eu + ev * ev) * ob.inv_sigma2);
+                if (e > POSE_OPT_HUBER_DELTA)
+                    w *= POSE_OPT_HUBER_DELTA / e;
+                
+                // d(u, v) / d(w, tau), same update as OptimizePose:
+                Matx<double, 2, 6> J_cam(-fx * xz * yz, fx * (1.0 + xz * xz), -fx * yz, fx * inv_z, 0.0, -fx * xz * inv_z,
+                                         -fy * (1.0 + yz * yz), fy * xz * yz, fy * xz, 0.0, fy * inv_z, -fy * yz * inv_z);
+                
+                // d(u, v) / d(X_c) * R:
+                Matx23d J_proj(fx * inv_z, 0.0, -fx * xz * inv_z,
+                               0.0, fy * inv_z, -fy * yz * inv_z);
+                Matx23d J_point = J_proj * R;
+                
+                Matx21d err(eu, ev);
+                
+                if (free_cam >= 0)
+                {
+                    U[free_cam] += (J_cam.t() * J_cam) * w;
+                    g_cam[free_cam] += (J_cam.t() * err) * w;
+                }
+                
+                if (point_free)
+                {
+                    V[ob.point] += (J_point.t() * J_point) * w;
+                    g_point[ob.point] += (J_point.t() * err) * w;
+                }
+                
+                if (free_cam >= 0 && point_free)
+                    W[o] = (J_cam.t() * J_point) * w;
+            }
+            
+            // Marquardt damping:
+            for (int c=0; c<num_free; c++)
+                for (int d=0; d<6; d++)
+                    U[c](d, d) += lambda * U[c](d, d) + 1e-9;
+            
+            vector<Matx33d> V_inv(num_points);
+            for (int p=0; p<num_points; p++)
+            {
+                if (problem.point_fixed[p])
+                    continue;
+                
+                for (int d=0; d<3; d++)
+                    V[p](d, d) += lambda * V[p](d, d) + 1e-9;
+                
+                V_inv[p] = V[p].inv(DECOMP_CHOLESKY);
+            }
+            
+            // Reduced camera system, one block per co-visible pair (row, col):
+            vector<map<int, Matx66d> > S(num_free);
+            vector<Matx61d> rhs(num_free);
+            for (int c=0; c<num_free; c++)
+            {
+                S[c][c] = U[c];
+                rhs[c] = -g_cam[c];
+            }
+            
+            for (int p=0; p<num_points; p++)
+            {
+                if (problem.point_fixed[p])
+                    continue;
+                
+                const vector<int>& obs_idx = problem.point_obs[p];
+                for (int a=0; a<obs_idx.size(); a++)
+                {
+                    const int cam_a = problem.obs[obs_idx[a]].cam - problem.num_fixed;
+                    if (cam_a < 0)
+                        continue;
+                    
+                    Matx63d WV = W[obs_idx[a]] * V_inv[p];
+                    rhs[cam_a] += WV * g_point[p];
+                    
+                    for (int b=0; b<obs_idx.size(); b++)
+                    {
+                        const int cam_b = problem.obs[obs_idx[b]].cam - problem.num_fixed;
+                        if (cam_b < 0)
+                            continue;
+                        
+                        S[cam_a][cam_b] -= WV * W[obs_idx[b]].t();
+                    }
+                }
+            }
+            
+            // Small systems (6 x window), so the blocks are solved with a dense Cholesky:
+            Mat S_dense = Mat::zeros(6 * num_free, 6 * num_free, CV_64F);
+            Mat rhs_dense(6 * num_free, 1, CV_64F);
+            for (int r=0; r<num_free; r++)
+            {
+                for (map<int, Matx66d>::iterator it=S[r].begin(); it!=S[r].end(); it++)
+                {
+                    Mat(it->second).copyTo(S_dense(Rect(6 * it->first, 6 * r, 6, 6)));
+                }
+                Mat(rhs[r]).copyTo(rhs_dense.rowRange(6 * r, 6 * r + 6));
+            }
+            
+            Mat delta_cam;
+            bool solved = solve(S_dense, rhs_dense, delta_cam, DECOMP_CHOLESKY);
+            
+            if (solved)
+            {
+                // Back-substitute the points and try the step:
+                vector<SE3> poses_new = problem.poses;
+                vector<Vec3d> points_new = problem.points;
+                
+                vector<Matx61d> dc(num_free);
+                for (int c=0; c<num_free; c++)
+                {
+                    for (int d=0; d<6; d++)
+                        dc[c](d) = delta_cam.at<double>(6 * c + d);
+                    
+                    const int cam = c + problem.num_fixed;
+                    poses_new[cam] = problem.poses[cam].Retract(Vec6d(dc[c](0), dc[c](1), dc[c](2),
+                                                                      dc[c](3), dc[c](4), dc[c](5)));
+                }
+                
+                for (int p=0; p<num_points; p++)
+                {
+                    if (problem.point_fixed[p])
+                        continue;
+                    
+                    Matx31d b = -g_point[p];
+                    const vector<int>& obs_idx = problem.point_obs[p];
+                    for (int a=0; a<obs_idx.size(); a++)
+                    {
+                        const int cam = problem.obs[obs_idx[a]].cam - problem.num_fixed;
+                        if (cam >= 0)
+                            b -= W[obs_idx[a]].t() * dc[cam];
+                    }
+                    
+                    Matx31d dp = V_inv[p] * b;
+                    points_new[p] = problem.points[p] + Vec3d(dp(0), dp(1), dp(2));
+                }
+                
+                double new_cost = LocalProblemCost(problem, poses_new, points_new);
+                
+                if (new_cost < cost)
+                {
+                    bool converged = (cost - new_cost) < BA_MIN_RELATIVE_DECREASE * cost;
+                    
+                    problem.poses = poses_new;
+                    problem.points = points_new;
+                    cost = new_cost;
+                    lambda = max(lambda * 0.1, 1e-12);
+                    
+                    problem.stats.iteration_cost.push_back(cost);
+                    problem.stats.iteration_ms.push_back((getTickCount() - iter_start) * 1000.0 / getTickFrequency());
+                    
+                    if (converged)
+                        break;
+                    
+                    continue;
+                }
+            }
+            
+            lambda *= 10.0;
+            
+            problem.stats.iteration_cost.push_back(cost);
+            problem.stats.iteration_ms.push_back((getTickCount() - iter_start) * 1000.0 / getTickFrequency());
+        }
+        
+        problem.stats.total_ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
     }
     
+    static void ApplyLocalProblem(const LocalBAProblem& problem, vector<KeyFramePtr>& keyframes)
+    {
+        for (int c=problem.num_fixed; c<problem.kf_indices.size(); c++)
+        {
+            const int kf_idx = problem.kf_indices[c];
+            if (kf_idx >= keyframes.size())
+                continue;
+            
+            keyframes[kf_idx] = keyframes[kf_idx]->WithPose(problem.poses[c]);
+        }
+        
+        // Points are shared through the map, so keyframes added since see the update too:
+        Ptr<Map> global_map = problem.global_map;
+        if (global_map.empty())
+            return;
+        
+        vector<int> moved_ids;
+        vector<Point3f> moved_coords;
+        for (int p=0; p<problem.points.size(); p++)
+        {
+            if (problem.point_fixed[p])
+                continue;
+            
+            moved_ids.push_back(problem.point_ids[p]);
+            moved_coords.push_back(Point3f((float)problem.points[p][0], (float)problem.points[p][1],
+                                           (float)problem.points[p][2]));
+        }
+        
+        if (!moved_ids.empty())
+            global_map->SetPoints3D(moved_ids, moved_coords);
+    }
+    
+    Optimizer::Optimizer()
+    {
+        ba_running = false;
+        ba_finished = false;
+    }
+    
+    Optimizer::~Optimizer()
+    {
+        WaitForBundleAdjust();
+    }
+    
+    void Optimizer::BundleAdjust(vector<KeyFramePtr> &keyframes)
+    {
+        LocalBAProblem problem;
+        if (!BuildLocalProblem(keyframes, problem))
+            return;
+        
+        SolveLocalProblem(problem);
+        ApplyLocalProblem(problem, keyframes);
+        
+        lock_guard<mutex> lock(ba_mutex);
+        ba_last_stats = problem.stats;
+    }
+    
+    bool Optimizer::StartBundleAdjust(const vector<KeyFramePtr> &keyframes)
+    {
+        {
+            lock_guard<mutex> lock(ba_mutex);
+            if (ba_running || ba_finished)
+                return false;
+        }
+        
+        // Join a run whose result was already fetched:
+        if (ba_thread.joinable())
+            ba_thread.join();
+        
+        // The problem copies poses and points, so the keyframes are free to change meanwhile:
+        shared_ptr<LocalBAProblem> problem = make_shared<LocalBAProblem>();
+        if (!BuildLocalProblem(keyframes, *problem))
+            return false;
+        
+        ba_problem = problem;
+        ba_running = true;
+        
+        ba_thread = thread([this, problem]()
+        {
+            SolveLocalProblem(*problem);
+            
+            lock_guard<mutex> lock(ba_mutex);
+            ba_running = false;
+            ba_finished = true;
+        });
+        
+        return true;
+    }
+    
+    bool Optimizer::FetchBundleAdjust(vector<KeyFramePtr> &keyframes)
+    {
+        {
+            lock_guard<mutex> lock(ba_mutex);
+            if (!ba_finished)
+                return false;
+            
+            ba_finished = false;
+        }
+        
+        ba_thread.join();
+        ApplyLocalProblem(*ba_problem, keyframes);
+        
+        lock_guard<mutex> lock(ba_mutex);
+        ba_last_stats = ba_problem->stats;
+        ba_problem.reset();
+        
+        return true;
+    }
+    
+    void Optimizer::WaitForBundleAdjust(void)
+    {
+        if (ba_thread.joinable())
+            ba_thread.join();
+    }
+    
+    BundleAdjustStats Optimizer::GetBundleAdjustStats(void)
+    {
+        lock_guard<mutex> lock(ba_mutex);
+        return ba_last_stats;
+    }
 }
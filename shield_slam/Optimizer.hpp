@@ -6,22 +6,84 @@
 #include <opencv2/contrib/contrib.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "Common.hpp"
 #include "MapPoint.hpp"
 #include "KeyFrame.hpp"
+#include "Pose.hpp"
+
+// Motion-only pose optimization: outlier rejection rounds of Gauss-Newton iterations, with
+// chi-square (2 dof, 95%) classification and a Huber kernel of the same width:
+#define POSE_OPT_ROUNDS 4
+#define POSE_OPT_ITERATIONS 10
+#define POSE_OPT_CHI2_TH 5.991
+#define POSE_OPT_HUBER_DELTA 2.447
+#define POSE_OPT_EPSILON 1e-10
+#define POSE_OPT_MIN_POINTS 6
+
+// Local bundle adjustment over the newest keyframes; the oldest ones in the window are held
+// fixed to anchor the gauge. Monocular BA is free up to a similarity, and one fixed pose
+// leaves the scale free, so two are held:
+#define BA_WINDOW_SIZE 5
+#define BA_FIXED_KEYFRAMES 2
+#define BA_MAX_ITERATIONS 10
+#define BA_INITIAL_LAMBDA 1e-3
+#define BA_MIN_RELATIVE_DECREASE 1e-6
 
 using namespace cv;
 using namespace std;
 
 namespace vslam {
     
+    struct BundleAdjustStats {
+        int num_keyframes;
+        int num_points;
+        int num_observations;
+        vector<double> iteration_cost;
+        vector<double> iteration_ms;
+        double total_ms;
+    };
+    
+    struct LocalBAProblem;
+    
     class Optimizer
     {
     public:
-        static void BundleAdjust(vector<KeyFrame>& keyframes);
+        
+        Optimizer();
+        virtual ~Optimizer();
+        
+        // Levenberg-Marquardt over the last BA_WINDOW_SIZE keyframes and the points they see.
+        // Points are eliminated with the Schur complement and the reduced camera system is
+        // accumulated per co-visible keyframe pair. Observations are grouped by map point ID and
+        // optimized points are written back to the global map.
+        void BundleAdjust(vector<KeyFramePtr>& keyframes);
+        
+        // Same problem solved on a background thread owned by this optimizer. Start returns
+        // false while a previous run is still pending; Fetch applies a finished run to the
+        // keyframes and returns true.
+        bool StartBundleAdjust(const vector<KeyFramePtr>& keyframes);
+        bool FetchBundleAdjust(vector<KeyFramePtr>& keyframes);
+        void WaitForBundleAdjust(void);
+        BundleAdjustStats GetBundleAdjustStats(void);
+        
+        // Refines the world-to-camera pose against undistorted pixel observations.
+        // sigma2 is the per-observation pixel variance (scale^(2*octave)). Returns the number
+        // of inliers, flagged in inliers.
+        static int OptimizePose(const vector<Point3f>& object_points, const vector<Point2f>& image_points,
+                                const vector<float>& sigma2, SE3& pose, vector<bool>& inliers);
         
     private:
-
+        
+        mutex ba_mutex;
+        thread ba_thread;
+        bool ba_running;
+        bool ba_finished;
+        shared_ptr<LocalBAProblem> ba_problem;
+        BundleAdjustStats ba_last_stats;
         
     protected:
         
@@ -0,0 +1,970 @@
+#include "OrbExtractor.hpp"
+#include "ThreadPool.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ORB_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    static const int kPatternTests = ORB_DESC_BYTES * 8;
+
+    // Learned rBRIEF test pattern of OpenCV's ORB (bit_pattern_31_), one test per row as
+    // x1,y1, x2,y2 offsets from the keypoint:
+    static const int ORB_BIT_PATTERN_31[kPatternTests * 4] = {
+        8,-3, 9,5,
+        4,2, 7,-12,
+        -11,9, -8,2,
+        7,-12, 12,-13,
+        2,-13, 2,12,
+        1,-7, 1,6,
+        -2,-10, -2,-4,
+        -13,-13, -11,-8,
+        -13,-3, -12,-9,
+        10,4, 11,9,
+        -13,-8, -8,-9,
+        -11,7, -9,12,
+        7,7, 12,6,
+        -4,-5, -3,0,
+        -13,2, -12,-3,
+        -9,0, -7,5,
+        12,-6, 12,-1,
+        -3,6, -2,12,
+        -6,-13, -4,-8,
+        11,-13, 12,-8,
+        4,7, 5,1,
+        5,-3, 10,-3,
+        3,-7, 6,12,
+        -8,-7, -6,-2,
+        -2,11, -1,-10,
+        -13,12, -8,10,
+        -7,3, -5,-3,
+        -4,2, -3,7,
+        -10,-12, -6,11,
+        5,-12, 6,-7,
+        5,-6, 7,-1,
+        1,0, 4,-5,
+        9,11, 11,-13,
+        4,7, 4,12,
+        2,-1, 4,4,
+        -4,-12, -2,7,
+        -8,-5, -7,-10,
+        4,11, 9,12,
+        0,-8, 1,-13,
+        -13,-2, -8,2,
+        -3,-2, -2,3,
+        -6,9, -4,-9,
+        8,12, 10,7,
+        0,9, 1,3,
+        7,-5, 11,-10,
+        -13,-6, -11,0,
+        10,7, 12,1,
+        -6,-3, -6,12,
+        10,-9, 12,-4,
+        -13,8, -8,-12,
+        -13,0, -8,-4,
+        3,3, 7,8,
+        5,7, 10,-7,
+        -1,7, 1,-12,
+        3,-10, 5,6,
+        2,-4, 3,-10,
+        -13,0, -13,5,
+        -13,-7, -12,12,
+        -13,3, -11,8,
+        -7,12, -4,7,
+        6,-10, 12,8,
+        -9,-1, -7,-6,
+        -2,-5, 0,12,
+        -12,5, -7,5,
+        3,-10, 8,-13,
+        -7,-7, -4,5,
+        -3,-2, -1,-7,
+        2,9, 5,-11,
+        -11,-13, -5,-13,
+        -1,6, 0,-1,
+        5,-3, 5,2,
+        -4,-13, -4,12,
+        -9,-6, -9,6,
+        -12,-10, -8,-4,
+        10,2, 12,-3,
+        7,12, 12,12,
+        -7,-13, -6,5,
+        -4,9, -3,4,
+        7,-1, 12,2,
+        -7,6, -5,1,
+        -13,11, -12,5,
+        -3,7, -2,-6,
+        7,-8, 12,-7,
+        -13,-7, -11,-12,
+        1,-3, 12,12,
+        2,-6, 3,0,
+        -4,3, -2,-13,
+        -1,-13, 1,9,
+        7,1, 8,-6,
+        1,-1, 3,12,
+        9,1, 12,6,
+        -1,-9, -1,3,
+        -13,-13, -10,5,
+        7,7, 10,12,
+        12,-5, 12,9,
+        6,3, 7,11,
+        5,-13, 6,10,
+        2,-12, 2,3,
+        3,8, 4,-6,
+        2,6, 12,-13,
+        9,-12, 10,3,
+        -8,4, -7,9,
+        -11,12, -4,-6,
+        1,12, 2,-8,
+        6,-9, 7,-4,
+        2,3, 3,-2,
+        6,3, 11,0,
+        3,-3, 8,-8,
+        7,8, 9,3,
+        -11,-5, -6,-4,
+        -10,11, -5,10,
+        -5,-8, -3,12,
+        -10,5, -9,0,
+        8,-1, 12,-6,
+        4,-6, 6,-11,
+        -10,12, -8,7,
+        4,-2, 6,7,
+        -2,0, -2,12,
+        -5,-8, -5,2,
+        7,-6, 10,12,
+        -9,-13, -8,-8,
+        -5,-13, -5,-2,
+        8,-8, 9,-13,
+        -9,-11, -9,0,
+        1,-8, 1,-2,
+        7,-4, 9,1,
+        -2,1, -1,-4,
+        11,-6, 12,-11,
+        -12,-9, -6,4,
+        3,7, 7,12,
+        5,5, 10,8,
+        0,-4, 2,8,
+        -9,12, -5,-13,
+        0,7, 2,12,
+        -1,2, 1,7,
+        5,11, 7,-9,
+        3,5, 6,-8,
+        -13,-4, -8,9,
+        -5,9, -3,-3,
+        -4,-7, -3,-12,
+        6,5, 8,0,
+        -7,6, -6,12,
+        -13,6, -5,-2,
+        1,-10, 3,10,
+        4,1, 8,-4,
+        -2,-2, 2,-13,
+        2,-12, 12,12,
+        -2,-13, 0,-6,
+        4,1, 9,3,
+        -6,-10, -3,-5,
+        -3,-13, -1,1,
+        7,5, 12,-11,
+        4,-2, 5,-7,
+        -13,9, -9,-5,
+        7,1, 8,6,
+        7,-8, 7,6,
+        -7,-4, -7,1,
+        -8,11, -7,-8,
+        -13,6, -12,-8,
+        2,4, 3,9,
+        10,-5, 12,3,
+        -6,-5, -6,7,
+        8,-3, 9,-8,
+        2,-12, 2,8,
+        -11,-2, -10,3,
+        -12,-13, -7,-9,
+        -11,0, -10,-5,
+        5,-3, 11,8,
+        -2,-13, -1,12,
+        -1,-8, 0,9,
+        -13,-11, -12,-5,
+        -10,-2, -10,11,
+        -3,9, -2,-13,
+        2,-3, 3,2,
+        -9,-13, -4,0,
+        -4,6, -3,-10,
+        -4,12, -2,-7,
+        -6,-11, -4,9,
+        6,-3, 6,11,
+        -13,11, -5,5,
+        11,11, 12,6,
+        7,-5, 12,-2,
+        -1,12, 0,7,
+        -4,-8, -3,-2,
+        -7,1, -6,7,
+        -13,-12, -8,-13,
+        -7,-2, -6,-8,
+        -8,5, -6,-9,
+        -5,-1, -4,5,
+        -13,7, -8,10,
+        1,5, 5,-13,
+        1,0, 10,-13,
+        9,12, 10,-1,
+        5,-8, 10,-9,
+        -1,11, 1,-13,
+        -9,-3, -6,2,
+        -1,-10, 1,12,
+        -13,1, -8,-10,
+        8,-11, 10,-6,
+        2,-13, 3,-6,
+        7,-13, 12,-9,
+        -10,-10, -5,-7,
+        -10,-8, -8,-13,
+        4,-6, 8,5,
+        3,12, 8,-13,
+        -4,2, -3,-3,
+        5,-13, 10,-12,
+        4,-13, 5,-1,
+        -9,9, -4,3,
+        0,3, 3,-9,
+        -12,1, -6,1,
+        3,2, 4,-8,
+        -10,-10, -10,9,
+        8,-13, 12,12,
+        -8,-12, -6,-5,
+        2,2, 3,7,
+        10,6, 11,-8,
+        6,8, 8,-12,
+        -7,10, -6,5,
+        -3,-9, -3,9,
+        -1,-13, -1,5,
+        -3,-7, -3,4,
+        -8,-2, -8,3,
+        4,2, 12,12,
+        2,-5, 3,11,
+        6,-9, 11,-13,
+        3,-1, 7,12,
+        11,-1, 12,4,
+        -3,0, -3,6,
+        4,-11, 4,12,
+        2,-4, 2,1,
+        -10,-6, -8,1,
+        -13,7, -11,1,
+        -13,12, -11,-13,
+        6,0, 11,-13,
+        0,-1, 1,4,
+        -13,3, -9,-2,
+        -9,8, -6,-3,
+        -13,-6, -8,-2,
+        5,-9, 8,10,
+        2,7, 3,-9,
+        -1,-6, -1,-1,
+        9,5, 11,-2,
+        11,-3, 12,-8,
+        3,0, 3,5,
+        -1,4, 0,10,
+        3,-6, 4,5,
+        -13,0, -10,5,
+        5,8, 12,11,
+        8,9, 9,-6,
+        7,-4, 8,-12,
+        -10,4, -10,9,
+        7,3, 12,4,
+        9,-7, 10,-2,
+        7,0, 12,-2,
+        -1,-6, 0,-11
+    };
+
+    // Reference rBRIEF kernel over a pre-rotated pattern (one angle bin):
+    static void DescriptorKernelScalar(const uchar* center, int step, const int* bin_pattern, uchar* desc)
+    {
+        const int* x1 = bin_pattern;
+        const int* y1 = bin_pattern + kPatternTests;
+        const int* x2 = bin_pattern + 2 * kPatternTests;
+        const int* y2 = bin_pattern + 3 * kPatternTests;
+
+        for (int byte_idx=0; byte_idx<ORB_DESC_BYTES; byte_idx++)
+        {
+            int val = 0;
+            for (int bit=0; bit<8; bit++)
+            {
+                int k = byte_idx * 8 + bit;
+                int t0 = center[y1[k] * step + x1[k]];
+                int t1 = center[y2[k] * step + x2[k]];
+
+                val |= (t0 < t1) << bit;
+            }
+
+            desc[byte_idx] = (uchar)val;
+        }
+    }
+
+#ifdef ORB_HAVE_AVX2_KERNEL
+    // Eight tests per byte map onto the eight 32-bit lanes: gather both pixels of every test,
+    // compare, and the sign mask of the comparison is the descriptor byte.
+    __attribute__((target("avx2")))
+    static void DescriptorKernelAVX2(const uchar* center, int step, const int* bin_pattern, uchar* desc)
+    {
+        const __m256i step_v = _mm256_set1_epi32(step);
+        const __m256i byte_mask = _mm256_set1_epi32(0xff);
+        const int* base = (const int*)center;
+
+        for (int byte_idx=0; byte_idx<ORB_DESC_BYTES; byte_idx++)
+        {
+            int k = byte_idx * 8;
+
+            __m256i x1 = _mm256_loadu_si256((const __m256i*)(bin_pattern + k));
+            __m256i y1 = _mm256_loadu_si256((const __m256i*)(bin_pattern + kPatternTests + k));
+            __m256i x2 = _mm256_loadu_si256((const __m256i*)(bin_pattern + 2 * kPatternTests + k));
+            __m256i y2 = _mm256_loadu_si256((const __m256i*)(bin_pattern + 3 * kPatternTests + k));
+
+            __m256i ofs1 = _mm256_add_epi32(_mm256_mullo_epi32(y1, step_v), x1);
+            __m256i ofs2 = _mm256_add_epi32(_mm256_mullo_epi32(y2, step_v), x2);
+
+            // Byte-addressed gathers; the three bytes read past each pixel are masked off:
+            __m256i t0 = _mm256_and_si256(_mm256_i32gather_epi32(base, ofs1, 1), byte_mask);
+            __m256i t1 = _mm256_and_si256(_mm256_i32gather_epi32(base, ofs2, 1), byte_mask);
+
+            __m256i less = _mm256_cmpgt_epi32(t1, t0);
+            desc[byte_idx] = (uchar)_mm256_movemask_ps(_mm256_castsi256_ps(less));
+        }
+    }
+#endif
+
+    OrbExtractor::OrbExtractor(int n_features, float scale_factor, int n_levels)
+    {
+        this->n_features = n_features;
+        this->scale_factor = scale_factor;
+        this->n_levels = n_levels;
+
+        level_scale.resize(n_levels);
+        level_scale[0] = 1.0f;
+        for (int i=1; i<n_levels; i++)
+        {
+            level_scale[i] = level_scale[i-1] * scale_factor;
+        }
+
+        // Distribute the feature budget geometrically over the levels (by image area):
+        features_per_level.resize(n_levels);
+        float factor = 1.0f / scale_factor;
+        float desired_features = n_features * (1 - factor) / (1 - (float)pow((double)factor, (double)n_levels));
+
+        int sum_features = 0;
+        for (int i=0; i<n_levels-1; i++)
+        {
+            features_per_level[i] = cvRound(desired_features);
+            sum_features += features_per_level[i];
+            desired_features *= factor;
+        }
+        features_per_level[n_levels-1] = max(n_features - sum_features, 0);
+
+        // Row extents of the circular orientation patch:
+        umax.resize(ORB_HALF_PATCH_SIZE + 1);
+
+        int v, v0;
+        int vmax = cvFloor(ORB_HALF_PATCH_SIZE * sqrt(2.0) / 2 + 1);
+        int vmin = cvCeil(ORB_HALF_PATCH_SIZE * sqrt(2.0) / 2);
+        const double hp2 = ORB_HALF_PATCH_SIZE * ORB_HALF_PATCH_SIZE;
+
+        for (v=0; v<=vmax; v++)
+        {
+            umax[v] = cvRound(sqrt(hp2 - v * v));
+        }
+
+        // Make sure the patch is symmetric:
+        for (v=ORB_HALF_PATCH_SIZE, v0=0; v>=vmin; v--)
+        {
+            while (umax[v0] == umax[v0 + 1])
+                v0++;
+            umax[v] = v0;
+            v0++;
+        }
+
+        // Rotated offsets stay within 18 pixels of the keypoint, inside ORB_EDGE_THRESHOLD:
+        pattern.resize(kPatternTests * 2);
+        for (int i=0; i<pattern.size(); i++)
+        {
+            pattern[i] = Point(ORB_BIT_PATTERN_31[2*i], ORB_BIT_PATTERN_31[2*i+1]);
+        }
+
+        // Rotate the pattern once per angle bin:
+        rotated_pattern.resize(ORB_ANGLE_BINS * 4 * kPatternTests);
+        for (int bin=0; bin<ORB_ANGLE_BINS; bin++)
+        {
+            double angle = bin * (2.0 * CV_PI / ORB_ANGLE_BINS);
+            float a = (float)cos(angle), b = (float)sin(angle);
+
+            int* bin_pattern = &rotated_pattern[bin * 4 * kPatternTests];
+            for (int k=0; k<kPatternTests; k++)
+            {
+                const Point& p1 = pattern[2*k];
+                const Point& p2 = pattern[2*k+1];
+
+                bin_pattern[k] = cvRound(p1.x * a - p1.y * b);
+                bin_pattern[kPatternTests + k] = cvRound(p1.x * b + p1.y * a);
+                bin_pattern[2 * kPatternTests + k] = cvRound(p2.x * a - p2.y * b);
+                bin_pattern[3 * kPatternTests + k] = cvRound(p2.x * b + p2.y * a);
+            }
+        }
+
+        SetUseSimdDescriptors(true);
+
+        desc_count = 0;
+        desc_time_ms = 0.0;
+
+        extraction_mode = EXTRACT_SERIAL;
+        grid_rows = 1;
+        grid_cols = 1;
+        distribution = DISTRIBUTE_RETAIN_BEST;
+
+        pyramid.resize(n_levels);
+        blurred_pyramid.resize(n_levels);
+        level_keypoints.resize(n_levels);
+        octave_times_ms.assign(n_levels, 0.0);
+    }
+
+    void OrbExtractor::SetUseSimdDescriptors(bool enable)
+    {
+        use_avx2 = false;
+#ifdef ORB_HAVE_AVX2_KERNEL
+        __builtin_cpu_init();
+        use_avx2 = enable && __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+
+    void OrbExtractor::SetExtractionMode(ExtractionMode mode, int grid_rows, int grid_cols)
+    {
+        if (grid_rows < 1 || grid_cols < 1)
+        {
+            CV_Error(0, "OrbExtractor: grid must have at least one cell");
+        }
+
+        extraction_mode = mode;
+        this->grid_rows = grid_rows;
+        this->grid_cols = grid_cols;
+    }
+
+    void OrbExtractor::Extract(const Mat &img, KeypointArray &keypoints, Mat &descriptors)
+    {
+        if (img.empty() || img.type() != CV_8U)
+        {
+            CV_Error(0, "OrbExtractor::Extract expects a non-empty grayscale image");
+        }
+
+        if (extraction_mode == EXTRACT_TILED)
+            ExtractTiled(img, keypoints, descriptors);
+        else
+            ExtractSerial(img, keypoints, descriptors);
+    }
+
+    void OrbExtractor::ExtractSerial(const Mat &img, KeypointArray &keypoints, Mat &descriptors)
+    {
+        int num_keypoints = 0;
+        for (int level=0; level<n_levels; level++)
+        {
+            int64 start = getTickCount();
+
+            ResizePyramidLevel(img, level);
+            BlurPyramidLevel(level);
+            DetectCell(level, GetDetectionArea(level), features_per_level[level], level_keypoints[level]);
+            num_keypoints += (int)level_keypoints[level].size();
+
+            octave_times_ms[level] = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        }
+
+        keypoints.clear();
+        keypoints.reserve(num_keypoints);
+        descriptors.create(num_keypoints, ORB_DESC_BYTES, CV_8U);
+
+        desc_count = num_keypoints;
+        desc_time_ms = 0.0;
+
+        int offset = 0;
+        for (int level=0; level<n_levels; level++)
+        {
+            KeypointArray& level_kp = level_keypoints[level];
+            if (level_kp.empty())
+                continue;
+
+            int64 start = getTickCount();
+
+            Mat level_desc = descriptors.rowRange(offset, offset + (int)level_kp.size());
+            ComputeDescriptors(blurred_pyramid[level], level_kp, level_desc);
+            offset += (int)level_kp.size();
+
+            desc_time_ms += (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+            // Keypoints are reported in level 0 coordinates:
+            for (int i=0; i<level_kp.size(); i++)
+            {
+                KeyPoint kp = level_kp[i];
+                kp.pt = kp.pt * level_scale[level];
+                keypoints.push_back(kp);
+            }
+
+            octave_times_ms[level] += (getTickCount() - start) * 1000.0 / getTickFrequency();
+        }
+    }
+
+    void OrbExtractor::ExtractTiled(const Mat &img, KeypointArray &keypoints, Mat &descriptors)
+    {
+        const int num_cells = grid_rows * grid_cols;
+        const int num_tiles = n_levels * num_cells;
+
+        vector<double> pyramid_times_ms(n_levels, 0.0);
+
+        // Each level is resized from the previous one, so only the blur runs in parallel:
+        for (int level=0; level<n_levels; level++)
+        {
+            int64 start = getTickCount();
+            ResizePyramidLevel(img, level);
+            pyramid_times_ms[level] = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        }
+
+        ThreadPool::Shared().ParallelFor(0, n_levels, [&](int level)
+        {
+            int64 start = getTickCount();
+            BlurPyramidLevel(level);
+            pyramid_times_ms[level] += (getTickCount() - start) * 1000.0 / getTickFrequency();
+        });
+
+        tile_keypoints.resize(num_tiles);
+        tile_descriptors.resize(num_tiles);
+        tile_times_ms.assign(num_tiles, 0.0);
+        tile_desc_times_ms.assign(num_tiles, 0.0);
+
+        ThreadPool::Shared().ParallelFor(0, num_tiles, [&](int tile)
+        {
+            int64 start = getTickCount();
+
+            int level = tile / num_cells;
+            int cell = tile % num_cells;
+            int cell_budget = (ORB_CELL_BUDGET_FACTOR * features_per_level[level] + num_cells - 1) / num_cells;
+
+            DetectCell(level, GetCellArea(level, cell), cell_budget, tile_keypoints[tile]);
+
+            int64 desc_start = getTickCount();
+            tile_descriptors[tile].create((int)tile_keypoints[tile].size(), ORB_DESC_BYTES, CV_8U);
+            ComputeDescriptors(blurred_pyramid[level], tile_keypoints[tile], tile_descriptors[tile]);
+
+            int64 end = getTickCount();
+            tile_desc_times_ms[tile] = (end - desc_start) * 1000.0 / getTickFrequency();
+            tile_times_ms[tile] = (end - start) * 1000.0 / getTickFrequency();
+        });
+
+        // Merge tiles in (level, cell) order and cap every level at its budget. Ties keep the
+        // earlier tile, so the selection is independent of scheduling.
+        vector<pair<int, int> > selected;
+        desc_count = 0;
+        desc_time_ms = 0.0;
+
+        for (int level=0; level<n_levels; level++)
+        {
+            vector<pair<int, int> > candidates;
+            octave_times_ms[level] = pyramid_times_ms[level];
+
+            for (int cell=0; cell<num_cells; cell++)
+            {
+                int tile = level * num_cells + cell;
+                octave_times_ms[level] += tile_times_ms[tile];
+                desc_time_ms += tile_desc_times_ms[tile];
+                desc_count += (int)tile_keypoints[tile].size();
+
+                for (int i=0; i<tile_keypoints[tile].size(); i++)
+                {
+                    candidates.push_back(make_pair(tile, i));
+                }
+            }
+
+            if ((int)candidates.size() > features_per_level[level] && distribution == DISTRIBUTE_QUADTREE)
+            {
+                KeypointArray candidate_kp(candidates.size());
+                for (int i=0; i<candidates.size(); i++)
+                {
+                    candidate_kp[i] = tile_keypoints[candidates[i].first][candidates[i].second];
+                }
+
+                vector<int> kept;
+                DistributeQuadtree(candidate_kp, GetDetectionArea(level), features_per_level[level], kept);
+
+                vector<pair<int, int> > kept_candidates(kept.size());
+                for (int i=0; i<kept.size(); i++)
+                {
+                    kept_candidates[i] = candidates[kept[i]];
+                }
+                candidates.swap(kept_candidates);
+            }
+            else if ((int)candidates.size() > features_per_level[level])
+            {
+                stable_sort(candidates.begin(), candidates.end(),
+                            [this](const pair<int, int>& a, const pair<int, int>& b)
+                            {
+                                return tile_keypoints[a.first][a.second].response >
+                                       tile_keypoints[b.first][b.second].response;
+                            });
+
+                candidates.resize(features_per_level[level]);
+                sort(candidates.begin(), candidates.end());
+            }
+
+            selected.insert(selected.end(), candidates.begin(), candidates.end());
+        }
+
+        keypoints.clear();
+        keypoints.reserve(selected.size());
+        descriptors.create((int)selected.size(), ORB_DESC_BYTES, CV_8U);
+
+        for (int i=0; i<selected.size(); i++)
+        {
+            int tile = selected[i].first;
+            int idx = selected[i].second;
+
+            // Keypoints are reported in level 0 coordinates:
+            KeyPoint kp = tile_keypoints[tile][idx];
+            kp.pt = kp.pt * level_scale[kp.octave];
+            keypoints.push_back(kp);
+
+            tile_descriptors[tile].row(idx).copyTo(descriptors.row(i));
+        }
+    }
+
+    void OrbExtractor::ResizePyramidLevel(const Mat &img, int level)
+    {
+        // Level buffers keep their allocation while the frame size does not change:
+        if (level == 0)
+        {
+            img.copyTo(pyramid[0]);
+        }
+        else
+        {
+            float inv_scale = 1.0f / level_scale[level];
+            Size level_size(cvRound(img.cols * inv_scale), cvRound(img.rows * inv_scale));
+            resize(pyramid[level-1], pyramid[level], level_size, 0, 0, INTER_LINEAR);
+        }
+    }
+
+    void OrbExtractor::BlurPyramidLevel(int level)
+    {
+        GaussianBlur(pyramid[level], blurred_pyramid[level], Size(ORB_DESC_BLUR_SIZE, ORB_DESC_BLUR_SIZE),
+                     ORB_DESC_BLUR_SIGMA, ORB_DESC_BLUR_SIGMA, BORDER_REFLECT_101);
+    }
+
+    Rect OrbExtractor::GetDetectionArea(int level)
+    {
+        // Detect away from the border so the rotated pattern stays inside the image:
+        const Mat& level_img = pyramid[level];
+        return Rect(ORB_EDGE_THRESHOLD, ORB_EDGE_THRESHOLD,
+                    max(level_img.cols - 2 * ORB_EDGE_THRESHOLD, 0),
+                    max(level_img.rows - 2 * ORB_EDGE_THRESHOLD, 0));
+    }
+
+    Rect OrbExtractor::GetCellArea(int level, int cell)
+    {
+        Rect area = GetDetectionArea(level);
+
+        int row = cell / grid_cols;
+        int col = cell % grid_cols;
+
+        int x0 = area.x + (area.width * col) / grid_cols;
+        int x1 = area.x + (area.width * (col + 1)) / grid_cols;
+        int y0 = area.y + (area.height * row) / grid_rows;
+        int y1 = area.y + (area.height * (row + 1)) / grid_rows;
+
+        return Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    void OrbExtractor::DetectCell(int level, const Rect &cell, int max_features, KeypointArray &cell_kp)
+    {
+        cell_kp.clear();
+
+        if (cell.width <= 0 || cell.height <= 0 || max_features <= 0)
+            return;
+
+        // FAST skips a 3 pixel ring, so grow the cell by that much into its neighbours:
+        const Mat& level_img = pyramid[level];
+        Rect roi(cell.x - ORB_FAST_BORDER, cell.y - ORB_FAST_BORDER,
+                 cell.width + 2 * ORB_FAST_BORDER, cell.height + 2 * ORB_FAST_BORDER);
+
+        FAST(level_img(roi), cell_kp, ORB_FAST_THRESHOLD, true);
+
+        // Textureless cell, retry with a lower threshold:
+        if (cell_kp.empty())
+        {
+            FAST(level_img(roi), cell_kp, ORB_FAST_MIN_THRESHOLD, true);
+        }
+
+        for (int i=0; i<cell_kp.size(); i++)
+        {
+            cell_kp[i].pt.x += roi.x;
+            cell_kp[i].pt.y += roi.y;
+        }
+
+        if (distribution == DISTRIBUTE_QUADTREE)
+        {
+            ComputeHarrisResponses(level_img, cell_kp);
+
+            vector<int> kept;
+            DistributeQuadtree(cell_kp, cell, max_features, kept);
+
+            KeypointArray kept_kp(kept.size());
+            for (int i=0; i<kept.size(); i++)
+            {
+                kept_kp[i] = cell_kp[kept[i]];
+            }
+            cell_kp.swap(kept_kp);
+        }
+        else
+        {
+            // Pre-filter on the FAST score, then keep the best Harris responses:
+            KeyPointsFilter::retainBest(cell_kp, 2 * max_features);
+            ComputeHarrisResponses(level_img, cell_kp);
+            KeyPointsFilter::retainBest(cell_kp, max_features);
+        }
+
+        ComputeOrientation(level_img, cell_kp);
+
+        for (int i=0; i<cell_kp.size(); i++)
+        {
+            cell_kp[i].octave = level;
+            cell_kp[i].size = ORB_PATCH_SIZE * level_scale[level];
+        }
+    }
+
+    void OrbExtractor::DistributeQuadtree(const KeypointArray &kp, const Rect &area, int max_features,
+                                          vector<int> &selected) const
+    {
+        selected.clear();
+
+        if ((int)kp.size() <= max_features)
+        {
+            for (int i=0; i<kp.size(); i++)
+                selected.push_back(i);
+            return;
+        }
+
+        struct QuadNode
+        {
+            float x0, y0, x1, y1;
+            vector<int> kp_idx;
+        };
+
+        // Roughly square root nodes side by side across the area:
+        int num_roots = max(1, cvRound((float)area.width / max(area.height, 1)));
+        float root_width = (float)area.width / num_roots;
+
+        vector<QuadNode> nodes(num_roots);
+        for (int i=0; i<num_roots; i++)
+        {
+            nodes[i].x0 = area.x + i * root_width;
+            nodes[i].x1 = area.x + (i + 1) * root_width;
+            nodes[i].y0 = (float)area.y;
+            nodes[i].y1 = (float)(area.y + area.height);
+        }
+
+        for (int i=0; i<kp.size(); i++)
+        {
+            int root = min(max((int)((kp[i].pt.x - area.x) / root_width), 0), num_roots - 1);
+            nodes[root].kp_idx.push_back(i);
+        }
+
+        // Textureless roots hold nothing to select and must not count towards max_features:
+        nodes.erase(remove_if(nodes.begin(), nodes.end(), [](const QuadNode& node)
+        {
+            return node.kp_idx.empty();
+        }), nodes.end());
+
+        // Split the most populated nodes first until there are enough nodes:
+        while ((int)nodes.size() < max_features)
+        {
+            vector<int> split_order;
+            for (int i=0; i<nodes.size(); i++)
+            {
+                if (nodes[i].kp_idx.size() > 1 && nodes[i].x1 - nodes[i].x0 >= 1.0f &&
+                    nodes[i].y1 - nodes[i].y0 >= 1.0f)
+                {
+                    split_order.push_back(i);
+                }
+            }
+
+            if (split_order.empty())
+                break;
+
+            stable_sort(split_order.begin(), split_order.end(), [&nodes](int a, int b)
+            {
+                return nodes[a].kp_idx.size() > nodes[b].kp_idx.size();
+            });
+
+            vector<bool> split(nodes.size(), false);
+            int expected_nodes = (int)nodes.size();
+            for (int i=0; i<split_order.size() && expected_nodes < max_features; i++)
+            {
+                split[split_order[i]] = true;
+                expected_nodes += 3;
+            }
+
+            vector<QuadNode> next_nodes;
+            for (int i=0; i<nodes.size(); i++)
+            {
+                if (!split[i])
+                {
+                    next_nodes.push_back(nodes[i]);
+                    continue;
+                }
+
+                const QuadNode& parent = nodes[i];
+                float mid_x = 0.5f * (parent.x0 + parent.x1);
+                float mid_y = 0.5f * (parent.y0 + parent.y1);
+
+                QuadNode children[4];
+                for (int c=0; c<4; c++)
+                {
+                    children[c].x0 = (c % 2 == 0) ? parent.x0 : mid_x;
+                    children[c].x1 = (c % 2 == 0) ? mid_x : parent.x1;
+                    children[c].y0 = (c < 2) ? parent.y0 : mid_y;
+                    children[c].y1 = (c < 2) ? mid_y : parent.y1;
+                }
+
+                for (int k=0; k<parent.kp_idx.size(); k++)
+                {
+                    const Point2f& pt = kp[parent.kp_idx[k]].pt;
+                    int c = (pt.x < mid_x ? 0 : 1) + (pt.y < mid_y ? 0 : 2);
+                    children[c].kp_idx.push_back(parent.kp_idx[k]);
+                }
+
+                for (int c=0; c<4; c++)
+                {
+                    if (!children[c].kp_idx.empty())
+                        next_nodes.push_back(children[c]);
+                }
+            }
+
+            nodes.swap(next_nodes);
+        }
+
+        // Best Harris response per node:
+        for (int i=0; i<nodes.size(); i++)
+        {
+            if (nodes[i].kp_idx.empty())
+                continue;
+
+            int best = nodes[i].kp_idx[0];
+            for (int k=1; k<nodes[i].kp_idx.size(); k++)
+            {
+                if (kp[nodes[i].kp_idx[k]].response > kp[best].response)
+                    best = nodes[i].kp_idx[k];
+            }
+
+            selected.push_back(best);
+        }
+
+        // The last round may overshoot by a few nodes:
+        if ((int)selected.size() > max_features)
+        {
+            stable_sort(selected.begin(), selected.end(), [&kp](int a, int b)
+            {
+                return kp[a].response > kp[b].response;
+            });
+            selected.resize(max_features);
+        }
+
+        sort(selected.begin(), selected.end());
+    }
+
+    void OrbExtractor::ComputeHarrisResponses(const Mat &level_img, KeypointArray &level_kp)
+    {
+        const int step = (int)level_img.step;
+        const int r = ORB_HARRIS_BLOCK_SIZE / 2;
+
+        float scale = 1.0f / ((1 << 2) * ORB_HARRIS_BLOCK_SIZE * 255.0f);
+        float scale_sq_sq = scale * scale * scale * scale;
+
+        for (int i=0; i<level_kp.size(); i++)
+        {
+            int x0 = cvRound(level_kp[i].pt.x) - r;
+            int y0 = cvRound(level_kp[i].pt.y) - r;
+
+            int a = 0, b = 0, c = 0;
+            for (int y=0; y<ORB_HARRIS_BLOCK_SIZE; y++)
+            {
+                const uchar* ptr = level_img.ptr<uchar>(y0 + y) + x0;
+
+                for (int x=0; x<ORB_HARRIS_BLOCK_SIZE; x++, ptr++)
+                {
+                    int Ix = (ptr[1] - ptr[-1]) * 2 + (ptr[-step+1] - ptr[-step-1]) + (ptr[step+1] - ptr[step-1]);
+                    int Iy = (ptr[step] - ptr[-step]) * 2 + (ptr[step-1] - ptr[-step-1]) + (ptr[step+1] - ptr[-step+1]);
+
+                    a += Ix * Ix;
+                    b += Iy * Iy;
+                    c += Ix * Iy;
+                }
+            }
+
+            level_kp[i].response = ((float)a * b - (float)c * c -
+                                    ORB_HARRIS_K * ((float)a + b) * ((float)a + b)) * scale_sq_sq;
+        }
+    }
+
+    void OrbExtractor::ComputeOrientation(const Mat &level_img, KeypointArray &level_kp)
+    {
+        const int step = (int)level_img.step;
+
+        for (int i=0; i<level_kp.size(); i++)
+        {
+            const uchar* center = level_img.ptr<uchar>(cvRound(level_kp[i].pt.y)) + cvRound(level_kp[i].pt.x);
+
+            // Intensity centroid moments over the circular patch:
+            int m_01 = 0, m_10 = 0;
+
+            for (int u=-ORB_HALF_PATCH_SIZE; u<=ORB_HALF_PATCH_SIZE; u++)
+                m_10 += u * center[u];
+
+            for (int v=1; v<=ORB_HALF_PATCH_SIZE; v++)
+            {
+                int v_sum = 0;
+                int d = umax[v];
+
+                for (int u=-d; u<=d; u++)
+                {
+                    int val_plus = center[u + v*step], val_minus = center[u - v*step];
+                    v_sum += (val_plus - val_minus);
+                    m_10 += u * (val_plus + val_minus);
+                }
+
+                m_01 += v * v_sum;
+            }
+
+            level_kp[i].angle = fastAtan2((float)m_01, (float)m_10);
+        }
+    }
+
+    void OrbExtractor::ComputeDescriptors(const Mat &blurred_img, const KeypointArray &level_kp, Mat &level_desc)
+    {
+        const int step = (int)blurred_img.step;
+        const float bin_width = 360.0f / ORB_ANGLE_BINS;
+
+        for (int i=0; i<level_kp.size(); i++)
+        {
+            const uchar* center = blurred_img.ptr<uchar>(cvRound(level_kp[i].pt.y)) + cvRound(level_kp[i].pt.x);
+            uchar* desc = level_desc.ptr<uchar>(i);
+
+            int bin = cvRound(level_kp[i].angle / bin_width) % ORB_ANGLE_BINS;
+            const int* bin_pattern = &rotated_pattern[bin * 4 * kPatternTests];
+
+#ifdef ORB_HAVE_AVX2_KERNEL
+            if (use_avx2)
+            {
+                DescriptorKernelAVX2(center, step, bin_pattern, desc);
+                continue;
+            }
+#endif
+            DescriptorKernelScalar(center, step, bin_pattern, desc);
+        }
+    }
+
+    double OrbExtractor::GetDescriptorThroughput(void) const
+    {
+        if (desc_time_ms <= 0.0)
+            return 0.0;
+
+        return desc_count / (desc_time_ms / 1000.0);
+    }
+}
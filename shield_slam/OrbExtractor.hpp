@@ -0,0 +1,136 @@
+#ifndef __shield_slam__OrbExtractor__
+#define __shield_slam__OrbExtractor__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "Common.hpp"
+
+#define ORB_PATCH_SIZE 31
+#define ORB_HALF_PATCH_SIZE 15
+#define ORB_EDGE_THRESHOLD 19
+
+#define ORB_FAST_THRESHOLD 20
+#define ORB_FAST_MIN_THRESHOLD 7
+#define ORB_FAST_BORDER 3
+#define ORB_HARRIS_BLOCK_SIZE 7
+#define ORB_HARRIS_K 0.04f
+
+#define ORB_DESC_BLUR_SIZE 7
+#define ORB_DESC_BLUR_SIGMA 2.0
+
+// rBRIEF pattern is pre-rotated for this many orientation bins (12 degrees each):
+#define ORB_ANGLE_BINS 30
+
+// Each tile may keep this many times its even share of the level budget:
+#define ORB_CELL_BUDGET_FACTOR 2
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    /*
+     ORB detector and descriptor on a single scale pyramid. The pyramid and its blurred copy
+     are built once per frame into buffers that are reused across frames, and FAST, Harris
+     scoring, orientation and rBRIEF all run on those levels.
+
+     EXTRACT_TILED splits every level into a grid of cells and processes the octave x cell
+     tiles on the shared thread pool. Cells fall back to a lower FAST threshold when they are
+     textureless, and tiles are merged in a fixed order so the output does not depend on the
+     number of threads.
+
+     DISTRIBUTE_QUADTREE spreads the kept corners over the image: the detection area is split
+     recursively until there are as many nodes as the target count, and every node keeps its
+     best Harris response. DISTRIBUTE_RETAIN_BEST keeps the strongest responses anywhere.
+     */
+    class OrbExtractor
+    {
+    public:
+
+        OrbExtractor(int n_features, float scale_factor, int n_levels);
+        virtual ~OrbExtractor() = default;
+
+        enum ExtractionMode {
+            EXTRACT_SERIAL = 0,
+            EXTRACT_TILED = 1,
+        };
+
+        enum DistributionStrategy {
+            DISTRIBUTE_RETAIN_BEST = 0,
+            DISTRIBUTE_QUADTREE = 1,
+        };
+
+        void SetExtractionMode(ExtractionMode mode, int grid_rows = 1, int grid_cols = 1);
+        void SetDistributionStrategy(DistributionStrategy strategy) { distribution = strategy; }
+
+        void Extract(const Mat& img, KeypointArray& keypoints, Mat& descriptors);
+
+        int GetNumLevels(void) const { return n_levels; }
+        float GetScaleFactor(void) const { return scale_factor; }
+
+        // Time (ms) spent on each octave during the last Extract call, pyramid level included:
+        const vector<double>& GetOctaveTimings(void) const { return octave_times_ms; }
+
+        // Descriptors computed per second of descriptor kernel time during the last Extract call:
+        double GetDescriptorThroughput(void) const;
+        const char* GetDescriptorKernelName(void) const { return use_avx2 ? "avx2-gather" : "scalar-lut"; }
+        // SIMD descriptor kernel when the CPU has one; false forces the scalar reference:
+        void SetUseSimdDescriptors(bool enable);
+
+    private:
+
+        void ExtractSerial(const Mat& img, KeypointArray& keypoints, Mat& descriptors);
+        void ExtractTiled(const Mat& img, KeypointArray& keypoints, Mat& descriptors);
+
+        void ResizePyramidLevel(const Mat& img, int level);
+        void BlurPyramidLevel(int level);
+        Rect GetDetectionArea(int level);
+        Rect GetCellArea(int level, int cell);
+
+        void DetectCell(int level, const Rect& cell, int max_features, KeypointArray& cell_kp);
+        void DistributeQuadtree(const KeypointArray& kp, const Rect& area, int max_features,
+                                vector<int>& selected) const;
+
+        void ComputeHarrisResponses(const Mat& level_img, KeypointArray& level_kp);
+        void ComputeOrientation(const Mat& level_img, KeypointArray& level_kp);
+        void ComputeDescriptors(const Mat& blurred_img, const KeypointArray& level_kp, Mat& level_desc);
+
+    protected:
+        int n_features;
+        float scale_factor;
+        int n_levels;
+
+        ExtractionMode extraction_mode;
+        int grid_rows, grid_cols;
+        DistributionStrategy distribution;
+
+        vector<float> level_scale;
+        vector<int> features_per_level;
+
+        // Circular patch bounds and the 256 point pairs of the rBRIEF test pattern:
+        vector<int> umax;
+        vector<Point> pattern;
+
+        // Pattern rotated to every angle bin, laid out per bin as [x1 | y1 | x2 | y2] blocks
+        // of 256 ints so a SIMD lane group reads 8 consecutive tests:
+        vector<int> rotated_pattern;
+        bool use_avx2;
+
+        vector<Mat> pyramid;
+        vector<Mat> blurred_pyramid;
+        vector<KeypointArray> level_keypoints;
+
+        vector<KeypointArray> tile_keypoints;
+        vector<Mat> tile_descriptors;
+        vector<double> tile_times_ms;
+        vector<double> tile_desc_times_ms;
+
+        int desc_count;
+        double desc_time_ms;
+
+        vector<double> octave_times_ms;
+    };
+}
+
+#endif /* defined(__shield_slam__OrbExtractor__) */
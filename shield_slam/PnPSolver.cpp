@@ -0,0 +1,878 @@
+#include "PnPSolver.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PNP_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define PNP_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    static inline double Dot3(const double* a, const double* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    static inline void Cross3(const double* a, const double* b, double* out)
+    {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    static inline bool Normalize3(double* a)
+    {
+        double n = sqrt(Dot3(a, a));
+        if (n < 1e-12)
+            return false;
+
+        a[0] /= n;
+        a[1] /= n;
+        a[2] /= n;
+        return true;
+    }
+
+    // Largest real root of x^3 + a x^2 + b x + c:
+    static double SolveCubicLargest(double a, double b, double c)
+    {
+        double p = b - a * a / 3.0;
+        double q = 2.0 * a * a * a / 27.0 - a * b / 3.0 + c;
+        double disc = q * q / 4.0 + p * p * p / 27.0;
+
+        double y;
+        if (disc >= 0.0)
+        {
+            double sqrt_disc = sqrt(disc);
+            y = cbrt(-q / 2.0 + sqrt_disc) + cbrt(-q / 2.0 - sqrt_disc);
+        }
+        else
+        {
+            double r = sqrt(-p / 3.0);
+            double phi = acos(max(-1.0, min(1.0, -q / (2.0 * r * r * r))));
+            y = 2.0 * r * cos(phi / 3.0);
+        }
+
+        return y - a / 3.0;
+    }
+
+    static int SolveQuadratic(double b, double c, double* roots)
+    {
+        double disc = b * b - 4.0 * c;
+
+        // Keep double roots that rounding pushed slightly negative:
+        if (disc < -1e-10 * (b * b + fabs(c)))
+            return 0;
+
+        double sqrt_disc = sqrt(max(disc, 0.0));
+        roots[0] = 0.5 * (-b + sqrt_disc);
+        roots[1] = 0.5 * (-b - sqrt_disc);
+        return 2;
+    }
+
+    // Real roots of c4 x^4 + c3 x^3 + c2 x^2 + c1 x + c0 (Ferrari), polished with Newton steps:
+    static int SolveQuartic(double c4, double c3, double c2, double c1, double c0, double* roots)
+    {
+        if (fabs(c4) < 1e-14)
+            return 0;
+
+        const double B = c3 / c4, C = c2 / c4, D = c1 / c4, E = c0 / c4;
+
+        // Depressed quartic y^4 + p y^2 + q y + r with x = y - B/4:
+        const double p = C - 3.0 * B * B / 8.0;
+        const double q = D - B * C / 2.0 + B * B * B / 8.0;
+        const double r = E - B * D / 4.0 + B * B * C / 16.0 - 3.0 * B * B * B * B / 256.0;
+
+        double y[4];
+        int num_roots = 0;
+
+        double m = (fabs(q) < 1e-14) ? 0.0 : SolveCubicLargest(p, p * p / 4.0 - r, -q * q / 8.0);
+
+        if (m <= 1e-14)
+        {
+            // Biquadratic:
+            double z[2];
+            if (SolveQuadratic(p, r, z))
+            {
+                for (int i=0; i<2; i++)
+                {
+                    if (z[i] < 0.0)
+                        continue;
+
+                    y[num_roots++] = sqrt(z[i]);
+                    y[num_roots++] = -sqrt(z[i]);
+                }
+            }
+        }
+        else
+        {
+            double s = sqrt(2.0 * m);
+            num_roots += SolveQuadratic(-s, p / 2.0 + m + q / (2.0 * s), y + num_roots);
+            num_roots += SolveQuadratic(s, p / 2.0 + m - q / (2.0 * s), y + num_roots);
+        }
+
+        for (int i=0; i<num_roots; i++)
+        {
+            double x = y[i] - B / 4.0;
+
+            for (int k=0; k<2; k++)
+            {
+                double f = (((x + B) * x + C) * x + D) * x + E;
+                double df = ((4.0 * x + 3.0 * B) * x + 2.0 * C) * x + D;
+                if (fabs(df) < 1e-14)
+                    break;
+
+                x -= f / df;
+            }
+
+            roots[i] = x;
+        }
+
+        return num_roots;
+    }
+
+    // Rotation and translation taking three world points onto three camera points, from the
+    // orthonormal frames both triangles span:
+    static bool AlignTriangles(const double world[3][3], const double cam[3][3], double* R, double* t)
+    {
+        double frames[2][9];
+        const double (*points[2])[3] = { world, cam };
+
+        for (int f=0; f<2; f++)
+        {
+            double e1[3], e2[3], e3[3], d2[3];
+            for (int k=0; k<3; k++)
+            {
+                e1[k] = points[f][1][k] - points[f][0][k];
+                d2[k] = points[f][2][k] - points[f][0][k];
+            }
+
+            Cross3(e1, d2, e3);
+            if (!Normalize3(e1) || !Normalize3(e3))
+                return false;
+
+            Cross3(e3, e1, e2);
+
+            // Columns e1, e2, e3:
+            for (int k=0; k<3; k++)
+            {
+                frames[f][k * 3 + 0] = e1[k];
+                frames[f][k * 3 + 1] = e2[k];
+                frames[f][k * 3 + 2] = e3[k];
+            }
+        }
+
+        // R = F_cam * F_world^T
+        for (int i=0; i<3; i++)
+        {
+            for (int j=0; j<3; j++)
+            {
+                R[i * 3 + j] = frames[1][i * 3 + 0] * frames[0][j * 3 + 0] +
+                               frames[1][i * 3 + 1] * frames[0][j * 3 + 1] +
+                               frames[1][i * 3 + 2] * frames[0][j * 3 + 2];
+            }
+        }
+
+        // Centroids:
+        for (int i=0; i<3; i++)
+        {
+            double world_mean = 0.0, cam_mean = 0.0;
+            for (int k=0; k<3; k++)
+            {
+                cam_mean += cam[k][i] / 3.0;
+                world_mean += (R[i * 3 + 0] * world[k][0] + R[i * 3 + 1] * world[k][1] +
+                               R[i * 3 + 2] * world[k][2]) / 3.0;
+            }
+
+            t[i] = cam_mean - world_mean;
+        }
+
+        return true;
+    }
+
+    // Grunert's P3P (as reviewed by Haralick et al. 1994). bearing holds unit rays. Writes up
+    // to four poses as row-major R and t, returns how many.
+    static int SolveP3P(const double world[3][3], const double bearing[3][3], double R_out[4][9], double t_out[4][3])
+    {
+        double d12[3], d13[3], d23[3];
+        for (int k=0; k<3; k++)
+        {
+            d12[k] = world[0][k] - world[1][k];
+            d13[k] = world[0][k] - world[2][k];
+            d23[k] = world[1][k] - world[2][k];
+        }
+
+        const double a2 = Dot3(d23, d23), b2 = Dot3(d13, d13), c2 = Dot3(d12, d12);
+        if (a2 < 1e-12 || b2 < 1e-12 || c2 < 1e-12)
+            return 0;
+
+        const double cos_alpha = Dot3(bearing[1], bearing[2]);
+        const double cos_beta = Dot3(bearing[0], bearing[2]);
+        const double cos_gamma = Dot3(bearing[0], bearing[1]);
+
+        const double amc = (a2 - c2) / b2;
+        const double apc = (a2 + c2) / b2;
+        const double bmc = (b2 - c2) / b2;
+        const double bma = (b2 - a2) / b2;
+
+        const double ca2 = cos_alpha * cos_alpha;
+        const double cb2 = cos_beta * cos_beta;
+        const double cg2 = cos_gamma * cos_gamma;
+
+        const double A4 = (amc - 1.0) * (amc - 1.0) - 4.0 * c2 / b2 * ca2;
+        const double A3 = 4.0 * (amc * (1.0 - amc) * cos_beta - (1.0 - apc) * cos_alpha * cos_gamma +
+                                 2.0 * c2 / b2 * ca2 * cos_beta);
+        const double A2 = 2.0 * (amc * amc - 1.0 + 2.0 * amc * amc * cb2 + 2.0 * bmc * ca2 -
+                                 4.0 * apc * cos_alpha * cos_beta * cos_gamma + 2.0 * bma * cg2);
+        const double A1 = 4.0 * (-amc * (1.0 + amc) * cos_beta + 2.0 * a2 / b2 * cg2 * cos_beta -
+                                 (1.0 - apc) * cos_alpha * cos_gamma);
+        const double A0 = (1.0 + amc) * (1.0 + amc) - 4.0 * a2 / b2 * cg2;
+
+        double roots[4];
+        int num_roots = SolveQuartic(A4, A3, A2, A1, A0, roots);
+
+        int num_solutions = 0;
+        for (int i=0; i<num_roots; i++)
+        {
+            const double v = roots[i];
+
+            double denom = 2.0 * (cos_gamma - v * cos_alpha);
+            if (fabs(denom) < 1e-12)
+                continue;
+
+            double u = ((-1.0 + amc) * v * v - 2.0 * amc * cos_beta * v + 1.0 + amc) / denom;
+
+            double s1_sq = b2 / (1.0 + v * v - 2.0 * v * cos_beta);
+            if (!(s1_sq > 0.0))
+                continue;
+
+            double s1 = sqrt(s1_sq);
+            double depth[3] = { s1, u * s1, v * s1 };
+            if (depth[1] <= 0.0 || depth[2] <= 0.0)
+                continue;
+
+            double cam[3][3];
+            for (int p=0; p<3; p++)
+            {
+                for (int k=0; k<3; k++)
+                    cam[p][k] = depth[p] * bearing[p][k];
+            }
+
+            if (AlignTriangles(world, cam, R_out[num_solutions], t_out[num_solutions]))
+                num_solutions++;
+        }
+
+        return num_solutions;
+    }
+
+    static int ScoreKernelScalar(const float* X, const float* Y, const float* Z,
+                                 const float* u, const float* v, int n,
+                                 const float* pose, const float* intrinsics, float max_sq_error)
+    {
+        int num_inliers = 0;
+
+        for (int i=0; i<n; i++)
+        {
+            float x = pose[0] * X[i] + pose[1] * Y[i] + pose[2] * Z[i] + pose[3];
+            float y = pose[4] * X[i] + pose[5] * Y[i] + pose[6] * Z[i] + pose[7];
+            float z = pose[8] * X[i] + pose[9] * Y[i] + pose[10] * Z[i] + pose[11];
+
+            if (z <= 0.0f)
+                continue;
+
+            float inv_z = 1.0f / z;
+            float du = intrinsics[0] * x * inv_z + intrinsics[2] - u[i];
+            float dv = intrinsics[1] * y * inv_z + intrinsics[3] - v[i];
+
+            if (du * du + dv * dv < max_sq_error)
+                num_inliers++;
+        }
+
+        return num_inliers;
+    }
+
+#ifdef PNP_HAVE_AVX2_KERNEL
+    __attribute__((target("avx2,fma")))
+    static int ScoreKernelAVX2(const float* X, const float* Y, const float* Z,
+                               const float* u, const float* v, int n,
+                               const float* pose, const float* intrinsics, float max_sq_error)
+    {
+        const __m256 r00 = _mm256_set1_ps(pose[0]), r01 = _mm256_set1_ps(pose[1]), r02 = _mm256_set1_ps(pose[2]), t0 = _mm256_set1_ps(pose[3]);
+        const __m256 r10 = _mm256_set1_ps(pose[4]), r11 = _mm256_set1_ps(pose[5]), r12 = _mm256_set1_ps(pose[6]), t1 = _mm256_set1_ps(pose[7]);
+        const __m256 r20 = _mm256_set1_ps(pose[8]), r21 = _mm256_set1_ps(pose[9]), r22 = _mm256_set1_ps(pose[10]), t2 = _mm256_set1_ps(pose[11]);
+        const __m256 fx = _mm256_set1_ps(intrinsics[0]), fy = _mm256_set1_ps(intrinsics[1]);
+        const __m256 cx = _mm256_set1_ps(intrinsics[2]), cy = _mm256_set1_ps(intrinsics[3]);
+        const __m256 th = _mm256_set1_ps(max_sq_error);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        int num_inliers = 0;
+        int i = 0;
+        for (; i+8<=n; i+=8)
+        {
+            __m256 px = _mm256_loadu_ps(X + i), py = _mm256_loadu_ps(Y + i), pz = _mm256_loadu_ps(Z + i);
+
+            __m256 x = _mm256_fmadd_ps(r00, px, _mm256_fmadd_ps(r01, py, _mm256_fmadd_ps(r02, pz, t0)));
+            __m256 y = _mm256_fmadd_ps(r10, px, _mm256_fmadd_ps(r11, py, _mm256_fmadd_ps(r12, pz, t1)));
+            __m256 z = _mm256_fmadd_ps(r20, px, _mm256_fmadd_ps(r21, py, _mm256_fmadd_ps(r22, pz, t2)));
+
+            __m256 inv_z = _mm256_div_ps(one, z);
+            __m256 du = _mm256_sub_ps(_mm256_fmadd_ps(_mm256_mul_ps(fx, x), inv_z, cx), _mm256_loadu_ps(u + i));
+            __m256 dv = _mm256_sub_ps(_mm256_fmadd_ps(_mm256_mul_ps(fy, y), inv_z, cy), _mm256_loadu_ps(v + i));
+            __m256 err = _mm256_fmadd_ps(du, du, _mm256_mul_ps(dv, dv));
+
+            __m256 inlier = _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GT_OQ), _mm256_cmp_ps(err, th, _CMP_LT_OQ));
+            num_inliers += __builtin_popcount(_mm256_movemask_ps(inlier));
+        }
+
+        return num_inliers + ScoreKernelScalar(X + i, Y + i, Z + i, u + i, v + i, n - i,
+                                               pose, intrinsics, max_sq_error);
+    }
+#endif
+
+#ifdef PNP_HAVE_NEON_KERNEL
+    static int ScoreKernelNEON(const float* X, const float* Y, const float* Z,
+                               const float* u, const float* v, int n,
+                               const float* pose, const float* intrinsics, float max_sq_error)
+    {
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        const float32x4_t th = vdupq_n_f32(max_sq_error);
+
+        uint32x4_t count = vdupq_n_u32(0);
+        int i = 0;
+        for (; i+4<=n; i+=4)
+        {
+            float32x4_t px = vld1q_f32(X + i), py = vld1q_f32(Y + i), pz = vld1q_f32(Z + i);
+
+            float32x4_t x = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(pose[3]), px, pose[0]), py, pose[1]), pz, pose[2]);
+            float32x4_t y = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(pose[7]), px, pose[4]), py, pose[5]), pz, pose[6]);
+            float32x4_t z = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(pose[11]), px, pose[8]), py, pose[9]), pz, pose[10]);
+
+            // Reciprocal estimate plus two Newton steps (ARMv7 has no vector divide):
+            float32x4_t inv_z = vrecpeq_f32(z);
+            inv_z = vmulq_f32(vrecpsq_f32(z, inv_z), inv_z);
+            inv_z = vmulq_f32(vrecpsq_f32(z, inv_z), inv_z);
+
+            float32x4_t du = vsubq_f32(vmlaq_n_f32(vdupq_n_f32(intrinsics[2]), vmulq_f32(x, inv_z), intrinsics[0]), vld1q_f32(u + i));
+            float32x4_t dv = vsubq_f32(vmlaq_n_f32(vdupq_n_f32(intrinsics[3]), vmulq_f32(y, inv_z), intrinsics[1]), vld1q_f32(v + i));
+            float32x4_t err = vmlaq_f32(vmulq_f32(dv, dv), du, du);
+
+            uint32x4_t inlier = vandq_u32(vcgtq_f32(z, zero), vcltq_f32(err, th));
+
+            // Lanes are all-ones for inliers, i.e. -1:
+            count = vsubq_u32(count, inlier);
+        }
+
+        int num_inliers = (int)(vgetq_lane_u32(count, 0) + vgetq_lane_u32(count, 1) +
+                                vgetq_lane_u32(count, 2) + vgetq_lane_u32(count, 3));
+
+        return num_inliers + ScoreKernelScalar(X + i, Y + i, Z + i, u + i, v + i, n - i,
+                                               pose, intrinsics, max_sq_error);
+    }
+#endif
+
+    PnPSolver::PnPSolver(const Mat& camera_matrix, const Mat& dist_coeff) : rng(PNP_RANSAC_SEED)
+    {
+        camera_matrix.convertTo(K, CV_64F);
+        dist = dist_coeff.clone();
+        undistorter = NULL;
+
+        fx = K.at<double>(0, 0);
+        fy = K.at<double>(1, 1);
+        cx = K.at<double>(0, 2);
+        cy = K.at<double>(1, 2);
+
+        SetRansacParameters(PNP_RANSAC_MAX_ITERATIONS, PNP_RANSAC_REPROJECTION_ERROR,
+                            PNP_RANSAC_CONFIDENCE, PNP_RANSAC_MIN_INLIERS);
+        ransac_backend = RANSAC_BACKEND_LEGACY;
+
+        kernel = ScoreKernelScalar;
+        kernel_name = "scalar";
+
+#if defined(PNP_HAVE_AVX2_KERNEL)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            kernel = ScoreKernelAVX2;
+            kernel_name = "avx2";
+        }
+#elif defined(PNP_HAVE_NEON_KERNEL)
+        kernel = ScoreKernelNEON;
+        kernel_name = "neon";
+#endif
+
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    void PnPSolver::SetRansacParameters(int max_iterations, float reprojection_error, double confidence,
+                                        int min_inliers)
+    {
+        this->max_iterations = max_iterations;
+        this->reprojection_error = reprojection_error;
+        this->confidence = confidence;
+        this->min_inliers = max(min_inliers, 4);
+    }
+
+    // [R|t] row-major as the score kernels take it:
+    static void MakePoseParams(const Matx33d &R, const Vec3d &t, float* pose)
+    {
+        for (int r=0; r<3; r++)
+        {
+            pose[4 * r] = (float)R(r, 0);
+            pose[4 * r + 1] = (float)R(r, 1);
+            pose[4 * r + 2] = (float)R(r, 2);
+            pose[4 * r + 3] = (float)t[r];
+        }
+    }
+
+    /*
+     RansacEngine problem over the correspondences of the running Solve: P3P samples,
+     scored by the solver's SIMD kernel and refit with its Gauss-Newton refinement.
+     */
+    class PnPProblem
+    {
+    public:
+
+        struct Model {
+            Matx33d R;
+            Vec3d t;
+            float pose[12];
+        };
+
+        PnPProblem(const PnPSolver& solver) : solver(solver)
+        {
+            intrinsics[0] = (float)solver.fx;
+            intrinsics[1] = (float)solver.fy;
+            intrinsics[2] = (float)solver.cx;
+            intrinsics[3] = (float)solver.cy;
+            max_sq_error = solver.reprojection_error * solver.reprojection_error;
+        }
+
+        static void MakeModel(const Matx33d& R, const Vec3d& t, Model& model)
+        {
+            model.R = R;
+            model.t = t;
+            MakePoseParams(R, t, model.pose);
+        }
+
+        int SampleSize(void) const { return 3; }
+        int NumPoints(void) const { return (int)solver.X.size(); }
+
+        void Solve(const int* sample, vector<Model>& models) const
+        {
+            double sol_R[4][9], sol_t[4][3];
+            int num_solutions = solver.SolveSample(sample, sol_R, sol_t);
+
+            models.resize(num_solutions);
+            for (int s=0; s<num_solutions; s++)
+            {
+                MakeModel(Matx33d(sol_R[s]), Vec3d(sol_t[s][0], sol_t[s][1], sol_t[s][2]), models[s]);
+            }
+        }
+
+        float Score(const Model& model, int begin, int end, float score, uchar* inliers, int& num_inliers) const
+        {
+            const float* X = &solver.X[0];
+            const float* Y = &solver.Y[0];
+            const float* Z = &solver.Z[0];
+            const float* u = &solver.u[0];
+            const float* v = &solver.v[0];
+
+            int count = 0;
+            if (inliers == NULL)
+            {
+                count = solver.kernel(X + begin, Y + begin, Z + begin, u + begin, v + begin, end - begin,
+                                      model.pose, intrinsics, max_sq_error);
+            }
+            else
+            {
+                // The mask is only needed for new best models, one point at a time is fine:
+                for (int i=begin; i<end; i++)
+                {
+                    inliers[i] = (uchar)ScoreKernelScalar(X + i, Y + i, Z + i, u + i, v + i, 1,
+                                                          model.pose, intrinsics, max_sq_error);
+                    count += inliers[i];
+                }
+            }
+
+            num_inliers += count;
+            return score + count;
+        }
+
+        bool Refit(const vector<int>& inliers, Model& model) const
+        {
+            Matx33d R = model.R;
+            Vec3d t = model.t;
+            solver.RefinePose(inliers, R, t);
+
+            MakeModel(R, t, model);
+            return true;
+        }
+
+    protected:
+        const PnPSolver& solver;
+        float intrinsics[4];
+        float max_sq_error;
+    };
+
+    int PnPSolver::ScoreHypothesis(const Matx33d &R, const Vec3d &t) const
+    {
+        float pose[12];
+        MakePoseParams(R, t, pose);
+        float intrinsics[4] = { (float)fx, (float)fy, (float)cx, (float)cy };
+
+        return kernel(&X[0], &Y[0], &Z[0], &u[0], &v[0], (int)X.size(), pose, intrinsics,
+                      reprojection_error * reprojection_error);
+    }
+
+    int PnPSolver::RequiredIterations(int num_inliers, int num_points) const
+    {
+        // Samples needed to draw three inliers at least once with the given confidence:
+        double w = (double)num_inliers / num_points;
+        double p_clean = w * w * w;
+
+        if (p_clean >= 1.0)
+            return 1;
+
+        if (p_clean <= 0.0)
+            return max_iterations;
+
+        double k = log(1.0 - confidence) / log(1.0 - p_clean);
+        return (int)min((double)max_iterations, ceil(k));
+    }
+
+    int PnPSolver::FindInliers(const Matx33d &R, const Vec3d &t, vector<int> &inliers) const
+    {
+        inliers.clear();
+
+        const double max_sq_error = reprojection_error * reprojection_error;
+        for (int i=0; i<X.size(); i++)
+        {
+            Vec3d p = R * Vec3d(X[i], Y[i], Z[i]) + t;
+            if (p[2] <= 0.0)
+                continue;
+
+            double du = fx * p[0] / p[2] + cx - u[i];
+            double dv = fy * p[1] / p[2] + cy - v[i];
+
+            if (du * du + dv * dv < max_sq_error)
+                inliers.push_back(i);
+        }
+
+        return (int)inliers.size();
+    }
+
+    void PnPSolver::RefinePose(const vector<int> &inliers, Matx33d &R, Vec3d &t) const
+    {
+        // Gauss-Newton on the pixel reprojection error, pose update exp(w) * [R|t] + tau:
+        for (int iter=0; iter<PNP_REFINE_ITERATIONS; iter++)
+        {
+            Matx66d H = Matx66d::zeros();
+            Matx61d g = Matx61d::zeros();
+
+            for (int k=0; k<inliers.size(); k++)
+            {
+                const int i = inliers[k];
+
+                Vec3d p = R * Vec3d(X[i], Y[i], Z[i]) + t;
+                if (p[2] <= 0.0)
+                    continue;
+
+                const double inv_z = 1.0 / p[2];
+                const double x = p[0], y = p[1];
+                const double eu = fx * x * inv_z + cx - u[i];
+                const double ev = fy * y * inv_z + cy - v[i];
+
+                const double ju[6] = {
+                    -fx * x * y * inv_z * inv_z, fx + fx * x * x * inv_z * inv_z, -fx * y * inv_z,
+                    fx * inv_z, 0.0, -fx * x * inv_z * inv_z
+                };
+                const double jv[6] = {
+                    -fy - fy * y * y * inv_z * inv_z, fy * x * y * inv_z * inv_z, fy * x * inv_z,
+                    0.0, fy * inv_z, -fy * y * inv_z * inv_z
+                };
+
+                for (int r=0; r<6; r++)
+                {
+                    for (int c=0; c<6; c++)
+                        H(r, c) += ju[r] * ju[c] + jv[r] * jv[c];
+
+                    g(r) += ju[r] * eu + jv[r] * ev;
+                }
+            }
+
+            Matx61d delta = H.solve(-g, DECOMP_CHOLESKY);
+
+            Matx33d dR = SE3::ExpSO3(Vec3d(delta(0), delta(1), delta(2)));
+            R = dR * R;
+            t = dR * t + Vec3d(delta(3), delta(4), delta(5));
+
+            if (delta.dot(delta) < PNP_REFINE_EPSILON)
+                break;
+        }
+    }
+
+    int PnPSolver::SolveSample(const int *idx, double sol_R[4][9], double sol_t[4][3]) const
+    {
+        double world[3][3], bearing[3][3];
+        for (int k=0; k<3; k++)
+        {
+            world[k][0] = X[idx[k]];
+            world[k][1] = Y[idx[k]];
+            world[k][2] = Z[idx[k]];
+
+            for (int c=0; c<3; c++)
+                bearing[k][c] = bearings[idx[k]][c];
+        }
+
+        // Skip (near) collinear samples:
+        double d1[3], d2[3], area[3];
+        for (int c=0; c<3; c++)
+        {
+            d1[c] = world[1][c] - world[0][c];
+            d2[c] = world[2][c] - world[0][c];
+        }
+        Cross3(d1, d2, area);
+        if (Dot3(area, area) < PNP_MIN_SAMPLE_AREA)
+            return 0;
+
+        return SolveP3P(world, bearing, sol_R, sol_t);
+    }
+
+    int PnPSolver::RunSampling(int needed_iterations, int &best_score, Matx33d &best_R, Vec3d &best_t)
+    {
+        const int n = (int)X.size();
+
+        int iter = 0;
+        for (; iter<needed_iterations; iter++)
+        {
+            int idx[3];
+            idx[0] = rng.uniform(0, n);
+            do { idx[1] = rng.uniform(0, n); } while (idx[1] == idx[0]);
+            do { idx[2] = rng.uniform(0, n); } while (idx[2] == idx[0] || idx[2] == idx[1]);
+
+            double sol_R[4][9], sol_t[4][3];
+            int num_solutions = SolveSample(idx, sol_R, sol_t);
+
+            for (int s=0; s<num_solutions; s++)
+            {
+                Matx33d hyp_R(sol_R[s]);
+                Vec3d hyp_t(sol_t[s][0], sol_t[s][1], sol_t[s][2]);
+
+                int score = ScoreHypothesis(hyp_R, hyp_t);
+                stats.hypotheses++;
+
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best_R = hyp_R;
+                    best_t = hyp_t;
+
+                    needed_iterations = RequiredIterations(score, n);
+                }
+            }
+        }
+
+        return iter;
+    }
+
+    int PnPSolver::RunEngine(const vector<int> *order, bool use_guess, int &best_score, Matx33d &best_R, Vec3d &best_t)
+    {
+        RansacOptions options;
+        options.max_iterations = max_iterations;
+        options.confidence = confidence;
+        options.seed = PNP_RANSAC_SEED;
+
+        PnPProblem problem(*this);
+        PnPProblem::Model model, guess;
+        if (use_guess)
+            PnPProblem::MakeModel(best_R, best_t, guess);
+
+        RansacEngine<PnPProblem> engine(options);
+        vector<uchar> mask;
+        if (engine.Run(problem, model, mask, order, use_guess ? &guess : NULL))
+        {
+            best_R = model.R;
+            best_t = model.t;
+            best_score = engine.GetStats().num_inliers;
+        }
+
+        stats.hypotheses += engine.GetStats().hypotheses;
+        return engine.GetStats().iterations;
+    }
+
+    bool PnPSolver::SolveOpenCV(const vector<Point3f> &object_points, const vector<Point2f> &image_points,
+                                SE3 &pose, Mat &inliers, bool use_guess)
+    {
+        int64 start = getTickCount();
+
+        Mat rvec, tvec;
+        if (use_guess)
+        {
+            Rodrigues(Mat(pose.GetRotation()), rvec);
+            tvec = Mat(pose.GetTranslation());
+        }
+
+        solvePnPRansac(object_points, image_points, K, dist, rvec, tvec, use_guess, max_iterations,
+                       reprojection_error, min_inliers, inliers, CV_ITERATIVE);
+
+        stats.num_inliers = inliers.rows;
+        stats.ransac_ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        stats.total_ms = stats.ransac_ms;
+
+        if (inliers.rows < min_inliers || rvec.empty() || tvec.empty())
+            return false;
+
+        Mat R;
+        Rodrigues(rvec, R);
+        R.convertTo(R, CV_64F);
+        tvec.convertTo(tvec, CV_64F);
+
+        pose = SE3(Matx33d((double*)R.data), Vec3d(tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2)));
+        return true;
+    }
+
+    bool PnPSolver::Solve(const vector<Point3f> &object_points, const vector<Point2f> &image_points,
+                          SE3 &pose, Mat &inliers, bool use_guess, const vector<int> *order)
+    {
+        int64 start = getTickCount();
+        memset(&stats, 0, sizeof(stats));
+        inliers.release();
+
+        if (object_points.size() != image_points.size())
+        {
+            CV_Error(0, "PnPSolver: object and image point counts differ");
+        }
+
+        const int n = (int)object_points.size();
+        if (n < min_inliers)
+            return false;
+
+        if (ransac_backend == RANSAC_BACKEND_OPENCV)
+            return SolveOpenCV(object_points, image_points, pose, inliers, use_guess);
+
+        // Normalized image coordinates, undistorted once:
+        vector<Point2f> normalized;
+        if (undistorter != NULL)
+            undistorter->UndistortNormalized(image_points, normalized);
+        else
+            undistortPoints(image_points, normalized, K, dist);
+
+        X.resize(n);
+        Y.resize(n);
+        Z.resize(n);
+        u.resize(n);
+        v.resize(n);
+        bearings.resize(n);
+
+        for (int i=0; i<n; i++)
+        {
+            X[i] = object_points[i].x;
+            Y[i] = object_points[i].y;
+            Z[i] = object_points[i].z;
+
+            u[i] = (float)(fx * normalized[i].x + cx);
+            v[i] = (float)(fy * normalized[i].y + cy);
+
+            Vec3d ray(normalized[i].x, normalized[i].y, 1.0);
+            bearings[i] = ray * (1.0 / norm(ray));
+        }
+
+        int best_score = -1;
+        Matx33d best_R;
+        Vec3d best_t;
+
+        int needed_iterations = max_iterations;
+
+        if (use_guess)
+        {
+            best_R = pose.GetRotation();
+            best_t = pose.GetTranslation();
+            best_score = ScoreHypothesis(best_R, best_t);
+            stats.hypotheses++;
+
+            needed_iterations = RequiredIterations(best_score, n);
+        }
+
+        if (ransac_backend == RANSAC_BACKEND_ENGINE)
+            stats.iterations = RunEngine(order, use_guess, best_score, best_R, best_t);
+        else
+            stats.iterations = RunSampling(needed_iterations, best_score, best_R, best_t);
+
+        stats.ransac_ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+        if (best_score < min_inliers)
+        {
+            stats.total_ms = stats.ransac_ms;
+            return false;
+        }
+
+        int64 refine_start = getTickCount();
+
+        vector<int> inlier_idx;
+        FindInliers(best_R, best_t, inlier_idx);
+
+        // EPnP on the inlier set, kept as the starting point if it does not lose inliers:
+        vector<Point3f> inlier_object;
+        vector<Point2f> inlier_image;
+        for (int k=0; k<inlier_idx.size(); k++)
+        {
+            inlier_object.push_back(object_points[inlier_idx[k]]);
+            inlier_image.push_back(image_points[inlier_idx[k]]);
+        }
+
+        Mat rvec_epnp, tvec_epnp;
+        if (solvePnP(inlier_object, inlier_image, K, dist, rvec_epnp, tvec_epnp, false, CV_EPNP))
+        {
+            Mat R_epnp;
+            Rodrigues(rvec_epnp, R_epnp);
+            R_epnp.convertTo(R_epnp, CV_64F);
+            tvec_epnp.convertTo(tvec_epnp, CV_64F);
+
+            Matx33d epnp_R((double*)R_epnp.data);
+            Vec3d epnp_t(tvec_epnp.at<double>(0), tvec_epnp.at<double>(1), tvec_epnp.at<double>(2));
+
+            if (ScoreHypothesis(epnp_R, epnp_t) >= best_score)
+            {
+                best_R = epnp_R;
+                best_t = epnp_t;
+            }
+        }
+
+        RefinePose(inlier_idx, best_R, best_t);
+        FindInliers(best_R, best_t, inlier_idx);
+
+        // One more pass on the refined inlier set:
+        if ((int)inlier_idx.size() >= min_inliers)
+        {
+            RefinePose(inlier_idx, best_R, best_t);
+            FindInliers(best_R, best_t, inlier_idx);
+        }
+
+        stats.num_inliers = (int)inlier_idx.size();
+        stats.refine_ms = (getTickCount() - refine_start) * 1000.0 / getTickFrequency();
+        stats.total_ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+        if (stats.num_inliers < min_inliers)
+            return false;
+
+        pose = SE3(best_R, best_t);
+
+        inliers.create(stats.num_inliers, 1, CV_32S);
+        for (int k=0; k<inlier_idx.size(); k++)
+        {
+            inliers.at<int>(k) = inlier_idx[k];
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef __shield_slam__PnPSolver__
+#define __shield_slam__PnPSolver__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "Common.hpp"
+#include "Pose.hpp"
+#include "Ransac.hpp"
+#include "Undistorter.hpp"
+
+#define PNP_RANSAC_MAX_ITERATIONS 300
+#define PNP_RANSAC_CONFIDENCE 0.99
+#define PNP_RANSAC_REPROJECTION_ERROR 8.0f
+#define PNP_RANSAC_MIN_INLIERS 10
+
+// Samples whose world points span less area than this (squared) are skipped as collinear:
+#define PNP_MIN_SAMPLE_AREA 1e-10
+
+#define PNP_REFINE_ITERATIONS 10
+#define PNP_REFINE_EPSILON 1e-8
+
+#define PNP_RANSAC_SEED 0x5f3759df
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    struct PnPStats {
+        int iterations;
+        int hypotheses;
+        int num_inliers;
+        double ransac_ms;
+        double refine_ms;
+        double total_ms;
+    };
+
+    /*
+     Pose RANSAC for 3D-2D correspondences. Every sample of three points goes through a P3P
+     solver (Grunert's quartic), all of its up to four poses are scored on every
+     correspondence by a SIMD reprojection kernel, and the iteration count shrinks with the
+     best inlier ratio seen so far. The winning inlier set is refit with EPnP followed by
+     Gauss-Newton on the reprojection error.
+
+     Image points are undistorted once per call, through the lookup table of an Undistorter
+     when one is set, so scoring and refinement run on the pinhole model. Poses are
+     world-to-camera.
+     */
+    class PnPSolver
+    {
+    public:
+
+        PnPSolver(const Mat& camera_matrix, const Mat& dist_coeff);
+        virtual ~PnPSolver() = default;
+
+        void SetRansacParameters(int max_iterations, float reprojection_error, double confidence,
+                                 int min_inliers);
+        void SetRansacBackend(RansacBackend backend) { ransac_backend = backend; }
+        // Replaces undistortPoints; the table must match camera_matrix and dist_coeff:
+        void SetUndistorter(const Undistorter* lut) { undistorter = lut; }
+
+        // Inliers are returned as an Nx1 CV_32S column of correspondence indices, the same
+        // layout solvePnPRansac produces. With use_guess, the incoming pose is scored as the
+        // first hypothesis, so a good prediction ends the sampling early. order (best first)
+        // enables PROSAC sampling with the RansacEngine backend.
+        bool Solve(const vector<Point3f>& object_points, const vector<Point2f>& image_points,
+                   SE3& pose, Mat& inliers, bool use_guess = false, const vector<int>* order = NULL);
+
+        const PnPStats& GetStats(void) const { return stats; }
+        const char* GetKernelName(void) const { return kernel_name; }
+
+        typedef int (*ScoreKernel)(const float* X, const float* Y, const float* Z,
+                                   const float* u, const float* v, int n,
+                                   const float* pose, const float* intrinsics, float max_sq_error);
+
+    private:
+
+        friend class PnPProblem;
+
+        // P3P on the correspondences idx[0..2]; no solutions for (near) collinear samples:
+        int SolveSample(const int* idx, double sol_R[4][9], double sol_t[4][3]) const;
+        int RunSampling(int needed_iterations, int& best_score, Matx33d& best_R, Vec3d& best_t);
+        int RunEngine(const vector<int>* order, bool use_guess, int& best_score, Matx33d& best_R, Vec3d& best_t);
+        bool SolveOpenCV(const vector<Point3f>& object_points, const vector<Point2f>& image_points,
+                         SE3& pose, Mat& inliers, bool use_guess);
+
+        int ScoreHypothesis(const Matx33d& R, const Vec3d& t) const;
+        int RequiredIterations(int num_inliers, int num_points) const;
+        int FindInliers(const Matx33d& R, const Vec3d& t, vector<int>& inliers) const;
+        void RefinePose(const vector<int>& inliers, Matx33d& R, Vec3d& t) const;
+
+    protected:
+        Mat K, dist;
+        double fx, fy, cx, cy;
+        const Undistorter* undistorter;
+
+        int max_iterations;
+        float reprojection_error;
+        double confidence;
+        int min_inliers;
+        RansacBackend ransac_backend;
+
+        // Correspondences in SoA layout; u, v are undistorted pixel coordinates:
+        vector<float> X, Y, Z, u, v;
+        vector<Vec3d> bearings;
+
+        ScoreKernel kernel;
+        const char* kernel_name;
+
+        RNG rng;
+        PnPStats stats;
+    };
+}
+
+#endif /* defined(__shield_slam__PnPSolver__) */
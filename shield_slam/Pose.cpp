@@ -0,0 +1,265 @@
+#include "Pose.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    SE3::SE3(const Mat &rot, const Mat &trans)
+    {
+        if (rot.total() != 9 || trans.total() != 3)
+        {
+            CV_Error(0, "SE3: expected a 3x3 rotation and a 3x1 translation");
+        }
+        
+        Mat R_64, t_64;
+        rot.convertTo(R_64, CV_64F);
+        trans.convertTo(t_64, CV_64F);
+        
+        const double* r = R_64.ptr<double>();
+        const double* p = t_64.ptr<double>();
+        
+        R = Matx33d(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8]);
+        t = Vec3d(p[0], p[1], p[2]);
+    }
+    
+    Matx33d SE3::Hat(const Vec3d &w)
+    {
+        return Matx33d(0.0, -w[2], w[1],
+                       w[2], 0.0, -w[0],
+                       -w[1], w[0], 0.0);
+    }
+    
+    Matx33d SE3::ExpSO3(const Vec3d &w)
+    {
+        const double theta2 = w.dot(w);
+        const Matx33d W = Hat(w);
+        
+        double a, b;
+        if (theta2 < POSE_SMALL_ANGLE)
+        {
+            a = 1.0 - theta2 / 6.0;
+            b = 0.5 - theta2 / 24.0;
+        }
+        else
+        {
+            const double theta = sqrt(theta2);
+            a = sin(theta) / theta;
+            b = (1.0 - cos(theta)) / theta2;
+        }
+        
+        return Matx33d::eye() + W * a + (W * W) * b;
+    }
+    
+    Vec3d SE3::LogSO3(const Matx33d &rot)
+    {
+        const double cos_theta = max(-1.0, min(1.0, 0.5 * (rot(0, 0) + rot(1, 1) + rot(2, 2) - 1.0)));
+        const Vec3d vee(rot(2, 1) - rot(1, 2), rot(0, 2) - rot(2, 0), rot(1, 0) - rot(0, 1));
+        
+        // Near pi the antisymmetric part vanishes; take the axis from R + I = 2 a a^T instead:
+        if (cos_theta < -1.0 + 1e-6)
+        {
+            int k = 0;
+            if (rot(1, 1) > rot(k, k)) k = 1;
+            if (rot(2, 2) > rot(k, k)) k = 2;
+            
+            Vec3d axis;
+            const double a_k = sqrt(max(0.0, 0.5 * (rot(k, k) + 1.0)));
+            for (int i=0; i<3; i++)
+                axis[i] = (i == k) ? a_k : 0.5 * (rot(i, k) + rot(k, i)) / (2.0 * a_k);
+            
+            axis *= 1.0 / norm(axis);
+            
+            // Sign of the axis follows the remaining antisymmetric part:
+            if (axis.dot(vee) < 0.0)
+                axis = -axis;
+            
+            return axis * acos(cos_theta);
+        }
+        
+        const double theta = acos(cos_theta);
+        const double factor = (theta < 1e-5) ? 0.5 + theta * theta / 12.0 : 0.5 * theta / sin(theta);
+        
+        return vee * factor;
+    }
+    
+    SE3 SE3::Exp(const Vec6d &xi)
+    {
+        const Vec3d w(xi[0], xi[1], xi[2]);
+        const Vec3d v(xi[3], xi[4], xi[5]);
+        
+        const double theta2 = w.dot(w);
+        const Matx33d W = Hat(w);
+        
+        double b, c;
+        if (theta2 < POSE_SMALL_ANGLE)
+        {
+            b = 0.5 - theta2 / 24.0;
+            c = 1.0 / 6.0 - theta2 / 120.0;
+        }
+        else
+        {
+            const double theta = sqrt(theta2);
+            b = (1.0 - cos(theta)) / theta2;
+            c = (theta - sin(theta)) / (theta2 * theta);
+        }
+        
+        const Matx33d V = Matx33d::eye() + W * b + (W * W) * c;
+        return SE3(ExpSO3(w), V * v);
+    }
+    
+    Vec6d SE3::Log(void) const
+    {
+        const Vec3d w = LogSO3(R);
+        
+        const double theta2 = w.dot(w);
+        const Matx33d W = Hat(w);
+        
+        double c;
+        if (theta2 < POSE_SMALL_ANGLE)
+        {
+            c = 1.0 / 12.0 + theta2 / 720.0;
+        }
+        else
+        {
+            const double theta = sqrt(theta2);
+            c = (1.0 - 0.5 * theta * sin(theta) / (1.0 - cos(theta))) / theta2;
+        }
+        
+        const Matx33d V_inv = Matx33d::eye() - W * 0.5 + (W * W) * c;
+        const Vec3d v = V_inv * t;
+        
+        return Vec6d(w[0], w[1], w[2], v[0], v[1], v[2]);
+    }
+    
+    SE3 SE3::FromQuaternion(const Vec4d &q, const Vec3d &trans)
+    {
+        const double n = sqrt(q.dot(q));
+        const double w = q[0] / n, x = q[1] / n, y = q[2] / n, z = q[3] / n;
+        
+        Matx33d rot(1.0 - 2.0 * (y * y + z * z), 2.0 * (x * y - w * z), 2.0 * (x * z + w * y),
+                    2.0 * (x * y + w * z), 1.0 - 2.0 * (x * x + z * z), 2.0 * (y * z - w * x),
+                    2.0 * (x * z - w * y), 2.0 * (y * z + w * x), 1.0 - 2.0 * (x * x + y * y));
+        
+        return SE3(rot, trans);
+    }
+    
+    Vec4d SE3::GetQuaternion(void) const
+    {
+        // Largest of the four candidates keeps the division well conditioned:
+        const double tr = R(0, 0) + R(1, 1) + R(2, 2);
+        
+        Vec4d q;
+        if (tr > 0.0)
+        {
+            const double s = 2.0 * sqrt(tr + 1.0);
+            q = Vec4d(0.25 * s, (R(2, 1) - R(1, 2)) / s, (R(0, 2) - R(2, 0)) / s, (R(1, 0) - R(0, 1)) / s);
+        }
+        else if (R(0, 0) > R(1, 1) && R(0, 0) > R(2, 2))
+        {
+            const double s = 2.0 * sqrt(1.0 + R(0, 0) - R(1, 1) - R(2, 2));
+            q = Vec4d((R(2, 1) - R(1, 2)) / s, 0.25 * s, (R(0, 1) + R(1, 0)) / s, (R(0, 2) + R(2, 0)) / s);
+        }
+        else if (R(1, 1) > R(2, 2))
+        {
+            const double s = 2.0 * sqrt(1.0 + R(1, 1) - R(0, 0) - R(2, 2));
+            q = Vec4d((R(0, 2) - R(2, 0)) / s, (R(0, 1) + R(1, 0)) / s, 0.25 * s, (R(1, 2) + R(2, 1)) / s);
+        }
+        else
+        {
+            const double s = 2.0 * sqrt(1.0 + R(2, 2) - R(0, 0) - R(1, 1));
+            q = Vec4d((R(1, 0) - R(0, 1)) / s, (R(0, 2) + R(2, 0)) / s, (R(1, 2) + R(2, 1)) / s, 0.25 * s);
+        }
+        
+        return q[0] < 0.0 ? -q : q;
+    }
+    
+    SE3 SE3::Retract(const Vec6d &delta) const
+    {
+        const Matx33d dR = ExpSO3(Vec3d(delta[0], delta[1], delta[2]));
+        return SE3(dR * R, dR * t + Vec3d(delta[3], delta[4], delta[5]));
+    }
+    
+    Matx34d SE3::GetMatrix3x4(void) const
+    {
+        return Matx34d(R(0, 0), R(0, 1), R(0, 2), t[0],
+                       R(1, 0), R(1, 1), R(1, 2), t[1],
+                       R(2, 0), R(2, 1), R(2, 2), t[2]);
+    }
+    
+    // Left Jacobian-like factor W of the similarity exponential, t = W v:
+    static Matx33d SimilarityW(const Vec3d &w, double sigma)
+    {
+        const double theta2 = w.dot(w);
+        const double theta = sqrt(theta2);
+        const double scale = exp(sigma);
+        const Matx33d W = SE3::Hat(w);
+        
+        double a, b, c;
+        if (fabs(sigma) < POSE_SMALL_ANGLE)
+        {
+            c = 1.0;
+            if (theta2 < POSE_SMALL_ANGLE)
+            {
+                a = 0.5;
+                b = 1.0 / 6.0;
+            }
+            else
+            {
+                a = (1.0 - cos(theta)) / theta2;
+                b = (theta - sin(theta)) / (theta2 * theta);
+            }
+        }
+        else
+        {
+            c = (scale - 1.0) / sigma;
+            if (theta2 < POSE_SMALL_ANGLE)
+            {
+                a = ((sigma - 1.0) * scale + 1.0) / (sigma * sigma);
+                b = (0.5 * scale * sigma * sigma + scale - 1.0 - sigma * scale) / (sigma * sigma * sigma);
+            }
+            else
+            {
+                const double sa = scale * sin(theta);
+                const double sb = scale * cos(theta);
+                const double sc = theta2 + sigma * sigma;
+                a = (sa * sigma + (1.0 - sb) * theta) / (theta * sc);
+                b = (c - ((sb - 1.0) * sigma + sa * theta) / sc) / theta2;
+            }
+        }
+        
+        return W * a + (W * W) * b + Matx33d::eye() * c;
+    }
+    
+    Sim3 Sim3::Exp(const Vec7d &xi)
+    {
+        const Vec3d w(xi[0], xi[1], xi[2]);
+        const Vec3d v(xi[3], xi[4], xi[5]);
+        const double sigma = xi[6];
+        
+        return Sim3(SE3::ExpSO3(w), SimilarityW(w, sigma) * v, exp(sigma));
+    }
+    
+    Vec7d Sim3::Log(void) const
+    {
+        const Vec3d w = SE3::LogSO3(R);
+        const double sigma = log(s);
+        
+        Matx31d v = SimilarityW(w, sigma).solve(Matx31d(t[0], t[1], t[2]), DECOMP_LU);
+        
+        Vec7d xi;
+        xi[0] = w[0]; xi[1] = w[1]; xi[2] = w[2];
+        xi[3] = v(0); xi[4] = v(1); xi[5] = v(2);
+        xi[6] = sigma;
+        
+        return xi;
+    }
+    
+    Sim3 Sim3::Inverse(void) const
+    {
+        const Matx33d R_t = R.t();
+        const double inv_s = 1.0 / s;
+        
+        return Sim3(R_t, -(R_t * t) * inv_s, inv_s);
+    }
+}
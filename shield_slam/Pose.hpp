@@ -0,0 +1,108 @@
+#ifndef __shield_slam__Pose__
+#define __shield_slam__Pose__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+
+// Below this angle (rad) exp/log switch to their Taylor expansions:
+#define POSE_SMALL_ANGLE 1e-10
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+    
+    typedef Vec<double, 7> Vec7d;
+    
+    /*
+     Rigid transform x' = R x + t as a fixed-size value: no heap allocation, no refcounting
+     and no bounds-checked element access. Camera poses are world-to-camera throughout.
+     
+     Tangent vectors are ordered (w, v): rotation first, then translation. Exp/Log are the
+     exact group maps; Retract is the update the Gauss-Newton solvers use, rotating about the
+     camera centre and adding the translation increment directly.
+     */
+    class SE3
+    {
+    public:
+        
+        SE3() : R(Matx33d::eye()), t(0.0, 0.0, 0.0) {}
+        SE3(const Matx33d& rot, const Vec3d& trans) : R(rot), t(trans) {}
+        
+        // From 3x3 and 3x1 Mats of any depth, for the OpenCV boundary:
+        SE3(const Mat& rot, const Mat& trans);
+        
+        static SE3 Exp(const Vec6d& xi);
+        Vec6d Log(void) const;
+        
+        static Matx33d ExpSO3(const Vec3d& w);
+        static Vec3d LogSO3(const Matx33d& rot);
+        static Matx33d Hat(const Vec3d& w);
+        
+        // Unit quaternion (w, x, y, z) of the rotation:
+        static SE3 FromQuaternion(const Vec4d& q, const Vec3d& trans);
+        Vec4d GetQuaternion(void) const;
+        
+        SE3 Inverse(void) const { Matx33d R_t = R.t(); return SE3(R_t, -(R_t * t)); }
+        SE3 Retract(const Vec6d& delta) const;
+        
+        SE3 operator*(const SE3& other) const { return SE3(R * other.R, R * other.t + t); }
+        Vec3d operator*(const Vec3d& p) const { return R * p + t; }
+        Vec3d operator*(const Point3f& p) const { return R * Vec3d(p.x, p.y, p.z) + t; }
+        
+        // Depth of p in this camera, without forming the other two coordinates:
+        double Depth(const Vec3d& p) const { return R(2, 0) * p[0] + R(2, 1) * p[1] + R(2, 2) * p[2] + t[2]; }
+        
+        const Matx33d& GetRotation(void) const { return R; }
+        const Vec3d& GetTranslation(void) const { return t; }
+        Vec3d GetCenter(void) const { return -(R.t() * t); }
+        Matx34d GetMatrix3x4(void) const;
+        
+        // Copies as CV_64F Mats, for APIs that still take them:
+        Mat GetRotationMat(void) const { return Mat(R, true); }
+        Mat GetTranslationMat(void) const { return Mat(t, true); }
+        
+    private:
+        
+    protected:
+        Matx33d R;
+        Vec3d t;
+    };
+    
+    /*
+     Similarity x' = s R x + t. Tangent vectors are (w, v, sigma) with s = exp(sigma).
+     */
+    class Sim3
+    {
+    public:
+        
+        Sim3() : R(Matx33d::eye()), t(0.0, 0.0, 0.0), s(1.0) {}
+        Sim3(const Matx33d& rot, const Vec3d& trans, double scale) : R(rot), t(trans), s(scale) {}
+        explicit Sim3(const SE3& pose) : R(pose.GetRotation()), t(pose.GetTranslation()), s(1.0) {}
+        
+        static Sim3 Exp(const Vec7d& xi);
+        Vec7d Log(void) const;
+        
+        Sim3 Inverse(void) const;
+        
+        Sim3 operator*(const Sim3& other) const { return Sim3(R * other.R, s * (R * other.t) + t, s * other.s); }
+        Vec3d operator*(const Vec3d& p) const { return s * (R * p) + t; }
+        
+        const Matx33d& GetRotation(void) const { return R; }
+        const Vec3d& GetTranslation(void) const { return t; }
+        double GetScale(void) const { return s; }
+        
+        // Rigid part with the translation brought back to metric scale:
+        SE3 ToSE3(void) const { return SE3(R, t * (1.0 / s)); }
+        
+    private:
+        
+    protected:
+        Matx33d R;
+        Vec3d t;
+        double s;
+    };
+}
+
+#endif /* defined(__shield_slam__Pose__) */
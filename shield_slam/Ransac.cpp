@@ -0,0 +1,135 @@
+#include "Ransac.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    RansacOptions::RansacOptions()
+    {
+        max_iterations = RANSAC_DEFAULT_MAX_ITERATIONS;
+        confidence = RANSAC_DEFAULT_CONFIDENCE;
+        seed = RANSAC_DEFAULT_SEED;
+
+        use_prosac = true;
+        use_sprt = true;
+        use_local_optimization = true;
+        lo_iterations = RANSAC_LO_ITERATIONS;
+    }
+
+    void RansacOrderByDistance(const vector<DMatch> &matches, vector<int> &order)
+    {
+        order.resize(matches.size());
+        for (int i=0; i<order.size(); i++)
+            order[i] = i;
+
+        // Stable, so equal distances keep match order:
+        stable_sort(order.begin(), order.end(), [&matches](int a, int b) {
+            return matches[a].distance < matches[b].distance;
+        });
+    }
+
+    int RansacRequiredIterations(int num_inliers, int num_points, int sample_size, double confidence,
+                                 int max_iterations)
+    {
+        if (num_points <= 0)
+            return max_iterations;
+
+        double w = (double)num_inliers / num_points;
+        double p_clean = pow(w, sample_size);
+
+        if (p_clean >= 1.0)
+            return 1;
+
+        if (p_clean <= 0.0)
+            return max_iterations;
+
+        double k = log(1.0 - confidence) / log(1.0 - p_clean);
+        return (int)min((double)max_iterations, ceil(k));
+    }
+
+    // Reference: Chum & Matas, "Optimal Randomized RANSAC", PAMI 2008
+    double SprtLogThreshold(double epsilon, double delta)
+    {
+        // Information gained per verified point, and the threshold A = K + log(A):
+        double C = (1.0 - delta) * log((1.0 - delta) / (1.0 - epsilon)) + delta * log(delta / epsilon);
+        double K = RANSAC_SPRT_MODEL_COST * C + 1.0;
+
+        double A = K;
+        for (int i=0; i<10; i++)
+        {
+            A = K + log(A);
+        }
+
+        return log(A);
+    }
+
+    RansacSampler::RansacSampler(int num_points, int sample_size, unsigned int seed, const vector<int>* order)
+        : num_points(num_points), sample_size(sample_size), order(order), rng(seed)
+    {
+        // T_m = T_N * prod_i (m - i) / (N - i), the expected draws of the top m points:
+        prosac_n = sample_size;
+        prosac_t = 0;
+        prosac_T_n = RANSAC_PROSAC_MAX_SAMPLES;
+        for (int i=0; i<sample_size; i++)
+        {
+            prosac_T_n *= (double)(sample_size - i) / (num_points - i);
+        }
+        prosac_T_n_prime = 1.0;
+    }
+
+    int RansacSampler::DrawFromPool(int pool_size, int *sample, int count)
+    {
+        for (int j=0; j<count; j++)
+        {
+            int k;
+            bool repeated;
+            do
+            {
+                k = rng.uniform(0, pool_size);
+                repeated = false;
+                for (int i=0; i<j; i++)
+                    repeated = repeated || sample[i] == k;
+            } while (repeated);
+
+            sample[j] = k;
+        }
+
+        return count;
+    }
+
+    // Reference: Chum & Matas, "Matching with PROSAC - Progressive Sample Consensus", CVPR 2005
+    void RansacSampler::Draw(int *sample)
+    {
+        if (order == NULL)
+        {
+            DrawFromPool(num_points, sample, sample_size);
+            return;
+        }
+
+        prosac_t++;
+        if (prosac_t > prosac_T_n_prime && prosac_n < num_points)
+        {
+            double T_next = prosac_T_n * (prosac_n + 1) / (prosac_n + 1 - sample_size);
+            prosac_T_n_prime += ceil(T_next - prosac_T_n);
+            prosac_T_n = T_next;
+            prosac_n++;
+        }
+
+        // Either uniform over the current pool, or the newest point plus m - 1 from before it:
+        if (prosac_T_n_prime < prosac_t)
+        {
+            DrawFromPool(prosac_n, sample, sample_size);
+        }
+        else
+        {
+            DrawFromPool(prosac_n - 1, sample, sample_size - 1);
+            sample[sample_size - 1] = prosac_n - 1;
+        }
+
+        for (int j=0; j<sample_size; j++)
+        {
+            sample[j] = (*order)[sample[j]];
+        }
+    }
+}
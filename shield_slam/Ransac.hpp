@@ -0,0 +1,339 @@
+#ifndef __shield_slam__Ransac__
+#define __shield_slam__Ransac__
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Common.hpp"
+
+#define RANSAC_DEFAULT_MAX_ITERATIONS 500
+#define RANSAC_DEFAULT_CONFIDENCE 0.99
+#define RANSAC_DEFAULT_SEED 0x2545f491
+
+// Correspondences scored between two SPRT decisions:
+#define RANSAC_SPRT_BLOCK_SIZE 32
+// Initial SPRT estimates: inlier ratio of a good model (epsilon) and fraction of points
+// consistent with a bad one (delta); both adapt during the run:
+#define RANSAC_SPRT_EPSILON 0.2
+#define RANSAC_SPRT_DELTA 0.05
+// Cost of drawing and solving one sample, in point evaluations:
+#define RANSAC_SPRT_MODEL_COST 200.0
+
+#define RANSAC_LO_ITERATIONS 4
+
+// PROSAC: samples after which drawing is uniform over all points (T_N in Chum & Matas):
+#define RANSAC_PROSAC_MAX_SAMPLES 200000
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // Where a module runs its robust estimation, selectable for benchmarking:
+    enum RansacBackend {
+        RANSAC_BACKEND_LEGACY = 0,  // the module's own sampling loop
+        RANSAC_BACKEND_ENGINE = 1,  // RansacEngine
+        RANSAC_BACKEND_OPENCV = 2,  // findHomography, findFundamentalMat, solvePnPRansac
+    };
+
+    struct RansacOptions {
+        RansacOptions();
+
+        int max_iterations;
+        double confidence;
+        unsigned int seed;
+
+        bool use_prosac;
+        bool use_sprt;
+        bool use_local_optimization;
+        int lo_iterations;
+    };
+
+    struct RansacStats {
+        int iterations;
+        int hypotheses;
+        int sprt_rejected;
+        int lo_runs;
+        int lo_improved;
+        int num_inliers;
+        float score;
+        double total_ms;
+    };
+
+    // Indices of matches by ascending descriptor distance, the PROSAC order:
+    void RansacOrderByDistance(const vector<DMatch>& matches, vector<int>& order);
+
+    // Samples still needed to draw one all-inlier sample of sample_size with the given confidence:
+    int RansacRequiredIterations(int num_inliers, int num_points, int sample_size, double confidence,
+                                 int max_iterations);
+
+    // log of the SPRT decision threshold A for the given epsilon and delta:
+    double SprtLogThreshold(double epsilon, double delta);
+
+    /*
+     Draws minimal samples without repeated indices. Uniform over all points, or with an
+     order (best first) the PROSAC progressive schedule: early samples come from the top
+     of the order, and the pool grows until sampling is uniform after
+     RANSAC_PROSAC_MAX_SAMPLES draws.
+     */
+    class RansacSampler
+    {
+    public:
+
+        RansacSampler(int num_points, int sample_size, unsigned int seed, const vector<int>* order = NULL);
+        virtual ~RansacSampler() = default;
+
+        void Draw(int* sample);
+
+    private:
+
+        int DrawFromPool(int pool_size, int* sample, int count);
+
+    protected:
+        int num_points, sample_size;
+        const vector<int>* order;
+        RNG rng;
+
+        // PROSAC schedule: pool size n, draw count t and the growth terms T_n, T'_n:
+        int prosac_n;
+        int prosac_t;
+        double prosac_T_n;
+        double prosac_T_n_prime;
+    };
+
+    /*
+     Generic RANSAC over a Problem that provides:
+
+       typedef ... Model;
+       int SampleSize(void) const;
+       int NumPoints(void) const;
+       // Minimal solver; clears models and adds every solution of the sample:
+       void Solve(const int* sample, vector<Model>& models) const;
+       // Scores points [begin, end) on top of score (higher is better) and counts inliers;
+       // inliers is indexed by point and may be NULL while hypotheses are only ranked:
+       float Score(const Model& model, int begin, int end, float score,
+                   uchar* inliers, int& num_inliers) const;
+       // Non-minimal fit on an inlier set, for local optimization:
+       bool Refit(const vector<int>& inliers, Model& model) const;
+
+     Hypotheses are scored in blocks of RANSAC_SPRT_BLOCK_SIZE points, and with SPRT a
+     hypothesis is dropped as soon as its likelihood ratio says it is bad. Every new best
+     model is refined with LO-RANSAC and shrinks the iteration count. A run is
+     deterministic for a given seed.
+     */
+    template <class Problem>
+    class RansacEngine
+    {
+    public:
+
+        typedef typename Problem::Model Model;
+
+        RansacEngine(const RansacOptions& options = RansacOptions()) : options(options)
+        {
+            memset(&stats, 0, sizeof(stats));
+        }
+        virtual ~RansacEngine() = default;
+
+        // order (best first) enables PROSAC; guess, if given, is scored before any sample:
+        bool Run(const Problem& problem, Model& best_model, vector<uchar>& best_inliers,
+                 const vector<int>* order = NULL, const Model* guess = NULL);
+
+        const RansacStats& GetStats(void) const { return stats; }
+
+    private:
+
+        // Full score with inlier mask; returns the score:
+        float Evaluate(const Problem& problem, const Model& model, vector<uchar>& inliers,
+                       int& num_inliers) const;
+        // SPRT-gated score; false once the hypothesis is rejected:
+        bool EvaluateSprt(const Problem& problem, const Model& model, double epsilon, double delta,
+                          double log_A, float& score, int& num_inliers, int& num_tested) const;
+        void LocalOptimize(const Problem& problem, Model& model, vector<uchar>& inliers,
+                           float& score, int& num_inliers);
+
+    protected:
+        RansacOptions options;
+        RansacStats stats;
+    };
+
+    template <class Problem>
+    float RansacEngine<Problem>::Evaluate(const Problem &problem, const Model &model, vector<uchar> &inliers,
+                                          int &num_inliers) const
+    {
+        const int n = problem.NumPoints();
+        inliers.resize(n);
+        num_inliers = 0;
+
+        return problem.Score(model, 0, n, 0.0f, &inliers[0], num_inliers);
+    }
+
+    template <class Problem>
+    bool RansacEngine<Problem>::EvaluateSprt(const Problem &problem, const Model &model, double epsilon,
+                                             double delta, double log_A, float &score, int &num_inliers,
+                                             int &num_tested) const
+    {
+        const int n = problem.NumPoints();
+        const double log_in = log(delta / epsilon);
+        const double log_out = log((1.0 - delta) / (1.0 - epsilon));
+
+        score = 0.0f;
+        num_inliers = 0;
+        num_tested = 0;
+
+        double log_lambda = 0.0;
+        for (int begin=0; begin<n; begin+=RANSAC_SPRT_BLOCK_SIZE)
+        {
+            const int end = min(n, begin + RANSAC_SPRT_BLOCK_SIZE);
+            const int prev_inliers = num_inliers;
+
+            score = problem.Score(model, begin, end, score, NULL, num_inliers);
+            num_tested = end;
+
+            if (!options.use_sprt)
+                continue;
+
+            // Wald's likelihood ratio, one factor per point in the block:
+            const int k = num_inliers - prev_inliers;
+            log_lambda += k * log_in + (end - begin - k) * log_out;
+
+            if (log_lambda > log_A)
+                return false;
+        }
+
+        return true;
+    }
+
+    template <class Problem>
+    void RansacEngine<Problem>::LocalOptimize(const Problem &problem, Model &model, vector<uchar> &inliers,
+                                              float &score, int &num_inliers)
+    {
+        stats.lo_runs++;
+
+        vector<int> inlier_idx;
+        vector<uchar> lo_inliers;
+        for (int it=0; it<options.lo_iterations; it++)
+        {
+            inlier_idx.clear();
+            for (int i=0; i<inliers.size(); i++)
+            {
+                if (inliers[i])
+                    inlier_idx.push_back(i);
+            }
+
+            if (inlier_idx.size() <= problem.SampleSize())
+                return;
+
+            Model lo_model = model;
+            if (!problem.Refit(inlier_idx, lo_model))
+                return;
+
+            int lo_num_inliers;
+            float lo_score = Evaluate(problem, lo_model, lo_inliers, lo_num_inliers);
+            if (lo_score <= score)
+                return;
+
+            model = lo_model;
+            inliers.swap(lo_inliers);
+            score = lo_score;
+            num_inliers = lo_num_inliers;
+            stats.lo_improved++;
+        }
+    }
+
+    template <class Problem>
+    bool RansacEngine<Problem>::Run(const Problem &problem, Model &best_model, vector<uchar> &best_inliers,
+                                    const vector<int> *order, const Model *guess)
+    {
+        int64 start = getTickCount();
+        memset(&stats, 0, sizeof(stats));
+
+        const int n = problem.NumPoints();
+        const int m = problem.SampleSize();
+        best_inliers.assign(n, 0);
+
+        if (n < m)
+            return false;
+
+        RansacSampler sampler(n, m, options.seed, options.use_prosac ? order : NULL);
+
+        double epsilon = RANSAC_SPRT_EPSILON;
+        double delta = RANSAC_SPRT_DELTA;
+        double log_A = SprtLogThreshold(epsilon, delta);
+
+        bool found = false;
+        float best_score = 0.0f;
+        int best_num_inliers = 0;
+        int needed_iterations = options.max_iterations;
+
+        if (guess != NULL)
+        {
+            best_model = *guess;
+            best_score = Evaluate(problem, best_model, best_inliers, best_num_inliers);
+            stats.hypotheses++;
+            found = true;
+
+            needed_iterations = RansacRequiredIterations(best_num_inliers, n, m, options.confidence,
+                                                         options.max_iterations);
+        }
+
+        vector<int> sample(m);
+        vector<Model> models;
+        vector<uchar> inliers;
+
+        int iter = 0;
+        for (; iter<needed_iterations; iter++)
+        {
+            sampler.Draw(&sample[0]);
+            problem.Solve(&sample[0], models);
+
+            for (int s=0; s<models.size(); s++)
+            {
+                stats.hypotheses++;
+
+                float score;
+                int num_inliers, num_tested;
+                if (!EvaluateSprt(problem, models[s], epsilon, delta, log_A, score, num_inliers, num_tested))
+                {
+                    // Rejected models tell how many points a bad model explains:
+                    stats.sprt_rejected++;
+                    delta = min(0.5 * epsilon, 0.95 * delta + 0.05 * max(1e-3, (double)num_inliers / num_tested));
+                    log_A = SprtLogThreshold(epsilon, delta);
+                    continue;
+                }
+
+                // Strictly greater, so ties keep the earlier hypothesis:
+                if (found && score <= best_score)
+                    continue;
+
+                best_model = models[s];
+                best_score = Evaluate(problem, best_model, best_inliers, best_num_inliers);
+                found = true;
+
+                if (options.use_local_optimization)
+                    LocalOptimize(problem, best_model, best_inliers, best_score, best_num_inliers);
+
+                if (options.use_sprt && best_num_inliers > epsilon * n)
+                {
+                    epsilon = min(0.99, (double)best_num_inliers / n);
+                    delta = min(delta, 0.5 * epsilon);
+                    log_A = SprtLogThreshold(epsilon, delta);
+                }
+
+                needed_iterations = RansacRequiredIterations(best_num_inliers, n, m, options.confidence,
+                                                             options.max_iterations);
+            }
+        }
+
+        stats.iterations = iter;
+        stats.num_inliers = best_num_inliers;
+        stats.score = best_score;
+        stats.total_ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+        return found && best_num_inliers >= m;
+    }
+}
+
+#endif /* defined(__shield_slam__Ransac__) */
@@ -0,0 +1,129 @@
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+namespace vslam {
+
+    ThreadPool::ThreadPool(int n_threads)
+    {
+        stopping = false;
+
+        if (n_threads <= 0)
+        {
+            n_threads = (int)thread::hardware_concurrency() - 1;
+        }
+
+        for (int i=0; i<n_threads; i++)
+        {
+            workers.push_back(thread(&ThreadPool::WorkerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_cond.notify_all();
+
+        for (int i=0; i<workers.size(); i++)
+        {
+            workers[i].join();
+        }
+    }
+
+    ThreadPool& ThreadPool::Shared(void)
+    {
+        static ThreadPool shared_pool;
+        return shared_pool;
+    }
+
+    void ThreadPool::Enqueue(const function<void()>& task)
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            tasks.push(task);
+        }
+        queue_cond.notify_one();
+    }
+
+    void ThreadPool::WorkerLoop(void)
+    {
+        while (true)
+        {
+            function<void()> task;
+
+            {
+                unique_lock<mutex> lock(queue_mutex);
+                queue_cond.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                if (stopping && tasks.empty())
+                    return;
+
+                task = tasks.front();
+                tasks.pop();
+            }
+
+            task();
+        }
+    }
+
+    void ThreadPool::ParallelFor(int begin, int end, const function<void(int)>& body)
+    {
+        const int num_items = end - begin;
+        if (num_items <= 0)
+            return;
+
+        if (num_items == 1 || workers.empty())
+        {
+            for (int i=begin; i<end; i++)
+                body(i);
+            return;
+        }
+
+        // Shared loop state outlives this call: helpers that start late find no work left
+        struct LoopState
+        {
+            function<void(int)> body;
+            atomic<int> next_item;
+            atomic<int> num_done;
+            int end;
+
+            mutex done_mutex;
+            condition_variable done_cond;
+        };
+
+        shared_ptr<LoopState> state = make_shared<LoopState>();
+        state->body = body;
+        state->next_item = begin;
+        state->num_done = 0;
+        state->end = end;
+
+        function<void()> run_items = [state, num_items]()
+        {
+            int i;
+            while ((i = state->next_item++) < state->end)
+            {
+                state->body(i);
+
+                if (++state->num_done == num_items)
+                {
+                    lock_guard<mutex> lock(state->done_mutex);
+                    state->done_cond.notify_all();
+                }
+            }
+        };
+
+        int num_helpers = min((int)workers.size(), num_items - 1);
+        for (int i=0; i<num_helpers; i++)
+        {
+            Enqueue(run_items);
+        }
+
+        run_items();
+
+        unique_lock<mutex> lock(state->done_mutex);
+        state->done_cond.wait(lock, [state, num_items] { return state->num_done == num_items; });
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __shield_slam__ThreadPool__
+#define __shield_slam__ThreadPool__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace vslam {
+
+    class ThreadPool
+    {
+    public:
+
+        // n_threads <= 0 uses one worker per hardware thread (minus the caller)
+        explicit ThreadPool(int n_threads = 0);
+        virtual ~ThreadPool();
+
+        void Enqueue(const function<void()>& task);
+
+        // Runs body(i) for i in [begin, end). The calling thread takes part in the loop, so
+        // nested calls from inside a worker never deadlock. Returns once every index is done.
+        void ParallelFor(int begin, int end, const function<void(int)>& body);
+
+        int GetNumThreads(void) const { return (int)workers.size() + 1; }
+
+        static ThreadPool& Shared(void);
+
+    private:
+
+        void WorkerLoop(void);
+
+    protected:
+        vector<thread> workers;
+        queue<function<void()> > tasks;
+
+        mutex queue_mutex;
+        condition_variable queue_cond;
+        bool stopping;
+    };
+}
+
+#endif /* defined(__shield_slam__ThreadPool__) */
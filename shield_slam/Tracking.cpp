@@ -6,17 +6,30 @@ using namespace std;
 namespace vslam {
     
     Ptr<ORB> Tracking::orb_handler;
+    Ptr<PnPSolver> Tracking::pnp_solver;
+    RansacBackend Tracking::ransac_backend = TRACKING_RANSAC_BACKEND;
+    LocalMapping* Tracking::local_mapping = NULL;
     double Tracking::init_scale =  1.0f;
     bool Tracking::has_scale_init = false;
+    int Tracking::tracked_kf_id = -1;
+    int Tracking::frames_since_keyframe = 0;
     
-    bool Tracking::TrackMap(const cv::Mat &gray_frame, vector<KeyFrame>& keyframes,
-                            Mat &R, Mat &t, bool& new_kf_added, KeypointArray& tar_kp)
+    bool Tracking::TrackMap(const cv::Mat &gray_frame, vector<KeyFramePtr>& keyframes,
+                            SE3 &pose, bool& new_kf_added, KeypointArray& tar_kp,
+                            const SE3* fallback)
     {
-        Mat Rvec, tvec, pnp_inliers;
-        KeyFrame kf = keyframes.back();
+        Mat pnp_inliers;
+        KeyFramePtr kf = keyframes.back();
         
-        Rodrigues(R, Rvec);
-        tvec = t;
+        // Frames tracked against the current reference keyframe:
+        if (kf->GetId() != tracked_kf_id)
+        {
+            tracked_kf_id = kf->GetId();
+            frames_since_keyframe = 0;
+        }
+        frames_since_keyframe++;
+        
+        bool use_prediction = (fallback != NULL);
 
         // Find matches with reference to the keyframe
         Mat tar_img = gray_frame;
@@ -29,19 +42,56 @@ namespace vslam {
         imshow("Frame KPs", debug_kp);
         */
          
-        Mat ref_desc;
-        PointArray ref_points;
-        vector<Point3f> ref_point_cloud;
-        
-        kf.GetKpDesc(ref_points, ref_desc);
-        ref_point_cloud = kf.Get3DPoints();
+        // Views of the keyframe's packed point arrays, no per-frame rebuild:
+        Mat ref_desc = kf->GetPointDescriptors();
+        shared_ptr<const vector<Point3f> > ref_coords = kf->GetPointCoords();
+        const vector<Point3f>& ref_point_cloud = *ref_coords;
+        const int num_ref_points = (int)ref_point_cloud.size();
         
         vector<DMatch> matches;
-        orb_handler->MatchFeatures(ref_desc, tar_desc, matches, true);
+        
+#if TRACKING_USE_GUIDED_MATCHING
+        // Search around the projections under the seed pose:
+        KeypointGrid tar_grid(tar_kp, gray_frame.size());
+        const vector<int>& ref_octaves = kf->GetPointOctaves();
+        
+        if (use_prediction)
+        {
+            orb_handler->MatchByProjection(ref_point_cloud, ref_desc, ref_octaves, pose,
+                                           tar_kp, tar_grid, tar_desc, matches,
+                                           TRACKING_PREDICTED_SEARCH_RADIUS);
+        }
+        
+        if (matches.size() < TRACKING_GUIDED_MIN_MATCHES)
+        {
+            if (use_prediction)
+            {
+                pose = *fallback;
+                use_prediction = false;
+            }
+            
+            orb_handler->MatchByProjection(ref_point_cloud, ref_desc, ref_octaves, pose,
+                                           tar_kp, tar_grid, tar_desc, matches);
+        }
+#endif
+        
+        if (matches.size() < TRACKING_GUIDED_MIN_MATCHES)
+        {
+            // The prediction did not hold, seed PnP from the last pose:
+            if (use_prediction)
+            {
+                pose = *fallback;
+                use_prediction = false;
+            }
+            
+            orb_handler->MatchFeatures(ref_desc, tar_desc, matches, true);
+        }
         
         // Prepare image and object points:
         vector<Point2f> image_points;
         vector<Point3f> object_points;
+        image_points.reserve(matches.size());
+        object_points.reserve(matches.size());
         
         for (int i=0; i<matches.size(); i++)
         {
@@ -61,11 +111,71 @@ namespace vslam {
                        true, 100, 0.006f * max_val, 0.24f * (double)(image_points.size()), pnp_inliers, CV_ITERATIVE);
         */
         
-        solvePnPRansac(object_points, image_points, camera_matrix, dist_coeff, Rvec, tvec,
-                       true, 100, 8.0f, 0.8f * (double)(image_points.size()), pnp_inliers, CV_ITERATIVE);
-         
-        Rodrigues(Rvec, R);
-        t = tvec;
+        // Pose RANSAC seeded with the incoming pose; a prediction gets fewer iterations.
+        // With the RANSAC engine, samples are drawn from the closest descriptor matches first:
+        SE3 pose_pnp = pose;
+        
+        vector<int> pnp_order;
+        if (ransac_backend == RANSAC_BACKEND_ENGINE)
+        {
+            RansacOrderByDistance(matches, pnp_order);
+        }
+        pnp_solver->SetRansacBackend(ransac_backend);
+        
+        int pnp_iterations = use_prediction ? TRACKING_PNP_ITERATIONS_PREDICTED : TRACKING_PNP_ITERATIONS;
+        pnp_solver->SetRansacParameters(pnp_iterations, TRACKING_PNP_REPROJECTION_ERROR,
+                                        PNP_RANSAC_CONFIDENCE, PNP_RANSAC_MIN_INLIERS);
+        bool pnp_found = pnp_solver->Solve(object_points, image_points, pose_pnp, pnp_inliers, true, &pnp_order);
+        
+        if (use_prediction && (!pnp_found || pnp_inliers.rows < TRACKING_PREDICTED_MIN_INLIERS))
+        {
+            pose_pnp = *fallback;
+            
+            pnp_solver->SetRansacParameters(TRACKING_PNP_ITERATIONS, TRACKING_PNP_REPROJECTION_ERROR,
+                                            PNP_RANSAC_CONFIDENCE, PNP_RANSAC_MIN_INLIERS);
+            pnp_solver->Solve(object_points, image_points, pose_pnp, pnp_inliers, true, &pnp_order);
+        }
+        
+        // Motion-only refinement over the PnP inliers, dropping the ones it rejects:
+        if (pnp_inliers.rows >= POSE_OPT_MIN_POINTS)
+        {
+            vector<Point3f> inlier_object;
+            vector<Point2f> inlier_image, inlier_image_undist;
+            vector<float> inlier_sigma2;
+            
+            for (int i=0; i<pnp_inliers.rows; i++)
+            {
+                int idx = pnp_inliers.at<int>(i);
+                float level_scale = pow(ORB_SCALE_FACTOR, tar_kp[matches[idx].trainIdx].octave);
+                
+                inlier_object.push_back(object_points[idx]);
+                inlier_image.push_back(image_points[idx]);
+                inlier_sigma2.push_back(level_scale * level_scale);
+            }
+            
+            Undistorter::Shared().UndistortPixels(inlier_image, inlier_image_undist);
+            
+            SE3 pose_opt = pose_pnp;
+            vector<bool> pose_inliers;
+            
+            int num_pose_inliers = Optimizer::OptimizePose(inlier_object, inlier_image_undist, inlier_sigma2,
+                                                           pose_opt, pose_inliers);
+            
+            if (num_pose_inliers >= POSE_OPT_MIN_POINTS)
+            {
+                pose_pnp = pose_opt;
+                
+                Mat kept_inliers(num_pose_inliers, 1, CV_32S);
+                for (int i=0, k=0; i<pose_inliers.size(); i++)
+                {
+                    if (pose_inliers[i])
+                        kept_inliers.at<int>(k++) = pnp_inliers.at<int>(i);
+                }
+                pnp_inliers = kept_inliers;
+            }
+        }
+        
+        pose = pose_pnp;
         
         /*
         // Correct scale using current KF as reference:
@@ -85,28 +195,46 @@ namespace vslam {
         */
         
         
-        kf.IncrementFrameCount();
-        KeypointArray ref_kp = kf.GetTotalKeypoints();
-        
         new_kf_added = false;
-        if (NeedsNewKeyframe(kf, (int)ref_points.size(), (int)tar_kp.size(), (int)matches.size()))
+        if (NeedsNewKeyframe(num_ref_points, (int)tar_kp.size(), (int)matches.size()))
         {
-            Mat R_prev = kf.GetRotation();
-            Mat t_prev = kf.GetTranslation();
+            if (local_mapping != NULL)
+            {
+                // Hand the keyframe to the mapping thread and keep tracking the current one:
+                if (local_mapping->AcceptsKeyFrames())
+                {
+                    KeyFrameRequest request;
+                    request.ref_kf = kf;
+                    request.pose = pose;
+                    request.ref_kp = kf->GetTotalKeypoints();
+                    request.tar_kp = tar_kp;
+                    request.ref_desc = ref_desc;
+                    request.tar_desc = tar_desc;
+                    request.matches = matches;
+                    request.pnp_inliers = pnp_inliers;
+                    request.max_val = max_val;
+                    
+                    new_kf_added = local_mapping->InsertRequest(request);
+                }
+                
+                return true;
+            }
             
-            new_kf_added = NewKeyFrame(kf, R_prev, R, t_prev, t, ref_kp, tar_kp, ref_desc,
-                                       tar_desc, matches, pnp_inliers, max_val, object_points);
+            KeyFramePtr new_kf = kf;
+            new_kf_added = NewKeyFrame(new_kf, pose, kf->GetTotalKeypoints(), tar_kp,
+                                       ref_desc, tar_desc, matches, pnp_inliers, max_val);
             
-            keyframes.push_back(kf);
+            if (new_kf_added)
+                keyframes.push_back(new_kf);
             return new_kf_added;
         }
         
         return true;
     }
     
-    bool Tracking::NeedsNewKeyframe(KeyFrame& kf, int num_kf_kp, int num_tar_kp, int num_kf_matches)
+    bool Tracking::NeedsNewKeyframe(int num_kf_kp, int num_tar_kp, int num_kf_matches)
     {
-//        cout << num_tar_kp << " " << (1.0 * num_kf_matches) / num_kf_kp << " " << kf.GetFrameCountSinceInsertion() << endl;
+//        cout << num_tar_kp << " " << (1.0 * num_kf_matches) / num_kf_kp << " " << frames_since_keyframe << endl;
         
         if (num_tar_kp < KEYFRAME_MIN_KEYPOINTS)
             return true;
@@ -114,43 +242,31 @@ namespace vslam {
         if ((1.0 * num_kf_matches) / num_kf_kp < KEYFRAME_MIN_MATCH_RATIO)
             return true;
         
-        if (kf.GetFrameCountSinceInsertion() > KEYFRAME_MAX_FRAME_COUNT_SINCE_INSERTION)
+        if (frames_since_keyframe > KEYFRAME_MAX_FRAME_COUNT_SINCE_INSERTION)
             return true;
         
         return false;
     }
     
-    bool Tracking::NewKeyFrame(KeyFrame &kf, Mat &R1, Mat &R2, Mat &t1, Mat &t2,
-                               KeypointArray &kp1, KeypointArray &kp2,
+    bool Tracking::NewKeyFrame(KeyFramePtr &kf, const SE3& pose,
+                               const KeypointArray &kp1, KeypointArray &kp2,
                                Mat& ref_desc, Mat& tar_desc, vector<DMatch>& matches_2D_3D,
-                               Mat& pnp_inliers, double max_val, vector<Point3f>& prev_pc)
+                               Mat& pnp_inliers, double max_val)
     {
-        vector<MapPoint> local_map;
+        Ptr<Map> global_map = kf->GetGlobalMap();
+        if (global_map.empty())
+            return false;
+        
+        const vector<int>& ref_point_ids = kf->GetPointIds();
+        const vector<int>& ref_point_kp_idx = kf->GetPointKeypointIdx();
         
         // Do full feature matching:
         vector<DMatch> full_orb_matches;
-        ref_desc = kf.GetTotalDescriptors();
+        ref_desc = kf->GetTotalDescriptors();
         orb_handler->MatchFeatures(ref_desc, tar_desc, full_orb_matches);
         
-        // Intrinsic parameters (3D->2D) for projection error checking:
-        double cam_fx = camera_matrix.at<double>(0, 0);
-        double cam_fy = camera_matrix.at<double>(1, 1);
-        double cam_cx = camera_matrix.at<double>(0, 2);
-        double cam_cy = camera_matrix.at<double>(1, 2);
-        
-        // P1 = K[R1|t1]
-        Mat ref_origin = -R1.t()*t1;
-        Mat P1 = (Mat_<double>(3, 4) << R1.at<double>(0, 0), R1.at<double>(0, 1), R1.at<double>(0, 2), t1.at<double>(0),
-                                        R1.at<double>(1, 0), R1.at<double>(1, 1), R1.at<double>(1, 2), t1.at<double>(1),
-                                        R1.at<double>(2, 0), R1.at<double>(2, 1), R1.at<double>(2, 2), t1.at<double>(2));
-        P1 = camera_matrix * P1;
-        
-        // P2 = K[R2|t2]
-        Mat tar_origin = -R2.t()*t2;
-        Mat P2 = (Mat_<double>(3, 4) << R2.at<double>(0, 0), R2.at<double>(0, 1), R2.at<double>(0, 2), t2.at<double>(0),
-                                        R2.at<double>(1, 0), R2.at<double>(1, 1), R2.at<double>(1, 2), t2.at<double>(1),
-                                        R2.at<double>(2, 0), R2.at<double>(2, 1), R2.at<double>(2, 2), t2.at<double>(2));
-        P2 = camera_matrix * P2;
+        const SE3& ref_pose = kf->GetPose();
+        const SE3& tar_pose = pose;
         
         // TODO: check for still camera (corrupts scale)
         
@@ -158,13 +274,40 @@ namespace vslam {
         const float ratio_factor = 1.5f * ORB_SCALE_FACTOR;
         
         
-        // Build a hash map of existing point cloud points
-        map<int, Point3f> existing_pc;
+        // Map points the new keyframe already sees, keyed by target keypoint. PnP inliers
+        // index matches_2D_3D, whose queryIdx is a position in the reference point list:
+        map<int, int> tar_point_ids;
+        set<int> used_point_ids;
         for (int i=0; i<pnp_inliers.size().height; i++)
         {
-            existing_pc[pnp_inliers.at<int>(i)] = prev_pc.at(i);
+            const DMatch& match = matches_2D_3D[pnp_inliers.at<int>(i)];
+            int point_id = ref_point_ids[match.queryIdx];
+            
+            if (tar_point_ids.count(match.trainIdx) || used_point_ids.count(point_id))
+                continue;
+            
+            tar_point_ids[match.trainIdx] = point_id;
+            used_point_ids.insert(point_id);
+        }
+        
+        // Reference keypoints that carry a map point:
+        map<int, int> ref_kp_point_ids;
+        for (int i=0; i<ref_point_ids.size(); i++)
+        {
+            ref_kp_point_ids[ref_point_kp_idx[i]] = ref_point_ids[i];
         }
         
+        // Newly triangulated points are only added to the map once the keyframe is accepted:
+        vector<int> new_point_kp_idx;
+        vector<Point3f> new_points_3D;
+        
+        // Matches without a map point on either side are triangulated as one batch:
+        Triangulator triangulator(camera_matrix);
+        triangulator.Reserve((int)full_orb_matches.size());
+        vector<DMatch> candidate_matches;
+        candidate_matches.reserve(full_orb_matches.size());
+        PointArray candidate_ref_points, candidate_tar_points;
+        
         /*
         // Find fundamental matrix to determine outliers:
         PointArray ref_points, tar_points;
@@ -178,7 +321,6 @@ namespace vslam {
         findFundamentalMat(ref_points, tar_points, f_status, FM_RANSAC, 0.006 * max_val, 0.99);
         */
         
-        int num_good_points = 0;
         for (int i=0; i<full_orb_matches.size(); i++)
         {
             /*
@@ -186,157 +328,103 @@ namespace vslam {
                 continue;
             */
              
-            Point3f point_3D;
+            const int ref_idx = full_orb_matches[i].queryIdx;
+            const int tar_idx = full_orb_matches[i].trainIdx;
             
-            KeyPoint ref_kp = kp1[full_orb_matches[i].queryIdx];
-            KeyPoint tar_kp = kp2[full_orb_matches[i].trainIdx];
+            if (tar_point_ids.count(tar_idx))
+                continue;
             
             // Check if the point already exists in the map
-            if (existing_pc.count(full_orb_matches[i].queryIdx))
+            map<int, int>::iterator ref_it = ref_kp_point_ids.find(ref_idx);
+            if (ref_it != ref_kp_point_ids.end())
             {
-                point_3D = existing_pc[full_orb_matches[i].queryIdx];
+                if (!used_point_ids.count(ref_it->second))
+                {
+                    tar_point_ids[tar_idx] = ref_it->second;
+                    used_point_ids.insert(ref_it->second);
+                }
             }
             else
             {
-                float ref_scale_factor = pow(ORB_SCALE_FACTOR, ref_kp.octave);
-                float tar_scale_factor = pow(ORB_SCALE_FACTOR, tar_kp.octave);
-                
-                Mat ref_point_3D = Mat(3, 1, CV_64F, 0.0f);
-//                Triangulate(ref_kp, tar_kp, P1, P2, ref_point_3D);
-                
-                ref_point_3D = LinearLSTriangulation(Point3d(ref_kp.pt.x, ref_kp.pt.y, 1.0),
-                                                     Point3d(tar_kp.pt.x, tar_kp.pt.y, 1.0), P1, P2);
-
-                Mat ref_point_3D_tp = ref_point_3D.t();
-                
-                // Check that the point is finite:
-                if (!isfinite(ref_point_3D.at<double>(0)) ||
-                    !isfinite(ref_point_3D.at<double>(1)) ||
-                    !isfinite(ref_point_3D.at<double>(2)))
-                {
-                    continue;
-                }
-                
-                // Check parallax:
-                Mat ref_normal = ref_point_3D - ref_origin;
-                float ref_dist = norm(ref_normal);
-                
-                Mat tar_normal = ref_point_3D - tar_origin;
-                float tar_dist = norm(tar_normal);
-                
-                if (ref_dist == 0.0 || tar_dist == 0.0)
-                    continue;
-                
-                // OLD REPROJECTION ERROR CHECKING:
-                /*
-                 float cos_parallax = ref_normal.dot(tar_normal) / (ref_dist * tar_dist);
-                 
-                 // Check that the point is in front of the reference camera:
-                 if (ref_point_3D.at<double>(2) <= 0.0 && cos_parallax < 0.9998)
-                 {
-                 continue;
-                 }
-                 
-                 Mat tar_point_3D = R2 * ref_point_3D + t2;
-                 
-                 // Check that the point is in front of the target camera:
-                 if (tar_point_3D.at<double>(2) <= 0.0 && cos_parallax < 0.9998)
-                 {
-                 continue;
-                 }
-                 
-                 // Check reprojection error for reference image:
-                 float ref_reproj_x, ref_reproj_y;
-                 ref_reproj_x = cam_fx * (ref_point_3D.at<double>(0) / ref_point_3D.at<double>(2)) + cam_cx;
-                 ref_reproj_y = cam_fy * (ref_point_3D.at<double>(1) / ref_point_3D.at<double>(2)) + cam_cy;
-                 
-                 float ref_square_error = (ref_reproj_x - ref_kp.pt.x) * (ref_reproj_x - ref_kp.pt.x) +
-                 (ref_reproj_y - ref_kp.pt.y) * (ref_reproj_y - ref_kp.pt.y);
-                 
-                 if (ref_square_error > REPROJECTION_ERROR_TH)
-                 {
-                 continue;
-                 }
-                 
-                 // Check reprojection error for target image:
-                 float tar_reproj_x, tar_reproj_y;
-                 tar_reproj_x = cam_fx * (tar_point_3D.at<double>(0) / tar_point_3D.at<double>(2)) + cam_cx;
-                 tar_reproj_y = cam_fy * (tar_point_3D.at<double>(1) / tar_point_3D.at<double>(2)) + cam_cy;
-                 
-                 float tar_square_error = (tar_reproj_x - tar_kp.pt.x) * (tar_reproj_x - tar_kp.pt.x) +
-                 (tar_reproj_y - tar_kp.pt.y) * (tar_reproj_y - tar_kp.pt.y);
-                 
-                 if (tar_square_error > REPROJECTION_ERROR_TH)
-                 {
-                 continue;
-                 }
-                 */
-                
-                // Check if point is in front of the cameras:
-                float z1 = R1.row(2).dot(ref_point_3D_tp)+t1.at<double>(2);
-                if (z1 <= 0)
-                    continue;
-                
-                float z2 = R2.row(2).dot(ref_point_3D_tp)+t2.at<double>(2);
-                if (z2 <= 0)
-                    continue;
-                
-                // Check reprojection error for reference camera:
-                float x1 = R1.row(0).dot(ref_point_3D_tp)+t1.at<double>(0);
-                float y1 = R1.row(1).dot(ref_point_3D_tp)+t1.at<double>(1);
-                float inv_z1 = 1.0 / z1;
-                
-                float u1 = cam_fx * x1 * inv_z1 + cam_cx;
-                float v1 = cam_fy * y1 * inv_z1 + cam_cy;
-                
-                float err_x1 = u1 - ref_kp.pt.x;
-                float err_y1 = v1 - ref_kp.pt.y;
-                if (err_x1 * err_x1 + err_y1 * err_y1 > REPROJECTION_ERROR_CHI * ref_scale_factor * ref_scale_factor)
-                    continue;
-                
-                // Check reprojection error for target camera:
-                float x2 = R2.row(0).dot(ref_point_3D_tp)+t2.at<double>(0);
-                float y2 = R2.row(1).dot(ref_point_3D_tp)+t2.at<double>(1);
-                float inv_z2 = 1.0 / z2;
-                
-                float u2 = cam_fx * x2 * inv_z2 + cam_cx;
-                float v2 = cam_fy * y2 * inv_z2 + cam_cy;
-                
-                float err_x2 = u2 - tar_kp.pt.x;
-                float err_y2 = v2 - tar_kp.pt.y;
-                if (err_x2 * err_x2 + err_y2 * err_y2 > REPROJECTION_ERROR_CHI * tar_scale_factor * tar_scale_factor)
-                    continue;
-                
-                // Check scale consistency:
-                float ratio_dist = ref_dist / tar_dist;
-                float ratio_octave = ref_scale_factor / tar_scale_factor;
-                
-                if (ratio_dist * ratio_factor < ratio_octave || ratio_dist > ratio_octave * ratio_factor)
-                    continue;
-                
-                point_3D = Point3f(ref_point_3D.at<double>(0), ref_point_3D.at<double>(1), ref_point_3D.at<double>(2));
+                candidate_ref_points.push_back(kp1[ref_idx].pt);
+                candidate_tar_points.push_back(kp2[tar_idx].pt);
+                candidate_matches.push_back(full_orb_matches[i]);
             }
+        }
+        
+        // The triangulator assumes a pinhole camera, so candidates are undistorted first:
+        PointArray undist_ref_points, undist_tar_points;
+        Undistorter::Shared().UndistortPixels(candidate_ref_points, undist_ref_points);
+        Undistorter::Shared().UndistortPixels(candidate_tar_points, undist_tar_points);
+        
+        for (int i=0; i<undist_ref_points.size(); i++)
+            triangulator.Add(undist_ref_points[i], undist_tar_points[i]);
+        
+        // Triangulate all candidates in one batch, then apply the per-point checks:
+        TriangulationResult tri;
+        triangulator.Run(ref_pose, tar_pose, tri);
+        
+        for (int i=0; i<candidate_matches.size(); i++)
+        {
+            const KeyPoint& ref_kp = kp1[candidate_matches[i].queryIdx];
+            const KeyPoint& tar_kp = kp2[candidate_matches[i].trainIdx];
             
-            Mat desc;
-            tar_desc.row(full_orb_matches[i].trainIdx).copyTo(desc);
+            // Check that the point is finite:
+            if (!isfinite(tri.X[i]) || !isfinite(tri.Y[i]) || !isfinite(tri.Z[i]))
+                continue;
             
-            // Create MapPoint:
-            MapPoint mp;
-            mp.SetPoint3D(point_3D);
-            mp.SetPoint2D(tar_kp.pt);
-            mp.SetDesc(desc);
-            local_map.push_back(mp);
+            if (tri.dist1[i] == 0.0f || tri.dist2[i] == 0.0f)
+                continue;
             
-            num_good_points++;
+            // Check if point is in front of the cameras:
+            if (tri.depth1[i] <= 0 || tri.depth2[i] <= 0)
+                continue;
+            
+            // Check reprojection error for both cameras:
+            float ref_scale_factor = pow(ORB_SCALE_FACTOR, ref_kp.octave);
+            float tar_scale_factor = pow(ORB_SCALE_FACTOR, tar_kp.octave);
+            
+            if (tri.error1[i] > REPROJECTION_ERROR_CHI * ref_scale_factor * ref_scale_factor)
+                continue;
+            
+            if (tri.error2[i] > REPROJECTION_ERROR_CHI * tar_scale_factor * tar_scale_factor)
+                continue;
+            
+            // Check scale consistency:
+            float ratio_dist = tri.dist1[i] / tri.dist2[i];
+            float ratio_octave = ref_scale_factor / tar_scale_factor;
+            
+            if (ratio_dist * ratio_factor < ratio_octave || ratio_dist > ratio_octave * ratio_factor)
+                continue;
+            
+            new_point_kp_idx.push_back(candidate_matches[i].trainIdx);
+            new_points_3D.push_back(Point3f(tri.X[i], tri.Y[i], tri.Z[i]));
+        }
+        
+        int num_good_points = (int)(tar_point_ids.size() + new_point_kp_idx.size());
+        if (num_good_points < TRIANGULATION_MIN_POINTS)
+            return false;
+        
+        int kf_id = global_map->NextKeyFrameId();
+        
+        vector<int> point_ids, point_kp_idx;
+        for (map<int, int>::iterator it=tar_point_ids.begin(); it!=tar_point_ids.end(); it++)
+        {
+            global_map->AddObservation(it->second, kf_id, it->first);
+            point_ids.push_back(it->second);
+            point_kp_idx.push_back(it->first);
         }
         
-        if (num_good_points >= TRIANGULATION_MIN_POINTS)
+        for (int i=0; i<new_point_kp_idx.size(); i++)
         {
-            kf = KeyFrame(R2, t2, local_map, kp2, tar_desc);
-            return true;
+            int point_id = global_map->AddMapPoint(new_points_3D[i], tar_desc.row(new_point_kp_idx[i]));
+            global_map->AddObservation(point_id, kf_id, new_point_kp_idx[i]);
+            point_ids.push_back(point_id);
+            point_kp_idx.push_back(new_point_kp_idx[i]);
         }
         
-        return false;
+        kf = make_shared<KeyFrame>(kf_id, tar_pose, global_map, point_ids, point_kp_idx, kp2, tar_desc);
+        return true;
     }
     
     void Tracking::Normalize3DPoints(vector<Point3f> &input_points, vector<Point3f> &norm_points)
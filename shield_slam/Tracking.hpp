@@ -7,11 +7,18 @@
 #include <math.h>
 #include <limits>
 #include <map>
+#include <set>
 
 #include "Common.hpp"
 #include "MapPoint.hpp"
 #include "KeyFrame.hpp"
+#include "Map.hpp"
 #include "ORB.hpp"
+#include "KeypointGrid.hpp"
+#include "PnPSolver.hpp"
+#include "Triangulator.hpp"
+#include "Optimizer.hpp"
+#include "LocalMapping.hpp"
 
 #define TRIANGULATION_LS_ITERATIONS 10
 #define TRIANGULATION_LS_EPSILON 0.0001
@@ -20,12 +27,26 @@
 #define REPROJECTION_ERROR_CHI 5.991
 #define TRIANGULATION_MIN_POINTS 4
 
+// Match keyframe points by projecting them with the last pose; brute force is used when
+// guided matching is disabled or finds fewer than TRACKING_GUIDED_MIN_MATCHES:
+#define TRACKING_USE_GUIDED_MATCHING 1
+#define TRACKING_GUIDED_MIN_MATCHES 30
+
+// A motion-model prediction is trusted with a tighter window and fewer RANSAC iterations;
+// below TRACKING_PREDICTED_MIN_INLIERS the pose is re-estimated from the last pose:
+#define TRACKING_PREDICTED_SEARCH_RADIUS 7.0f
+#define TRACKING_PNP_REPROJECTION_ERROR 8.0f
+#define TRACKING_PNP_ITERATIONS 50
+#define TRACKING_PNP_ITERATIONS_PREDICTED 15
+#define TRACKING_PREDICTED_MIN_INLIERS 20
+
+// Pose RANSAC implementation, see RansacBackend:
+#define TRACKING_RANSAC_BACKEND RANSAC_BACKEND_LEGACY
+
 #define KEYFRAME_MIN_KEYPOINTS 50
 #define KEYFRAME_MIN_MATCH_RATIO 0.7
 #define KEYFRAME_MAX_FRAME_COUNT_SINCE_INSERTION 10
 
-#define ORB_SCALE_FACTOR 1.2
-
 using namespace cv;
 using namespace std;
 
@@ -34,16 +55,28 @@ namespace vslam {
     class Tracking
     {
     public:
-        static bool TrackMap(const Mat& gray_frame, vector<KeyFrame>& keyframes,
-                             Mat& R, Mat& t, bool& new_kf_added, KeypointArray& tar_kp);
-        static bool NewKeyFrame(KeyFrame &kf, Mat &R1, Mat &R2, Mat &t1, Mat &t2,
-                                KeypointArray &kp1, KeypointArray &kp2,
+        // pose seeds the search and receives the tracked pose. When fallback is given, pose is
+        // a motion-model prediction and the fallback is the last tracked pose.
+        static bool TrackMap(const Mat& gray_frame, vector<KeyFramePtr>& keyframes,
+                             SE3& pose, bool& new_kf_added, KeypointArray& tar_kp,
+                             const SE3* fallback = NULL);
+        // kf is the reference keyframe on entry and the new keyframe on success; pose is the
+        // tracked pose of the new keyframe:
+        static bool NewKeyFrame(KeyFramePtr &kf, const SE3& pose,
+                                const KeypointArray &kp1, KeypointArray &kp2,
                                 Mat& ref_desc, Mat& tar_desc,
                                 vector<DMatch>& matches_2D_3D,
-                                Mat& pnp_inliers, double max_val,
-                                vector<Point3f>& prev_pc);
+                                Mat& pnp_inliers, double max_val);
         
         static void SetOrbHandler(Ptr<ORB> handler)  { orb_handler = handler; }
+        static void SetPnPSolver(Ptr<PnPSolver> solver)  { pnp_solver = solver; }
+        static Ptr<PnPSolver> GetPnPSolver(void)  { return pnp_solver; }
+        static void SetRansacBackend(RansacBackend backend)  { ransac_backend = backend; }
+        
+        // With a mapper set, new keyframes are built on its thread and new_kf_added from
+        // TrackMap only means a request was queued. The mapper is not owned; its owner clears
+        // it before destroying the mapper:
+        static void SetLocalMapping(LocalMapping* mapper)  { local_mapping = mapper; }
         static void SetInitScale(double scale)  { init_scale = scale; }
         
         static bool CheckDistEpipolarLine(const KeyPoint &kp1,const KeyPoint &kp2,const Mat &F);
@@ -66,8 +99,7 @@ namespace vslam {
                                       vector<Point3f>& object_points);
         
     private:
-        static bool NeedsNewKeyframe(KeyFrame& kf, int num_kf_kp, int num_tar_kp,
-                                     int num_kf_matches);
+        static bool NeedsNewKeyframe(int num_kf_kp, int num_tar_kp, int num_kf_matches);
         static void FilterPnPInliers(vector<Point3f>& object_points,
                                      vector<Point2f>& image_points, Mat& inliers);
         static void Normalize3DPoints(vector<Point3f>& input_points,
@@ -75,9 +107,16 @@ namespace vslam {
         
     protected:
         static Ptr<ORB> orb_handler;
+        static Ptr<PnPSolver> pnp_solver;
+        static RansacBackend ransac_backend;
+        static LocalMapping* local_mapping;
         static double init_scale;
         
         static bool has_scale_init;
+        
+        // Keyframes are immutable, so the frame count since insertion is kept here:
+        static int tracked_kf_id;
+        static int frames_since_keyframe;
     };
 }
 
@@ -0,0 +1,405 @@
+#include "Triangulator.hpp"
+
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TRIANGULATOR_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define TRIANGULATOR_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    /*
+     For rays C1 + l1*d1 and C2 + l2*d2 with d = R^T [x y 1]^T and base b = C2 - C1, the
+     closest points satisfy
+        | d1.d1  -d1.d2 | |l1|   | d1.b |
+        | d1.d2  -d2.d2 | |l2| = | d2.b |
+     and the point is the midpoint between them. Parallel rays give a zero determinant and
+     non-finite coordinates, which callers reject.
+     */
+    static void TriangulateKernelScalar(const TriangulationParams& p,
+                                        const float* x1, const float* y1,
+                                        const float* x2, const float* y2,
+                                        int begin, int end, TriangulationResult& result)
+    {
+        const float bx = p.C2[0] - p.C1[0], by = p.C2[1] - p.C1[1], bz = p.C2[2] - p.C1[2];
+
+        for (int i=begin; i<end; i++)
+        {
+            // Viewing rays in world coordinates:
+            float d1x = p.R1[0] * x1[i] + p.R1[3] * y1[i] + p.R1[6];
+            float d1y = p.R1[1] * x1[i] + p.R1[4] * y1[i] + p.R1[7];
+            float d1z = p.R1[2] * x1[i] + p.R1[5] * y1[i] + p.R1[8];
+
+            float d2x = p.R2[0] * x2[i] + p.R2[3] * y2[i] + p.R2[6];
+            float d2y = p.R2[1] * x2[i] + p.R2[4] * y2[i] + p.R2[7];
+            float d2z = p.R2[2] * x2[i] + p.R2[5] * y2[i] + p.R2[8];
+
+            float a = d1x * d1x + d1y * d1y + d1z * d1z;
+            float b = d1x * d2x + d1y * d2y + d1z * d2z;
+            float c = d2x * d2x + d2y * d2y + d2z * d2z;
+            float d = d1x * bx + d1y * by + d1z * bz;
+            float e = d2x * bx + d2y * by + d2z * bz;
+
+            float inv_det = 1.0f / (a * c - b * b);
+            float l1 = (c * d - b * e) * inv_det;
+            float l2 = (b * d - a * e) * inv_det;
+
+            float X = 0.5f * (p.C1[0] + l1 * d1x + p.C2[0] + l2 * d2x);
+            float Y = 0.5f * (p.C1[1] + l1 * d1y + p.C2[1] + l2 * d2y);
+            float Z = 0.5f * (p.C1[2] + l1 * d1z + p.C2[2] + l2 * d2z);
+
+            // Parallax between the rays from both centres:
+            float v1x = X - p.C1[0], v1y = Y - p.C1[1], v1z = Z - p.C1[2];
+            float v2x = X - p.C2[0], v2y = Y - p.C2[1], v2z = Z - p.C2[2];
+
+            float dist1 = sqrt(v1x * v1x + v1y * v1y + v1z * v1z);
+            float dist2 = sqrt(v2x * v2x + v2y * v2y + v2z * v2z);
+            float cos_parallax = (v1x * v2x + v1y * v2y + v1z * v2z) / (dist1 * dist2);
+
+            // Camera coordinates, R * (X - C) = R * X + t:
+            float cx1 = p.R1[0] * v1x + p.R1[1] * v1y + p.R1[2] * v1z;
+            float cy1 = p.R1[3] * v1x + p.R1[4] * v1y + p.R1[5] * v1z;
+            float cz1 = p.R1[6] * v1x + p.R1[7] * v1y + p.R1[8] * v1z;
+
+            float cx2 = p.R2[0] * v2x + p.R2[1] * v2y + p.R2[2] * v2z;
+            float cy2 = p.R2[3] * v2x + p.R2[4] * v2y + p.R2[5] * v2z;
+            float cz2 = p.R2[6] * v2x + p.R2[7] * v2y + p.R2[8] * v2z;
+
+            float inv_z1 = 1.0f / cz1;
+            float ex1 = p.fx * (cx1 * inv_z1 - x1[i]);
+            float ey1 = p.fy * (cy1 * inv_z1 - y1[i]);
+
+            float inv_z2 = 1.0f / cz2;
+            float ex2 = p.fx * (cx2 * inv_z2 - x2[i]);
+            float ey2 = p.fy * (cy2 * inv_z2 - y2[i]);
+
+            result.X[i] = X;
+            result.Y[i] = Y;
+            result.Z[i] = Z;
+            result.depth1[i] = cz1;
+            result.depth2[i] = cz2;
+            result.error1[i] = ex1 * ex1 + ey1 * ey1;
+            result.error2[i] = ex2 * ex2 + ey2 * ey2;
+            result.dist1[i] = dist1;
+            result.dist2[i] = dist2;
+            result.cos_parallax[i] = cos_parallax;
+        }
+    }
+
+#ifdef TRIANGULATOR_HAVE_AVX2_KERNEL
+    __attribute__((target("avx2,fma")))
+    static inline __m256 Dot3AVX2(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+    {
+        return _mm256_fmadd_ps(ax, bx, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(az, bz)));
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void TriangulateKernelAVX2(const TriangulationParams& p,
+                                      const float* x1, const float* y1,
+                                      const float* x2, const float* y2,
+                                      int begin, int end, TriangulationResult& result)
+    {
+        __m256 R1[9], R2[9], C1[3], C2[3], base[3];
+        for (int k=0; k<9; k++)
+        {
+            R1[k] = _mm256_set1_ps(p.R1[k]);
+            R2[k] = _mm256_set1_ps(p.R2[k]);
+        }
+        for (int k=0; k<3; k++)
+        {
+            C1[k] = _mm256_set1_ps(p.C1[k]);
+            C2[k] = _mm256_set1_ps(p.C2[k]);
+            base[k] = _mm256_set1_ps(p.C2[k] - p.C1[k]);
+        }
+
+        const __m256 fx = _mm256_set1_ps(p.fx), fy = _mm256_set1_ps(p.fy);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        int i = begin;
+        for (; i+8<=end; i+=8)
+        {
+            __m256 u1 = _mm256_loadu_ps(x1 + i), v1 = _mm256_loadu_ps(y1 + i);
+            __m256 u2 = _mm256_loadu_ps(x2 + i), v2 = _mm256_loadu_ps(y2 + i);
+
+            __m256 d1x = _mm256_fmadd_ps(R1[0], u1, _mm256_fmadd_ps(R1[3], v1, R1[6]));
+            __m256 d1y = _mm256_fmadd_ps(R1[1], u1, _mm256_fmadd_ps(R1[4], v1, R1[7]));
+            __m256 d1z = _mm256_fmadd_ps(R1[2], u1, _mm256_fmadd_ps(R1[5], v1, R1[8]));
+
+            __m256 d2x = _mm256_fmadd_ps(R2[0], u2, _mm256_fmadd_ps(R2[3], v2, R2[6]));
+            __m256 d2y = _mm256_fmadd_ps(R2[1], u2, _mm256_fmadd_ps(R2[4], v2, R2[7]));
+            __m256 d2z = _mm256_fmadd_ps(R2[2], u2, _mm256_fmadd_ps(R2[5], v2, R2[8]));
+
+            __m256 a = Dot3AVX2(d1x, d1y, d1z, d1x, d1y, d1z);
+            __m256 b = Dot3AVX2(d1x, d1y, d1z, d2x, d2y, d2z);
+            __m256 c = Dot3AVX2(d2x, d2y, d2z, d2x, d2y, d2z);
+            __m256 d = Dot3AVX2(d1x, d1y, d1z, base[0], base[1], base[2]);
+            __m256 e = Dot3AVX2(d2x, d2y, d2z, base[0], base[1], base[2]);
+
+            __m256 inv_det = _mm256_div_ps(one, _mm256_fmsub_ps(a, c, _mm256_mul_ps(b, b)));
+            __m256 l1 = _mm256_mul_ps(_mm256_fmsub_ps(c, d, _mm256_mul_ps(b, e)), inv_det);
+            __m256 l2 = _mm256_mul_ps(_mm256_fmsub_ps(b, d, _mm256_mul_ps(a, e)), inv_det);
+
+            __m256 X = _mm256_mul_ps(half, _mm256_add_ps(_mm256_fmadd_ps(l1, d1x, C1[0]), _mm256_fmadd_ps(l2, d2x, C2[0])));
+            __m256 Y = _mm256_mul_ps(half, _mm256_add_ps(_mm256_fmadd_ps(l1, d1y, C1[1]), _mm256_fmadd_ps(l2, d2y, C2[1])));
+            __m256 Z = _mm256_mul_ps(half, _mm256_add_ps(_mm256_fmadd_ps(l1, d1z, C1[2]), _mm256_fmadd_ps(l2, d2z, C2[2])));
+
+            __m256 r1x = _mm256_sub_ps(X, C1[0]), r1y = _mm256_sub_ps(Y, C1[1]), r1z = _mm256_sub_ps(Z, C1[2]);
+            __m256 r2x = _mm256_sub_ps(X, C2[0]), r2y = _mm256_sub_ps(Y, C2[1]), r2z = _mm256_sub_ps(Z, C2[2]);
+
+            __m256 dist1 = _mm256_sqrt_ps(Dot3AVX2(r1x, r1y, r1z, r1x, r1y, r1z));
+            __m256 dist2 = _mm256_sqrt_ps(Dot3AVX2(r2x, r2y, r2z, r2x, r2y, r2z));
+            __m256 cos_parallax = _mm256_div_ps(Dot3AVX2(r1x, r1y, r1z, r2x, r2y, r2z), _mm256_mul_ps(dist1, dist2));
+
+            __m256 cx1 = Dot3AVX2(R1[0], R1[1], R1[2], r1x, r1y, r1z);
+            __m256 cy1 = Dot3AVX2(R1[3], R1[4], R1[5], r1x, r1y, r1z);
+            __m256 cz1 = Dot3AVX2(R1[6], R1[7], R1[8], r1x, r1y, r1z);
+
+            __m256 cx2 = Dot3AVX2(R2[0], R2[1], R2[2], r2x, r2y, r2z);
+            __m256 cy2 = Dot3AVX2(R2[3], R2[4], R2[5], r2x, r2y, r2z);
+            __m256 cz2 = Dot3AVX2(R2[6], R2[7], R2[8], r2x, r2y, r2z);
+
+            __m256 inv_z1 = _mm256_div_ps(one, cz1);
+            __m256 ex1 = _mm256_mul_ps(fx, _mm256_fmsub_ps(cx1, inv_z1, u1));
+            __m256 ey1 = _mm256_mul_ps(fy, _mm256_fmsub_ps(cy1, inv_z1, v1));
+
+            __m256 inv_z2 = _mm256_div_ps(one, cz2);
+            __m256 ex2 = _mm256_mul_ps(fx, _mm256_fmsub_ps(cx2, inv_z2, u2));
+            __m256 ey2 = _mm256_mul_ps(fy, _mm256_fmsub_ps(cy2, inv_z2, v2));
+
+            _mm256_storeu_ps(&result.X[i], X);
+            _mm256_storeu_ps(&result.Y[i], Y);
+            _mm256_storeu_ps(&result.Z[i], Z);
+            _mm256_storeu_ps(&result.depth1[i], cz1);
+            _mm256_storeu_ps(&result.depth2[i], cz2);
+            _mm256_storeu_ps(&result.error1[i], _mm256_fmadd_ps(ex1, ex1, _mm256_mul_ps(ey1, ey1)));
+            _mm256_storeu_ps(&result.error2[i], _mm256_fmadd_ps(ex2, ex2, _mm256_mul_ps(ey2, ey2)));
+            _mm256_storeu_ps(&result.dist1[i], dist1);
+            _mm256_storeu_ps(&result.dist2[i], dist2);
+            _mm256_storeu_ps(&result.cos_parallax[i], cos_parallax);
+        }
+
+        TriangulateKernelScalar(p, x1, y1, x2, y2, i, end, result);
+    }
+#endif
+
+#ifdef TRIANGULATOR_HAVE_NEON_KERNEL
+    static inline float32x4_t Dot3NEON(float32x4_t ax, float32x4_t ay, float32x4_t az,
+                                       float32x4_t bx, float32x4_t by, float32x4_t bz)
+    {
+        return vmlaq_f32(vmlaq_f32(vmulq_f32(az, bz), ay, by), ax, bx);
+    }
+
+    // Reciprocal estimate plus two Newton steps (ARMv7 has no vector divide):
+    static inline float32x4_t ReciprocalNEON(float32x4_t x)
+    {
+        float32x4_t inv = vrecpeq_f32(x);
+        inv = vmulq_f32(vrecpsq_f32(x, inv), inv);
+        return vmulq_f32(vrecpsq_f32(x, inv), inv);
+    }
+
+    // Same for the square root, via 1/sqrt(x); zero stays zero instead of becoming NaN:
+    static inline float32x4_t SqrtNEON(float32x4_t x)
+    {
+        float32x4_t inv = vrsqrteq_f32(x);
+        inv = vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, inv), inv), inv);
+        inv = vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, inv), inv), inv);
+        return vbslq_f32(vcgtq_f32(x, vdupq_n_f32(0.0f)), vmulq_f32(x, inv), vdupq_n_f32(0.0f));
+    }
+
+    static void TriangulateKernelNEON(const TriangulationParams& p,
+                                      const float* x1, const float* y1,
+                                      const float* x2, const float* y2,
+                                      int begin, int end, TriangulationResult& result)
+    {
+        float32x4_t R1[9], R2[9], C1[3], C2[3], base[3];
+        for (int k=0; k<9; k++)
+        {
+            R1[k] = vdupq_n_f32(p.R1[k]);
+            R2[k] = vdupq_n_f32(p.R2[k]);
+        }
+        for (int k=0; k<3; k++)
+        {
+            C1[k] = vdupq_n_f32(p.C1[k]);
+            C2[k] = vdupq_n_f32(p.C2[k]);
+            base[k] = vdupq_n_f32(p.C2[k] - p.C1[k]);
+        }
+
+        int i = begin;
+        for (; i+4<=end; i+=4)
+        {
+            float32x4_t u1 = vld1q_f32(x1 + i), v1 = vld1q_f32(y1 + i);
+            float32x4_t u2 = vld1q_f32(x2 + i), v2 = vld1q_f32(y2 + i);
+
+            float32x4_t d1x = vmlaq_f32(vmlaq_f32(R1[6], R1[3], v1), R1[0], u1);
+            float32x4_t d1y = vmlaq_f32(vmlaq_f32(R1[7], R1[4], v1), R1[1], u1);
+            float32x4_t d1z = vmlaq_f32(vmlaq_f32(R1[8], R1[5], v1), R1[2], u1);
+
+            float32x4_t d2x = vmlaq_f32(vmlaq_f32(R2[6], R2[3], v2), R2[0], u2);
+            float32x4_t d2y = vmlaq_f32(vmlaq_f32(R2[7], R2[4], v2), R2[1], u2);
+            float32x4_t d2z = vmlaq_f32(vmlaq_f32(R2[8], R2[5], v2), R2[2], u2);
+
+            float32x4_t a = Dot3NEON(d1x, d1y, d1z, d1x, d1y, d1z);
+            float32x4_t b = Dot3NEON(d1x, d1y, d1z, d2x, d2y, d2z);
+            float32x4_t c = Dot3NEON(d2x, d2y, d2z, d2x, d2y, d2z);
+            float32x4_t d = Dot3NEON(d1x, d1y, d1z, base[0], base[1], base[2]);
+            float32x4_t e = Dot3NEON(d2x, d2y, d2z, base[0], base[1], base[2]);
+
+            float32x4_t inv_det = ReciprocalNEON(vmlsq_f32(vmulq_f32(a, c), b, b));
+            float32x4_t l1 = vmulq_f32(vmlsq_f32(vmulq_f32(c, d), b, e), inv_det);
+            float32x4_t l2 = vmulq_f32(vmlsq_f32(vmulq_f32(b, d), a, e), inv_det);
+
+            float32x4_t X = vmulq_n_f32(vaddq_f32(vmlaq_f32(C1[0], l1, d1x), vmlaq_f32(C2[0], l2, d2x)), 0.5f);
+            float32x4_t Y = vmulq_n_f32(vaddq_f32(vmlaq_f32(C1[1], l1, d1y), vmlaq_f32(C2[1], l2, d2y)), 0.5f);
+            float32x4_t Z = vmulq_n_f32(vaddq_f32(vmlaq_f32(C1[2], l1, d1z), vmlaq_f32(C2[2], l2, d2z)), 0.5f);
+
+            float32x4_t r1x = vsubq_f32(X, C1[0]), r1y = vsubq_f32(Y, C1[1]), r1z = vsubq_f32(Z, C1[2]);
+            float32x4_t r2x = vsubq_f32(X, C2[0]), r2y = vsubq_f32(Y, C2[1]), r2z = vsubq_f32(Z, C2[2]);
+
+            float32x4_t dist1 = SqrtNEON(Dot3NEON(r1x, r1y, r1z, r1x, r1y, r1z));
+            float32x4_t dist2 = SqrtNEON(Dot3NEON(r2x, r2y, r2z, r2x, r2y, r2z));
+            float32x4_t cos_parallax = vmulq_f32(Dot3NEON(r1x, r1y, r1z, r2x, r2y, r2z),
+                                                 ReciprocalNEON(vmulq_f32(dist1, dist2)));
+
+            float32x4_t cx1 = Dot3NEON(R1[0], R1[1], R1[2], r1x, r1y, r1z);
+            float32x4_t cy1 = Dot3NEON(R1[3], R1[4], R1[5], r1x, r1y, r1z);
+            float32x4_t cz1 = Dot3NEON(R1[6], R1[7], R1[8], r1x, r1y, r1z);
+
+            float32x4_t cx2 = Dot3NEON(R2[0], R2[1], R2[2], r2x, r2y, r2z);
+            float32x4_t cy2 = Dot3NEON(R2[3], R2[4], R2[5], r2x, r2y, r2z);
+            float32x4_t cz2 = Dot3NEON(R2[6], R2[7], R2[8], r2x, r2y, r2z);
+
+            float32x4_t inv_z1 = ReciprocalNEON(cz1);
+            float32x4_t ex1 = vmulq_n_f32(vsubq_f32(vmulq_f32(cx1, inv_z1), u1), p.fx);
+            float32x4_t ey1 = vmulq_n_f32(vsubq_f32(vmulq_f32(cy1, inv_z1), v1), p.fy);
+
+            float32x4_t inv_z2 = ReciprocalNEON(cz2);
+            float32x4_t ex2 = vmulq_n_f32(vsubq_f32(vmulq_f32(cx2, inv_z2), u2), p.fx);
+            float32x4_t ey2 = vmulq_n_f32(vsubq_f32(vmulq_f32(cy2, inv_z2), v2), p.fy);
+
+            vst1q_f32(&result.X[i], X);
+            vst1q_f32(&result.Y[i], Y);
+            vst1q_f32(&result.Z[i], Z);
+            vst1q_f32(&result.depth1[i], cz1);
+            vst1q_f32(&result.depth2[i], cz2);
+            vst1q_f32(&result.error1[i], vmlaq_f32(vmulq_f32(ey1, ey1), ex1, ex1));
+            vst1q_f32(&result.error2[i], vmlaq_f32(vmulq_f32(ey2, ey2), ex2, ex2));
+            vst1q_f32(&result.dist1[i], dist1);
+            vst1q_f32(&result.dist2[i], dist2);
+            vst1q_f32(&result.cos_parallax[i], cos_parallax);
+        }
+
+        TriangulateKernelScalar(p, x1, y1, x2, y2, i, end, result);
+    }
+#endif
+
+    static void FillCameraParams(const SE3& pose, float* R, float* t, float* C)
+    {
+        Matx33d rot = pose.GetRotation();
+        Vec3d trans = pose.GetTranslation();
+        Vec3d center = pose.GetCenter();
+
+        for (int k=0; k<9; k++)
+            R[k] = (float)rot.val[k];
+        for (int k=0; k<3; k++)
+        {
+            t[k] = (float)trans[k];
+            C[k] = (float)center[k];
+        }
+    }
+
+    Triangulator::Triangulator(const Mat& camera_matrix)
+    {
+        Mat K;
+        camera_matrix.convertTo(K, CV_64F);
+
+        fx = K.at<double>(0, 0);
+        fy = K.at<double>(1, 1);
+        cx = K.at<double>(0, 2);
+        cy = K.at<double>(1, 2);
+
+        kernel = TriangulateKernelScalar;
+        kernel_name = "scalar";
+
+#if defined(TRIANGULATOR_HAVE_AVX2_KERNEL)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            kernel = TriangulateKernelAVX2;
+            kernel_name = "avx2";
+        }
+#elif defined(TRIANGULATOR_HAVE_NEON_KERNEL)
+        kernel = TriangulateKernelNEON;
+        kernel_name = "neon";
+#endif
+    }
+
+    void Triangulator::Reserve(int n)
+    {
+        x1.reserve(n);
+        y1.reserve(n);
+        x2.reserve(n);
+        y2.reserve(n);
+    }
+
+    void Triangulator::Clear(void)
+    {
+        x1.clear();
+        y1.clear();
+        x2.clear();
+        y2.clear();
+    }
+
+    int Triangulator::Add(const Point2f& ref_pt, const Point2f& tar_pt)
+    {
+        x1.push_back((float)((ref_pt.x - cx) / fx));
+        y1.push_back((float)((ref_pt.y - cy) / fy));
+        x2.push_back((float)((tar_pt.x - cx) / fx));
+        y2.push_back((float)((tar_pt.y - cy) / fy));
+
+        return (int)x1.size() - 1;
+    }
+
+    void Triangulator::Run(const SE3& pose1, const SE3& pose2, TriangulationResult& result) const
+    {
+        Run(pose1, pose2, 0, Size(), result);
+    }
+
+    void Triangulator::Run(const SE3& pose1, const SE3& pose2, int begin, int end,
+                           TriangulationResult& result) const
+    {
+        int n = end - begin;
+
+        // resize() keeps capacity, so a result reused across runs does not reallocate:
+        result.X.resize(n);
+        result.Y.resize(n);
+        result.Z.resize(n);
+        result.depth1.resize(n);
+        result.depth2.resize(n);
+        result.error1.resize(n);
+        result.error2.resize(n);
+        result.dist1.resize(n);
+        result.dist2.resize(n);
+        result.cos_parallax.resize(n);
+
+        if (n <= 0)
+            return;
+
+        TriangulationParams params;
+        FillCameraParams(pose1, params.R1, params.t1, params.C1);
+        FillCameraParams(pose2, params.R2, params.t2, params.C2);
+        params.fx = (float)fx;
+        params.fy = (float)fy;
+
+        kernel(params, &x1[begin], &y1[begin], &x2[begin], &y2[begin], 0, n, result);
+    }
+}
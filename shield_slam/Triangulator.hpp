@@ -0,0 +1,79 @@
+#ifndef __shield_slam__Triangulator__
+#define __shield_slam__Triangulator__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+#include "Pose.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // Per-correspondence results of one Triangulator::Run, in SoA layout. Depths are camera z,
+    // errors are squared reprojection errors in pixels, distances run from each camera centre:
+    struct TriangulationResult {
+        vector<float> X, Y, Z;
+        vector<float> depth1, depth2;
+        vector<float> error1, error2;
+        vector<float> dist1, dist2;
+        vector<float> cos_parallax;
+    };
+
+    // Both cameras of a Run as flat float arrays; R is row-major, C the camera centre:
+    struct TriangulationParams {
+        float R1[9], t1[3], C1[3];
+        float R2[9], t2[3], C2[3];
+        float fx, fy;
+    };
+
+    /*
+     Batched two-view triangulation. Correspondences are added in pixels and kept as
+     normalized coordinates; Run intersects the viewing rays with the closed-form midpoint
+     method and, in the same SIMD pass, computes depth in both cameras, reprojection errors
+     and the parallax angle, so callers only apply their thresholds.
+
+     Run is const and writes to a caller-owned result, so one batch can be evaluated for
+     several pose hypotheses, also from several threads.
+     */
+    class Triangulator
+    {
+    public:
+
+        Triangulator(const Mat& camera_matrix);
+        virtual ~Triangulator() = default;
+
+        void Reserve(int n);
+        void Clear(void);
+
+        // Returns the index of the correspondence in the batch:
+        int Add(const Point2f& ref_pt, const Point2f& tar_pt);
+
+        // pose1, pose2 are world-to-camera; result is resized to Size():
+        void Run(const SE3& pose1, const SE3& pose2, TriangulationResult& result) const;
+
+        // Correspondences [begin, end) only, stored at result indices [0, end - begin):
+        void Run(const SE3& pose1, const SE3& pose2, int begin, int end,
+                 TriangulationResult& result) const;
+
+        int Size(void) const { return (int)x1.size(); }
+        const char* GetKernelName(void) const { return kernel_name; }
+
+        typedef void (*TriangulationKernel)(const TriangulationParams& params,
+                                            const float* x1, const float* y1,
+                                            const float* x2, const float* y2,
+                                            int begin, int end, TriangulationResult& result);
+
+    protected:
+        double fx, fy, cx, cy;
+
+        // Normalized image coordinates of both views:
+        vector<float> x1, y1, x2, y2;
+
+        TriangulationKernel kernel;
+        const char* kernel_name;
+    };
+}
+
+#endif /* defined(__shield_slam__Triangulator__) */
@@ -0,0 +1,460 @@
+#include "TwoViewScorer.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TWO_VIEW_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+// The kernels divide per match; ARMv7 NEON has no vector divide, so it uses the scalar kernel:
+#if defined(__aarch64__) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define TWO_VIEW_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+// a * b + c must round twice in every kernel. GCC contracts it into a fused multiply-add by
+// default wherever the target has one (aarch64, or x86 with -mfma), NEON intrinsics included:
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // The SIMD kernels below repeat these operations in the same order and without fused
+    // multiply-adds, which keeps their results identical to the scalar kernels.
+
+    static float HomographyKernelScalar(const TwoViewScoreParams& p,
+                                        const float* x1, const float* y1,
+                                        const float* x2, const float* y2,
+                                        int begin, int end, float score,
+                                        uchar* inliers, int& num_inliers)
+    {
+        const float* H_21 = p.M;
+        const float* H_12 = p.M + 9;
+
+        for (int i=begin; i<end; i++)
+        {
+            // Reproject tar keypoints to ref keypoints:
+            float inv_w1 = 1.0f / (H_21[6] * x2[i] + H_21[7] * y2[i] + H_21[8]);
+            float u1 = (H_21[0] * x2[i] + H_21[1] * y2[i] + H_21[2]) * inv_w1;
+            float v1 = (H_21[3] * x2[i] + H_21[4] * y2[i] + H_21[5]) * inv_w1;
+
+            float dx1 = x1[i] - u1, dy1 = y1[i] - v1;
+            float chi1 = (dx1 * dx1 + dy1 * dy1) * p.inv_sigma_square;
+
+            // Reproject ref keypoints to tar keypoints:
+            float inv_w2 = 1.0f / (H_12[6] * x1[i] + H_12[7] * y1[i] + H_12[8]);
+            float u2 = (H_12[0] * x1[i] + H_12[1] * y1[i] + H_12[2]) * inv_w2;
+            float v2 = (H_12[3] * x1[i] + H_12[4] * y1[i] + H_12[5]) * inv_w2;
+
+            float dx2 = x2[i] - u2, dy2 = y2[i] - v2;
+            float chi2 = (dx2 * dx2 + dy2 * dy2) * p.inv_sigma_square;
+
+            bool in1 = chi1 <= p.th;
+            bool in2 = chi2 <= p.th;
+
+            score += in1 ? p.score_th - chi1 : 0.0f;
+            score += in2 ? p.score_th - chi2 : 0.0f;
+
+            inliers[i] = in1 && in2;
+            num_inliers += inliers[i];
+        }
+
+        return score;
+    }
+
+    static float FundamentalKernelScalar(const TwoViewScoreParams& p,
+                                         const float* x1, const float* y1,
+                                         const float* x2, const float* y2,
+                                         int begin, int end, float score,
+                                         uchar* inliers, int& num_inliers)
+    {
+        const float* F = p.M;
+
+        for (int i=begin; i<end; i++)
+        {
+            // Epipolar line of the ref keypoint in the target image, F * x1:
+            float a2 = F[0] * x1[i] + F[1] * y1[i] + F[2];
+            float b2 = F[3] * x1[i] + F[4] * y1[i] + F[5];
+            float c2 = F[6] * x1[i] + F[7] * y1[i] + F[8];
+
+            float num2 = a2 * x2[i] + b2 * y2[i] + c2;
+            float chi2 = (num2 * num2 / (a2 * a2 + b2 * b2)) * p.inv_sigma_square;
+
+            // Epipolar line of the tar keypoint in the reference image, F^T * x2:
+            float a1 = F[0] * x2[i] + F[3] * y2[i] + F[6];
+            float b1 = F[1] * x2[i] + F[4] * y2[i] + F[7];
+            float c1 = F[2] * x2[i] + F[5] * y2[i] + F[8];
+
+            float num1 = a1 * x1[i] + b1 * y1[i] + c1;
+            float chi1 = (num1 * num1 / (a1 * a1 + b1 * b1)) * p.inv_sigma_square;
+
+            bool in2 = chi2 <= p.th;
+            bool in1 = chi1 <= p.th;
+
+            score += in2 ? p.score_th - chi2 : 0.0f;
+            score += in1 ? p.score_th - chi1 : 0.0f;
+
+            inliers[i] = in1 && in2;
+            num_inliers += inliers[i];
+        }
+
+        return score;
+    }
+
+    // Adds per-lane terms in match order, first and second direction interleaved:
+    static inline float AccumulateLanes(const float* first, const float* second, int n, float score)
+    {
+        for (int k=0; k<n; k++)
+        {
+            score += first[k];
+            score += second[k];
+        }
+        return score;
+    }
+
+#ifdef TWO_VIEW_HAVE_AVX2_KERNEL
+    // m[0] * x + m[stride] * y + m[2 * stride]; stride 1 walks a row, stride 3 a column:
+    __attribute__((target("avx2")))
+    static inline __m256 Line3AVX2(const float* m, int stride, __m256 x, __m256 y)
+    {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0]), x),
+                                           _mm256_mul_ps(_mm256_set1_ps(m[stride]), y)),
+                             _mm256_set1_ps(m[2 * stride]));
+    }
+
+    __attribute__((target("avx2")))
+    static inline void StoreMaskAVX2(__m256 in, uchar* inliers, int& num_inliers)
+    {
+        int bits = _mm256_movemask_ps(in);
+        for (int k=0; k<8; k++)
+            inliers[k] = (bits >> k) & 1;
+        num_inliers += __builtin_popcount(bits);
+    }
+
+    __attribute__((target("avx2")))
+    static float HomographyKernelAVX2(const TwoViewScoreParams& p,
+                                      const float* x1, const float* y1,
+                                      const float* x2, const float* y2,
+                                      int begin, int end, float score,
+                                      uchar* inliers, int& num_inliers)
+    {
+        const float* H_21 = p.M;
+        const float* H_12 = p.M + 9;
+
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 inv_sigma_square = _mm256_set1_ps(p.inv_sigma_square);
+        const __m256 th = _mm256_set1_ps(p.th);
+        const __m256 score_th = _mm256_set1_ps(p.score_th);
+
+        float terms1[8], terms2[8];
+
+        int i = begin;
+        for (; i+8<=end; i+=8)
+        {
+            __m256 px1 = _mm256_loadu_ps(x1 + i), py1 = _mm256_loadu_ps(y1 + i);
+            __m256 px2 = _mm256_loadu_ps(x2 + i), py2 = _mm256_loadu_ps(y2 + i);
+
+            __m256 inv_w1 = _mm256_div_ps(one, Line3AVX2(H_21 + 6, 1, px2, py2));
+            __m256 u1 = _mm256_mul_ps(Line3AVX2(H_21, 1, px2, py2), inv_w1);
+            __m256 v1 = _mm256_mul_ps(Line3AVX2(H_21 + 3, 1, px2, py2), inv_w1);
+
+            __m256 dx1 = _mm256_sub_ps(px1, u1), dy1 = _mm256_sub_ps(py1, v1);
+            __m256 chi1 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(dx1, dx1), _mm256_mul_ps(dy1, dy1)), inv_sigma_square);
+
+            __m256 inv_w2 = _mm256_div_ps(one, Line3AVX2(H_12 + 6, 1, px1, py1));
+            __m256 u2 = _mm256_mul_ps(Line3AVX2(H_12, 1, px1, py1), inv_w2);
+            __m256 v2 = _mm256_mul_ps(Line3AVX2(H_12 + 3, 1, px1, py1), inv_w2);
+
+            __m256 dx2 = _mm256_sub_ps(px2, u2), dy2 = _mm256_sub_ps(py2, v2);
+            __m256 chi2 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(dx2, dx2), _mm256_mul_ps(dy2, dy2)), inv_sigma_square);
+
+            __m256 in1 = _mm256_cmp_ps(chi1, th, _CMP_LE_OQ);
+            __m256 in2 = _mm256_cmp_ps(chi2, th, _CMP_LE_OQ);
+
+            _mm256_storeu_ps(terms1, _mm256_and_ps(in1, _mm256_sub_ps(score_th, chi1)));
+            _mm256_storeu_ps(terms2, _mm256_and_ps(in2, _mm256_sub_ps(score_th, chi2)));
+            score = AccumulateLanes(terms1, terms2, 8, score);
+
+            StoreMaskAVX2(_mm256_and_ps(in1, in2), inliers + i, num_inliers);
+        }
+
+        return HomographyKernelScalar(p, x1, y1, x2, y2, i, end, score, inliers, num_inliers);
+    }
+
+    __attribute__((target("avx2")))
+    static float FundamentalKernelAVX2(const TwoViewScoreParams& p,
+                                       const float* x1, const float* y1,
+                                       const float* x2, const float* y2,
+                                       int begin, int end, float score,
+                                       uchar* inliers, int& num_inliers)
+    {
+        const float* F = p.M;
+
+        const __m256 inv_sigma_square = _mm256_set1_ps(p.inv_sigma_square);
+        const __m256 th = _mm256_set1_ps(p.th);
+        const __m256 score_th = _mm256_set1_ps(p.score_th);
+
+        float terms2[8], terms1[8];
+
+        int i = begin;
+        for (; i+8<=end; i+=8)
+        {
+            __m256 px1 = _mm256_loadu_ps(x1 + i), py1 = _mm256_loadu_ps(y1 + i);
+            __m256 px2 = _mm256_loadu_ps(x2 + i), py2 = _mm256_loadu_ps(y2 + i);
+
+            // F * x1 uses the rows of F, F^T * x2 its columns (stride 3):
+            __m256 a2 = Line3AVX2(F, 1, px1, py1);
+            __m256 b2 = Line3AVX2(F + 3, 1, px1, py1);
+            __m256 c2 = Line3AVX2(F + 6, 1, px1, py1);
+
+            __m256 num2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a2, px2), _mm256_mul_ps(b2, py2)), c2);
+            __m256 den2 = _mm256_add_ps(_mm256_mul_ps(a2, a2), _mm256_mul_ps(b2, b2));
+            __m256 chi2 = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(num2, num2), den2), inv_sigma_square);
+
+            __m256 a1 = Line3AVX2(F, 3, px2, py2);
+            __m256 b1 = Line3AVX2(F + 1, 3, px2, py2);
+            __m256 c1 = Line3AVX2(F + 2, 3, px2, py2);
+
+            __m256 num1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a1, px1), _mm256_mul_ps(b1, py1)), c1);
+            __m256 den1 = _mm256_add_ps(_mm256_mul_ps(a1, a1), _mm256_mul_ps(b1, b1));
+            __m256 chi1 = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(num1, num1), den1), inv_sigma_square);
+
+            __m256 in2 = _mm256_cmp_ps(chi2, th, _CMP_LE_OQ);
+            __m256 in1 = _mm256_cmp_ps(chi1, th, _CMP_LE_OQ);
+
+            _mm256_storeu_ps(terms2, _mm256_and_ps(in2, _mm256_sub_ps(score_th, chi2)));
+            _mm256_storeu_ps(terms1, _mm256_and_ps(in1, _mm256_sub_ps(score_th, chi1)));
+            score = AccumulateLanes(terms2, terms1, 8, score);
+
+            StoreMaskAVX2(_mm256_and_ps(in1, in2), inliers + i, num_inliers);
+        }
+
+        return FundamentalKernelScalar(p, x1, y1, x2, y2, i, end, score, inliers, num_inliers);
+    }
+#endif
+
+#ifdef TWO_VIEW_HAVE_NEON_KERNEL
+    static inline float32x4_t Line3NEON(const float* m, int stride, float32x4_t x, float32x4_t y)
+    {
+        return vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[0]), vmulq_n_f32(y, m[stride])),
+                         vdupq_n_f32(m[2 * stride]));
+    }
+
+    static inline void StoreMaskNEON(uint32x4_t in, uchar* inliers, int& num_inliers)
+    {
+        inliers[0] = vgetq_lane_u32(in, 0) & 1;
+        inliers[1] = vgetq_lane_u32(in, 1) & 1;
+        inliers[2] = vgetq_lane_u32(in, 2) & 1;
+        inliers[3] = vgetq_lane_u32(in, 3) & 1;
+        num_inliers += inliers[0] + inliers[1] + inliers[2] + inliers[3];
+    }
+
+    static inline float32x4_t MaskTermNEON(uint32x4_t in, float32x4_t score_th, float32x4_t chi)
+    {
+        return vreinterpretq_f32_u32(vandq_u32(in, vreinterpretq_u32_f32(vsubq_f32(score_th, chi))));
+    }
+
+    static float HomographyKernelNEON(const TwoViewScoreParams& p,
+                                      const float* x1, const float* y1,
+                                      const float* x2, const float* y2,
+                                      int begin, int end, float score,
+                                      uchar* inliers, int& num_inliers)
+    {
+        const float* H_21 = p.M;
+        const float* H_12 = p.M + 9;
+
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        const float32x4_t th = vdupq_n_f32(p.th);
+        const float32x4_t score_th = vdupq_n_f32(p.score_th);
+
+        float terms1[4], terms2[4];
+
+        int i = begin;
+        for (; i+4<=end; i+=4)
+        {
+            float32x4_t px1 = vld1q_f32(x1 + i), py1 = vld1q_f32(y1 + i);
+            float32x4_t px2 = vld1q_f32(x2 + i), py2 = vld1q_f32(y2 + i);
+
+            float32x4_t inv_w1 = vdivq_f32(one, Line3NEON(H_21 + 6, 1, px2, py2));
+            float32x4_t u1 = vmulq_f32(Line3NEON(H_21, 1, px2, py2), inv_w1);
+            float32x4_t v1 = vmulq_f32(Line3NEON(H_21 + 3, 1, px2, py2), inv_w1);
+
+            float32x4_t dx1 = vsubq_f32(px1, u1), dy1 = vsubq_f32(py1, v1);
+            float32x4_t chi1 = vmulq_n_f32(vaddq_f32(vmulq_f32(dx1, dx1), vmulq_f32(dy1, dy1)), p.inv_sigma_square);
+
+            float32x4_t inv_w2 = vdivq_f32(one, Line3NEON(H_12 + 6, 1, px1, py1));
+            float32x4_t u2 = vmulq_f32(Line3NEON(H_12, 1, px1, py1), inv_w2);
+            float32x4_t v2 = vmulq_f32(Line3NEON(H_12 + 3, 1, px1, py1), inv_w2);
+
+            float32x4_t dx2 = vsubq_f32(px2, u2), dy2 = vsubq_f32(py2, v2);
+            float32x4_t chi2 = vmulq_n_f32(vaddq_f32(vmulq_f32(dx2, dx2), vmulq_f32(dy2, dy2)), p.inv_sigma_square);
+
+            uint32x4_t in1 = vcleq_f32(chi1, th);
+            uint32x4_t in2 = vcleq_f32(chi2, th);
+
+            vst1q_f32(terms1, MaskTermNEON(in1, score_th, chi1));
+            vst1q_f32(terms2, MaskTermNEON(in2, score_th, chi2));
+            score = AccumulateLanes(terms1, terms2, 4, score);
+
+            StoreMaskNEON(vandq_u32(in1, in2), inliers + i, num_inliers);
+        }
+
+        return HomographyKernelScalar(p, x1, y1, x2, y2, i, end, score, inliers, num_inliers);
+    }
+
+    static float FundamentalKernelNEON(const TwoViewScoreParams& p,
+                                       const float* x1, const float* y1,
+                                       const float* x2, const float* y2,
+                                       int begin, int end, float score,
+                                       uchar* inliers, int& num_inliers)
+    {
+        const float* F = p.M;
+
+        const float32x4_t th = vdupq_n_f32(p.th);
+        const float32x4_t score_th = vdupq_n_f32(p.score_th);
+
+        float terms2[4], terms1[4];
+
+        int i = begin;
+        for (; i+4<=end; i+=4)
+        {
+            float32x4_t px1 = vld1q_f32(x1 + i), py1 = vld1q_f32(y1 + i);
+            float32x4_t px2 = vld1q_f32(x2 + i), py2 = vld1q_f32(y2 + i);
+
+            float32x4_t a2 = Line3NEON(F, 1, px1, py1);
+            float32x4_t b2 = Line3NEON(F + 3, 1, px1, py1);
+            float32x4_t c2 = Line3NEON(F + 6, 1, px1, py1);
+
+            float32x4_t num2 = vaddq_f32(vaddq_f32(vmulq_f32(a2, px2), vmulq_f32(b2, py2)), c2);
+            float32x4_t den2 = vaddq_f32(vmulq_f32(a2, a2), vmulq_f32(b2, b2));
+            float32x4_t chi2 = vmulq_n_f32(vdivq_f32(vmulq_f32(num2, num2), den2), p.inv_sigma_square);
+
+            float32x4_t a1 = Line3NEON(F, 3, px2, py2);
+            float32x4_t b1 = Line3NEON(F + 1, 3, px2, py2);
+            float32x4_t c1 = Line3NEON(F + 2, 3, px2, py2);
+
+            float32x4_t num1 = vaddq_f32(vaddq_f32(vmulq_f32(a1, px1), vmulq_f32(b1, py1)), c1);
+            float32x4_t den1 = vaddq_f32(vmulq_f32(a1, a1), vmulq_f32(b1, b1));
+            float32x4_t chi1 = vmulq_n_f32(vdivq_f32(vmulq_f32(num1, num1), den1), p.inv_sigma_square);
+
+            uint32x4_t in2 = vcleq_f32(chi2, th);
+            uint32x4_t in1 = vcleq_f32(chi1, th);
+
+            vst1q_f32(terms2, MaskTermNEON(in2, score_th, chi2));
+            vst1q_f32(terms1, MaskTermNEON(in1, score_th, chi1));
+            score = AccumulateLanes(terms2, terms1, 4, score);
+
+            StoreMaskNEON(vandq_u32(in1, in2), inliers + i, num_inliers);
+        }
+
+        return FundamentalKernelScalar(p, x1, y1, x2, y2, i, end, score, inliers, num_inliers);
+    }
+#endif
+
+    TwoViewScorer::TwoViewScorer()
+    {
+        SetUseSimd(true);
+    }
+
+    void TwoViewScorer::SetUseSimd(bool enable)
+    {
+        homography_kernel = HomographyKernelScalar;
+        fundamental_kernel = FundamentalKernelScalar;
+        kernel_name = "scalar";
+
+        if (!enable)
+            return;
+
+#if defined(TWO_VIEW_HAVE_AVX2_KERNEL)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            homography_kernel = HomographyKernelAVX2;
+            fundamental_kernel = FundamentalKernelAVX2;
+            kernel_name = "avx2";
+        }
+#elif defined(TWO_VIEW_HAVE_NEON_KERNEL)
+        homography_kernel = HomographyKernelNEON;
+        fundamental_kernel = FundamentalKernelNEON;
+        kernel_name = "neon";
+#endif
+    }
+
+    void TwoViewScorer::SetPoints(const PointArray &ref_points, const PointArray &tar_points)
+    {
+        assert(ref_points.size() == tar_points.size());
+
+        const int n = (int)ref_points.size();
+        x1.resize(n);
+        y1.resize(n);
+        x2.resize(n);
+        y2.resize(n);
+
+        for (int i=0; i<n; i++)
+        {
+            x1[i] = ref_points[i].x;
+            y1[i] = ref_points[i].y;
+            x2[i] = tar_points[i].x;
+            y2[i] = tar_points[i].y;
+        }
+    }
+
+    void TwoViewScorer::MakeHomographyParams(const Matx33d &H_12, float sigma, float th,
+                                             TwoViewScoreParams &params) const
+    {
+        Matx33d H_21 = H_12.inv();
+        for (int k=0; k<9; k++)
+        {
+            params.M[k] = (float)H_21.val[k];
+            params.M[9 + k] = (float)H_12.val[k];
+        }
+        params.inv_sigma_square = 1.0f / (sigma * sigma);
+        params.th = th;
+        params.score_th = th;
+    }
+
+    void TwoViewScorer::MakeFundamentalParams(const Matx33d &F_21, float sigma, float th, float score_th,
+                                              TwoViewScoreParams &params) const
+    {
+        for (int k=0; k<9; k++)
+        {
+            params.M[k] = (float)F_21.val[k];
+        }
+        params.inv_sigma_square = 1.0f / (sigma * sigma);
+        params.th = th;
+        params.score_th = score_th;
+    }
+
+    float TwoViewScorer::ScoreHomography(const Matx33d &H_12, float sigma, float th,
+                                         vector<uchar> &inliers, int &num_inliers) const
+    {
+        TwoViewScoreParams params;
+        MakeHomographyParams(H_12, sigma, th, params);
+
+        inliers.resize(Size());
+        num_inliers = 0;
+        if (Size() == 0)
+            return 0.0f;
+
+        return ScoreHomography(params, 0, Size(), 0.0f, &inliers[0], num_inliers);
+    }
+
+    float TwoViewScorer::ScoreFundamental(const Matx33d &F_21, float sigma, float th, float score_th,
+                                          vector<uchar> &inliers, int &num_inliers) const
+    {
+        TwoViewScoreParams params;
+        MakeFundamentalParams(F_21, sigma, th, score_th, params);
+
+        inliers.resize(Size());
+        num_inliers = 0;
+        if (Size() == 0)
+            return 0.0f;
+
+        return ScoreFundamental(params, 0, Size(), 0.0f, &inliers[0], num_inliers);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef __shield_slam__TwoViewScorer__
+#define __shield_slam__TwoViewScorer__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // One model as flat floats. Homographies use M[0..8] = H_21 and M[9..17] = H_12,
+    // fundamental matrices M[0..8] = F_21; all row-major:
+    struct TwoViewScoreParams {
+        float M[18];
+        float inv_sigma_square;
+        float th;
+        float score_th;
+    };
+
+    /*
+     Symmetric transfer (homography) and symmetric epipolar (fundamental) scoring over
+     matches held as float x/y arrays. A correspondence is an inlier when both directions
+     are within th; every direction within th adds score_th - chi_square to the score.
+
+     The SIMD kernels evaluate the same per-match operations as the scalar kernel and add
+     the per-match terms to the score in match order, so every kernel returns the same
+     inlier mask and score. Scoring is const, so one scorer can serve concurrent RANSAC
+     loops.
+     */
+    class TwoViewScorer
+    {
+    public:
+
+        TwoViewScorer();
+        virtual ~TwoViewScorer() = default;
+
+        // Matches in pixels, ref_points[i] <-> tar_points[i]:
+        void SetPoints(const PointArray& ref_points, const PointArray& tar_points);
+
+        // H_12 maps reference to target points. inliers gets one byte per match:
+        float ScoreHomography(const Matx33d& H_12, float sigma, float th,
+                              vector<uchar>& inliers, int& num_inliers) const;
+
+        // F_21 satisfies x2^T * F_21 * x1 = 0:
+        float ScoreFundamental(const Matx33d& F_21, float sigma, float th, float score_th,
+                               vector<uchar>& inliers, int& num_inliers) const;
+
+        // Incremental scoring: params are built once per model, then [begin, end) is scored on
+        // top of score; inliers is indexed by match:
+        void MakeHomographyParams(const Matx33d& H_12, float sigma, float th, TwoViewScoreParams& params) const;
+        void MakeFundamentalParams(const Matx33d& F_21, float sigma, float th, float score_th,
+                                   TwoViewScoreParams& params) const;
+
+        float ScoreHomography(const TwoViewScoreParams& params, int begin, int end, float score,
+                              uchar* inliers, int& num_inliers) const
+        {
+            return homography_kernel(params, &x1[0], &y1[0], &x2[0], &y2[0], begin, end, score,
+                                     inliers, num_inliers);
+        }
+
+        float ScoreFundamental(const TwoViewScoreParams& params, int begin, int end, float score,
+                               uchar* inliers, int& num_inliers) const
+        {
+            return fundamental_kernel(params, &x1[0], &y1[0], &x2[0], &y2[0], begin, end, score,
+                                      inliers, num_inliers);
+        }
+
+        int Size(void) const { return (int)x1.size(); }
+        const char* GetKernelName(void) const { return kernel_name; }
+        // SIMD kernels when the CPU has them; false forces the scalar reference:
+        void SetUseSimd(bool enable);
+
+        typedef float (*ScoreKernel)(const TwoViewScoreParams& params,
+                                     const float* x1, const float* y1,
+                                     const float* x2, const float* y2,
+                                     int begin, int end, float score,
+                                     uchar* inliers, int& num_inliers);
+
+    protected:
+        vector<float> x1, y1, x2, y2;
+
+        ScoreKernel homography_kernel;
+        ScoreKernel fundamental_kernel;
+        const char* kernel_name;
+    };
+}
+
+#endif /* defined(__shield_slam__TwoViewScorer__) */
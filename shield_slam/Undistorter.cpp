@@ -0,0 +1,318 @@
+#include "Undistorter.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UNDISTORT_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+// NEON has no gather: its kernel loads the four nodes of each point in scalar code and only
+// vectorizes the interpolation and the affine output.
+#if defined(__aarch64__) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define UNDISTORT_HAVE_NEON_KERNEL
+#include <arm_neon.h>
+#endif
+
+// Every kernel rounds each product and sum on its own; a fused multiply-add, which GCC emits
+// by default on aarch64 or with -mfma, would make the SIMD results drift from the scalar ones:
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    static inline float Bilinear(const float* map, int k, int cols, float ax, float ay)
+    {
+        float top = map[k] + ax * (map[k + 1] - map[k]);
+        float bottom = map[k + cols] + ax * (map[k + cols + 1] - map[k + cols]);
+        return top + ay * (bottom - top);
+    }
+
+    static void LutKernelScalar(const UndistortLut& lut, const float* in, float* out, int begin, int end)
+    {
+        const float* A = lut.A;
+
+        for (int i=begin; i<end; i++)
+        {
+            float gx = min(max(in[2 * i] * lut.inv_step, 0.0f), lut.max_gx);
+            float gy = min(max(in[2 * i + 1] * lut.inv_step, 0.0f), lut.max_gy);
+
+            // Cell of the point; the last node row and column only close the cells before them:
+            int c = min((int)gx, lut.cols - 2);
+            int r = min((int)gy, lut.rows - 2);
+            float ax = gx - (float)c;
+            float ay = gy - (float)r;
+
+            int k = r * lut.cols + c;
+            float nx = Bilinear(lut.map_x, k, lut.cols, ax, ay);
+            float ny = Bilinear(lut.map_y, k, lut.cols, ax, ay);
+
+            out[2 * i] = A[0] * nx + A[1] * ny + A[2];
+            out[2 * i + 1] = A[3] * ny + A[4];
+        }
+    }
+
+#ifdef UNDISTORT_HAVE_AVX2_KERNEL
+    __attribute__((target("avx2")))
+    static inline __m256 BilinearAVX2(const float* map, __m256i k, __m256i k_down, __m256 ax, __m256 ay)
+    {
+        __m256 v00 = _mm256_i32gather_ps(map, k, 4);
+        __m256 v01 = _mm256_i32gather_ps(map + 1, k, 4);
+        __m256 v10 = _mm256_i32gather_ps(map, k_down, 4);
+        __m256 v11 = _mm256_i32gather_ps(map + 1, k_down, 4);
+
+        __m256 top = _mm256_add_ps(v00, _mm256_mul_ps(ax, _mm256_sub_ps(v01, v00)));
+        __m256 bottom = _mm256_add_ps(v10, _mm256_mul_ps(ax, _mm256_sub_ps(v11, v10)));
+        return _mm256_add_ps(top, _mm256_mul_ps(ay, _mm256_sub_ps(bottom, top)));
+    }
+
+    __attribute__((target("avx2")))
+    static void LutKernelAVX2(const UndistortLut& lut, const float* in, float* out, int begin, int end)
+    {
+        const __m256 inv_step = _mm256_set1_ps(lut.inv_step);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 max_gx = _mm256_set1_ps(lut.max_gx);
+        const __m256 max_gy = _mm256_set1_ps(lut.max_gy);
+        const __m256i max_c = _mm256_set1_epi32(lut.cols - 2);
+        const __m256i max_r = _mm256_set1_epi32(lut.rows - 2);
+        const __m256i cols = _mm256_set1_epi32(lut.cols);
+
+        const __m256 A0 = _mm256_set1_ps(lut.A[0]), A1 = _mm256_set1_ps(lut.A[1]);
+        const __m256 A2 = _mm256_set1_ps(lut.A[2]), A3 = _mm256_set1_ps(lut.A[3]);
+        const __m256 A4 = _mm256_set1_ps(lut.A[4]);
+
+        int i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            // x0 y0 ... x3 y3 | x4 y4 ... x7 y7 to x0 ... x7 and y0 ... y7:
+            __m256 a = _mm256_loadu_ps(in + 2 * i);
+            __m256 b = _mm256_loadu_ps(in + 2 * i + 8);
+            __m256 px = _mm256_castpd_ps(_mm256_permute4x64_pd(
+                _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+            __m256 py = _mm256_castpd_ps(_mm256_permute4x64_pd(
+                _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+
+            __m256 gx = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(px, inv_step), zero), max_gx);
+            __m256 gy = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(py, inv_step), zero), max_gy);
+
+            __m256i c = _mm256_min_epi32(_mm256_cvttps_epi32(gx), max_c);
+            __m256i r = _mm256_min_epi32(_mm256_cvttps_epi32(gy), max_r);
+            __m256 ax = _mm256_sub_ps(gx, _mm256_cvtepi32_ps(c));
+            __m256 ay = _mm256_sub_ps(gy, _mm256_cvtepi32_ps(r));
+
+            __m256i k = _mm256_add_epi32(_mm256_mullo_epi32(r, cols), c);
+            __m256i k_down = _mm256_add_epi32(k, cols);
+            __m256 nx = BilinearAVX2(lut.map_x, k, k_down, ax, ay);
+            __m256 ny = BilinearAVX2(lut.map_y, k, k_down, ax, ay);
+
+            __m256 ox = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(A0, nx), _mm256_mul_ps(A1, ny)), A2);
+            __m256 oy = _mm256_add_ps(_mm256_mul_ps(A3, ny), A4);
+
+            // Back to interleaved x, y:
+            __m256 lo = _mm256_unpacklo_ps(ox, oy);
+            __m256 hi = _mm256_unpackhi_ps(ox, oy);
+            _mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+
+        LutKernelScalar(lut, in, out, i, end);
+    }
+#endif
+
+#ifdef UNDISTORT_HAVE_NEON_KERNEL
+    static inline float32x4_t BilinearNEON(const float* v00, const float* v01, const float* v10,
+                                           const float* v11, float32x4_t ax, float32x4_t ay)
+    {
+        float32x4_t a = vld1q_f32(v00), b = vld1q_f32(v01);
+        float32x4_t c = vld1q_f32(v10), d = vld1q_f32(v11);
+
+        float32x4_t top = vaddq_f32(a, vmulq_f32(ax, vsubq_f32(b, a)));
+        float32x4_t bottom = vaddq_f32(c, vmulq_f32(ax, vsubq_f32(d, c)));
+        return vaddq_f32(top, vmulq_f32(ay, vsubq_f32(bottom, top)));
+    }
+
+    static void LutKernelNEON(const UndistortLut& lut, const float* in, float* out, int begin, int end)
+    {
+        const float32x4_t inv_step = vdupq_n_f32(lut.inv_step);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        const float32x4_t max_gx = vdupq_n_f32(lut.max_gx);
+        const float32x4_t max_gy = vdupq_n_f32(lut.max_gy);
+        const int32x4_t max_c = vdupq_n_s32(lut.cols - 2);
+        const int32x4_t max_r = vdupq_n_s32(lut.rows - 2);
+        const int32x4_t cols = vdupq_n_s32(lut.cols);
+
+        const float32x4_t A0 = vdupq_n_f32(lut.A[0]), A1 = vdupq_n_f32(lut.A[1]);
+        const float32x4_t A2 = vdupq_n_f32(lut.A[2]), A3 = vdupq_n_f32(lut.A[3]);
+        const float32x4_t A4 = vdupq_n_f32(lut.A[4]);
+
+        int32_t k[4];
+        float x00[4], x01[4], x10[4], x11[4];
+        float y00[4], y01[4], y10[4], y11[4];
+
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            // De-interleaves x0 y0 ... x3 y3:
+            float32x4x2_t p = vld2q_f32(in + 2 * i);
+
+            float32x4_t gx = vminq_f32(vmaxq_f32(vmulq_f32(p.val[0], inv_step), zero), max_gx);
+            float32x4_t gy = vminq_f32(vmaxq_f32(vmulq_f32(p.val[1], inv_step), zero), max_gy);
+
+            int32x4_t c = vminq_s32(vcvtq_s32_f32(gx), max_c);
+            int32x4_t r = vminq_s32(vcvtq_s32_f32(gy), max_r);
+            float32x4_t ax = vsubq_f32(gx, vcvtq_f32_s32(c));
+            float32x4_t ay = vsubq_f32(gy, vcvtq_f32_s32(r));
+
+            vst1q_s32(k, vaddq_s32(vmulq_s32(r, cols), c));
+            for (int j=0; j<4; j++)
+            {
+                const int k_down = k[j] + lut.cols;
+                x00[j] = lut.map_x[k[j]];
+                x01[j] = lut.map_x[k[j] + 1];
+                x10[j] = lut.map_x[k_down];
+                x11[j] = lut.map_x[k_down + 1];
+                y00[j] = lut.map_y[k[j]];
+                y01[j] = lut.map_y[k[j] + 1];
+                y10[j] = lut.map_y[k_down];
+                y11[j] = lut.map_y[k_down + 1];
+            }
+
+            float32x4_t nx = BilinearNEON(x00, x01, x10, x11, ax, ay);
+            float32x4_t ny = BilinearNEON(y00, y01, y10, y11, ax, ay);
+
+            float32x4x2_t o;
+            o.val[0] = vaddq_f32(vaddq_f32(vmulq_f32(A0, nx), vmulq_f32(A1, ny)), A2);
+            o.val[1] = vaddq_f32(vmulq_f32(A3, ny), A4);
+            vst2q_f32(out + 2 * i, o);
+        }
+
+        LutKernelScalar(lut, in, out, i, end);
+    }
+#endif
+
+    Undistorter::Undistorter()
+    {
+        K = Matx33d::eye();
+        step = UNDISTORT_LUT_STEP;
+        cols = rows = 0;
+
+        SetUseSimd(true);
+    }
+
+    void Undistorter::SetUseSimd(bool enable)
+    {
+        kernel = LutKernelScalar;
+        kernel_name = "scalar";
+
+        if (!enable)
+            return;
+
+#if defined(UNDISTORT_HAVE_AVX2_KERNEL)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = LutKernelAVX2;
+            kernel_name = "avx2";
+        }
+#elif defined(UNDISTORT_HAVE_NEON_KERNEL)
+        kernel = LutKernelNEON;
+        kernel_name = "neon";
+#endif
+    }
+
+    Undistorter& Undistorter::Shared(void)
+    {
+        static Undistorter shared_undistorter;
+        return shared_undistorter;
+    }
+
+    void Undistorter::Build(const Mat &camera_matrix, const Mat &dist_coeff, Size img_size, int step)
+    {
+        if (img_size.width <= 0 || img_size.height <= 0 || step <= 0)
+        {
+            CV_Error(0, "Undistorter: invalid image size or grid step");
+        }
+
+        Mat K64;
+        camera_matrix.convertTo(K64, CV_64F);
+        K = Matx33d((double*)K64.data);
+
+        // Nodes reach the last pixel row and column:
+        this->step = step;
+        cols = max(2, (img_size.width + step - 2) / step + 1);
+        rows = max(2, (img_size.height + step - 2) / step + 1);
+
+        PointArray nodes(cols * rows);
+        for (int r=0; r<rows; r++)
+        {
+            for (int c=0; c<cols; c++)
+                nodes[r * cols + c] = Point2f((float)(c * step), (float)(r * step));
+        }
+
+        PointArray normalized;
+        undistortPoints(nodes, normalized, camera_matrix, dist_coeff);
+
+        map_x.resize(normalized.size());
+        map_y.resize(normalized.size());
+        for (int i=0; i<normalized.size(); i++)
+        {
+            map_x[i] = normalized[i].x;
+            map_y[i] = normalized[i].y;
+        }
+    }
+
+    void Undistorter::UndistortNormalized(const PointArray &in_points, PointArray &out_points) const
+    {
+        Apply(in_points, out_points, false);
+    }
+
+    void Undistorter::UndistortPixels(const PointArray &in_points, PointArray &out_points) const
+    {
+        Apply(in_points, out_points, true);
+    }
+
+    void Undistorter::Apply(const PointArray &in_points, PointArray &out_points, bool to_pixels) const
+    {
+        if (!IsBuilt())
+        {
+            CV_Error(0, "Undistorter: lookup table is not built");
+        }
+
+        UndistortLut lut;
+        lut.map_x = &map_x[0];
+        lut.map_y = &map_y[0];
+        lut.cols = cols;
+        lut.rows = rows;
+        lut.inv_step = 1.0f / step;
+        lut.max_gx = (float)(cols - 1);
+        lut.max_gy = (float)(rows - 1);
+
+        if (to_pixels)
+        {
+            lut.A[0] = (float)K(0, 0);
+            lut.A[1] = (float)K(0, 1);
+            lut.A[2] = (float)K(0, 2);
+            lut.A[3] = (float)K(1, 1);
+            lut.A[4] = (float)K(1, 2);
+        }
+        else
+        {
+            lut.A[0] = 1.0f;
+            lut.A[1] = 0.0f;
+            lut.A[2] = 0.0f;
+            lut.A[3] = 1.0f;
+            lut.A[4] = 0.0f;
+        }
+
+        const int n = (int)in_points.size();
+        out_points.resize(n);
+        if (n == 0)
+            return;
+
+        kernel(lut, (const float*)&in_points[0], (float*)&out_points[0], 0, n);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef __shield_slam__Undistorter__
+#define __shield_slam__Undistorter__
+
+#include <opencv2/opencv.hpp>
+
+#include "Common.hpp"
+
+// Spacing (px) of the grid on which the distortion model is inverted:
+#define UNDISTORT_LUT_STEP 4
+
+using namespace cv;
+using namespace std;
+
+namespace vslam {
+
+    // Lookup table as flat floats: normalized coordinates of each grid node (row-major,
+    // cols x rows nodes UNDISTORT_LUT_STEP apart), and the affine output map
+    // out = (A[0] * x + A[1] * y + A[2], A[3] * y + A[4]):
+    struct UndistortLut {
+        const float* map_x;
+        const float* map_y;
+        int cols, rows;
+        float inv_step;
+        float max_gx, max_gy;
+        float A[5];
+    };
+
+    /*
+     Maps distorted pixels to undistorted coordinates through a table built once from the
+     calibration: undistortPoints inverts the distortion model on a grid of nodes, and
+     points are bilinearly interpolated between the four surrounding nodes. The models
+     OpenCV fits are smooth at the grid spacing, so the interpolation error stays well
+     below keypoint noise. Points outside the image are clamped to its border.
+
+     The AVX2 kernel gathers the four nodes of eight points at once; the NEON kernel loads
+     them per point and interpolates four points at once. Both repeat the scalar operations
+     in the same order, so every kernel returns the same coordinates.
+     */
+    class Undistorter
+    {
+    public:
+
+        Undistorter();
+        virtual ~Undistorter() = default;
+
+        void Build(const Mat& camera_matrix, const Mat& dist_coeff, Size img_size, int step = UNDISTORT_LUT_STEP);
+        bool IsBuilt(void) const { return !map_x.empty(); }
+
+        // Normalized camera coordinates, like undistortPoints without P:
+        void UndistortNormalized(const PointArray& in_points, PointArray& out_points) const;
+        // Pixels of the same camera matrix, like undistortPoints with P = camera_matrix:
+        void UndistortPixels(const PointArray& in_points, PointArray& out_points) const;
+
+        const char* GetKernelName(void) const { return kernel_name; }
+        // SIMD kernel when the CPU has one; false forces the scalar reference:
+        void SetUseSimd(bool enable);
+
+        // Table built from the intrinsics VSlam loads:
+        static Undistorter& Shared(void);
+
+        // in and out hold interleaved x, y; they may alias:
+        typedef void (*LutKernel)(const UndistortLut& lut, const float* in, float* out, int begin, int end);
+
+    private:
+
+        void Apply(const PointArray& in_points, PointArray& out_points, bool to_pixels) const;
+
+    protected:
+        Matx33d K;
+        int step, cols, rows;
+        vector<float> map_x, map_y;
+
+        LutKernel kernel;
+        const char* kernel_name;
+    };
+}
+
+#endif /* defined(__shield_slam__Undistorter__) */
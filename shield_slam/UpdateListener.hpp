@@ -1,5 +1,6 @@
 #include <opencv2/core/core.hpp>
 #include "MapPoint.hpp"
+#include "KeyFrame.hpp"
 
 using namespace cv;
 using namespace std;
@@ -8,5 +9,5 @@ using namespace vslam;
 class UpdateListener
 {
 public:
-	virtual void update(vector<KeyFrame> keyframes, Mat camera_rot, Mat camera_pos) = 0;
+	virtual void update(const vector<KeyFramePtr>& keyframes, Mat camera_rot, Mat camera_pos) = 0;
 };
\ No newline at end of file
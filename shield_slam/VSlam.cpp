@@ -19,12 +19,39 @@ namespace vslam
         
         orb_handler = new ORB(500, true);
         Tracking::SetOrbHandler(orb_handler);
+        Ptr<PnPSolver> pnp_solver = new PnPSolver(camera_matrix, dist_coeff);
+        pnp_solver->SetUndistorter(&Undistorter::Shared());
+        Tracking::SetPnPSolver(pnp_solver);
+        
+        global_map = new Map();
+        
+        local_mapping = new LocalMapping();
+        Tracking::SetLocalMapping(local_mapping);
         
         curr_state = NOT_INITIALIZED;
+        init_frame_count = 0;
+        last_timestamp = -DEFAULT_FRAME_PERIOD;
+    }
+    
+    VSlam::~VSlam()
+    {
+        // Detach the mapper from tracking before its thread and queue go away:
+        Tracking::SetLocalMapping(NULL);
+        local_mapping->Stop();
+        local_mapping.release();
+        
+        optimizer.WaitForBundleAdjust();
     }
     
     void VSlam::ProcessFrame(cv::Mat &img)
     {
+        ProcessFrame(img, last_timestamp + DEFAULT_FRAME_PERIOD);
+    }
+    
+    void VSlam::ProcessFrame(cv::Mat &img, double timestamp)
+    {
+        last_timestamp = timestamp;
+        
         cvtColor(img, img, CV_BGRA2BGR);
         
         Mat frame;
@@ -32,28 +59,50 @@ namespace vslam
         
         if (curr_state == NOT_INITIALIZED)
         {
-            initial_frame = frame.clone();
+            init_candidates.clear();
+            init_frame_count = 0;
             curr_state = INITIALIZING;
         }
         
         if (curr_state == INITIALIZING)
         {
-            if(initializer.InitializeMap(orb_handler, initial_frame, frame, keyframes))
+            if (InitializeFromCandidates(frame))
             {
-                AppendCameraPose(keyframes.back().GetRotation(), keyframes.back().GetTranslation());
+                AppendCameraPose(keyframes.back()->GetPose());
+                motion_model.Reset();
+                motion_model.Update(keyframes.back()->GetPose(), timestamp);
+                init_candidates.clear();
                 curr_state = TRACKING;
             }
         }
         
         if (curr_state == TRACKING)
         {
-            Mat R_vec = world_camera_rot.back().clone();
-            Mat t_vec = world_camera_pos.back().clone();
+            // Publish keyframes the mapping thread finished, then refine them in the background:
+            if (local_mapping->FetchNewKeyFrames(keyframes) > 0)
+            {
+                optimizer.StartBundleAdjust(keyframes);
+            }
+            
+            // Pick up a finished local BA before tracking against the keyframes:
+            optimizer.FetchBundleAdjust(keyframes);
             
+            // Seed with the constant-velocity prediction, falling back to the last pose:
+            SE3 pose;
+            bool is_lost;
             bool new_kf_added = false;
             KeypointArray new_kps;
-            bool is_lost = !Tracking::TrackMap(frame, keyframes, R_vec, t_vec,
-                                               new_kf_added, new_kps);
+            
+            if (motion_model.Predict(timestamp, pose))
+            {
+                is_lost = !Tracking::TrackMap(frame, keyframes, pose, new_kf_added, new_kps,
+                                              &curr_pose);
+            }
+            else
+            {
+                pose = curr_pose;
+                is_lost = !Tracking::TrackMap(frame, keyframes, pose, new_kf_added, new_kps);
+            }
             
             // Render extracted keypoints to contrast with matched keypoints
             Scalar kpColor = Scalar(255, 255, 0);
@@ -61,10 +110,12 @@ namespace vslam
             
             if (!is_lost)
             {
-                AppendCameraPose(R_vec, t_vec);
+                AppendCameraPose(pose);
+                motion_model.Update(pose, timestamp);
             }
             else
             {
+                motion_model.Reset();
                 curr_state = LOST;
             }
         }
@@ -75,10 +126,61 @@ namespace vslam
         }
     }
     
-    void VSlam::AppendCameraPose(Mat rot, Mat pos)
+    bool VSlam::InitializeFromCandidates(Mat &frame)
+    {
+        // Candidates whose optical-flow tracks died out cannot initialize any more:
+        for (int i=(int)init_candidates.size()-1; i>=0; i--)
+        {
+            if (init_candidates[i]->IsReferenceLost())
+                init_candidates.erase(init_candidates.begin() + i);
+        }
+        
+        // Every candidate tries the frame; the first success cancels the others:
+        InitTargetFrame target(frame);
+        atomic<bool> init_done(false);
+        int winner = -1;
+        
+        ThreadPool::Shared().ParallelFor(0, (int)init_candidates.size(), [&](int i)
+        {
+            if (init_done)
+                return;
+            
+            if (init_candidates[i]->AttemptInitialization(orb_handler, target, &init_done))
+            {
+                bool expected = false;
+                if (init_done.compare_exchange_strong(expected, true))
+                    winner = i;
+            }
+        });
+        
+        if (winner >= 0)
+        {
+            init_candidates[winner]->CommitMap(global_map, keyframes);
+            return true;
+        }
+        
+        // Slide the candidate window, reusing the features extracted for this frame:
+        if (init_candidates.empty() || init_frame_count % INIT_CANDIDATE_INTERVAL == 0)
+        {
+            target.ExtractFeatures(orb_handler);
+            
+            Ptr<Initializer> candidate = new Initializer();
+            candidate->SetReferenceFrame(frame, target.keypoints, target.desc);
+            init_candidates.push_back(candidate);
+            
+            if (init_candidates.size() > INIT_NUM_CANDIDATES)
+                init_candidates.pop_front();
+        }
+        init_frame_count++;
+        
+        return false;
+    }
+    
+    void VSlam::AppendCameraPose(const SE3& pose)
     {
-        world_camera_rot.push_back(rot);
-        world_camera_pos.push_back(pos);
+        curr_pose = pose;
+        world_camera_rot.push_back(pose.GetRotationMat());
+        world_camera_pos.push_back(pose.GetTranslationMat());
     }
 
     void VSlam::LoadIntrinsicParameters()
@@ -94,6 +196,11 @@ namespace vslam
         fs["distCoeffs"] >> dist_coeff;
         fs["imageSize"] >> img_size;
         
+        // Keypoints stay in distorted pixels; their consumers undistort through this table:
+        Mat size_px;
+        img_size.convertTo(size_px, CV_64F);
+        Undistorter::Shared().Build(camera_matrix, dist_coeff, Size((int)size_px.at<double>(0), (int)size_px.at<double>(1)));
+        
 //        // The following is hard-coded for demo purposes on Wed 6/3/15
 //        camera_matrix = Mat::zeros(3, 3, CV_64F);
 //        camera_matrix.at<double>(0, 0) = .397;
@@ -3,12 +3,26 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <deque>
+
 #include "Initializer.hpp"
 #include "MapPoint.hpp"
 #include "Common.hpp"
 #include "KeyFrame.hpp"
+#include "Map.hpp"
 #include "Tracking.hpp"
 #include "ORB.hpp"
+#include "MotionModel.hpp"
+#include "Optimizer.hpp"
+#include "LocalMapping.hpp"
+
+// Frame period assumed by ProcessFrame(img) when the caller has no timestamps:
+#define DEFAULT_FRAME_PERIOD (1.0 / 30.0)
+
+// Initialization tries up to INIT_NUM_CANDIDATES reference frames in parallel; every
+// INIT_CANDIDATE_INTERVAL frames the current frame becomes a candidate and the oldest is dropped:
+#define INIT_NUM_CANDIDATES 3
+#define INIT_CANDIDATE_INTERVAL 5
 
 using namespace cv;
 using namespace std;
@@ -21,10 +35,15 @@ namespace vslam
     public:
         
         VSlam();
-        virtual ~VSlam() = default;
+        virtual ~VSlam();
+        
+        // Owns the mapping and BA threads, so it is neither copied nor moved:
+        VSlam(const VSlam&) = delete;
+        VSlam& operator=(const VSlam&) = delete;
         
         void Initialize(vector<Mat>& init_imgs);
         void ProcessFrame(Mat& img);
+        void ProcessFrame(Mat& img, double timestamp);
         
         enum State{
             NOT_INITIALIZED = 0,
@@ -37,36 +56,44 @@ namespace vslam
         vector<Mat> GetCameraPose(void) { return world_camera_pos; }
         vector<Mat> GetCameraRot(void) { return world_camera_rot; }
         
-        KeyFrame GetCurrKeyFrame(void)
+        // Handles to the published keyframes; nothing is copied:
+        KeyFramePtr GetCurrKeyFrame(void)
         {
             if (!keyframes.empty())
                 return keyframes.back();
             else
-            {
-                KeyFrame empty_kf;
-                return empty_kf;
-            }
+                return make_shared<const KeyFrame>();
         }
         
-        vector<KeyFrame> GetKeyFrames(void) { return keyframes; }
+        const vector<KeyFramePtr>& GetKeyFrames(void) { return keyframes; }
+        Ptr<Map> GetGlobalMap(void) { return global_map; }
+        BundleAdjustStats GetBundleAdjustStats(void) { return optimizer.GetBundleAdjustStats(); }
         
         Ptr<ORB> orb_handler;
         
     private:
         
-        Initializer initializer;
+        // One initializer per candidate reference frame, oldest first:
+        deque<Ptr<Initializer> > init_candidates;
+        int init_frame_count;
+        MotionModel motion_model;
+        Optimizer optimizer;
+        Ptr<LocalMapping> local_mapping;
         
         void LoadIntrinsicParameters(void);
-        void AppendCameraPose(Mat rot, Mat pos);
+        void AppendCameraPose(const SE3& pose);
+        bool InitializeFromCandidates(Mat& frame);
         void CommpoundCameraPose();
     
     protected:
         
-        Mat initial_frame;
-        vector<KeyFrame> keyframes;
+        Ptr<Map> global_map;
+        vector<KeyFramePtr> keyframes;
+        SE3 curr_pose;
         vector<Mat> world_camera_pos, world_camera_rot;
         
         State curr_state, prev_state;
+        double last_timestamp;
     };
     
 }
@@ -16,7 +16,7 @@ using namespace vslam;
 class VisualizerListener : public UpdateListener {
     
 public:
-	void update(vector<KeyFrame> keyframes, Mat camera_rot, Mat camera_pos) {
+	void update(const vector<KeyFramePtr>& keyframes, Mat camera_rot, Mat camera_pos) {
         
         vector<Point3d> init_pc;
         vector<Point3d> kf_pc;
@@ -24,22 +24,20 @@ public:
         if (keyframes.empty())
             return;
         
-        vector<MapPoint> local_map = keyframes.back().GetMap();
-        vector<MapPoint> global_map;
+        vector<Point3f> local_map = keyframes.back()->Get3DPoints();
         
         for (int i=0; i<local_map.size(); i++)
         {
-            kf_pc.push_back(local_map.at(i).GetPoint3D());
+            kf_pc.push_back(local_map.at(i));
         }
         
-        for (int i=0; i<keyframes.size(); i++)
+        // Every map point once, rather than once per keyframe that sees it:
+        Ptr<Map> global_map = keyframes.back()->GetGlobalMap();
+        vector<Point3f> all_points = global_map->GetAllPoints3D();
+        
+        for (int i=0; i<all_points.size(); i++)
         {
-            vector<MapPoint> kf_map = keyframes.at(i).GetMap();
-            
-            for (int j=0; j<kf_map.size(); j++)
-            {
-                init_pc.push_back(kf_map.at(j).GetPoint3D());
-            }
+            init_pc.push_back(all_points.at(i));
         }
         
         
@@ -82,7 +80,7 @@ int main(int argc, char** argv)
     // Initialize SLAM
     Mat frame;
     Size size(640, 480);
-    vslam::VSlam slam = vslam::VSlam();
+    vslam::VSlam slam;
 
     while (true) {
         cap >> frame;
@@ -92,13 +90,19 @@ int main(int argc, char** argv)
         
         resize(frame, frame, size);
         
+        double timestamp = cap.get(CV_CAP_PROP_POS_MSEC) / 1000.0;
+        
         clock_t start = clock();
-        slam.ProcessFrame(frame);
+        slam.ProcessFrame(frame, timestamp);
         clock_t end = clock();
         
         double processFrameDuration = (end - start) / (double) CLOCKS_PER_SEC;
         cout << "processFrameDuration: " << processFrameDuration << endl;
         
+        const PnPStats& pnp_stats = Tracking::GetPnPSolver()->GetStats();
+        cout << "pnpIterations: " << pnp_stats.iterations << " inliers: " << pnp_stats.num_inliers
+             << " ransac: " << pnp_stats.ransac_ms << "ms refine: " << pnp_stats.refine_ms << "ms" << endl;
+        
         if (waitKey(30) == 27) {
             break;
         }
@@ -110,14 +114,14 @@ int main(int argc, char** argv)
         
         // Draw translation and rotation information
         Augmentor augmentor;
-        KeyFrame currKeyFrame = slam.GetCurrKeyFrame();
-        Mat translationMatrix = currKeyFrame.GetTranslation();
+        KeyFramePtr currKeyFrame = slam.GetCurrKeyFrame();
+        Mat translationMatrix = currKeyFrame->GetTranslation();
         augmentor.DisplayTranslation(frame, translationMatrix);
-        Mat rotationMatrix = currKeyFrame.GetRotation();
+        Mat rotationMatrix = currKeyFrame->GetRotation();
         augmentor.DisplayRotation(frame, rotationMatrix);
         
         // Draw keypoints
-        KeypointArray keypoints = currKeyFrame.GetTrackedKeypoints();
+        KeypointArray keypoints = currKeyFrame->GetTrackedKeypoints();
         Mat trackedFeatures;
         Scalar kpColor = Scalar(255, 0, 0);
         drawKeypoints(frame, keypoints, trackedFeatures, kpColor);
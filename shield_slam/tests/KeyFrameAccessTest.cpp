@@ -0,0 +1,135 @@
+/*
+ Heap traffic of the per-frame keyframe access in Tracking::TrackMap. Before keyframes were
+ shared, TrackMap copied the reference keyframe out of the keyframe list by value; now it
+ takes a KeyFramePtr and reads the packed point arrays through views. Both access patterns
+ run on the same keyframe, and the operator new calls and bytes per frame are printed. Mat
+ buffers come from cv::fastMalloc and are not counted, but neither pattern copies one.
+
+   g++ -std=c++11 -O2 -I.. KeyFrameAccessTest.cpp ../KeyFrame.cpp ../Map.cpp ../Pose.cpp \
+       `pkg-config --cflags --libs opencv` -o KeyFrameAccessTest
+   ./KeyFrameAccessTest
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "KeyFrame.hpp"
+#include "Map.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_NUM_KEYPOINTS 1000
+#define TEST_NUM_POINTS 500
+#define TEST_FRAMES 100
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+static atomic<size_t> allocated_bytes(0);
+static atomic<size_t> allocation_count(0);
+
+void* operator new(size_t size)
+{
+    allocated_bytes += size;
+    allocation_count++;
+
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw bad_alloc();
+
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+// TrackMap before: the reference keyframe is copied, then its views are read:
+static int AccessByValue(const vector<KeyFrame>& keyframes)
+{
+    KeyFrame kf = keyframes.back();
+
+    Mat ref_desc = kf.GetPointDescriptors();
+    shared_ptr<const vector<Point3f> > ref_coords = kf.GetPointCoords();
+    const PointArray& ref_obs = kf.GetPointObservations();
+
+    return ref_desc.rows + (int)ref_coords->size() + (int)ref_obs.size();
+}
+
+// TrackMap now: only the handle is copied:
+static int AccessByHandle(const vector<KeyFramePtr>& keyframes)
+{
+    KeyFramePtr kf = keyframes.back();
+
+    Mat ref_desc = kf->GetPointDescriptors();
+    shared_ptr<const vector<Point3f> > ref_coords = kf->GetPointCoords();
+    const PointArray& ref_obs = kf->GetPointObservations();
+
+    return ref_desc.rows + (int)ref_coords->size() + (int)ref_obs.size();
+}
+
+template<typename Access, typename KeyFrames>
+static void Measure(const char* name, Access access, const KeyFrames& keyframes,
+                    double& calls_per_frame, double& bytes_per_frame)
+{
+    // The first access fills the keyframe's point position cache:
+    int checksum = access(keyframes);
+
+    size_t count_before = allocation_count;
+    size_t bytes_before = allocated_bytes;
+
+    for (int frame=0; frame<TEST_FRAMES; frame++)
+        checksum += access(keyframes);
+
+    calls_per_frame = (double)(allocation_count - count_before) / TEST_FRAMES;
+    bytes_per_frame = (double)(allocated_bytes - bytes_before) / TEST_FRAMES;
+
+    TEST_CHECK(checksum == 3 * TEST_NUM_POINTS * (TEST_FRAMES + 1));
+
+    printf("%s: %.1f allocations, %.0f bytes per frame\n", name, calls_per_frame, bytes_per_frame);
+}
+
+int main(void)
+{
+    RNG rng(0x5eed);
+
+    KeypointArray keypoints;
+    Mat descriptors(TEST_NUM_KEYPOINTS, ORB_DESC_BYTES, CV_8U);
+    rng.fill(descriptors, RNG::UNIFORM, 0, 256);
+    for (int i=0; i<TEST_NUM_KEYPOINTS; i++)
+    {
+        keypoints.push_back(KeyPoint((float)rng.uniform(0.0, 640.0), (float)rng.uniform(0.0, 480.0),
+                                     31.0f, -1.0f, 0.0f, rng.uniform(0, 8)));
+    }
+
+    // Every other keypoint carries a map point:
+    Ptr<Map> global_map = new Map();
+    vector<int> point_ids, point_kp_idx;
+    for (int i=0; i<TEST_NUM_POINTS; i++)
+    {
+        int kp_idx = 2 * i;
+        Point3f coord((float)rng.uniform(-2.0, 2.0), (float)rng.uniform(-1.5, 1.5), (float)rng.uniform(2.0, 8.0));
+        point_ids.push_back(global_map->AddMapPoint(coord, descriptors.row(kp_idx)));
+        point_kp_idx.push_back(kp_idx);
+    }
+
+    KeyFrame kf(global_map->NextKeyFrameId(), SE3(), global_map, point_ids, point_kp_idx,
+                keypoints, descriptors);
+
+    vector<KeyFrame> by_value(1, kf);
+    vector<KeyFramePtr> by_handle(1, make_shared<const KeyFrame>(kf));
+
+    double value_calls, value_bytes, handle_calls, handle_bytes;
+    Measure("by value (before)", AccessByValue, by_value, value_calls, value_bytes);
+    Measure("by handle (after)", AccessByHandle, by_handle, handle_calls, handle_bytes);
+
+    // Reading a shared keyframe must not touch the heap at all:
+    TEST_CHECK(handle_calls == 0.0 && handle_bytes == 0.0);
+    TEST_CHECK(value_calls > 0.0);
+
+    return TestResult("KeyFrameAccessTest");
+}
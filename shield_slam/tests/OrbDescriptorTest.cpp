@@ -0,0 +1,103 @@
+/*
+ rBRIEF descriptor kernels: the SIMD kernel must match the scalar reference bit for bit on
+ the pyramid of a real image, in serial and tiled extraction; then the throughput of both
+ kernels is reported in descriptors per second.
+
+   g++ -std=c++11 -O2 -I.. OrbDescriptorTest.cpp ../OrbExtractor.cpp ../ThreadPool.cpp \
+       `pkg-config --cflags --libs opencv` -o OrbDescriptorTest
+   ./OrbDescriptorTest ../../SS.png
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <cstring>
+
+#include "OrbExtractor.hpp"
+#include "ORB.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_NUM_FEATURES 1000
+#define BENCHMARK_RUNS 50
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+static void CheckKernelsMatch(const Mat& img, OrbExtractor::ExtractionMode mode)
+{
+    OrbExtractor simd(TEST_NUM_FEATURES, ORB_SCALE_FACTOR, ORB_NUM_LEVELS);
+    OrbExtractor scalar(TEST_NUM_FEATURES, ORB_SCALE_FACTOR, ORB_NUM_LEVELS);
+    simd.SetExtractionMode(mode, GRID_CELL_ROWS, GRID_CELL_COLS);
+    scalar.SetExtractionMode(mode, GRID_CELL_ROWS, GRID_CELL_COLS);
+    scalar.SetUseSimdDescriptors(false);
+
+    KeypointArray simd_kp, scalar_kp;
+    Mat simd_desc, scalar_desc;
+    simd.Extract(img, simd_kp, simd_desc);
+    scalar.Extract(img, scalar_kp, scalar_desc);
+
+    TEST_CHECK(!simd_kp.empty());
+    TEST_CHECK(simd_kp.size() == scalar_kp.size());
+    TEST_CHECK(simd_desc.size() == scalar_desc.size());
+    if (simd_desc.size() != scalar_desc.size())
+        return;
+
+    int mismatched = 0;
+    for (int i=0; i<simd_desc.rows; i++)
+    {
+        if (simd_kp[i].pt != scalar_kp[i].pt || simd_kp[i].angle != scalar_kp[i].angle ||
+            memcmp(simd_desc.ptr<uchar>(i), scalar_desc.ptr<uchar>(i), ORB_DESC_BYTES) != 0)
+            mismatched++;
+    }
+    TEST_CHECK(mismatched == 0);
+
+    printf("%s: %d descriptors, %s vs %s, %d mismatched\n", mode == OrbExtractor::EXTRACT_TILED ? "tiled" : "serial",
+           simd_desc.rows, simd.GetDescriptorKernelName(), scalar.GetDescriptorKernelName(), mismatched);
+}
+
+static double MeasureThroughput(const Mat& img, bool use_simd, const char*& kernel_name)
+{
+    OrbExtractor extractor(TEST_NUM_FEATURES, ORB_SCALE_FACTOR, ORB_NUM_LEVELS);
+    extractor.SetUseSimdDescriptors(use_simd);
+    kernel_name = extractor.GetDescriptorKernelName();
+
+    KeypointArray kp;
+    Mat desc;
+    double sum = 0.0;
+    for (int run=0; run<BENCHMARK_RUNS; run++)
+    {
+        extractor.Extract(img, kp, desc);
+        sum += extractor.GetDescriptorThroughput();
+    }
+
+    return sum / BENCHMARK_RUNS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s image\n", argv[0]);
+        return 2;
+    }
+
+    Mat img = imread(argv[1], CV_LOAD_IMAGE_GRAYSCALE);
+    if (img.empty())
+    {
+        fprintf(stderr, "could not read %s\n", argv[1]);
+        return 2;
+    }
+
+    CheckKernelsMatch(img, OrbExtractor::EXTRACT_SERIAL);
+    CheckKernelsMatch(img, OrbExtractor::EXTRACT_TILED);
+
+    const char* simd_name;
+    const char* scalar_name;
+    double simd_rate = MeasureThroughput(img, true, simd_name);
+    double scalar_rate = MeasureThroughput(img, false, scalar_name);
+
+    printf("%s: %.0f desc/s\n", simd_name, simd_rate);
+    printf("%s: %.0f desc/s\n", scalar_name, scalar_rate);
+
+    return TestResult("OrbDescriptorTest");
+}
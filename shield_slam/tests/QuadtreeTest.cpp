@@ -0,0 +1,119 @@
+/*
+ Quadtree keypoint distribution on a wide frame whose right half is blank: the root nodes
+ over the blank half get no keypoints and must neither be selected from nor count towards
+ the feature budget, so the textured half alone fills it. The textured half has a strong
+ band on its left and weaker texture on its right; keeping the best responses crowds into
+ the strong band, while the quadtree must reach every cell of a coarse grid over the half.
+
+   g++ -std=c++11 -O2 -I.. QuadtreeTest.cpp ../OrbExtractor.cpp ../ThreadPool.cpp \
+       `pkg-config --cflags --libs opencv` -o QuadtreeTest
+   ./QuadtreeTest
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "OrbExtractor.hpp"
+#include "ORB.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_NUM_FEATURES 500
+#define TEST_IMG_WIDTH 1280
+#define TEST_IMG_HEIGHT 240
+// Share of the budget the textured half must fill:
+#define TEST_MIN_FILL 0.9
+// Coarse grid over the textured half for the spreading check:
+#define TEST_GRID_ROWS 2
+#define TEST_GRID_COLS 4
+// Noise amplitude of the weak texture; still well above ORB_FAST_THRESHOLD:
+#define TEST_WEAK_CONTRAST 48
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+static void Extract(const Mat& img, OrbExtractor::ExtractionMode mode,
+                    OrbExtractor::DistributionStrategy strategy, KeypointArray& keypoints)
+{
+    OrbExtractor extractor(TEST_NUM_FEATURES, ORB_SCALE_FACTOR, ORB_NUM_LEVELS);
+    extractor.SetExtractionMode(mode, GRID_CELL_ROWS, GRID_CELL_COLS);
+    extractor.SetDistributionStrategy(strategy);
+
+    Mat descriptors;
+    extractor.Extract(img, keypoints, descriptors);
+
+    TEST_CHECK(!keypoints.empty());
+    TEST_CHECK((int)keypoints.size() <= TEST_NUM_FEATURES);
+    TEST_CHECK(descriptors.rows == (int)keypoints.size());
+}
+
+// Fewest keypoints in any cell of the coarse grid over the textured half:
+static int MinCellCount(const KeypointArray& keypoints)
+{
+    const float cell_w = (TEST_IMG_WIDTH / 2) / (float)TEST_GRID_COLS;
+    const float cell_h = TEST_IMG_HEIGHT / (float)TEST_GRID_ROWS;
+
+    vector<int> counts(TEST_GRID_ROWS * TEST_GRID_COLS, 0);
+    for (int i=0; i<keypoints.size(); i++)
+    {
+        int col = min((int)(keypoints[i].pt.x / cell_w), TEST_GRID_COLS - 1);
+        int row = min((int)(keypoints[i].pt.y / cell_h), TEST_GRID_ROWS - 1);
+        if (col >= 0 && row >= 0)
+            counts[row * TEST_GRID_COLS + col]++;
+    }
+
+    return *min_element(counts.begin(), counts.end());
+}
+
+static void CheckBlankHalf(const Mat& img, OrbExtractor::ExtractionMode mode)
+{
+    const char* mode_name = mode == OrbExtractor::EXTRACT_TILED ? "tiled" : "serial";
+
+    KeypointArray keypoints;
+    Extract(img, mode, OrbExtractor::DISTRIBUTE_QUADTREE, keypoints);
+
+    // Only the textured half has corners; allow the FAST ring and level rounding at its edge:
+    int in_blank_half = 0;
+    for (int i=0; i<keypoints.size(); i++)
+    {
+        if (keypoints[i].pt.x > TEST_IMG_WIDTH / 2 + ORB_HALF_PATCH_SIZE)
+            in_blank_half++;
+    }
+    TEST_CHECK(in_blank_half == 0);
+
+    // Empty roots over the blank half must not eat the budget:
+    TEST_CHECK(keypoints.size() >= TEST_MIN_FILL * TEST_NUM_FEATURES);
+
+    // The quadtree reaches the weak texture; keeping the best responses alone does no better:
+    KeypointArray best_keypoints;
+    Extract(img, mode, OrbExtractor::DISTRIBUTE_RETAIN_BEST, best_keypoints);
+
+    int quadtree_min = MinCellCount(keypoints);
+    int best_min = MinCellCount(best_keypoints);
+    TEST_CHECK(quadtree_min > 0);
+    TEST_CHECK(quadtree_min >= best_min);
+
+    printf("%s: %d keypoints, %d in the blank half, fewest per cell %d (retain best: %d)\n", mode_name,
+           (int)keypoints.size(), in_blank_half, quadtree_min, best_min);
+}
+
+int main(void)
+{
+    // Noise on the left half gives far more corners than the budget, so the quadtree runs.
+    // Its first grid column gets full contrast, the rest a weaker texture:
+    Mat img(TEST_IMG_HEIGHT, TEST_IMG_WIDTH, CV_8U, Scalar(128));
+    const int strong_width = (TEST_IMG_WIDTH / 2) / TEST_GRID_COLS;
+    Mat strong = img(Rect(0, 0, strong_width, TEST_IMG_HEIGHT));
+    Mat weak = img(Rect(strong_width, 0, TEST_IMG_WIDTH / 2 - strong_width, TEST_IMG_HEIGHT));
+
+    RNG rng(0x5eed);
+    rng.fill(strong, RNG::UNIFORM, 0, 256);
+    rng.fill(weak, RNG::UNIFORM, 128 - TEST_WEAK_CONTRAST, 128 + TEST_WEAK_CONTRAST);
+
+    Mat textured = img(Rect(0, 0, TEST_IMG_WIDTH / 2, TEST_IMG_HEIGHT));
+    GaussianBlur(textured, textured, Size(3, 3), 0.8);
+
+    CheckBlankHalf(img, OrbExtractor::EXTRACT_SERIAL);
+    CheckBlankHalf(img, OrbExtractor::EXTRACT_TILED);
+
+    return TestResult("QuadtreeTest");
+}
@@ -0,0 +1,178 @@
+/*
+ RANSAC backends side by side: the initializer's homography and fundamental estimators and
+ the tracking PnP solver run on synthetic correspondences with noise and outliers under the
+ legacy loops, the RansacEngine and OpenCV. Every backend must recover the true inliers;
+ iterations and the mean time per call are reported for comparison.
+
+   g++ -std=c++11 -O2 -I.. RansacBackendTest.cpp ../Initializer.cpp ../PnPSolver.cpp \
+       ../Ransac.cpp ../EssentialSolver.cpp ../TwoViewScorer.cpp ../Triangulator.cpp \
+       ../Undistorter.cpp ../ThreadPool.cpp ../Common.cpp ../ORB.cpp ../OrbExtractor.cpp \
+       ../HammingMatcher.cpp ../KeyFrame.cpp ../KeypointGrid.cpp ../Map.cpp ../Tracking.cpp \
+       ../LocalMapping.cpp ../Optimizer.cpp ../Pose.cpp \
+       `pkg-config --cflags --libs opencv` -o RansacBackendTest
+   ./RansacBackendTest
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "Initializer.hpp"
+#include "PnPSolver.hpp"
+#include "Ransac.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_NUM_MATCHES 600
+#define TEST_OUTLIER_RATIO 0.4
+#define TEST_NOISE_SIGMA 0.5
+#define TEST_RUNS 20
+// Share of the true inliers every backend must flag:
+#define TEST_MIN_RECALL 0.9
+
+#define TEST_PNP_ITERATIONS 50
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+static const char* BackendName(RansacBackend backend)
+{
+    switch (backend)
+    {
+        case RANSAC_BACKEND_LEGACY: return "legacy";
+        case RANSAC_BACKEND_ENGINE: return "engine";
+        default: return "opencv";
+    }
+}
+
+static int CountRecovered(const TestScene& scene, const vector<bool>& inliers, int& num_true)
+{
+    int recovered = 0;
+    num_true = 0;
+    for (int i=0; i<scene.is_inlier.size(); i++)
+    {
+        if (!scene.is_inlier[i])
+            continue;
+
+        num_true++;
+        if (inliers[i])
+            recovered++;
+    }
+
+    return recovered;
+}
+
+static void CheckRecall(const char* model, RansacBackend backend, int recovered, int num_true,
+                        int num_inliers, int iterations, double ms)
+{
+    TEST_CHECK(recovered >= TEST_MIN_RECALL * num_true);
+
+    printf("%-12s %-7s %4d/%4d true inliers, %4d flagged, %5d iterations, %8.3fms\n",
+           model, BackendName(backend), recovered, num_true, num_inliers, iterations, ms);
+}
+
+static void CompareTwoView(const TestScene& scene, bool homography, RansacBackend backend)
+{
+    Initializer initializer;
+    initializer.SetRansacBackend(backend);
+
+    PointArray ref_points = scene.ref_points;
+    PointArray tar_points = scene.tar_points;
+
+    vector<bool> inliers;
+    int num_inliers = 0;
+    float score;
+    int64 ticks = 0;
+
+    for (int run=0; run<TEST_RUNS; run++)
+    {
+        int64 start = getTickCount();
+
+        RansacSamples samples;
+        initializer.PrepareSamples(ref_points, tar_points, samples);
+        if (backend == RANSAC_BACKEND_ENGINE)
+        {
+            RansacOrderByDistance(scene.matches, samples.order);
+        }
+
+        if (homography)
+            initializer.FindHomography(ref_points, tar_points, samples, score, inliers, num_inliers);
+        else
+            initializer.FindFundamental(ref_points, tar_points, samples, score, inliers, num_inliers);
+
+        ticks += getTickCount() - start;
+    }
+
+    // Only the engine counts its iterations; the legacy loop always runs its fixed budget:
+    int iterations = -1;
+    if (backend == RANSAC_BACKEND_ENGINE)
+    {
+        iterations = homography ? initializer.GetHomographyRansacStats().iterations
+                                : initializer.GetFundamentalRansacStats().iterations;
+    }
+    else if (backend == RANSAC_BACKEND_LEGACY)
+    {
+        iterations = RANSAC_MAX_ITERATIONS;
+    }
+
+    int num_true;
+    int recovered = CountRecovered(scene, inliers, num_true);
+    CheckRecall(homography ? "homography" : "fundamental", backend, recovered, num_true, num_inliers,
+                iterations, ticks * 1000.0 / getTickFrequency() / TEST_RUNS);
+}
+
+static void ComparePnP(const TestScene& scene, const Matx33d& K, RansacBackend backend)
+{
+    PnPSolver solver(Mat(K), Mat::zeros(1, 5, CV_64F));
+    solver.SetRansacBackend(backend);
+    solver.SetRansacParameters(TEST_PNP_ITERATIONS, PNP_RANSAC_REPROJECTION_ERROR,
+                               PNP_RANSAC_CONFIDENCE, PNP_RANSAC_MIN_INLIERS);
+
+    vector<int> order;
+    if (backend == RANSAC_BACKEND_ENGINE)
+    {
+        RansacOrderByDistance(scene.matches, order);
+    }
+
+    Mat pnp_inliers;
+    int64 ticks = 0;
+
+    for (int run=0; run<TEST_RUNS; run++)
+    {
+        SE3 pose;
+        int64 start = getTickCount();
+        solver.Solve(scene.object_points, scene.tar_points, pose, pnp_inliers, false, &order);
+        ticks += getTickCount() - start;
+    }
+
+    vector<bool> inliers(scene.is_inlier.size(), false);
+    for (int i=0; i<pnp_inliers.rows; i++)
+        inliers[pnp_inliers.at<int>(i)] = true;
+
+    int num_true;
+    int recovered = CountRecovered(scene, inliers, num_true);
+    CheckRecall("pnp", backend, recovered, num_true, pnp_inliers.rows, solver.GetStats().iterations,
+                ticks * 1000.0 / getTickFrequency() / TEST_RUNS);
+}
+
+int main(void)
+{
+    Matx33d K, R;
+    Vec3d t;
+    MakeTestCamera(K, R, t);
+    camera_matrix = Mat(K);
+    dist_coeff = Mat::zeros(1, 5, CV_64F);
+
+    RNG rng(0x2545f491);
+    TestScene planar, general;
+    MakeTestScene(rng, K, R, t, TEST_NUM_MATCHES, TEST_SCENE_PLANAR, TEST_NOISE_SIGMA, TEST_OUTLIER_RATIO, planar);
+    MakeTestScene(rng, K, R, t, TEST_NUM_MATCHES, TEST_SCENE_GENERAL, TEST_NOISE_SIGMA, TEST_OUTLIER_RATIO, general);
+
+    const RansacBackend backends[] = { RANSAC_BACKEND_LEGACY, RANSAC_BACKEND_ENGINE, RANSAC_BACKEND_OPENCV };
+    for (int b=0; b<3; b++)
+    {
+        CompareTwoView(planar, true, backends[b]);
+        CompareTwoView(general, false, backends[b]);
+        ComparePnP(general, K, backends[b]);
+    }
+
+    return TestResult("RansacBackendTest");
+}
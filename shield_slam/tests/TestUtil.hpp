@@ -0,0 +1,105 @@
+#ifndef __shield_slam__TestUtil__
+#define __shield_slam__TestUtil__
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdio>
+#include <vector>
+
+#include "Common.hpp"
+
+/*
+ Every test in this directory is a standalone executable built against the sources it
+ exercises and OpenCV (see the build line at the top of each file). A test prints its
+ failed checks and exits non-zero when any check failed.
+ */
+
+static int test_failures = 0;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static inline int TestResult(const char* name)
+{
+    if (test_failures > 0)
+    {
+        printf("%s: FAILED (%d checks)\n", name, test_failures);
+        return 1;
+    }
+
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+// Two-view geometry scenes: camera 1 at the origin, camera 2 at [R|t], points 2-8 units deep:
+#define TEST_SCENE_FOCAL 500.0
+
+enum TestSceneDepth {
+    TEST_SCENE_PLANAR = 0,      // every point on the plane z = 4
+    TEST_SCENE_GENERAL = 1,     // every point anywhere in depth
+    TEST_SCENE_HALF_PLANAR = 2  // even points on the plane, odd ones anywhere
+};
+
+// Correspondences with ground truth; inliers get the smaller descriptor distances on average,
+// as real matches do, so PROSAC has an order to exploit:
+struct TestScene {
+    vslam::PointArray ref_points, tar_points;
+    std::vector<cv::Point3f> object_points;
+    std::vector<cv::DMatch> matches;
+    std::vector<bool> is_inlier;
+};
+
+static inline void MakeTestCamera(cv::Matx33d& K, cv::Matx33d& R, cv::Vec3d& t)
+{
+    K = cv::Matx33d(TEST_SCENE_FOCAL, 0, 320,
+                    0, TEST_SCENE_FOCAL, 240,
+                    0, 0, 1);
+    cv::Rodrigues(cv::Vec3d(0.02, -0.05, 0.01), R);
+    t = cv::Vec3d(0.3, 0.05, 0.02);
+}
+
+static inline cv::Point2f Project(const cv::Matx33d& K, const cv::Matx33d& R, const cv::Vec3d& t,
+                                  const cv::Vec3d& X)
+{
+    cv::Vec3d x = K * (R * X + t);
+    return cv::Point2f((float)(x[0] / x[2]), (float)(x[1] / x[2]));
+}
+
+// Noise of noise_sigma px in both views; outliers get a random target point:
+static inline void MakeTestScene(cv::RNG& rng, const cv::Matx33d& K, const cv::Matx33d& R,
+                                 const cv::Vec3d& t, int num_matches, TestSceneDepth depth,
+                                 double noise_sigma, double outlier_ratio, TestScene& scene)
+{
+    for (int i=0; i<num_matches; i++)
+    {
+        bool on_plane = depth == TEST_SCENE_PLANAR || (depth == TEST_SCENE_HALF_PLANAR && i % 2 == 0);
+        cv::Vec3d X(rng.uniform(-2.0, 2.0), rng.uniform(-1.5, 1.5), on_plane ? 4.0 : rng.uniform(2.0, 8.0));
+
+        cv::Point2f p1 = Project(K, cv::Matx33d::eye(), cv::Vec3d(0, 0, 0), X);
+        cv::Point2f p2 = Project(K, R, t, X);
+        p1.x += (float)rng.gaussian(noise_sigma);
+        p1.y += (float)rng.gaussian(noise_sigma);
+        p2.x += (float)rng.gaussian(noise_sigma);
+        p2.y += (float)rng.gaussian(noise_sigma);
+
+        bool inlier = rng.uniform(0.0, 1.0) >= outlier_ratio;
+        if (!inlier)
+            p2 = cv::Point2f((float)rng.uniform(0.0, 640.0), (float)rng.uniform(0.0, 480.0));
+
+        scene.ref_points.push_back(p1);
+        scene.tar_points.push_back(p2);
+        scene.object_points.push_back(cv::Point3f((float)X[0], (float)X[1], (float)X[2]));
+        scene.is_inlier.push_back(inlier);
+
+        float distance = inlier ? (float)rng.uniform(0.0, 60.0) : (float)rng.uniform(20.0, 100.0);
+        scene.matches.push_back(cv::DMatch(i, i, distance));
+    }
+}
+
+#endif /* defined(__shield_slam__TestUtil__) */
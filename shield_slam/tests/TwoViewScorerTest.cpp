@@ -0,0 +1,86 @@
+/*
+ Two-view scoring kernels: the SIMD kernel must return the same inlier mask, inlier count and
+ score, bit for bit, as the scalar reference for homographies and fundamental matrices. The
+ scene is half planar, with noise and outliers, so both models see a mix of inliers and
+ outliers; the match count is not a multiple of the vector width, so the tail is covered.
+
+   g++ -std=c++11 -O2 -I.. TwoViewScorerTest.cpp ../TwoViewScorer.cpp \
+       `pkg-config --cflags --libs opencv` -o TwoViewScorerTest
+   ./TwoViewScorerTest
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <cstring>
+
+#include "TwoViewScorer.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_NUM_MATCHES 1003
+#define TEST_OUTLIER_RATIO 0.3
+#define TEST_NOISE_SIGMA 0.7
+
+// Thresholds of the initializer (chi-square, 2 and 1 dof at 95%):
+#define TEST_SIGMA 1.0f
+#define TEST_H_TH 5.991f
+#define TEST_F_TH 3.841f
+#define TEST_F_SCORE_TH 5.991f
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+static void CheckSame(const char* model, float simd_score, const vector<uchar>& simd_inliers, int simd_num,
+                      float scalar_score, const vector<uchar>& scalar_inliers, int scalar_num)
+{
+    TEST_CHECK(simd_num == scalar_num);
+    TEST_CHECK(simd_inliers == scalar_inliers);
+    TEST_CHECK(memcmp(&simd_score, &scalar_score, sizeof(float)) == 0);
+
+    // Both models must see inliers and outliers for the mask comparison to mean anything:
+    TEST_CHECK(scalar_num > 0 && scalar_num < TEST_NUM_MATCHES);
+
+    printf("%s: %d inliers, score %.6f vs %.6f\n", model, scalar_num, simd_score, scalar_score);
+}
+
+int main(void)
+{
+    Matx33d K, R;
+    Vec3d t;
+    MakeTestCamera(K, R, t);
+
+    RNG rng(0x2545f491);
+    TestScene scene;
+    MakeTestScene(rng, K, R, t, TEST_NUM_MATCHES, TEST_SCENE_HALF_PLANAR, TEST_NOISE_SIGMA, TEST_OUTLIER_RATIO, scene);
+
+    // Plane n^T X = d with n = (0, 0, 1), d = 4: H_12 = K (R + t n^T / d) K^-1.
+    Matx33d tn(0, 0, t[0],
+               0, 0, t[1],
+               0, 0, t[2]);
+    Matx33d H_12 = K * (R + tn * 0.25) * K.inv();
+
+    // F_21 = K^-T [t]x R K^-1:
+    Matx33d t_x(0, -t[2], t[1],
+                t[2], 0, -t[0],
+                -t[1], t[0], 0);
+    Matx33d F_21 = K.inv().t() * t_x * R * K.inv();
+
+    TwoViewScorer simd, scalar;
+    scalar.SetUseSimd(false);
+    simd.SetPoints(scene.ref_points, scene.tar_points);
+    scalar.SetPoints(scene.ref_points, scene.tar_points);
+    printf("%s vs %s\n", simd.GetKernelName(), scalar.GetKernelName());
+
+    vector<uchar> simd_inliers, scalar_inliers;
+    int simd_num, scalar_num;
+
+    float simd_score = simd.ScoreHomography(H_12, TEST_SIGMA, TEST_H_TH, simd_inliers, simd_num);
+    float scalar_score = scalar.ScoreHomography(H_12, TEST_SIGMA, TEST_H_TH, scalar_inliers, scalar_num);
+    CheckSame("homography", simd_score, simd_inliers, simd_num, scalar_score, scalar_inliers, scalar_num);
+
+    simd_score = simd.ScoreFundamental(F_21, TEST_SIGMA, TEST_F_TH, TEST_F_SCORE_TH, simd_inliers, simd_num);
+    scalar_score = scalar.ScoreFundamental(F_21, TEST_SIGMA, TEST_F_TH, TEST_F_SCORE_TH, scalar_inliers, scalar_num);
+    CheckSame("fundamental", simd_score, simd_inliers, simd_num, scalar_score, scalar_inliers, scalar_num);
+
+    return TestResult("TwoViewScorerTest");
+}
@@ -0,0 +1,83 @@
+/*
+ Lookup-table undistortion with a strongly distorting calibration: on a dense grid of
+ pixels, off the table nodes, the SIMD kernel must match the scalar reference bit for bit,
+ and both must stay within TEST_MAX_ERROR pixels of undistortPoints.
+
+   g++ -std=c++11 -O2 -I.. UndistorterTest.cpp ../Undistorter.cpp \
+       `pkg-config --cflags --libs opencv` -o UndistorterTest
+   ./UndistorterTest
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <cstring>
+
+#include "Undistorter.hpp"
+#include "TestUtil.hpp"
+
+#define TEST_IMG_WIDTH 640
+#define TEST_IMG_HEIGHT 480
+// Grid spacing (px); not a divisor of UNDISTORT_LUT_STEP, so points fall between nodes:
+#define TEST_GRID_SPACING 1.25f
+// Points beyond the border, clamped by the table, only take part in the kernel comparison:
+#define TEST_GRID_MARGIN 8.0f
+#define TEST_MAX_ERROR 0.05
+
+using namespace cv;
+using namespace std;
+using namespace vslam;
+
+int main(void)
+{
+    Mat K = (Mat_<double>(3, 3) << 500.0, 0.0, 320.0,
+                                   0.0, 500.0, 240.0,
+                                   0.0, 0.0, 1.0);
+    // Wide-angle barrel distortion with some tangential error:
+    Mat dist = (Mat_<double>(1, 5) << -0.28, 0.07, 0.001, -0.0005, 0.0);
+
+    Undistorter simd, scalar;
+    simd.Build(K, dist, Size(TEST_IMG_WIDTH, TEST_IMG_HEIGHT));
+    scalar.Build(K, dist, Size(TEST_IMG_WIDTH, TEST_IMG_HEIGHT));
+    scalar.SetUseSimd(false);
+
+    PointArray grid, inside;
+    for (float y=-TEST_GRID_MARGIN; y<=TEST_IMG_HEIGHT - 1 + TEST_GRID_MARGIN; y+=TEST_GRID_SPACING)
+    {
+        for (float x=-TEST_GRID_MARGIN; x<=TEST_IMG_WIDTH - 1 + TEST_GRID_MARGIN; x+=TEST_GRID_SPACING)
+        {
+            grid.push_back(Point2f(x, y));
+            if (x >= 0.0f && y >= 0.0f && x <= TEST_IMG_WIDTH - 1 && y <= TEST_IMG_HEIGHT - 1)
+                inside.push_back(Point2f(x, y));
+        }
+    }
+
+    // Kernels, on pixel and normalized output:
+    PointArray simd_out, scalar_out;
+    simd.UndistortPixels(grid, simd_out);
+    scalar.UndistortPixels(grid, scalar_out);
+    TEST_CHECK(simd_out.size() == grid.size() && scalar_out.size() == grid.size());
+    TEST_CHECK(memcmp(&simd_out[0], &scalar_out[0], grid.size() * sizeof(Point2f)) == 0);
+
+    simd.UndistortNormalized(grid, simd_out);
+    scalar.UndistortNormalized(grid, scalar_out);
+    TEST_CHECK(memcmp(&simd_out[0], &scalar_out[0], grid.size() * sizeof(Point2f)) == 0);
+
+    // Accuracy against the distortion model inverted per point:
+    PointArray lut_out, expected;
+    simd.UndistortPixels(inside, lut_out);
+    undistortPoints(inside, expected, K, dist, noArray(), K);
+
+    double max_error = 0.0, sum_error = 0.0;
+    for (int i=0; i<inside.size(); i++)
+    {
+        double error = norm(lut_out[i] - expected[i]);
+        max_error = max(max_error, error);
+        sum_error += error;
+    }
+    TEST_CHECK(max_error <= TEST_MAX_ERROR);
+
+    printf("%s vs %s: %d points, max error %.4fpx, mean %.4fpx\n", simd.GetKernelName(),
+           scalar.GetKernelName(), (int)inside.size(), max_error, sum_error / inside.size());
+
+    return TestResult("UndistorterTest");
+}